@@ -8,23 +8,63 @@
 // ================================================================================================
 
 // Compiles with:
-// c++ -std=c++11 -Wall -Wextra -Weffc++ -pedantic -O3 benchmarks.cpp -o hash_idx_bench
+// c++ -std=c++11 -Wall -Wextra -Weffc++ -pedantic -O3 -pthread benchmarks.cpp -o hash_idx_bench
 //
 // Asm listing:
 // c++ -std=c++11 -S -mllvm --x86-asm-syntax=intel benchmarks.cpp
+//
+// Usage:
+// hash_idx_bench <num_iterations> [suite|scaling|huge_pages] [--format=text|csv|json] [--counters] [--threads=N]
+//
+//  With no mode, runs the operation tests with num_iterations items each, followed by
+//  the lookup suite with tables of up to num_iterations items and the read scaling test
+//  on up to N threads (default std::thread::hardware_concurrency()). 'suite', 'scaling'
+//  and 'huge_pages' run only the lookup suite, the scaling or the huge pages test.
+//  CSV and JSON write one row per measurement to stdout, for scripts to collect,
+//  instead of the text report.
+//
+//  --counters also collects hardware performance counters (Linux perf_event) over
+//  each timed run: instructions, cycles, branch mispredicts and L1d, last level cache
+//  and dTLB read misses, reported per operation. Needs perf_event_paranoid <= 2
+//  (user space only) and a CPU/VM exposing the events; Any missing ones are skipped.
+
+// Also time build_parallel() and rehash_parallel(), which are opt-in.
+#ifndef HASH_INDEX_ENABLE_PARALLEL
+    #define HASH_INDEX_ENABLE_PARALLEL
+#endif // HASH_INDEX_ENABLE_PARALLEL
 
 #include "hash_index.hpp"
+#include "hash_index_huge_pages.hpp"
+#include "concurrent_hash_index.hpp"
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <chrono>
+#include <functional>
 #include <random>
 #include <string>
+#include <thread>
 #include <vector>
 
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #define BENCH_PERF_EVENTS 1
+#endif // __linux__
+
 // ========================================================
 // Test support code:
 // ========================================================
@@ -32,12 +72,14 @@
 using KeyType  = std::string;
 using ValType  = std::pair<std::size_t, KeyType>;
 
-using Clock    = std::chrono::high_resolution_clock;
-using TimeUnit = std::chrono::nanoseconds;
-using Times    = std::vector<TimeUnit>;
+using Clock    = std::chrono::steady_clock;
 
 static const char * TimeUnitSuffix = " ns";
 
+// Operations timed together per sample. Clock::now() alone takes about 20 ns, as
+// long as a lookup on a small table, so individual operations can't be resolved.
+static constexpr long BatchSize = 256;
+
 // Tells the compiler that all previous changes to memory shall be visible.
 inline void clobber_memory() { asm volatile ( "" : : : "memory" ); }
 
@@ -70,314 +112,982 @@ static KeyType make_random_key()
     return key;
 }
 
+// Distinct keys, since the maps would silently drop the duplicates, which
+// are likely with this few random characters past some 10000 keys.
 static std::vector<KeyType> make_random_key_vector(const long size)
 {
     std::vector<KeyType> keys;
+    std::unordered_set<KeyType> unique_keys;
+    keys.reserve(size);
+    unique_keys.reserve(size);
+    while (long(keys.size()) < size)
+    {
+        KeyType key = make_random_key();
+        if (unique_keys.insert(key).second)
+        {
+            keys.push_back(std::move(key));
+        }
+    }
+    return keys;
+}
+
+// Distinct by construction, since mix() is a bijection.
+static std::vector<std::uint64_t> make_integer_key_vector(const long first, const long size)
+{
+    std::vector<std::uint64_t> keys;
     keys.reserve(size);
-    for (long i = 0; i < size; ++i)
+    for (long i = first; i < first + size; ++i)
     {
-        keys.push_back(make_random_key());
+        keys.push_back(hash_index_hasher::mix(static_cast<std::uint64_t>(i) + 1));
     }
     return keys;
 }
 
-static void print_test_stats(const Times & times)
+//
+// Ranks in [0, n) with probability proportional to 1 / (rank + 1)^s, rank 0 being
+// the most frequent. With s = 0.99 about a fifth of all draws go to the top 0.1%
+// of a million items, close to the key popularity seen by real caches.
+//
+class zipf_distribution final
 {
-    // Take the median, minimum and maximum:
-    auto sum     = TimeUnit::zero();
-    auto minimum = TimeUnit::max();
-    auto maximum = TimeUnit::min();
+public:
 
-    for (auto t : times)
+    zipf_distribution(const long n, const double s)
+        : m_cdf(static_cast<std::size_t>(n))
     {
-        if (t < minimum)
+        double sum = 0.0;
+        for (long i = 0; i < n; ++i)
         {
-            minimum = t;
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+            m_cdf[i] = sum;
         }
-        else if (t > maximum)
+        for (auto & c : m_cdf)
         {
-            maximum = t;
+            c /= sum;
         }
-        sum += t;
     }
 
-    const std::uint64_t mean = sum.count() / times.size();
-    const std::uint64_t min  = minimum.count();
-    const std::uint64_t max  = maximum.count();
+    template<typename Engine>
+    long operator()(Engine & engine) const
+    {
+        const double u = std::uniform_real_distribution<double>{ 0.0, 1.0 }(engine);
+        const auto it = std::lower_bound(m_cdf.begin(), m_cdf.end(), u);
+        return (it == m_cdf.end()) ? long(m_cdf.size()) - 1 : long(it - m_cdf.begin());
+    }
+
+private:
 
-    // Now we can print:
-    std::cout << "\n";
-    std::cout << "average time taken...: " << mean << TimeUnitSuffix << "\n";
-    std::cout << "lowest time sample...: " << min  << TimeUnitSuffix << "\n";
-    std::cout << "largest time sample..: " << max  << TimeUnitSuffix << "\n";
-    std::cout << "\n";
-}
+    std::vector<double> m_cdf;
+};
 
 // ========================================================
-// Key/Value insertion:
+// Hardware counters:
 // ========================================================
 
-template<typename StdMapType>
-static void test_insertion_std(const char * const map_type_name, const long num_iterations)
+//
+// Event totals of one timed run, reported divided by its number of operations.
+// Events that couldn't be opened are left out of the report.
+//
+struct Counters
 {
-    std::cout << "\n";
-    std::cout << "testing insertions on " << map_type_name << "\n";
-    std::cout << num_iterations << " iterations\n";
+    enum event { instructions, cycles, branch_misses, l1d_misses, llc_misses, dtlb_misses, num_events };
 
-    StdMapType test_map;
+    bool   collected = false;
+    bool   has[num_events]    = {};
+    double totals[num_events] = {};
+    long   ops = 0;
 
-    Times times;
-    times.reserve(num_iterations);
+    double per_op(const int e) const { return totals[e] / static_cast<double>(std::max(ops, 1L)); }
+};
 
-    for (long i = 0; i < num_iterations; ++i)
+static const char * const CounterNames[Counters::num_events] =
+{
+    "instructions", "cycles", "branch_misses", "l1d_misses", "llc_misses", "dtlb_misses"
+};
+
+//
+// One perf_event counter per event, each on the calling thread, user space only.
+// Not a single group, since most PMUs can't count all six at once and a group
+// is all or nothing, so the kernel multiplexes them and the totals are scaled
+// by the fraction of the run each was actually counting.
+//
+class perf_counters final
+{
+public:
+
+    perf_counters() = default;
+    perf_counters(const perf_counters &) = delete;
+    perf_counters & operator = (const perf_counters &) = delete;
+
+    ~perf_counters()
     {
-        const KeyType key{ make_random_key() };
-        const ValType val{ i, key };
+        #if defined(BENCH_PERF_EVENTS)
+        for (const int fd : m_fds)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+        #endif // BENCH_PERF_EVENTS
+    }
 
-        clobber_memory();
+    // True if at least one of the events is available.
+    bool open()
+    {
+        #if defined(BENCH_PERF_EVENTS)
+        const auto cache_miss = [](const std::uint64_t cache) -> std::uint64_t
+        {
+            return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        };
+        m_fds[Counters::instructions]  = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        m_fds[Counters::cycles]        = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        m_fds[Counters::branch_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        m_fds[Counters::l1d_misses]    = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+        m_fds[Counters::llc_misses]    = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+        m_fds[Counters::dtlb_misses]   = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB));
+        #endif // BENCH_PERF_EVENTS
+        return is_open();
+    }
 
-        const auto start = Clock::now();
+    bool is_open() const
+    {
+        for (const int fd : m_fds)
+        {
+            if (fd >= 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
 
-        test_map.insert(std::make_pair(key, val));
+    void start()
+    {
+        #if defined(BENCH_PERF_EVENTS)
+        for (const int fd : m_fds)
+        {
+            if (fd >= 0)
+            {
+                ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        #endif // BENCH_PERF_EVENTS
+    }
 
-        const auto end = Clock::now();
+    void stop(Counters & counters, const long ops)
+    {
+        #if defined(BENCH_PERF_EVENTS)
+        for (const int fd : m_fds)
+        {
+            if (fd >= 0)
+            {
+                ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
 
-        use_variable(&test_map);
+        counters.collected = true;
+        counters.ops = ops;
+        for (int e = 0; e < Counters::num_events; ++e)
+        {
+            // value, time enabled, time running
+            std::uint64_t values[3] = {};
+            if (m_fds[e] < 0 || ::read(m_fds[e], values, sizeof(values)) != ssize_t(sizeof(values)) || values[2] == 0)
+            {
+                continue;
+            }
+            counters.has[e]    = true;
+            counters.totals[e] = static_cast<double>(values[0]) * (static_cast<double>(values[1]) / static_cast<double>(values[2]));
+        }
+        #else // !BENCH_PERF_EVENTS
+        (void)counters;
+        (void)ops;
+        #endif // BENCH_PERF_EVENTS
+    }
+
+private:
 
-        times.push_back(end - start);
+    #if defined(BENCH_PERF_EVENTS)
+    static int open_event(const std::uint32_t type, const std::uint64_t config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = type;
+        attr.config         = config;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
     }
+    #endif // BENCH_PERF_EVENTS
 
-    assert(long(test_map.size()) == num_iterations);
+    int m_fds[Counters::num_events] = { -1, -1, -1, -1, -1, -1 };
+};
 
-    print_test_stats(times);
-    std::cout << "----------------------------------\n";
-}
+// Opened by main() with --counters, otherwise the timed runs don't touch it.
+static perf_counters g_perf_counters;
 
-static void test_insertion_map(const long num_iterations)
+static void counters_start()
 {
-    using MapType = std::map<KeyType, ValType>;
-    test_insertion_std<MapType>("std::map", num_iterations);
+    if (g_perf_counters.is_open())
+    {
+        clobber_memory();
+        g_perf_counters.start();
+    }
 }
 
-static void test_insertion_unordered_map(const long num_iterations)
+static void counters_stop(Counters & counters, const long ops)
 {
-    using MapType = std::unordered_map<KeyType, ValType>;
-    test_insertion_std<MapType>("std::unordered_map", num_iterations);
+    if (g_perf_counters.is_open())
+    {
+        g_perf_counters.stop(counters, ops);
+        clobber_memory();
+    }
 }
 
-static void test_insertion_hash_index(const long num_iterations)
-{
-    std::cout << "\n";
-    std::cout << "testing insertions on hash_index + std::vector\n";
-    std::cout << num_iterations << " iterations\n";
-
-    hash_index<> hash_idx;
-    std::vector<ValType> values;
+// ========================================================
+// Timing and reporting:
+// ========================================================
 
-    Times times;
-    times.reserve(num_iterations);
+//
+// Time samples, each the average nanoseconds per operation of one batch, plus
+// the hardware counters of the whole timed run when those are being collected.
+//
+struct Times
+{
+    std::vector<double> samples  = {};
+    Counters            counters = {};
+};
 
-    for (long i = 0; i < num_iterations; ++i)
+//
+// Times op(0) to op(num_ops-1) in batches of batch_size consecutive calls, recording
+// the average per call of each batch. Keep batch_size at 1 only to catch the latency
+// of individual operations much slower than reading the clock, like a rehash.
+//
+template<typename Op>
+static std::vector<double> batch_samples(const long num_ops, Op op, const long batch_size = BatchSize)
+{
+    std::vector<double> samples;
+    samples.reserve(num_ops / batch_size + 1);
+    for (long base = 0; base < num_ops; base += batch_size)
     {
-        const KeyType key{ make_random_key() };
-        const ValType val{ i, key };
-
+        const long count = std::min(batch_size, num_ops - base);
         clobber_memory();
 
-        // hash_index doesn't bind the values to the keys
-        // like std::map/unordered_map, so adding to the
-        // hash_index also implies adding to the value store.
-        // We also measure the vector::push_back time by design.
-        // We're also assuming a full copy of the value for
-        // the worst case usage where a move is not possible.
-
         const auto start = Clock::now();
-
-        values.push_back(val);
-        hash_idx.insert(std::hash<KeyType>{}(key), values.size() - 1);
-
+        for (long j = 0; j < count; ++j)
+        {
+            op(base + j);
+        }
         const auto end = Clock::now();
 
-        use_variable(&hash_idx);
-        use_variable(&values);
-
-        times.push_back(end - start);
+        clobber_memory();
+        samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / count);
     }
+    return samples;
+}
 
-    assert(long(values.size()) == num_iterations);
-
-    print_test_stats(times);
-    std::cout << "----------------------------------\n";
+// Same as batch_samples(), plus the counters. The counters also see the two
+// clock reads per batch, which are negligible for batches of more than a few ops.
+template<typename Op>
+static Times time_batches(const long num_ops, Op op, const long batch_size = BatchSize)
+{
+    Times times;
+    counters_start();
+    times.samples = batch_samples(num_ops, op, batch_size);
+    counters_stop(times.counters, num_ops);
+    return times;
 }
 
-// ========================================================
-// Erasing by key:
-// ========================================================
+// Times a single call of func() performing num_ops operations, e.g. a whole build().
+template<typename Func>
+static Times time_once(const long num_ops, Func func)
+{
+    Times times;
+    counters_start();
+    clobber_memory();
+    const auto start = Clock::now();
+    func();
+    const auto end = Clock::now();
+    clobber_memory();
+    counters_stop(times.counters, num_ops);
+    times.samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / std::max(num_ops, 1L));
+    return times;
+}
 
-template<typename StdMapType>
-static void test_erasure_std(const char * const map_type_name, const long num_iterations)
+// Lookups are read-only, so their warmup is just an untimed pass over all of them.
+template<typename Op>
+static Times time_lookups(const long num_ops, Op op, const long batch_size = BatchSize)
 {
-    std::cout << "\n";
-    std::cout << "testing erasures on " << map_type_name << "\n";
-    std::cout << num_iterations << " iterations\n";
+    for (long i = 0; i < num_ops; ++i)
+    {
+        op(i);
+    }
+    return time_batches(num_ops, op, batch_size);
+}
 
-    StdMapType test_map;
-    const auto keys = make_random_key_vector(num_iterations);
+// Runs a test body returning its Times once untimed first, so that the measured run
+// doesn't pay for page faults of fresh memory, cold caches and CPU frequency ramp up.
+template<typename Body>
+static Times with_warmup(Body body)
+{
+    body();
+    return body();
+}
 
-    // Fill up the test map:
-    for (long i = 0; i < num_iterations; ++i)
+struct Stats
+{
+    double mean = 0.0;
+    double p50  = 0.0;
+    double p90  = 0.0;
+    double p99  = 0.0;
+    double p999 = 0.0;
+    double min  = 0.0;
+    double max  = 0.0;
+};
+
+static Stats compute_stats(std::vector<double> times)
+{
+    Stats stats;
+    if (times.empty())
     {
-        const ValType val{ i, keys[i] };
-        test_map.insert(std::make_pair(keys[i], val));
+        return stats;
     }
 
-    // Now attempt to erase each key, then measure:
-    Times times;
-    times.reserve(num_iterations);
-    for (long i = 0; i < num_iterations; ++i)
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for (const double t : times)
     {
-        clobber_memory();
-
-        const auto start = Clock::now();
+        sum += t;
+    }
 
-        test_map.erase(keys[i]);
+    // Nearest rank percentiles.
+    auto percentile = [&times](const double p)
+    {
+        const std::size_t rank = static_cast<std::size_t>(std::ceil(p * static_cast<double>(times.size())));
+        return times[std::min(times.size(), std::max(rank, std::size_t(1))) - 1];
+    };
 
-        const auto end = Clock::now();
+    stats.mean = sum / static_cast<double>(times.size());
+    stats.p50  = percentile(0.50);
+    stats.p90  = percentile(0.90);
+    stats.p99  = percentile(0.99);
+    stats.p999 = percentile(0.999);
+    stats.min  = times.front();
+    stats.max  = times.back();
+    return stats;
+}
 
-        use_variable(&test_map);
+enum class OutputFormat { text, csv, json };
+static OutputFormat g_output_format = OutputFormat::text;
+static bool g_first_row = true;
 
-        times.push_back(end - start);
+//
+// One measurement. 'test' and 'container' identify it, 'variant' tells apart runs of
+// the same container in a test. The key and distribution fields describe the lookup
+// suite runs. hit_ratio is the fraction of lookups expected to succeed and table_bytes
+// the size of the hash_index arrays, or 0 for the other containers. Multithreaded runs
+// set the number of threads and their aggregate throughput. For the others it is left
+// at 0 and the CSV/JSON output derives it from the mean time per operation instead.
+//
+struct Row
+{
+    std::string test         = "";
+    std::string container    = "";
+    std::string variant      = "-";
+    std::string keys         = "string";
+    std::string distribution = "uniform";
+    long        items        = 0;
+    double      hit_ratio    = 1.0;
+    std::size_t table_bytes  = 0;
+    long        batch_size   = BatchSize;
+    unsigned    threads      = 1;
+    double      ops_per_sec  = 0.0;
+};
+
+static void begin_report()
+{
+    if (g_output_format == OutputFormat::csv)
+    {
+        std::cout << "test,container,variant,keys,distribution,items,hit_ratio,table_bytes,"
+                     "batch_size,threads,ops_per_sec,samples,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,min_ns,max_ns";
+        // Per op, empty when not collected.
+        for (const char * name : CounterNames)
+        {
+            std::cout << "," << name;
+        }
+        std::cout << "\n";
+    }
+    else if (g_output_format == OutputFormat::json)
+    {
+        std::cout << "[";
     }
-
-    assert(test_map.empty());
-
-    print_test_stats(times);
-    std::cout << "----------------------------------\n";
 }
 
-static void test_erasure_map(const long num_iterations)
+static void end_report()
 {
-    using MapType = std::map<KeyType, ValType>;
-    test_erasure_std<MapType>("std::map", num_iterations);
+    if (g_output_format == OutputFormat::json)
+    {
+        std::cout << "\n]\n";
+    }
 }
 
-static void test_erasure_unordered_map(const long num_iterations)
+// Title of a group of rows; The machine-readable formats only have the rows.
+static void begin_section(const std::string & title, const long items)
 {
-    using MapType = std::unordered_map<KeyType, ValType>;
-    test_erasure_std<MapType>("std::unordered_map", num_iterations);
+    if (g_output_format == OutputFormat::text)
+    {
+        std::cout << "\n";
+        std::cout << "testing " << title << "\n";
+        std::cout << items << " items\n";
+    }
 }
 
-static void test_erasure_hash_index(const long num_iterations)
+static void end_section()
 {
-    std::cout << "\n";
-    std::cout << "testing erasures on hash_index + std::vector\n";
-    std::cout << num_iterations << " iterations\n";
-
-    hash_index<> hash_idx;
-    const auto keys = make_random_key_vector(num_iterations);
-
-    // Fill up the hash_idx:
-    for (long i = 0; i < num_iterations; ++i)
+    if (g_output_format == OutputFormat::text)
     {
-        hash_idx.insert(std::hash<KeyType>{}(keys[i]), i);
+        std::cout << "----------------------------------\n";
     }
-    assert(long(hash_idx.index_chain_size()) >= num_iterations);
+}
 
-    // Now attempt to erase each key, then measure:
-    Times times;
-    times.reserve(num_iterations);
-    for (long i = 0; i < num_iterations; ++i)
+// Quoted if needed, since the variants have commas.
+static std::string csv_field(const std::string & field)
+{
+    if (field.find_first_of(",\"") == std::string::npos)
     {
-        clobber_memory();
-
-        const auto start = Clock::now();
-
-        // We are not removing a value from the value store,
-        // so hash_idx::erase() will always beat the other standard
-        // maps. In a real life use case, you'd probably also want
-        // to erase a value from a vector, which will then take
-        // linear time by itself on the number of elements shifted.
-        hash_idx.erase(std::hash<KeyType>{}(keys[i]), i);
+        return field;
+    }
+    std::string quoted = "\"";
+    for (const char c : field)
+    {
+        quoted += (c == '"') ? "\"\"" : std::string(1, c);
+    }
+    return quoted + "\"";
+}
 
-        const auto end = Clock::now();
+static void report(const Row & row, const Times & times)
+{
+    const Stats stats = compute_stats(times.samples);
+    const std::size_t samples = times.samples.size();
+    const Counters & counters = times.counters;
+    const double ops_per_sec = (row.ops_per_sec > 0.0) ? row.ops_per_sec : ((stats.mean > 0.0) ? 1e9 / stats.mean : 0.0);
 
-        use_variable(&hash_idx);
+    if (g_output_format == OutputFormat::csv)
+    {
+        std::cout << csv_field(row.test) << "," << csv_field(row.container) << "," << csv_field(row.variant) << "," << row.keys << ","
+                  << row.distribution << "," << row.items << "," << row.hit_ratio << "," << row.table_bytes << ","
+                  << row.batch_size << "," << row.threads << "," << ops_per_sec << "," << samples << "," << stats.mean << "," << stats.p50 << ","
+                  << stats.p90 << "," << stats.p99 << "," << stats.p999 << "," << stats.min << "," << stats.max;
+        for (int e = 0; e < Counters::num_events; ++e)
+        {
+            std::cout << ",";
+            if (counters.has[e])
+            {
+                std::cout << counters.per_op(e);
+            }
+        }
+        std::cout << "\n";
+    }
+    else if (g_output_format == OutputFormat::json)
+    {
+        std::cout << (g_first_row ? "\n" : ",\n");
+        std::cout << "  { \"test\": \"" << row.test << "\", \"container\": \"" << row.container
+                  << "\", \"variant\": \"" << row.variant << "\", \"keys\": \"" << row.keys
+                  << "\", \"distribution\": \"" << row.distribution << "\", \"items\": " << row.items
+                  << ", \"hit_ratio\": " << row.hit_ratio << ", \"table_bytes\": " << row.table_bytes
+                  << ", \"batch_size\": " << row.batch_size << ", \"threads\": " << row.threads
+                  << ", \"ops_per_sec\": " << ops_per_sec << ", \"samples\": " << samples
+                  << ", \"mean_ns\": " << stats.mean << ", \"p50_ns\": " << stats.p50 << ", \"p90_ns\": " << stats.p90
+                  << ", \"p99_ns\": " << stats.p99 << ", \"p999_ns\": " << stats.p999
+                  << ", \"min_ns\": " << stats.min << ", \"max_ns\": " << stats.max;
+        if (counters.collected)
+        {
+            // Per op, null for the events not available.
+            for (int e = 0; e < Counters::num_events; ++e)
+            {
+                std::cout << ", \"" << CounterNames[e] << "\": ";
+                if (counters.has[e])
+                {
+                    std::cout << counters.per_op(e);
+                }
+                else
+                {
+                    std::cout << "null";
+                }
+            }
+        }
+        std::cout << " }";
+    }
+    else
+    {
+        std::cout << "\n" << row.container;
+        if (row.variant != "-")
+        {
+            std::cout << ", " << row.variant;
+        }
+        std::cout << " (" << samples << (samples == 1 ? " sample" : " samples");
+        if (samples > 1)
+        {
+            std::cout << " of " << row.batch_size << (row.batch_size == 1 ? " op" : " ops");
+        }
+        if (row.table_bytes != 0)
+        {
+            std::cout << ", " << (row.table_bytes / 1024) << " KB of arrays";
+        }
+        if (row.threads > 1)
+        {
+            std::cout << ", " << row.threads << " threads";
+        }
+        std::cout << "):\n";
 
-        times.push_back(end - start);
+        std::cout << std::fixed << std::setprecision(1);
+        if (row.ops_per_sec > 0.0)
+        {
+            std::cout << "aggregate throughput.: " << (row.ops_per_sec / 1e6) << " Mops/s\n";
+        }
+        std::cout << "average time taken...: " << stats.mean << TimeUnitSuffix << "\n";
+        if (samples > 1)
+        {
+            std::cout << "median / p90.........: " << stats.p50 << " / " << stats.p90 << TimeUnitSuffix << "\n";
+            std::cout << "p99 / p99.9..........: " << stats.p99 << " / " << stats.p999 << TimeUnitSuffix << "\n";
+            std::cout << "lowest time sample...: " << stats.min << TimeUnitSuffix << "\n";
+            std::cout << "largest time sample..: " << stats.max << TimeUnitSuffix << "\n";
+        }
+        std::cout << std::setprecision(2);
+        for (int e = 0; e < Counters::num_events; ++e)
+        {
+            if (counters.has[e])
+            {
+                std::string label = std::string{ CounterNames[e] } + "/op";
+                label.resize(21, '.');
+                std::cout << label << ": " << counters.per_op(e) << "\n";
+            }
+        }
+        if (counters.has[Counters::instructions] && counters.has[Counters::cycles] && counters.totals[Counters::cycles] > 0.0)
+        {
+            std::cout << "instructions/cycle...: " << (counters.totals[Counters::instructions] / counters.totals[Counters::cycles]) << "\n";
+        }
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout << std::setprecision(6);
     }
+    g_first_row = false;
+}
 
-    print_test_stats(times);
-    std::cout << "----------------------------------\n";
+// Shorthand for the operation tests, all on string keys.
+static void report(const char * test, const char * container, const long items,
+                   const Times & times, const char * variant = "-", const long batch_size = BatchSize)
+{
+    Row row;
+    row.test       = test;
+    row.container  = container;
+    row.variant    = variant;
+    row.items      = items;
+    row.batch_size = batch_size;
+    report(row, times);
 }
 
 // ========================================================
-// Lookup by key:
+// Key/Value insertion:
 // ========================================================
 
 template<typename StdMapType>
-static void test_lookup_std(const char * const map_type_name, const long num_iterations)
+static void test_insertion_std(const char * const map_type_name, const long num_iterations)
 {
-    std::cout << "\n";
-    std::cout << "testing lookup on " << map_type_name << "\n";
-    std::cout << num_iterations << " iterations\n";
-
-    StdMapType test_map;
-    auto keys = make_random_key_vector(num_iterations);
-
-    // Fill up the test map:
-    for (long i = 0; i < num_iterations; ++i)
-    {
-        const ValType val{ i, keys[i] };
-        test_map.insert(std::make_pair(keys[i], val));
-    }
-
-    // Scramble the keys so lookup is in a random order from the insertion:
-    std::shuffle(std::begin(keys), std::end(keys), std::mt19937{});
+    begin_section(std::string{ "insertions on " } + map_type_name, num_iterations);
+    const auto keys = make_random_key_vector(num_iterations);
 
-    // Now attempt to lookup each key, then measure:
-    Times times;
-    times.reserve(num_iterations);
-    for (long i = 0; i < num_iterations; ++i)
+    const Times times = with_warmup([&]() -> Times
     {
-        clobber_memory();
-
-        const auto start = Clock::now();
-
-        auto iter = test_map.find(keys[i]);
-
-        const auto end = Clock::now();
-
-        assert(iter != std::end(test_map));
+        StdMapType test_map;
+        const Times t = time_batches(num_iterations, [&](const long i)
+        {
+            test_map.insert(std::make_pair(keys[i], ValType{ std::size_t(i), keys[i] }));
+        });
 
-        use_variable(&iter);
+        assert(long(test_map.size()) == num_iterations);
         use_variable(&test_map);
+        return t;
+    });
 
-        times.push_back(end - start);
-    }
-
-    print_test_stats(times);
-    std::cout << "----------------------------------\n";
+    report("insert", map_type_name, num_iterations, times);
+    end_section();
 }
 
-static void test_lookup_map(const long num_iterations)
+static void test_insertion_map(const long num_iterations)
 {
     using MapType = std::map<KeyType, ValType>;
-    test_lookup_std<MapType>("std::map", num_iterations);
+    test_insertion_std<MapType>("std::map", num_iterations);
 }
 
-static void test_lookup_unordered_map(const long num_iterations)
+static void test_insertion_unordered_map(const long num_iterations)
 {
     using MapType = std::unordered_map<KeyType, ValType>;
-    test_lookup_std<MapType>("std::unordered_map", num_iterations);
+    test_insertion_std<MapType>("std::unordered_map", num_iterations);
 }
 
-static void test_lookup_hash_index(const long num_iterations)
+static void test_insertion_hash_index(const long num_iterations)
 {
-    std::cout << "\n";
-    std::cout << "testing lookup on hash_index + std::vector\n";
-    std::cout << num_iterations << " iterations\n";
+    begin_section("insertions on hash_index + std::vector", num_iterations);
+    const auto keys = make_random_key_vector(num_iterations);
+
+    const Times times = with_warmup([&]() -> Times
+    {
+        hash_index<> hash_idx;
+        std::vector<ValType> values;
+
+        // hash_index doesn't bind the values to the keys
+        // like std::map/unordered_map, so adding to the
+        // hash_index also implies adding to the value store.
+        // We also measure the vector::push_back time by design.
+        // We're also assuming a full copy of the value for
+        // the worst case usage where a move is not possible.
+        const Times t = time_batches(num_iterations, [&](const long i)
+        {
+            const ValType val{ std::size_t(i), keys[i] };
+            values.push_back(val);
+            hash_idx.insert(std::hash<KeyType>{}(keys[i]), values.size() - 1);
+        });
+
+        assert(long(values.size()) == num_iterations);
+        use_variable(&hash_idx);
+        use_variable(&values);
+        return t;
+    });
+
+    report("insert", "hash_index", num_iterations, times);
+    end_section();
+}
+
+static void test_build_hash_index(const long num_iterations)
+{
+    begin_section("bulk build vs per-item insertion on hash_index", num_iterations);
+
+    const auto keys = make_random_key_vector(num_iterations);
+
+    std::vector<std::size_t> hash_keys;
+    hash_keys.reserve(num_iterations);
+    for (const auto & key : keys)
+    {
+        hash_keys.push_back(std::hash<KeyType>{}(key));
+    }
+
+    // A single sample each, since we are timing the whole table construction,
+    // reported as the time per key.
+    const Times insert_times = with_warmup([&]() -> Times
+    {
+        hash_index<> hash_idx;
+        const Times t = time_once(num_iterations, [&]()
+        {
+            for (long i = 0; i < num_iterations; ++i)
+            {
+                hash_idx.insert(hash_keys[i], i);
+            }
+        });
+        use_variable(&hash_idx);
+        return t;
+    });
+    const Times insert_growth_times = with_warmup([&]() -> Times
+    {
+        hash_index<> hash_idx;
+        hash_idx.set_index_chain_growth(2.0f);
+        const Times t = time_once(num_iterations, [&]()
+        {
+            for (long i = 0; i < num_iterations; ++i)
+            {
+                hash_idx.insert(hash_keys[i], i);
+            }
+        });
+        use_variable(&hash_idx);
+        return t;
+    });
+    const Times build_times = with_warmup([&]() -> Times
+    {
+        hash_index<> hash_idx;
+        const Times t = time_once(num_iterations, [&]() { hash_idx.build(hash_keys.data(), hash_keys.size()); });
+        use_variable(&hash_idx);
+        return t;
+    });
+    const Times build_parallel_times = with_warmup([&]() -> Times
+    {
+        // Serial anyway below parallel_grain keys per thread.
+        hash_index<> hash_idx;
+        const Times t = time_once(num_iterations, [&]() { hash_idx.build_parallel(hash_keys.data(), hash_keys.size()); });
+        use_variable(&hash_idx);
+        return t;
+    });
+    const Times rehash_parallel_times = with_warmup([&]() -> Times
+    {
+        hash_index<> hash_idx;
+        hash_idx.build(hash_keys.data(), hash_keys.size());
+        const Times t = time_once(num_iterations, [&]()
+        {
+            hash_idx.rehash_parallel(hash_idx.hash_buckets_size() * 2, 0, [&hash_keys](const unsigned int i) { return hash_keys[i]; });
+        });
+        use_variable(&hash_idx);
+        return t;
+    });
+
+    report("build", "hash_index", num_iterations, insert_times,          "per-item insert()",    1);
+    report("build", "hash_index", num_iterations, insert_growth_times,   "insert() chain x2",    1);
+    report("build", "hash_index", num_iterations, build_times,           "bulk build()",         1);
+    report("build", "hash_index", num_iterations, build_parallel_times,  "build_parallel()",     1);
+    report("build", "hash_index", num_iterations, rehash_parallel_times, "rehash_parallel() x2", 1);
+    end_section();
+}
+
+static void test_insertion_incremental_rehash_hash_index(const long num_iterations)
+{
+    begin_section("insertions with automatic rehash on hash_index", num_iterations);
+
+    std::vector<std::size_t> hash_keys;
+    hash_keys.reserve(num_iterations);
+    for (const auto & key : make_random_key_vector(num_iterations))
+    {
+        hash_keys.push_back(std::hash<KeyType>{}(key));
+    }
+
+    // Same growth policy for both, but one relinks the whole table in the insert()
+    // that crosses the load factor, while the other spreads it over later inserts.
+    // The index chain is sized upfront so that only the rehash shows in the largest sample.
+    // Timed one insert() at a time, since those pauses are the point of this test.
+    for (const std::size_t rehash_step : { std::size_t(0), std::size_t(4) })
+    {
+        const Times times = with_warmup([&]() -> Times
+        {
+            hash_index<> hash_idx{ 1024, static_cast<std::size_t>(num_iterations) };
+            hash_idx.set_max_load_factor(1.0f);
+            hash_idx.set_incremental_rehash(rehash_step);
+
+            const Times t = time_batches(num_iterations, [&](const long i) { hash_idx.insert(hash_keys[i], i); }, 1);
+            use_variable(&hash_idx);
+            return t;
+        });
+
+        report("insert_rehash", "hash_index", num_iterations, times,
+               (rehash_step == 0 ? "stop-the-world rehash" : "incremental rehash, 4 buckets per insert"), 1);
+    }
+    end_section();
+}
+
+// Each tick copies the table for the readers, then the writer updates one entry.
+// The previous snapshot is dropped by the next copy, like a reader done with it.
+template<typename HashIndexType>
+static Times time_snapshot_ticks(const std::vector<std::size_t> & hash_keys, const long num_ticks)
+{
+    const long num_items = static_cast<long>(hash_keys.size());
+
+    HashIndexType hash_idx;
+    for (long i = 0; i < num_items; ++i)
+    {
+        hash_idx.insert(hash_keys[i], i);
+    }
+
+    HashIndexType snapshot{ hash_idx };
+    const Times t = time_batches(num_ticks, [&](const long tick)
+    {
+        const long i = (tick * 7919) % num_items;
+        snapshot = hash_idx;
+        hash_idx.erase(hash_keys[i], i);
+        hash_idx.insert(hash_keys[i], i);
+    }, 1);
+    use_variable(&snapshot);
+    return t;
+}
+
+static void test_snapshot_hash_index(const long num_iterations)
+{
+    begin_section("per-tick snapshot copies, hash_index vs cow_hash_index", num_iterations);
+
+    std::vector<std::size_t> hash_keys;
+    hash_keys.reserve(num_iterations);
+    for (const auto & key : make_random_key_vector(num_iterations))
+    {
+        hash_keys.push_back(std::hash<KeyType>{}(key));
+    }
+
+    // Reported as the time per tick, which for hash_index<> grows with the table size.
+    const long num_ticks = 256;
+    const Times copy_times = with_warmup([&]() { return time_snapshot_ticks<hash_index<>>(hash_keys, num_ticks); });
+    const Times cow_times  = with_warmup([&]() { return time_snapshot_ticks<cow_hash_index<>>(hash_keys, num_ticks); });
+
+    report("snapshot", "hash_index",     num_iterations, copy_times, "deep copy + 1 write", 1);
+    report("snapshot", "cow_hash_index", num_iterations, cow_times,  "snapshot + 1 write",  1);
+    end_section();
+}
+
+// ========================================================
+// Erasing by key:
+// ========================================================
+
+template<typename StdMapType>
+static void test_erasure_std(const char * const map_type_name, const long num_iterations)
+{
+    begin_section(std::string{ "erasures on " } + map_type_name, num_iterations);
+    const auto keys = make_random_key_vector(num_iterations);
+
+    const Times times = with_warmup([&]() -> Times
+    {
+        // Fill up the test map:
+        StdMapType test_map;
+        for (long i = 0; i < num_iterations; ++i)
+        {
+            const ValType val{ std::size_t(i), keys[i] };
+            test_map.insert(std::make_pair(keys[i], val));
+        }
+
+        // Now attempt to erase each key, then measure:
+        const Times t = time_batches(num_iterations, [&](const long i) { test_map.erase(keys[i]); });
+
+        assert(test_map.empty());
+        use_variable(&test_map);
+        return t;
+    });
+
+    report("erase", map_type_name, num_iterations, times);
+    end_section();
+}
+
+static void test_erasure_map(const long num_iterations)
+{
+    using MapType = std::map<KeyType, ValType>;
+    test_erasure_std<MapType>("std::map", num_iterations);
+}
+
+static void test_erasure_unordered_map(const long num_iterations)
+{
+    using MapType = std::unordered_map<KeyType, ValType>;
+    test_erasure_std<MapType>("std::unordered_map", num_iterations);
+}
+
+static void test_erasure_hash_index(const long num_iterations)
+{
+    begin_section("erasures on hash_index + std::vector", num_iterations);
+    const auto keys = make_random_key_vector(num_iterations);
+
+    const Times times = with_warmup([&]() -> Times
+    {
+        // Fill up the hash_idx:
+        hash_index<> hash_idx;
+        for (long i = 0; i < num_iterations; ++i)
+        {
+            hash_idx.insert(std::hash<KeyType>{}(keys[i]), i);
+        }
+        assert(long(hash_idx.index_chain_size()) >= num_iterations);
+
+        // We are not removing a value from the value store,
+        // so hash_idx::erase() will always beat the other standard
+        // maps. In a real life use case, you'd probably also want
+        // to erase a value from a vector, which will then take
+        // linear time by itself on the number of elements shifted.
+        const Times t = time_batches(num_iterations, [&](const long i)
+        {
+            hash_idx.erase(std::hash<KeyType>{}(keys[i]), i);
+        });
+
+        assert(hash_idx.empty());
+        use_variable(&hash_idx);
+        return t;
+    });
+
+    report("erase", "hash_index", num_iterations, times);
+    end_section();
+}
+
+static void test_erasure_prev_chain_hash_index(const long num_iterations)
+{
+    begin_section("erasures on hash_index with long chains (64 buckets), with vs without prev chain", num_iterations);
+    const auto keys = make_random_key_vector(num_iterations);
+
+    // A single sample each, timing the whole erase pass. Erasing in insertion
+    // order always removes the chain tails, the worst case without back links.
+    for (const bool use_prev_chain : { false, true })
+    {
+        const Times times = with_warmup([&]() -> Times
+        {
+            hash_index<> hash_idx{ 64, static_cast<std::size_t>(num_iterations) };
+            hash_idx.set_prev_chain(use_prev_chain);
+            for (long i = 0; i < num_iterations; ++i)
+            {
+                hash_idx.insert(std::hash<KeyType>{}(keys[i]), i);
+            }
+
+            const Times t = time_once(num_iterations, [&]()
+            {
+                for (long i = 0; i < num_iterations; ++i)
+                {
+                    hash_idx.erase(std::hash<KeyType>{}(keys[i]), i);
+                }
+            });
+
+            assert(hash_idx.empty());
+            use_variable(&hash_idx);
+            return t;
+        });
+
+        report("erase_long_chains", "hash_index", num_iterations, times,
+               (use_prev_chain ? "prev chain erase()" : "chain walk erase()"), 1);
+    }
+    end_section();
+}
+
+// ========================================================
+// Lookup by key:
+// ========================================================
+
+template<typename StdMapType>
+static void test_lookup_std(const char * const map_type_name, const long num_iterations)
+{
+    begin_section(std::string{ "lookup on " } + map_type_name, num_iterations);
+
+    StdMapType test_map;
+    auto keys = make_random_key_vector(num_iterations);
+
+    // Fill up the test map:
+    for (long i = 0; i < num_iterations; ++i)
+    {
+        const ValType val{ std::size_t(i), keys[i] };
+        test_map.insert(std::make_pair(keys[i], val));
+    }
+
+    // Scramble the keys so lookup is in a random order from the insertion:
+    std::shuffle(std::begin(keys), std::end(keys), std::mt19937{});
+
+    // Now attempt to lookup each key, then measure:
+    long found = 0;
+    const Times times = time_lookups(num_iterations, [&](const long i)
+    {
+        found += (test_map.find(keys[i]) != std::end(test_map));
+    });
+
+    assert(found == num_iterations * 2);
+    use_variable(&found);
+
+    report("lookup", map_type_name, num_iterations, times);
+    end_section();
+}
+
+static void test_lookup_map(const long num_iterations)
+{
+    using MapType = std::map<KeyType, ValType>;
+    test_lookup_std<MapType>("std::map", num_iterations);
+}
+
+static void test_lookup_unordered_map(const long num_iterations)
+{
+    using MapType = std::unordered_map<KeyType, ValType>;
+    test_lookup_std<MapType>("std::unordered_map", num_iterations);
+}
+
+template<typename HashIndexType>
+static void test_lookup_chained(const char * const hash_index_name, const long num_iterations,
+                                HashIndexType hash_idx = HashIndexType{})
+{
+    begin_section(std::string{ "lookup on " } + hash_index_name + " + std::vector", num_iterations);
 
-    hash_index<> hash_idx;
     std::vector<ValType> values;
     auto keys = make_random_key_vector(num_iterations);
 
@@ -394,7 +1104,7 @@ static void test_lookup_hash_index(const long num_iterations)
     values.reserve(num_iterations);
     for (long i = 0; i < num_iterations; ++i)
     {
-        values.push_back({ i, keys[i] });
+        values.push_back({ std::size_t(i), keys[i] });
         hash_idx.insert(std::hash<KeyType>{}(keys[i]), values.size() - 1);
     }
     assert(long(hash_idx.index_chain_size()) >= num_iterations);
@@ -403,29 +1113,736 @@ static void test_lookup_hash_index(const long num_iterations)
     std::shuffle(std::begin(keys), std::end(keys), std::mt19937{});
 
     // Now attempt to lookup each key, then measure:
+    long found = 0;
+    const Times times = time_lookups(num_iterations, [&](const long i)
+    {
+        found += (hash_idx.find(std::hash<KeyType>{}(keys[i]), keys[i], values, find_predicate) != hash_idx.null_index);
+    });
+
+    assert(found == num_iterations * 2);
+    use_variable(&found);
+
+    report("lookup", hash_index_name, num_iterations, times);
+    end_section();
+}
+
+static void test_lookup_hash_index(const long num_iterations)
+{
+    test_lookup_chained<hash_index<>>("hash_index", num_iterations);
+}
+
+static void test_lookup_compact_hash_index(const long num_iterations)
+{
+    test_lookup_chained<compact_hash_index<>>("compact_hash_index", num_iterations);
+}
+
+static void test_lookup_inline_bucket_hash_index(const long num_iterations)
+{
+    // Sized so that the chains mostly fit inline, which is how this layout is meant to be used.
+    using InlineType = inline_bucket_hash_index<>;
+    std::size_t hash_buckets_size = 1;
+    while (hash_buckets_size * InlineType::inline_capacity < std::size_t(num_iterations))
+    {
+        hash_buckets_size *= 2;
+    }
+    test_lookup_chained<InlineType>("inline_bucket_hash_index", num_iterations,
+                                    InlineType{ hash_buckets_size, InlineType::default_granularity });
+}
+
+static void test_lookup_frozen_hash_index(const long num_iterations)
+{
+    begin_section("lookup on frozen_hash_index + std::vector", num_iterations);
+
+    std::vector<ValType> values;
+    auto keys = make_random_key_vector(num_iterations);
+
+    auto find_predicate = [](const KeyType & key, const ValType & item)
+    {
+        return key == item.second;
+    };
+
+    hash_index<> hash_idx;
+    hash_idx.set_key_retention(true);
+
+    values.reserve(num_iterations);
+    for (long i = 0; i < num_iterations; ++i)
+    {
+        values.push_back({ std::size_t(i), keys[i] });
+        hash_idx.insert(std::hash<KeyType>{}(keys[i]), values.size() - 1);
+    }
+
+    frozen_hash_index<> frozen;
+    const Times freeze_times = time_once(num_iterations, [&]()
+    {
+        frozen = hash_idx.freeze();
+    });
+    assert(long(frozen.size()) == num_iterations);
+
+    std::shuffle(std::begin(keys), std::end(keys), std::mt19937{});
+
+    long found = 0;
+    const Times times = time_lookups(num_iterations, [&](const long i)
+    {
+        found += (frozen.find(std::hash<KeyType>{}(keys[i]), keys[i], values, find_predicate) != frozen.null_index);
+    });
+
+    assert(found == num_iterations * 2);
+    use_variable(&found);
+
+    report("build",  "frozen_hash_index", num_iterations, freeze_times, "freeze()", 1);
+    report("lookup", "frozen_hash_index", num_iterations, times);
+    end_section();
+}
+
+static void test_lookup_many_hash_index(const long num_iterations)
+{
+    begin_section("batched lookup on hash_index + std::vector", num_iterations);
+
+    hash_index<> hash_idx;
+    std::vector<ValType> values;
+    auto keys = make_random_key_vector(num_iterations);
+
+    auto find_predicate = [](const KeyType & key, const ValType & item)
+    {
+        return key == item.second;
+    };
+
+    values.reserve(num_iterations);
+    for (long i = 0; i < num_iterations; ++i)
+    {
+        values.push_back({ std::size_t(i), keys[i] });
+        hash_idx.insert(std::hash<KeyType>{}(keys[i]), values.size() - 1);
+    }
+
+    std::shuffle(std::begin(keys), std::end(keys), std::mt19937{});
+
+    // Hashing is the same for both variants, so do it upfront.
+    std::vector<std::size_t> hash_keys;
+    hash_keys.reserve(num_iterations);
+    for (const auto & key : keys)
+    {
+        hash_keys.push_back(std::hash<KeyType>{}(key));
+    }
+
+    // Batches of BatchSize lookups, first resolved with individual find() calls,
+    // then again with one find_many() call per batch, each timed as a sample.
+    // A full pass each, so that neither variant runs on cache lines just pulled
+    // in by the other (for tables larger than the cache).
+    const long num_batches = num_iterations / BatchSize;
+    if (num_batches == 0)
+    {
+        if (g_output_format == OutputFormat::text)
+        {
+            std::cout << "\nnot enough iterations for a batch of " << BatchSize << "\n";
+        }
+        end_section();
+        return;
+    }
+
+    std::vector<unsigned int> results(BatchSize);
+    const Times find_times = time_lookups(num_batches * BatchSize, [&](const long i)
+    {
+        results[i % BatchSize] = hash_idx.find(hash_keys[i], keys[i], values, find_predicate);
+    });
+    const Times find_many_times = time_lookups(num_batches, [&](const long b)
+    {
+        hash_idx.find_many(&hash_keys[b * BatchSize], &keys[b * BatchSize], BatchSize, values, find_predicate, results.data());
+    }, 1);
+
+    assert(results[0] != hash_idx.null_index);
+    use_variable(results.data());
+
+    // Per lookup, same as the find() samples.
+    const auto per_lookup = [](const Times & batch_times) -> Times
+    {
+        Times t;
+        for (const double sample : batch_times.samples)
+        {
+            t.samples.push_back(sample / BatchSize);
+        }
+        t.counters = batch_times.counters;
+        t.counters.ops *= BatchSize;
+        return t;
+    };
+
+    report("lookup_batched", "hash_index", num_iterations, find_times, "find()");
+    report("lookup_batched", "hash_index", num_iterations, per_lookup(find_many_times), "find_many()");
+
+    #if defined(HASH_INDEX_COROUTINES)
+    // A whole batch of coroutine lookups in flight on one scheduler,
+    // including the allocation of the coroutine frames.
+    hash_index_scheduler scheduler;
+    std::vector<hash_index_lookup<unsigned int>> lookups;
+    lookups.reserve(BatchSize);
+    const Times find_async_times = time_lookups(num_batches, [&](const long b)
+    {
+        lookups.clear();
+        for (long i = b * BatchSize; i < (b + 1) * BatchSize; ++i)
+        {
+            lookups.push_back(hash_idx.find_async(scheduler, hash_keys[i], keys[i], values, find_predicate));
+        }
+        scheduler.run();
+        for (long j = 0; j < BatchSize; ++j)
+        {
+            results[j] = lookups[j].result();
+        }
+    }, 1);
+
+    assert(results[0] != hash_idx.null_index);
+    use_variable(results.data());
+    report("lookup_batched", "hash_index", num_iterations, per_lookup(find_async_times), "find_async()");
+    #endif // HASH_INDEX_COROUTINES
+    end_section();
+}
+
+// Lookup of every item with keys from key_func, timing the key computation too.
+template<typename Needle, typename Collection, typename KeyFunc>
+static void test_lookup_hashed_run(const char * const variant, const char * const key_kind,
+                                   const std::vector<Needle> & needles, const Collection & values, KeyFunc key_func)
+{
+    hash_index<> hash_idx;
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        hash_idx.insert(key_func(values[i]), i);
+    }
+
+    long found = 0;
+    const Times times = time_lookups(long(needles.size()), [&](const long i)
+    {
+        found += (hash_idx.find(key_func(needles[i]), needles[i], values) != hash_idx.null_index);
+    });
+
+    assert(found == long(needles.size()) * 2);
+    use_variable(&found);
+
+    Row row;
+    row.test      = "lookup_hasher";
+    row.container = "hash_index";
+    row.variant   = variant;
+    row.keys      = key_kind;
+    row.items     = long(values.size());
+    report(row, times);
+}
+
+static void test_lookup_hashed_hash_index(const long num_iterations)
+{
+    begin_section("lookup with std::hash vs hash_index_hasher", num_iterations);
+
+    const auto std_hasher  = [](const KeyType & key) { return std::hash<KeyType>{}(key); };
+    const auto fast_hasher = [](const KeyType & key) { return hash_index<>::hashed_key(key); };
+
+    auto keys = make_random_key_vector(num_iterations);
+    auto needles = keys;
+    std::shuffle(std::begin(needles), std::end(needles), std::mt19937{});
+
+    test_lookup_hashed_run("std::hash, string keys", "string", needles, keys, std_hasher);
+    test_lookup_hashed_run("hash_index_hasher, string keys", "string", needles, keys, fast_hasher);
+
+    // Integer ids with a stride of 64, like aligned addresses or handles with
+    // tag bits. std::hash is the identity for integers, so they use 1/64th of it.
+    std::vector<std::size_t> ids;
+    ids.reserve(num_iterations);
+    for (long i = 0; i < num_iterations; ++i)
+    {
+        ids.push_back(std::size_t(i) * 64);
+    }
+    auto id_needles = ids;
+    std::shuffle(std::begin(id_needles), std::end(id_needles), std::mt19937{});
+
+    const auto std_id_hasher  = [](const std::size_t id) { return std::hash<std::size_t>{}(id); };
+    const auto fast_id_hasher = [](const std::size_t id) { return hash_index<>::hashed_key(id); };
+
+    test_lookup_hashed_run("std::hash, integer keys stride 64", "integer", id_needles, ids, std_id_hasher);
+    test_lookup_hashed_run("hash_index_hasher, integer keys stride 64", "integer", id_needles, ids, fast_id_hasher);
+    end_section();
+}
+
+// ========================================================
+// Lookup suite:
+// ========================================================
+
+//
+// Matrix of lookups on hash_index<> and std::unordered_map, over:
+//  - Table sizes from 1K items, cache resident, growing 16 times each step up
+//    to max_items, past the last level cache at the millions of items.
+//  - String keys (8 characters, like the tests above) and 64-bit integer keys.
+//  - Uniform and Zipfian (s = 0.99) popularity of the keys looked up.
+//  - All hits, half hits and all misses. Misses are keys absent from the table,
+//    drawn with the same popularity, so they cost the same to generate.
+// Both containers hash with std::hash and are reserved upfront for the item count.
+//
+static constexpr long SuiteLookups = 1L << 18;
+
+template<typename Key>
+struct suite_case
+{
+    std::vector<Key> needles       = {};
+    long             expected_hits = 0;
+};
+
+template<typename Key>
+static suite_case<Key> make_suite_case(const std::vector<Key> & present, const std::vector<Key> & absent,
+                                       const zipf_distribution * zipf, const double hit_ratio, std::mt19937_64 & engine)
+{
+    const long n = long(present.size());
+    std::uniform_int_distribution<long> uniform{ 0, n - 1 };
+    std::bernoulli_distribution hit{ hit_ratio };
+
+    // Rank to item, so that the popular keys are not also the first inserted.
+    std::vector<long> item_of_rank(static_cast<std::size_t>(n));
+    for (long i = 0; i < n; ++i)
+    {
+        item_of_rank[i] = i;
+    }
+    std::shuffle(item_of_rank.begin(), item_of_rank.end(), engine);
+
+    suite_case<Key> c;
+    c.needles.reserve(SuiteLookups);
+    for (long i = 0; i < SuiteLookups; ++i)
+    {
+        const long item = item_of_rank[(zipf != nullptr) ? (*zipf)(engine) : uniform(engine)];
+        if (hit(engine))
+        {
+            c.needles.push_back(present[item]);
+            ++c.expected_hits;
+        }
+        else
+        {
+            c.needles.push_back(absent[item]);
+        }
+    }
+    return c;
+}
+
+template<typename Key>
+static void run_suite_for_keys(const char * const key_kind, const std::vector<Key> & present, const std::vector<Key> & absent)
+{
+    const long items = long(present.size());
+
+    hash_index<> hash_idx;
+    hash_idx.reserve(items);
+    for (long i = 0; i < items; ++i)
+    {
+        hash_idx.insert(std::hash<Key>{}(present[i]), i);
+    }
+
+    std::unordered_map<Key, long> std_map;
+    std_map.reserve(items);
+    for (long i = 0; i < items; ++i)
+    {
+        std_map.emplace(present[i], i);
+    }
+
+    std::mt19937_64 engine{ static_cast<std::uint64_t>(items) };
+    const zipf_distribution zipf{ items, 0.99 };
+
+    for (const bool use_zipf : { false, true })
+    {
+        for (const double hit_ratio : { 1.0, 0.5, 0.0 })
+        {
+            const suite_case<Key> c = make_suite_case(present, absent, (use_zipf ? &zipf : nullptr), hit_ratio, engine);
+
+            long found = 0;
+            const Times index_times = time_lookups(SuiteLookups, [&](const long i)
+            {
+                const Key & needle = c.needles[i];
+                found += (hash_idx.find(std::hash<Key>{}(needle), needle, present) != hash_idx.null_index);
+            });
+            const Times map_times = time_lookups(SuiteLookups, [&](const long i)
+            {
+                found += (std_map.find(c.needles[i]) != std_map.end());
+            });
+
+            // Two passes (warmup and timed) on each container.
+            assert(found == c.expected_hits * 4);
+            use_variable(&found);
+
+            Row row;
+            row.test         = "lookup_suite";
+            row.keys         = key_kind;
+            row.distribution = use_zipf ? "zipf-0.99" : "uniform";
+            row.items        = items;
+            row.hit_ratio    = hit_ratio;
+
+            char variant[128];
+            std::snprintf(variant, sizeof(variant), "%s keys, %s, %d%% hits",
+                          key_kind, row.distribution.c_str(), int(hit_ratio * 100.0));
+            row.variant = variant;
+
+            row.container   = "hash_index";
+            row.table_bytes = static_cast<std::size_t>(hash_idx.allocated_bytes());
+            report(row, index_times);
+
+            row.container   = "std::unordered_map";
+            row.table_bytes = 0;
+            report(row, map_times);
+        }
+    }
+}
+
+static void test_lookup_suite(const long max_items)
+{
+    for (long items = std::min(1024L, max_items); items <= max_items; items *= 16)
+    {
+        begin_section("lookup suite, hash_index vs std::unordered_map", items);
+
+        // Twice the keys, the second half never inserted, for the misses.
+        auto string_keys = make_random_key_vector(items * 2);
+        const std::vector<KeyType> string_absent(string_keys.begin() + items, string_keys.end());
+        string_keys.resize(items);
+        run_suite_for_keys("string", string_keys, string_absent);
+
+        run_suite_for_keys("integer", make_integer_key_vector(0, items), make_integer_key_vector(items, items));
+        end_section();
+    }
+}
+
+// ========================================================
+// Read scaling:
+// ========================================================
+
+//
+// find() from 1, 2, 4... up to max_threads threads at once over a shared table, with
+// and without a writer thread inserting and erasing other keys at the same time.
+// Every reader does ScalingLookups lookups of present integer keys, each starting
+// from its own offset of a shared needle array, timed in batches as elsewhere.
+// Reports the aggregate throughput, from the moment all readers are released
+// until the last one finishes, and the batch latencies of all readers together.
+//
+// Lookups never write to any shared memory, so throughput should grow linearly with
+// the threads until the memory bandwidth is saturated. Anything short of that on
+// a cache resident table is contention or false sharing, e.g. for the reader slots
+// of concurrent_hash_index or the shard mutexes of sharded_hash_index.
+//
+static constexpr long ScalingLookups = 1L << 18;
+
+// Releases all the readers at once, after their setup.
+class start_barrier final
+{
+public:
+
+    explicit start_barrier(const unsigned threads) : m_waiting{ threads } { }
+
+    void wait() const
+    {
+        m_waiting.fetch_sub(1);
+        while (!m_go.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    void release_when_ready()
+    {
+        while (m_waiting.load() != 0)
+        {
+            std::this_thread::yield();
+        }
+        m_go.store(true, std::memory_order_release);
+    }
+
+private:
+
+    mutable std::atomic<unsigned> m_waiting;
+    std::atomic<bool>             m_go{ false };
+};
+
+//
+// reader(t, barrier, samples, found) runs on each of the threads, setting up any per
+// thread state and calling barrier.wait() before the timed lookups. writer(), if set,
+// is called in a loop from one more thread until all the readers are done.
+//
+template<typename Reader>
+static void run_scaling(Row row, const unsigned threads, Reader reader, const std::function<void()> & writer)
+{
+    start_barrier barrier{ threads };
+    std::atomic<bool> readers_done{ false };
+
+    // Written once by each thread when done, so no false sharing between the readers.
+    std::vector<std::vector<double>> samples(threads);
+    std::vector<long> found(threads, 0);
+
+    std::thread writer_thread;
+    if (writer)
+    {
+        writer_thread = std::thread{ [&]()
+        {
+            while (!readers_done.load(std::memory_order_relaxed))
+            {
+                writer();
+            }
+        } };
+    }
+
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        readers.emplace_back([&, t]()
+        {
+            std::vector<double> s;
+            long f = 0;
+            reader(t, barrier, s, f);
+            samples[t] = std::move(s);
+            found[t] = f;
+        });
+    }
+
+    barrier.release_when_ready();
+    const auto start = Clock::now();
+    for (auto & r : readers)
+    {
+        r.join();
+    }
+    const auto end = Clock::now();
+
+    readers_done.store(true);
+    if (writer_thread.joinable())
+    {
+        writer_thread.join();
+    }
+
     Times times;
-    times.reserve(num_iterations);
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        assert(found[t] == ScalingLookups);
+        times.samples.insert(times.samples.end(), samples[t].begin(), samples[t].end());
+    }
+    use_variable(found.data());
+
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    row.threads     = threads;
+    row.ops_per_sec = (seconds > 0.0) ? (static_cast<double>(ScalingLookups) * threads / seconds) : 0.0;
+    report(row, times);
+}
+
+static void test_lookup_scaling(const long num_iterations, const unsigned max_threads)
+{
+    begin_section("read scaling of hash_index, concurrent_hash_index and sharded_hash_index", num_iterations);
+
+    using ConcurrentType = concurrent_hash_index<>;
+    using ShardedType    = sharded_hash_index<16>;
+
+    // The writer inserts and erases the keys past num_iterations, which the readers never
+    // look up, so that every lookup must succeed even while the chains are changing.
+    const long writer_keys = std::min(num_iterations, 4096L);
+    const std::vector<std::uint64_t> keys = make_integer_key_vector(0, num_iterations + writer_keys);
+
+    std::vector<std::uint64_t> needles;
+    needles.reserve(ScalingLookups);
+    std::mt19937_64 engine{ 42 };
+    std::uniform_int_distribution<long> dist{ 0, num_iterations - 1 };
+    for (long i = 0; i < ScalingLookups; ++i)
+    {
+        needles.push_back(keys[dist(engine)]);
+    }
+
+    // Offset of each reader into the needles, so that they don't all hit the same buckets at once.
+    const auto needle_of = [&needles](const unsigned t, const long i) -> std::uint64_t
+    {
+        long j = i + long(t) * 4099;
+        j %= ScalingLookups;
+        return needles[j];
+    };
+
+    // Same load for all, with the writer's keys in. Sized upfront, since concurrent_hash_index can't rehash.
+    const std::size_t chain = static_cast<std::size_t>(num_iterations + writer_keys);
+    std::size_t buckets = 1;
+    while (buckets < chain)
+    {
+        buckets <<= 1;
+    }
+
+    hash_index<> hash_idx{ buckets, chain };
+    ConcurrentType concurrent_idx{ buckets, chain, std::max<std::size_t>(max_threads, ConcurrentType::default_max_readers) };
+    ShardedType sharded_idx{ buckets / ShardedType::shard_count, chain / ShardedType::shard_count };
+
     for (long i = 0; i < num_iterations; ++i)
     {
-        clobber_memory();
+        hash_idx.insert(keys[i], i);
+        concurrent_idx.insert(keys[i], i);
+        sharded_idx.insert(keys[i], i);
+    }
 
-        const auto start = Clock::now();
+    const auto concurrent_writer = [&]()
+    {
+        for (long i = num_iterations; i < num_iterations + writer_keys; ++i)
+        {
+            concurrent_idx.insert(keys[i], i);
+        }
+        for (long i = num_iterations; i < num_iterations + writer_keys; ++i)
+        {
+            concurrent_idx.erase(keys[i], i);
+        }
+        // Erased indexes can't be reinserted while a reader might still be standing on them.
+        concurrent_idx.synchronize();
+    };
+    const auto sharded_writer = [&]()
+    {
+        for (long i = num_iterations; i < num_iterations + writer_keys; ++i)
+        {
+            sharded_idx.insert(keys[i], i);
+        }
+        for (long i = num_iterations; i < num_iterations + writer_keys; ++i)
+        {
+            sharded_idx.erase(keys[i], i);
+        }
+    };
 
-        auto index = hash_idx.find(std::hash<KeyType>{}(keys[i]), keys[i], values, find_predicate);
+    const auto hash_index_reader = [&](const unsigned t, const start_barrier & barrier, std::vector<double> & samples, long & found)
+    {
+        barrier.wait();
+        samples = batch_samples(ScalingLookups, [&](const long i)
+        {
+            const std::uint64_t key = needle_of(t, i);
+            found += (hash_idx.find(key, key, keys) != hash_idx.null_index);
+        });
+    };
+    const auto concurrent_reader = [&](const unsigned t, const start_barrier & barrier, std::vector<double> & samples, long & found)
+    {
+        const ConcurrentType::reader r{ concurrent_idx };
+        barrier.wait();
+        samples = batch_samples(ScalingLookups, [&](const long i)
+        {
+            const std::uint64_t key = needle_of(t, i);
+            found += (r.find(key, key, keys) != concurrent_idx.null_index);
+        });
+    };
+    const auto sharded_reader = [&](const unsigned t, const start_barrier & barrier, std::vector<double> & samples, long & found)
+    {
+        barrier.wait();
+        samples = batch_samples(ScalingLookups, [&](const long i)
+        {
+            const std::uint64_t key = needle_of(t, i);
+            found += (sharded_idx.find(key, key, keys) != sharded_idx.null_index);
+        });
+    };
 
-        const auto end = Clock::now();
+    Row row;
+    row.test  = "lookup_scaling";
+    row.keys  = "integer";
+    row.items = num_iterations;
 
-        assert(index != hash_idx.null_index);
+    std::vector<unsigned> thread_counts;
+    for (unsigned threads = 1; threads < max_threads; threads *= 2)
+    {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
 
-        use_variable(&index);
-        use_variable(&hash_idx);
-        use_variable(&values);
+    for (const unsigned threads : thread_counts)
+    {
+        // hash_index<> is only safe to share while nobody writes to it.
+        row.container = "hash_index";
+        row.variant   = "readers only";
+        run_scaling(row, threads, hash_index_reader, nullptr);
+
+        row.container = "concurrent_hash_index";
+        row.variant   = "readers only";
+        run_scaling(row, threads, concurrent_reader, nullptr);
+        row.variant   = "readers + 1 writer";
+        run_scaling(row, threads, concurrent_reader, concurrent_writer);
+
+        row.container = "sharded_hash_index<16>";
+        row.variant   = "readers only";
+        run_scaling(row, threads, sharded_reader, nullptr);
+        row.variant   = "readers + 1 writer";
+        run_scaling(row, threads, sharded_reader, sharded_writer);
+    }
+    end_section();
+}
+
+// ========================================================
+// Huge pages:
+// ========================================================
+
+template<typename HashIndexType>
+static void test_lookup_huge_pages_run(const char * const allocator_name, HashIndexType hash_idx,
+                                       const std::vector<std::uint64_t> & keys,
+                                       const std::vector<std::uint64_t> & lookups)
+{
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        hash_idx.insert(keys[i], static_cast<unsigned int>(i));
+    }
+
+    // Integer keys double as their own hash, so the lookup
+    // cost is only the bucket and chain accesses themselves.
+    const auto find_predicate = [](const std::uint64_t key, const std::uint64_t item)
+    {
+        return key == item;
+    };
+
+    long found = 0;
+    const Times times = time_lookups(long(lookups.size()), [&](const long i)
+    {
+        const std::uint64_t key = lookups[i];
+        found += (hash_idx.find(key, key, keys, find_predicate) != hash_idx.null_index);
+    });
+
+    assert(found == long(lookups.size()) * 2);
+    use_variable(&found);
+
+    Row row;
+    row.test        = "lookup_huge_pages";
+    row.container   = "hash_index";
+    row.variant     = allocator_name;
+    row.keys        = "integer";
+    row.items       = long(keys.size());
+    row.table_bytes = static_cast<std::size_t>(hash_idx.allocated_bytes());
+    report(row, times);
+}
+
+static void test_lookup_huge_pages(const long num_iterations)
+{
+    begin_section("random lookup on hash_index with huge pages", num_iterations);
+
+    using StdIndexType  = hash_index<unsigned int, std::size_t, std::size_t>;
+    using HugeAllocator = hash_index_huge_page_allocator<unsigned int>;
+    using HugeIndexType = hash_index<unsigned int, std::size_t, std::size_t, HugeAllocator>;
+
+    if (!HugeAllocator::is_supported() && g_output_format == OutputFormat::text)
+    {
+        std::cout << "\nhuge pages not supported on this platform, results are for operator new\n";
+    }
+
+    std::mt19937_64 rand_engine{ 1234 };
+    std::vector<std::uint64_t> keys(num_iterations);
+    for (auto & key : keys)
+    {
+        key = rand_engine();
+    }
+
+    // Lookups scattered all over the table, where page walks dominate with 4 KB pages.
+    std::vector<std::uint64_t> lookups;
+    lookups.reserve(num_iterations);
+    std::uniform_int_distribution<long> dist{ 0, num_iterations - 1 };
+    for (long i = 0; i < num_iterations; ++i)
+    {
+        lookups.push_back(keys[dist(rand_engine)]);
+    }
 
-        times.push_back(end - start);
+    const std::size_t chain = static_cast<std::size_t>(num_iterations);
+    std::size_t buckets = 1;
+    while (buckets < chain)
+    {
+        buckets <<= 1;
     }
 
-    print_test_stats(times);
-    std::cout << "----------------------------------\n";
+    hash_index_huge_page_options transparent;
+    transparent.pages = hash_index_huge_page_options::page_mode::transparent;
+
+    hash_index_huge_page_options explicit_2mb;
+    explicit_2mb.pages = hash_index_huge_page_options::page_mode::explicit_2mb;
+
+    hash_index_huge_page_options interleaved;
+    interleaved.numa       = hash_index_huge_page_options::numa_mode::interleave;
+    interleaved.numa_nodes = ~0ul;
+
+    test_lookup_huge_pages_run("std::allocator", StdIndexType{ buckets, chain }, keys, lookups);
+    test_lookup_huge_pages_run("transparent huge pages", HugeIndexType{ buckets, chain, HugeAllocator{ transparent } }, keys, lookups);
+    test_lookup_huge_pages_run("explicit 2 MB pages", HugeIndexType{ buckets, chain, HugeAllocator{ explicit_2mb } }, keys, lookups);
+    test_lookup_huge_pages_run("transparent, NUMA interleave", HugeIndexType{ buckets, chain, HugeAllocator{ interleaved } }, keys, lookups);
+    end_section();
 }
 
 // ========================================================
@@ -435,34 +1852,118 @@ static void test_lookup_hash_index(const long num_iterations)
 int main(int argc, const char * argv[])
 {
     long num_iterations = 1024; // default value if none provided via cmdline
+    const char * mode = nullptr;
+
+    bool collect_counters = false;
+    unsigned max_threads = std::max(std::thread::hardware_concurrency(), 1u);
 
-    if (argc > 1)
+    for (int i = 1; i < argc; ++i)
     {
-        try
+        const char * const arg = argv[i];
+        if (std::strcmp(arg, "--counters") == 0)
+        {
+            collect_counters = true;
+        }
+        else if (std::strncmp(arg, "--threads=", 10) == 0)
         {
-            num_iterations = std::stol(argv[1]);
+            const long threads = std::strtol(arg + 10, nullptr, 10);
+            if (threads <= 0)
+            {
+                std::cerr << "\nNumber of threads must be a positive integer number!\n";
+                return EXIT_FAILURE;
+            }
+            max_threads = static_cast<unsigned>(threads);
         }
-        catch (...)
+        else if (std::strncmp(arg, "--format=", 9) == 0)
         {
-            std::cerr << "\nArgument must be a positive integer number!\n";
-            std::cerr << "Usage: " << argv[0] << " <num_iterations>\n\n";
-            return EXIT_FAILURE;
+            const char * const format = arg + 9;
+            if      (std::strcmp(format, "text") == 0) { g_output_format = OutputFormat::text; }
+            else if (std::strcmp(format, "csv")  == 0) { g_output_format = OutputFormat::csv;  }
+            else if (std::strcmp(format, "json") == 0) { g_output_format = OutputFormat::json; }
+            else
+            {
+                std::cerr << "\nUnknown output format '" << format << "'!\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (i == 1)
+        {
+            char * end = nullptr;
+            num_iterations = std::strtol(arg, &end, 10);
+            if (end == arg || *end != '\0' || num_iterations <= 0)
+            {
+                std::cerr << "\nArgument must be a positive integer number!\n";
+                std::cerr << "Usage: " << argv[0] << " <num_iterations> [suite|scaling|huge_pages] [--format=text|csv|json] [--counters] [--threads=N]\n\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if (mode == nullptr)
+        {
+            mode = arg;
         }
     }
 
-    // insert() method:
-    test_insertion_map(num_iterations);
-    test_insertion_unordered_map(num_iterations);
-    test_insertion_hash_index(num_iterations);
+    if (mode != nullptr && std::strcmp(mode, "suite") != 0 && std::strcmp(mode, "scaling") != 0 && std::strcmp(mode, "huge_pages") != 0)
+    {
+        std::cerr << "\nUnknown mode '" << mode << "'!\n";
+        return EXIT_FAILURE;
+    }
 
-    // erase() method:
-    test_erasure_map(num_iterations);
-    test_erasure_unordered_map(num_iterations);
-    test_erasure_hash_index(num_iterations);
+    // Timing still works without them, so only warn.
+    if (collect_counters && !g_perf_counters.open())
+    {
+        std::cerr << "\nperf_event_open() failed, no hardware counters will be reported. "
+                     "Check /proc/sys/kernel/perf_event_paranoid or the VM's PMU support.\n";
+    }
 
-    // find() method:
-    test_lookup_map(num_iterations);
-    test_lookup_unordered_map(num_iterations);
-    test_lookup_hash_index(num_iterations);
-}
+    begin_report();
+
+    // Separate mode, since it only pays off with tables much larger than the
+    // TLB reach, e.g.: hash_idx_bench 16000000 huge_pages
+    if (mode != nullptr && std::strcmp(mode, "huge_pages") == 0)
+    {
+        test_lookup_huge_pages(num_iterations);
+        end_report();
+        return 0;
+    }
+
+    if (mode == nullptr)
+    {
+        // insert() method:
+        test_insertion_map(num_iterations);
+        test_insertion_unordered_map(num_iterations);
+        test_insertion_hash_index(num_iterations);
+        test_build_hash_index(num_iterations);
+        test_insertion_incremental_rehash_hash_index(num_iterations);
+        test_snapshot_hash_index(num_iterations);
+
+        // erase() method:
+        test_erasure_map(num_iterations);
+        test_erasure_unordered_map(num_iterations);
+        test_erasure_hash_index(num_iterations);
+        test_erasure_prev_chain_hash_index(num_iterations);
+
+        // find() method:
+        test_lookup_map(num_iterations);
+        test_lookup_unordered_map(num_iterations);
+        test_lookup_hash_index(num_iterations);
+        test_lookup_compact_hash_index(num_iterations);
+        test_lookup_inline_bucket_hash_index(num_iterations);
+        test_lookup_frozen_hash_index(num_iterations);
+        test_lookup_many_hash_index(num_iterations);
+        test_lookup_hashed_hash_index(num_iterations);
+    }
+
+    // Table sizes, key types, distributions and hit ratios:
+    if (mode == nullptr || std::strcmp(mode, "suite") == 0)
+    {
+        test_lookup_suite(num_iterations);
+    }
 
+    // Concurrent reads, with and without a writer:
+    if (mode == nullptr || std::strcmp(mode, "scaling") == 0)
+    {
+        test_lookup_scaling(num_iterations, max_threads);
+    }
+    end_report();
+}
@@ -0,0 +1,1477 @@
+// ================================================================================================
+// -*- C++ -*-
+// File: concurrent_hash_index.hpp
+// Author: Guilherme R. Lampert
+// Created on: 10/14/26
+//
+// About:
+//  concurrent_hash_index, a hash_index variant for a single writer
+//  thread and any number of lock-free reader threads, sharded_hash_index,
+//  for multiple concurrent writers, and cow_hash_index, for cheap
+//  snapshots shared with other threads.
+//
+// License:
+//  hash_index is work derived from a similar class found on the source code release of
+//  DOOM 3 BFG by id Software, available at <https://github.com/id-Software/DOOM-3-BFG>,
+//  and therefore is released under the GNU General Public License version 3 to comply
+//  with the original work. See the accompanying LICENSE file for full disclosure.
+//
+// ================================================================================================
+
+#ifndef CONCURRENT_HASH_INDEX_HPP
+#define CONCURRENT_HASH_INDEX_HPP
+
+#include "hash_index.hpp"
+
+// Same as in hash_index.hpp. User is responsible for providing
+// the Standard headers if HASH_INDEX_NO_STD_INCLUDES is defined.
+#ifndef HASH_INDEX_NO_STD_INCLUDES
+    #include <atomic>
+    #include <mutex>
+    #include <thread>
+#endif // HASH_INDEX_NO_STD_INCLUDES
+
+//
+// ----------------------------------
+//  concurrent_hash_index<> template
+// ----------------------------------
+//
+// Brief:
+//  Same chaining scheme of hash_index<>, but the hash buckets and
+//  index chain are arrays of std::atomic<index_type>, so that one
+//  writer thread can insert and erase while other threads look up,
+//  without any locking on either side.
+//
+//  Inserts publish a new chain head with a release store, after the
+//  entry's own link was written, so a reader that sees the new head
+//  also sees the rest of the chain. When the index chain has to grow,
+//  the writer builds a larger copy of both arrays and publishes it
+//  atomically. The old arrays are only freed once every reader that
+//  could still be walking them is done, using a simple epoch scheme:
+//  readers announce the epoch they started in through a per-reader
+//  slot, and retired arrays are reclaimed when all active readers
+//  are past the epoch in which they were retired.
+//
+//  Readers go through a reader object, which claims one of the
+//  max_readers slots for its lifetime, so create one per thread
+//  and reuse it. All the other methods are writer-only and must
+//  be called from a single thread at a time.
+//
+//  Erased entries keep their link, so a reader standing on one keeps
+//  walking the rest of its chain. If an index is reinserted right after
+//  being erased, a concurrent reader standing on it could wander into
+//  another chain and miss the remaining entries of its own. Call
+//  synchronize() between erasing and reusing an index if that matters.
+//
+// Usage example:
+//
+//  concurrent_hash_index<> hash_idx;
+//
+//  // Writer thread:
+//  hash_idx.insert(std::hash<std::string>{}(t.name), index);
+//
+//  // Each reader thread:
+//  concurrent_hash_index<>::reader r{ hash_idx };
+//  const auto index = r.find(std::hash<std::string>{}(key), key, values, pred);
+//
+//  The writer must also make sure the external value collection
+//  is safe to read concurrently, which is outside of our control.
+//
+template
+<
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t,
+    typename Allocator = std::allocator<IndexType>
+>
+class concurrent_hash_index final
+    : private Allocator // Take advantage of EBO for the default empty std::allocator
+{
+    // Defined further down, but used by the reader class.
+    struct table;
+    struct reader_slot;
+
+public:
+
+    static_assert(std::is_integral<IndexType>::value, "Integer type required for IndexType!");
+    static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
+    static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
+
+    using index_type = IndexType;
+    using key_type   = KeyType;
+    using size_type  = SizeType;
+
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+
+    static constexpr size_type default_initial_size = 1024;
+    static constexpr size_type default_granularity  = 1024;
+    static constexpr size_type default_max_readers  = 64;
+
+    class reader;
+
+    //
+    // Constructors-destructor:
+    //
+    // Unlike hash_index<>, the initial arrays are allocated upfront,
+    // since readers must always have a table to point to. Not copyable
+    // or movable, since readers keep a reference to the hash index.
+    //
+
+    concurrent_hash_index()
+    {
+        internal_init(default_initial_size, default_initial_size, default_max_readers);
+    }
+
+    concurrent_hash_index(const size_type initial_hash_buckets_size,
+                          const size_type initial_index_chain_size,
+                          const size_type max_readers = default_max_readers)
+    {
+        internal_init(initial_hash_buckets_size, initial_index_chain_size, max_readers);
+    }
+
+    ~concurrent_hash_index()
+    {
+        for (size_type i = 0; i < m_max_readers; ++i)
+        {
+            HASH_INDEX_ASSERT(!m_reader_slots[i].claimed.load() && "Destroying concurrent_hash_index with live readers!");
+            m_reader_slots[i].~reader_slot();
+        }
+        deallocate_array(m_reader_slots_storage, reader_slots_storage_size(m_max_readers));
+
+        free_table(m_table.load());
+        for (const auto & retired : m_retired)
+        {
+            free_table(retired.table_ptr);
+        }
+    }
+
+    concurrent_hash_index(const concurrent_hash_index &) = delete;
+    concurrent_hash_index & operator = (const concurrent_hash_index &) = delete;
+
+    //
+    // Writer interface (single thread):
+    //
+
+    void insert(const key_type key, const index_type index)
+    {
+        HASH_INDEX_ASSERT(index != null_index);
+
+        table * t = m_table.load(std::memory_order_relaxed);
+        if (static_cast<size_type>(index) >= t->index_chain_size)
+        {
+            resize_index_chain(index + 1);
+            t = m_table.load(std::memory_order_relaxed);
+        }
+
+        // Link first, then publish the new head. The release store
+        // makes the link visible to any reader that sees the head.
+        const size_type k = static_cast<size_type>(key) & t->hash_mask;
+        t->index_chain[index].store(t->hash_buckets[k].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        t->hash_buckets[k].store(index, std::memory_order_release);
+        ++m_num_items;
+    }
+
+    void erase(const key_type key, const index_type index)
+    {
+        table * const t = m_table.load(std::memory_order_relaxed);
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < t->index_chain_size);
+
+        const size_type  k    = static_cast<size_type>(key) & t->hash_mask;
+        const index_type head = t->hash_buckets[k].load(std::memory_order_relaxed);
+        const index_type rest = t->index_chain[index].load(std::memory_order_relaxed);
+
+        // The erased entry keeps pointing to the rest of the chain,
+        // for the sake of readers that might be standing on it.
+        if (head == index)
+        {
+            t->hash_buckets[k].store(rest, std::memory_order_release);
+            --m_num_items;
+            return;
+        }
+
+        for (index_type i = head; i != null_index; i = t->index_chain[i].load(std::memory_order_relaxed))
+        {
+            if (t->index_chain[i].load(std::memory_order_relaxed) == index)
+            {
+                t->index_chain[i].store(rest, std::memory_order_release);
+                --m_num_items;
+                return;
+            }
+        }
+    }
+
+    void clear() noexcept
+    {
+        table * const t = m_table.load(std::memory_order_relaxed);
+        for (size_type i = 0; i < t->hash_buckets_size; ++i)
+        {
+            t->hash_buckets[i].store(null_index, std::memory_order_release);
+        }
+        m_num_items = 0;
+    }
+
+    void resize_index_chain(const size_type new_index_chain_size)
+    {
+        table * const old_table = m_table.load(std::memory_order_relaxed);
+        if (new_index_chain_size <= old_table->index_chain_size)
+        {
+            return;
+        }
+
+        const auto mod = new_index_chain_size % default_granularity;
+        const size_type new_size = (mod == 0) ? new_index_chain_size : new_index_chain_size + default_granularity - mod;
+
+        table * const new_table = allocate_table(old_table->hash_buckets_size, new_size);
+        for (size_type i = 0; i < old_table->hash_buckets_size; ++i)
+        {
+            new_table->hash_buckets[i].store(old_table->hash_buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        for (size_type i = 0; i < old_table->index_chain_size; ++i)
+        {
+            new_table->index_chain[i].store(old_table->index_chain[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        publish(new_table);
+    }
+
+    // Waits until every reader that was active at the time of the call is done,
+    // then frees all the retired arrays. After it returns, no reader can be
+    // observing the hash index as it was before the call (a grace period).
+    void synchronize()
+    {
+        const std::uint64_t epoch = m_epoch.fetch_add(1);
+        while (min_active_epoch() <= epoch)
+        {
+            std::this_thread::yield();
+        }
+        reclaim_retired();
+    }
+
+    //
+    // Queries (writer thread):
+    //
+
+    size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    size_type hash_buckets_size() const noexcept
+    {
+        return m_table.load(std::memory_order_relaxed)->hash_buckets_size;
+    }
+
+    size_type index_chain_size() const noexcept
+    {
+        return m_table.load(std::memory_order_relaxed)->index_chain_size;
+    }
+
+    size_type max_readers() const noexcept
+    {
+        return m_max_readers;
+    }
+
+    // Number of replaced arrays still waiting for readers to move on.
+    size_type retired_count() const noexcept
+    {
+        return static_cast<size_type>(m_retired.size());
+    }
+
+    size_type allocated_bytes() const noexcept
+    {
+        size_type bytes = table_bytes(m_table.load(std::memory_order_relaxed));
+        for (const auto & retired : m_retired)
+        {
+            bytes += table_bytes(retired.table_ptr);
+        }
+        return bytes;
+    }
+
+    //
+    // Reader interface:
+    //
+    // A reader claims one of the reader slots of the hash index for its whole
+    // lifetime and is meant to be owned by a single thread. If all slots are
+    // taken, construction waits until another thread destroys its reader, so
+    // a thread must never hold more than max_readers at once. Every lookup pins
+    // the current epoch in the slot, so the arrays being walked can't be freed
+    // under it, then unpins it.
+    //
+    class reader final
+    {
+    public:
+
+        explicit reader(const concurrent_hash_index & owner)
+            : m_owner{ owner }
+            , m_slot{ owner.claim_reader_slot() }
+        {
+        }
+
+        ~reader()
+        {
+            m_slot->claimed.store(false, std::memory_order_release);
+        }
+
+        reader(const reader &) = delete;
+        reader & operator = (const reader &) = delete;
+
+        template<typename ValueType, typename CollectionType, typename Predicate>
+        index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+        {
+            const section s{ *this };
+            for (index_type i = s.first(key); i != null_index; i = s.next(i))
+            {
+                const auto & item = collection[i];
+                if (pred(needle, item))
+                {
+                    return i;
+                }
+            }
+            return null_index;
+        }
+
+        template<typename ValueType, typename CollectionType>
+        index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+        {
+            return find(key, needle, collection, std::equal_to<ValueType>{});
+        }
+
+        //
+        // Scoped read-side critical section for manual first()/next() walks.
+        // Indexes obtained from one section must not be used in another.
+        // Sections don't nest; keep them short, since they hold back
+        // the reclamation of replaced arrays.
+        //
+        class section final
+        {
+        public:
+
+            explicit section(const reader & r)
+                : m_slot{ r.m_slot }
+                , m_table{ pin_table(r) }
+            {
+            }
+
+            ~section()
+            {
+                m_slot->epoch.store(0, std::memory_order_release);
+            }
+
+            section(const section &) = delete;
+            section & operator = (const section &) = delete;
+
+            index_type first(const key_type key) const
+            {
+                return m_table->hash_buckets[static_cast<size_type>(key) & m_table->hash_mask].load(std::memory_order_acquire);
+            }
+
+            index_type next(const index_type index) const
+            {
+                HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_table->index_chain_size);
+                return m_table->index_chain[index].load(std::memory_order_acquire);
+            }
+
+        private:
+
+            static const table * pin_table(const reader & r) noexcept
+            {
+                // Must be sequentially consistent: The epoch store has to be
+                // visible to the writer before we load the table pointer.
+                r.m_slot->epoch.store(r.m_owner.m_epoch.load());
+                return r.m_owner.m_table.load();
+            }
+
+            reader_slot * const m_slot;
+            const table * const m_table;
+        };
+
+    private:
+
+        const concurrent_hash_index & m_owner;
+        reader_slot * const           m_slot;
+    };
+
+private:
+
+    //
+    // One published version of the hash buckets and index chain arrays.
+    //
+    struct table
+    {
+        std::atomic<index_type> * hash_buckets;
+        std::atomic<index_type> * index_chain;
+        size_type hash_buckets_size;
+        size_type index_chain_size;
+        size_type hash_mask;
+    };
+
+    struct retired_table
+    {
+        table *       table_ptr;
+        std::uint64_t epoch;
+    };
+
+    //
+    // Per-reader epoch announcement. Zero when the reader isn't in a read section.
+    // Spaced one cache line apart to avoid false sharing between reader threads.
+    //
+    static constexpr size_type cache_line_size = 64;
+
+    struct reader_slot
+    {
+        std::atomic<std::uint64_t> epoch;
+        std::atomic<bool>          claimed;
+        unsigned char              padding[cache_line_size - sizeof(std::atomic<std::uint64_t>) - sizeof(std::atomic<bool>)];
+
+        reader_slot() noexcept : epoch{ 0 }, claimed{ false }, padding{} { }
+    };
+
+    static_assert(sizeof(reader_slot) == cache_line_size, "Reader slots should fill exactly one cache line!");
+
+    template<typename T>
+    T * allocate_array(const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        return alloc.allocate(count);
+    }
+
+    template<typename T>
+    void deallocate_array(T * array, const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        alloc.deallocate(array, count);
+    }
+
+    static size_type reader_slots_storage_size(const size_type max_readers) noexcept
+    {
+        // One extra slot worth of bytes so the slots can be aligned to a cache line.
+        return (max_readers + 1) * sizeof(reader_slot);
+    }
+
+    std::atomic<index_type> * allocate_atomics(const size_type count)
+    {
+        std::atomic<index_type> * const array = allocate_array<std::atomic<index_type>>(count);
+        for (size_type i = 0; i < count; ++i)
+        {
+            ::new(static_cast<void *>(array + i)) std::atomic<index_type>{ null_index };
+        }
+        return array;
+    }
+
+    table * allocate_table(const size_type hash_buckets_size, const size_type index_chain_size)
+    {
+        HASH_INDEX_ASSERT((hash_buckets_size > 0) && ((hash_buckets_size & (hash_buckets_size - 1)) == 0) &&
+                          "Size of hash_index buckets array must be a power-of-2!");
+
+        table * const t = allocate_array<table>(1);
+        t->hash_buckets      = allocate_atomics(hash_buckets_size);
+        t->index_chain       = allocate_atomics(index_chain_size);
+        t->hash_buckets_size = hash_buckets_size;
+        t->index_chain_size  = index_chain_size;
+        t->hash_mask         = hash_buckets_size - 1;
+        return t;
+    }
+
+    void free_table(table * t)
+    {
+        // std::atomic of an integer is trivially destructible, no need to run destructors.
+        deallocate_array(t->hash_buckets, t->hash_buckets_size);
+        deallocate_array(t->index_chain,  t->index_chain_size);
+        deallocate_array(t, 1);
+    }
+
+    static size_type table_bytes(const table * t) noexcept
+    {
+        return (t->hash_buckets_size + t->index_chain_size) * sizeof(std::atomic<index_type>);
+    }
+
+    void internal_init(const size_type initial_hash_buckets_size,
+                       const size_type initial_index_chain_size,
+                       const size_type max_readers)
+    {
+        HASH_INDEX_ASSERT(max_readers > 0);
+
+        m_table.store(allocate_table(initial_hash_buckets_size, initial_index_chain_size));
+        m_max_readers = max_readers;
+
+        m_reader_slots_storage = allocate_array<unsigned char>(reader_slots_storage_size(max_readers));
+        void * aligned_start   = m_reader_slots_storage;
+        std::size_t space      = reader_slots_storage_size(max_readers);
+        std::align(cache_line_size, max_readers * sizeof(reader_slot), aligned_start, space);
+
+        m_reader_slots = static_cast<reader_slot *>(aligned_start);
+        for (size_type i = 0; i < max_readers; ++i)
+        {
+            ::new(static_cast<void *>(m_reader_slots + i)) reader_slot{};
+        }
+    }
+
+    // Never fails; Waits for a reader to release its slot if all are taken.
+    reader_slot * claim_reader_slot() const
+    {
+        for (;;)
+        {
+            for (size_type i = 0; i < m_max_readers; ++i)
+            {
+                bool expected = false;
+                if (m_reader_slots[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                {
+                    return &m_reader_slots[i];
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    std::uint64_t min_active_epoch() const noexcept
+    {
+        std::uint64_t min_epoch = ~static_cast<std::uint64_t>(0);
+        for (size_type i = 0; i < m_max_readers; ++i)
+        {
+            const std::uint64_t epoch = m_reader_slots[i].epoch.load();
+            if (epoch != 0 && epoch < min_epoch)
+            {
+                min_epoch = epoch;
+            }
+        }
+        return min_epoch;
+    }
+
+    void publish(table * new_table)
+    {
+        table * const old_table = m_table.load(std::memory_order_relaxed);
+        m_table.store(new_table);
+
+        // Readers that announced an epoch up to this one might still see
+        // the old table. Those starting afterwards only see the new one.
+        m_retired.push_back({ old_table, m_epoch.fetch_add(1) });
+        reclaim_retired();
+    }
+
+    void reclaim_retired()
+    {
+        const std::uint64_t min_epoch = min_active_epoch();
+        auto keep = m_retired.begin();
+        for (auto it = m_retired.begin(); it != m_retired.end(); ++it)
+        {
+            if (it->epoch < min_epoch)
+            {
+                free_table(it->table_ptr);
+            }
+            else
+            {
+                *keep++ = *it;
+            }
+        }
+        m_retired.erase(keep, m_retired.end());
+    }
+
+    // Currently published arrays. Swapped atomically when the index chain grows.
+    std::atomic<table *> m_table{ nullptr };
+
+    // Global epoch counter, starting at 1 since a zero reader epoch means inactive.
+    std::atomic<std::uint64_t> m_epoch{ 1 };
+
+    // Writer-only state. Replaced tables wait in m_retired until it is safe to free them.
+    std::vector<retired_table> m_retired{};
+    size_type m_num_items = 0;
+
+    // Reader slots, m_max_readers of them, aligned inside m_reader_slots_storage.
+    unsigned char * m_reader_slots_storage = nullptr;
+    reader_slot *   m_reader_slots         = nullptr;
+    size_type       m_max_readers          = 0;
+};
+
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename concurrent_hash_index<IT, KT, ST, AT>::index_type concurrent_hash_index<IT, KT, ST, AT>::null_index;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename concurrent_hash_index<IT, KT, ST, AT>::size_type concurrent_hash_index<IT, KT, ST, AT>::default_initial_size;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename concurrent_hash_index<IT, KT, ST, AT>::size_type concurrent_hash_index<IT, KT, ST, AT>::default_granularity;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename concurrent_hash_index<IT, KT, ST, AT>::size_type concurrent_hash_index<IT, KT, ST, AT>::default_max_readers;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename concurrent_hash_index<IT, KT, ST, AT>::size_type concurrent_hash_index<IT, KT, ST, AT>::cache_line_size;
+
+//
+// -------------------------------
+//  sharded_hash_index<> template
+// -------------------------------
+//
+// Brief:
+//  Splits the keys over ShardCount independent hash_index<> instances,
+//  each guarded by its own mutex, so that threads inserting, erasing or
+//  looking up keys in different shards never contend. Keys are routed by
+//  their top bits, which hash_index<> itself never uses for the buckets,
+//  so ShardCount must be a power-of-two and the hash function should mix
+//  the high bits well.
+//
+//  The indexes given to insert() and returned by find() are global indexes
+//  into a value collection shared by all shards. Internally each shard
+//  links dense local indexes, mapped to the global ones, so that every
+//  shard's index chain only grows with the number of items in it, and not
+//  with the largest global index. erase() has to walk the key's chain to
+//  find the local index of a global one.
+//
+//  There's no first()/next() interface, since the chain of a shard can only
+//  be walked while holding its lock. Use find() with a predicate instead.
+//
+// Usage example:
+//
+//  sharded_hash_index<16> hash_idx;
+//
+//  // Any thread; Making room for the value in the shared store is up to the caller:
+//  hash_idx.insert(std::hash<std::string>{}(t.name), index);
+//
+//  // Any thread:
+//  const auto index = hash_idx.find(std::hash<std::string>{}(key), key, values, pred);
+//
+template
+<
+    std::size_t ShardCount,
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t,
+    typename Allocator = std::allocator<IndexType>
+>
+class sharded_hash_index final
+{
+public:
+
+    static_assert(ShardCount > 0 && (ShardCount & (ShardCount - 1)) == 0, "ShardCount must be a power-of-2!");
+
+    using shard_index_type = hash_index<IndexType, KeyType, SizeType, Allocator>;
+    using index_type       = typename shard_index_type::index_type;
+    using key_type         = typename shard_index_type::key_type;
+    using size_type        = typename shard_index_type::size_type;
+
+    static constexpr index_type null_index  = shard_index_type::null_index;
+    static constexpr size_type  shard_count = ShardCount;
+
+    //
+    // Snapshot of the state of a single shard. See compute_shard_stats().
+    //
+    struct shard_stats
+    {
+        size_type size;                    // Number of indexes in the shard.
+        size_type hash_buckets_size;       // Same as the hash_index<> queries.
+        size_type index_chain_size;
+        size_type allocated_bytes;         // Includes the local to global index map.
+        size_type distribution_percentage; // hash_index<>::compute_distribution_percentage().
+    };
+
+    //
+    // Constructors:
+    //
+    // Sizes are per shard. Not copyable or movable, due to the mutexes.
+    //
+
+    sharded_hash_index() = default;
+
+    sharded_hash_index(const size_type initial_hash_buckets_size,
+                       const size_type initial_index_chain_size)
+    {
+        for (auto & s : m_shards)
+        {
+            s.hash_idx = shard_index_type{ initial_hash_buckets_size, initial_index_chain_size };
+        }
+    }
+
+    sharded_hash_index(const sharded_hash_index &) = delete;
+    sharded_hash_index & operator = (const sharded_hash_index &) = delete;
+
+    //
+    // Thread-safe interface:
+    //
+
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        const shard & s = m_shards[shard_of(key)];
+        std::lock_guard<std::mutex> lock{ s.mutex };
+
+        for (index_type i = s.hash_idx.first(key); i != null_index; i = s.hash_idx.next(i))
+        {
+            const index_type global_index = s.local_to_global[i];
+            const auto & item = collection[global_index];
+            if (pred(needle, item))
+            {
+                return global_index;
+            }
+        }
+        return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(key, needle, collection, std::equal_to<ValueType>{});
+    }
+
+    void insert(const key_type key, const index_type global_index)
+    {
+        HASH_INDEX_ASSERT(global_index != null_index);
+
+        shard & s = m_shards[shard_of(key)];
+        std::lock_guard<std::mutex> lock{ s.mutex };
+
+        index_type local_index;
+        if (!s.free_locals.empty())
+        {
+            local_index = s.free_locals.back();
+            s.free_locals.pop_back();
+            s.local_to_global[local_index] = global_index;
+        }
+        else
+        {
+            local_index = static_cast<index_type>(s.local_to_global.size());
+            s.local_to_global.push_back(global_index);
+        }
+
+        s.hash_idx.insert(key, local_index);
+    }
+
+    void erase(const key_type key, const index_type global_index)
+    {
+        shard & s = m_shards[shard_of(key)];
+        std::lock_guard<std::mutex> lock{ s.mutex };
+
+        for (index_type i = s.hash_idx.first(key); i != null_index; i = s.hash_idx.next(i))
+        {
+            if (s.local_to_global[i] == global_index)
+            {
+                s.hash_idx.erase(key, i);
+                s.local_to_global[i] = null_index;
+                s.free_locals.push_back(i);
+                return;
+            }
+        }
+    }
+
+    void clear()
+    {
+        for (auto & s : m_shards)
+        {
+            std::lock_guard<std::mutex> lock{ s.mutex };
+            s.hash_idx.clear();
+            s.local_to_global.clear();
+            s.free_locals.clear();
+        }
+    }
+
+    //
+    // Queries:
+    //
+    // These lock each shard in turn, so the totals are not
+    // an atomic snapshot if other threads are writing.
+    //
+
+    static size_type shard_of(const key_type key) noexcept
+    {
+        using unsigned_key_type = typename std::make_unsigned<key_type>::type;
+        return static_cast<size_type>(static_cast<unsigned_key_type>(key) >> shard_shift) & (ShardCount - 1);
+    }
+
+    size_type size() const
+    {
+        size_type total = 0;
+        for (const auto & s : m_shards)
+        {
+            std::lock_guard<std::mutex> lock{ s.mutex };
+            total += s.hash_idx.size();
+        }
+        return total;
+    }
+
+    size_type allocated_bytes() const
+    {
+        size_type total = 0;
+        for (size_type i = 0; i < shard_count; ++i)
+        {
+            total += compute_shard_stats(i).allocated_bytes;
+        }
+        return total;
+    }
+
+    shard_stats compute_shard_stats(const size_type shard_index) const
+    {
+        HASH_INDEX_ASSERT(shard_index < shard_count);
+
+        const shard & s = m_shards[shard_index];
+        std::lock_guard<std::mutex> lock{ s.mutex };
+
+        shard_stats stats;
+        stats.size                    = s.hash_idx.size();
+        stats.hash_buckets_size       = s.hash_idx.hash_buckets_size();
+        stats.index_chain_size        = s.hash_idx.index_chain_size();
+        stats.allocated_bytes         = s.hash_idx.allocated_bytes() +
+                                        static_cast<size_type>((s.local_to_global.capacity() + s.free_locals.capacity()) * sizeof(index_type));
+        stats.distribution_percentage = s.hash_idx.compute_distribution_percentage();
+        return stats;
+    }
+
+    // Size of the largest shard over the average shard size. 1 means the
+    // keys are perfectly balanced, ShardCount means they all went to one
+    // shard. Returns 1 for an empty index.
+    float compute_shard_imbalance() const
+    {
+        size_type total   = 0;
+        size_type largest = 0;
+        for (size_type i = 0; i < shard_count; ++i)
+        {
+            const size_type n = compute_shard_stats(i).size;
+            total  += n;
+            largest = std::max(largest, n);
+        }
+        if (total == 0)
+        {
+            return 1.0f;
+        }
+        return static_cast<float>(largest) * static_cast<float>(ShardCount) / static_cast<float>(total);
+    }
+
+private:
+
+    static constexpr int log2_of(const std::size_t num) noexcept
+    {
+        return (num <= 1) ? 0 : 1 + log2_of(num / 2);
+    }
+
+    // Shards are routed by the top log2(ShardCount) bits of the key.
+    // The modulo makes it a shift by zero instead of by the full key
+    // width for a single shard, which is then masked out to zero anyway.
+    static constexpr int key_bits    = static_cast<int>(sizeof(key_type) * 8);
+    static constexpr int shard_shift = (key_bits - log2_of(ShardCount)) % key_bits;
+
+    using index_vector = std::vector<index_type, typename std::allocator_traits<Allocator>::template rebind_alloc<index_type>>;
+
+    //
+    // Each shard in its own cache line(s), so that the mutexes
+    // of neighboring shards don't suffer from false sharing.
+    //
+    struct alignas(64) shard
+    {
+        mutable std::mutex mutex{};
+        shard_index_type   hash_idx{};
+        index_vector       local_to_global{}; // Local index => global index, null_index if free.
+        index_vector       free_locals{};     // Local indexes available for reuse.
+    };
+
+    shard m_shards[ShardCount];
+};
+
+template<std::size_t SC, typename IT, typename KT, typename ST, typename AT>
+constexpr typename sharded_hash_index<SC, IT, KT, ST, AT>::index_type sharded_hash_index<SC, IT, KT, ST, AT>::null_index;
+template<std::size_t SC, typename IT, typename KT, typename ST, typename AT>
+constexpr typename sharded_hash_index<SC, IT, KT, ST, AT>::size_type sharded_hash_index<SC, IT, KT, ST, AT>::shard_count;
+
+//
+// ---------------------------
+//  cow_hash_index<> template
+// ---------------------------
+//
+// Brief:
+//  hash_index<> whose copies share their arrays until one of them writes,
+//  meant for handing immutable snapshots of a table to other threads every
+//  frame or tick. Copying is O(1): the copy just takes a reference to the
+//  same table. The hash buckets and index chain are split in chunks of
+//  chunk_size entries (a 4 KB page of indexes), each reference counted on
+//  its own, so the first write after a copy only duplicates the chunk list
+//  and the one or two chunks the write actually lands in, not whole arrays.
+//  Growing the index chain appends new chunks without copying the old ones.
+//
+//  Reference counts are atomic, so copies can be read and destroyed on other
+//  threads while the original keeps being modified. A single instance is still
+//  not thread-safe, so each thread must have its own copy. The entries being
+//  read by a copy are never written in place, since every write goes to
+//  chunks that no other copy references.
+//
+//  Lookups pay an extra indirection through the chunk list per entry, and
+//  the bucket count is fixed at construction, like concurrent_hash_index<>.
+//  Template arguments have the same meaning of hash_index<>. Key retention,
+//  fingerprints, rehashing and the other optional hash_index<> features are
+//  not available.
+//
+// Usage example:
+//
+//  cow_hash_index<> hash_idx;
+//  hash_idx.insert(std::hash<std::string>{}(t.name), index);
+//
+//  // Every tick, O(1) regardless of the table size:
+//  worker.post([snapshot = hash_idx.snapshot()]() { ... snapshot.find(key, name, values) ... });
+//
+template
+<
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t,
+    typename Allocator = std::allocator<IndexType>
+>
+class cow_hash_index final
+    : private Allocator // Take advantage of EBO for the default empty std::allocator
+{
+public:
+
+    static_assert(std::is_integral<IndexType>::value, "Integer type required for IndexType!");
+    static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
+    static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
+
+    using index_type = IndexType;
+    using key_type   = KeyType;
+    using size_type  = SizeType;
+
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+
+    // Entries per chunk, the unit of sharing. Also the index chain granularity.
+    static constexpr size_type chunk_size = 4096 / sizeof(index_type);
+
+    static constexpr size_type default_initial_size = 1024;
+
+    //
+    // Constructors-destructor / copy-assignment:
+    //
+    // Arrays are only allocated by the first insert(), like hash_index<>.
+    // Copies share the table of the source, see snapshot().
+    //
+
+    cow_hash_index()
+    {
+        internal_init(default_initial_size, default_initial_size);
+    }
+
+    cow_hash_index(const size_type initial_hash_buckets_size,
+                   const size_type initial_index_chain_size)
+    {
+        internal_init(initial_hash_buckets_size, initial_index_chain_size);
+    }
+
+    ~cow_hash_index()
+    {
+        clear_and_free();
+    }
+
+    cow_hash_index(const cow_hash_index & other)
+        : Allocator{ static_cast<const Allocator &>(other) }
+        , m_table{ other.m_table }
+        , m_hash_buckets_size{ other.m_hash_buckets_size }
+        , m_index_chain_size{ other.m_index_chain_size }
+        , m_hash_mask{ other.m_hash_mask }
+        , m_num_items{ other.m_num_items }
+    {
+        if (m_table != nullptr)
+        {
+            // Relaxed is enough, since other holds a reference for the duration.
+            m_table->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    cow_hash_index & operator = (cow_hash_index other)
+    {
+        swap(*this, other);
+        return *this;
+    }
+
+    cow_hash_index(cow_hash_index && other)
+        : cow_hash_index{}
+    {
+        swap(*this, other);
+    }
+
+    friend void swap(cow_hash_index & lhs, cow_hash_index & rhs) noexcept
+    {
+        using std::swap;
+        swap(lhs.m_table,             rhs.m_table);
+        swap(lhs.m_hash_buckets_size, rhs.m_hash_buckets_size);
+        swap(lhs.m_index_chain_size,  rhs.m_index_chain_size);
+        swap(lhs.m_hash_mask,         rhs.m_hash_mask);
+        swap(lhs.m_num_items,         rhs.m_num_items);
+    }
+
+    // Same as a copy, spelled out. Never deep copies any entries.
+    cow_hash_index snapshot() const
+    {
+        return *this;
+    }
+
+    //
+    // Lookup:
+    //
+
+    index_type first(const key_type key) const
+    {
+        if (m_table == nullptr)
+        {
+            return null_index;
+        }
+        return entry(bucket_chunk(static_cast<size_type>(key) & m_hash_mask), static_cast<size_type>(key) & m_hash_mask);
+    }
+
+    index_type next(const index_type index) const
+    {
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
+        if (m_table == nullptr)
+        {
+            return null_index;
+        }
+        return entry(chain_chunk(static_cast<size_type>(index)), static_cast<size_type>(index));
+    }
+
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        for (index_type i = first(key); i != null_index; i = next(i))
+        {
+            const auto & item = collection[i];
+            if (pred(needle, item))
+            {
+                return i;
+            }
+        }
+        return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(key, needle, collection, std::equal_to<ValueType>{});
+    }
+
+    //
+    // Insertion / removal:
+    //
+    // Writes duplicate the chunks they touch if those are shared with a copy.
+    //
+
+    void insert(const key_type key, const index_type index)
+    {
+        HASH_INDEX_ASSERT(index != null_index);
+
+        if (!is_allocated())
+        {
+            const size_type index_chain_size = ((static_cast<size_type>(index) >= m_index_chain_size) ?
+                                                index + 1 : m_index_chain_size);
+            internal_allocate(index_chain_size);
+        }
+        else if (static_cast<size_type>(index) >= m_index_chain_size)
+        {
+            resize_index_chain(index + 1);
+        }
+
+        const size_type k = static_cast<size_type>(key) & m_hash_mask;
+        writable_entry(chain_chunk(static_cast<size_type>(index)), static_cast<size_type>(index)) = entry(bucket_chunk(k), k);
+        writable_entry(bucket_chunk(k), k) = index;
+        ++m_num_items;
+    }
+
+    void erase(const key_type key, const index_type index)
+    {
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
+
+        if (!is_allocated())
+        {
+            return;
+        }
+
+        const size_type  k    = static_cast<size_type>(key) & m_hash_mask;
+        const index_type head = entry(bucket_chunk(k), k);
+        const index_type nxt  = next(index);
+
+        if (head == index)
+        {
+            writable_entry(bucket_chunk(k), k) = nxt;
+            --m_num_items;
+        }
+        else
+        {
+            for (index_type i = head; i != null_index; i = next(i))
+            {
+                if (next(i) == index)
+                {
+                    writable_entry(chain_chunk(static_cast<size_type>(i)), static_cast<size_type>(i)) = nxt;
+                    --m_num_items;
+                    break;
+                }
+            }
+        }
+
+        if (nxt != null_index)
+        {
+            writable_entry(chain_chunk(static_cast<size_type>(index)), static_cast<size_type>(index)) = null_index;
+        }
+    }
+
+    //
+    // Memory management:
+    //
+
+    void clear()
+    {
+        if (is_allocated())
+        {
+            // Shared bucket chunks are just dropped in favor of new ones.
+            make_table_unique();
+            for (size_type c = 0; c < m_table->bucket_chunks; ++c)
+            {
+                chunk *& ch = m_table->chunks[c];
+                if (ch->refs.load(std::memory_order_acquire) != 1)
+                {
+                    release_chunk(ch);
+                    ch = allocate_chunk();
+                }
+                std::fill(ch->entries, ch->entries + chunk_size, null_index);
+            }
+        }
+        m_num_items = 0;
+    }
+
+    void clear_and_free()
+    {
+        if (is_allocated())
+        {
+            release_table(m_table);
+        }
+        m_table     = nullptr;
+        m_num_items = 0;
+    }
+
+    // Grows the index chain to a multiple of chunk_size entries. Only the chunk
+    // list is reallocated; Existing chunks are kept and stay shared. Never shrinks.
+    void resize_index_chain(const size_type new_index_chain_size)
+    {
+        if (new_index_chain_size <= m_index_chain_size)
+        {
+            return;
+        }
+
+        const size_type new_chain_chunks = chunks_for(new_index_chain_size);
+        if (!is_allocated()) // Not allocated yet; Defer.
+        {
+            m_index_chain_size = new_chain_chunks * chunk_size;
+            return;
+        }
+
+        table * const old_table = m_table;
+        table * const new_table = allocate_table(old_table->bucket_chunks, new_chain_chunks);
+        const size_type old_count = old_table->bucket_chunks + old_table->chain_chunks;
+        const size_type new_count = new_table->bucket_chunks + new_table->chain_chunks;
+
+        std::copy(old_table->chunks, old_table->chunks + old_count, new_table->chunks);
+        for (size_type c = old_count; c < new_count; ++c)
+        {
+            new_table->chunks[c] = allocate_chunk();
+            std::fill(new_table->chunks[c]->entries, new_table->chunks[c]->entries + chunk_size, null_index);
+        }
+
+        if (old_table->refs.load(std::memory_order_acquire) == 1)
+        {
+            // The chunks move over to the new table with their references.
+            free_table(old_table);
+        }
+        else
+        {
+            for (size_type c = 0; c < old_count; ++c)
+            {
+                old_table->chunks[c]->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+            release_table(old_table);
+        }
+
+        m_table            = new_table;
+        m_index_chain_size = new_chain_chunks * chunk_size;
+    }
+
+    //
+    // Queries:
+    //
+
+    // Bytes of the table referenced by this instance, including what it shares with copies.
+    size_type allocated_bytes() const noexcept
+    {
+        if (!is_allocated())
+        {
+            return 0;
+        }
+        return chunk_count() * sizeof(chunk) + chunk_count() * sizeof(chunk *) + sizeof(table);
+    }
+
+    size_type chunk_count() const noexcept
+    {
+        return is_allocated() ? (m_table->bucket_chunks + m_table->chain_chunks) : 0;
+    }
+
+    // Chunks also referenced by other copies, which the next write to them would
+    // duplicate. Only a hint if copies are being modified or destroyed concurrently.
+    size_type shared_chunks() const noexcept
+    {
+        if (!is_allocated())
+        {
+            return 0;
+        }
+        if (m_table->refs.load(std::memory_order_relaxed) != 1)
+        {
+            return chunk_count();
+        }
+
+        size_type shared = 0;
+        for (size_type c = 0; c < chunk_count(); ++c)
+        {
+            shared += (m_table->chunks[c]->refs.load(std::memory_order_relaxed) != 1) ? 1 : 0;
+        }
+        return shared;
+    }
+
+    size_type hash_buckets_size() const noexcept
+    {
+        return m_hash_buckets_size;
+    }
+
+    size_type index_chain_size() const noexcept
+    {
+        return m_index_chain_size;
+    }
+
+    size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    float load_factor() const noexcept
+    {
+        return static_cast<float>(m_num_items) / static_cast<float>(m_hash_buckets_size);
+    }
+
+    bool is_allocated() const noexcept
+    {
+        return m_table != nullptr;
+    }
+
+    //
+    // Deep comparison operators:
+    //
+    // Chunks shared by both sides compare equal without looking at the entries.
+    //
+
+    bool operator == (const cow_hash_index & other) const noexcept
+    {
+        if (this == &other || (m_table == other.m_table && m_num_items == other.m_num_items))
+        {
+            return true;
+        }
+
+        if (m_hash_buckets_size != other.m_hash_buckets_size) { return false; }
+        if (m_index_chain_size  != other.m_index_chain_size ) { return false; }
+        if (m_num_items         != other.m_num_items        ) { return false; }
+        if (is_allocated()      != other.is_allocated()     ) { return false; }
+        if (!is_allocated()) { return true; }
+
+        // Same sizes imply the same number of chunks.
+        for (size_type c = 0; c < chunk_count(); ++c)
+        {
+            const chunk * const lhs = m_table->chunks[c];
+            const chunk * const rhs = other.m_table->chunks[c];
+            if (lhs != rhs && !std::equal(lhs->entries, lhs->entries + chunk_size, rhs->entries))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator != (const cow_hash_index & other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+private:
+
+    //
+    // A chunk is referenced by every table listing it, a table by every
+    // cow_hash_index sharing it. Both are freed when the count drops to zero.
+    //
+    struct chunk
+    {
+        std::atomic<std::size_t> refs;
+        index_type               entries[chunk_size];
+
+        chunk() noexcept : refs{ 1 } { } // Entries are filled by the owner.
+    };
+
+    //
+    // List of chunks: the hash buckets first, followed by the index chain.
+    // Buckets always take at least one whole chunk, even if fewer than chunk_size.
+    //
+    struct table
+    {
+        std::atomic<std::size_t> refs;
+        chunk **                 chunks;
+        size_type                bucket_chunks;
+        size_type                chain_chunks;
+
+        table(chunk ** c, const size_type b, const size_type n) noexcept
+            : refs{ 1 }, chunks{ c }, bucket_chunks{ b }, chain_chunks{ n } { }
+    };
+
+    static size_type chunks_for(const size_type count) noexcept
+    {
+        return (count + chunk_size - 1) / chunk_size;
+    }
+
+    static size_type bucket_chunk(const size_type k) noexcept
+    {
+        return k / chunk_size;
+    }
+
+    size_type chain_chunk(const size_type index) const noexcept
+    {
+        return m_table->bucket_chunks + index / chunk_size;
+    }
+
+    index_type entry(const size_type chunk_index, const size_type i) const noexcept
+    {
+        return m_table->chunks[chunk_index]->entries[i % chunk_size];
+    }
+
+    // Entry i of the chunk, duplicating the chunk (and table) first if shared.
+    index_type & writable_entry(const size_type chunk_index, const size_type i)
+    {
+        make_table_unique();
+
+        chunk *& ch = m_table->chunks[chunk_index];
+        if (ch->refs.load(std::memory_order_acquire) != 1)
+        {
+            chunk * const copy = allocate_chunk();
+            std::copy(ch->entries, ch->entries + chunk_size, copy->entries);
+            release_chunk(ch);
+            ch = copy;
+        }
+        return ch->entries[i % chunk_size];
+    }
+
+    // Replaces a table shared with copies by a private one listing the same chunks.
+    void make_table_unique()
+    {
+        // Acquire pairs with release_table() in copies, so their reads of
+        // any chunk we are about to write are done before we write it.
+        if (m_table->refs.load(std::memory_order_acquire) == 1)
+        {
+            return;
+        }
+
+        table * const old_table = m_table;
+        table * const new_table = allocate_table(old_table->bucket_chunks, old_table->chain_chunks);
+        for (size_type c = 0; c < chunk_count(); ++c)
+        {
+            new_table->chunks[c] = old_table->chunks[c];
+            new_table->chunks[c]->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        release_table(old_table);
+        m_table = new_table;
+    }
+
+    template<typename T>
+    T * allocate_array(const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        return alloc.allocate(count);
+    }
+
+    template<typename T>
+    void deallocate_array(T * array, const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        alloc.deallocate(array, count);
+    }
+
+    chunk * allocate_chunk()
+    {
+        return ::new(static_cast<void *>(allocate_array<chunk>(1))) chunk{};
+    }
+
+    void release_chunk(chunk * ch)
+    {
+        // std::atomic of an integer is trivially destructible, no need to run destructors.
+        if (ch->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            deallocate_array(ch, 1);
+        }
+    }
+
+    // New table with a reference count of one and an uninitialized chunk list.
+    table * allocate_table(const size_type bucket_chunks, const size_type chain_chunks)
+    {
+        chunk ** const chunks = allocate_array<chunk *>(bucket_chunks + chain_chunks);
+        return ::new(static_cast<void *>(allocate_array<table>(1))) table{ chunks, bucket_chunks, chain_chunks };
+    }
+
+    // Frees the table itself, without touching the chunks it lists.
+    void free_table(table * t)
+    {
+        deallocate_array(t->chunks, t->bucket_chunks + t->chain_chunks);
+        deallocate_array(t, 1);
+    }
+
+    void release_table(table * t)
+    {
+        if (t->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            for (size_type c = 0; c < t->bucket_chunks + t->chain_chunks; ++c)
+            {
+                release_chunk(t->chunks[c]);
+            }
+            free_table(t);
+        }
+    }
+
+    void internal_init(const size_type initial_hash_buckets_size,
+                       const size_type initial_index_chain_size)
+    {
+        HASH_INDEX_ASSERT(initial_hash_buckets_size > 0 && (initial_hash_buckets_size & (initial_hash_buckets_size - 1)) == 0 &&
+                          "Size of hash_index buckets array must be a power-of-2!");
+
+        m_table             = nullptr;
+        m_hash_buckets_size = initial_hash_buckets_size;
+        m_index_chain_size  = chunks_for(initial_index_chain_size) * chunk_size;
+        m_hash_mask         = m_hash_buckets_size - 1;
+        m_num_items         = 0;
+    }
+
+    void internal_allocate(const size_type new_index_chain_size)
+    {
+        HASH_INDEX_ASSERT(!is_allocated());
+
+        m_table = allocate_table(chunks_for(m_hash_buckets_size), chunks_for(new_index_chain_size));
+        for (size_type c = 0; c < chunk_count(); ++c)
+        {
+            m_table->chunks[c] = allocate_chunk();
+            std::fill(m_table->chunks[c]->entries, m_table->chunks[c]->entries + chunk_size, null_index);
+        }
+        m_index_chain_size = m_table->chain_chunks * chunk_size;
+    }
+
+    // Null until the first insert(). Possibly shared with copies.
+    table *   m_table             = nullptr;
+    size_type m_hash_buckets_size = 0;
+    size_type m_index_chain_size  = 0; // Always a multiple of chunk_size.
+    size_type m_hash_mask         = 0;
+    size_type m_num_items         = 0;
+};
+
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename cow_hash_index<IT, KT, ST, AT>::index_type cow_hash_index<IT, KT, ST, AT>::null_index;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename cow_hash_index<IT, KT, ST, AT>::size_type cow_hash_index<IT, KT, ST, AT>::chunk_size;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename cow_hash_index<IT, KT, ST, AT>::size_type cow_hash_index<IT, KT, ST, AT>::default_initial_size;
+
+#endif // CONCURRENT_HASH_INDEX_HPP
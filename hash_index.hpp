@@ -27,10 +27,62 @@
     #include <type_traits>
     #include <functional>
     #include <algorithm>
+    #include <array>
+    #include <limits>
+    #include <cstdint>
+    #include <cstring>
+    #include <cstddef>
+    #include <iterator>
     #include <memory>
+    #include <string>
     #include <vector>
 #endif // HASH_INDEX_NO_STD_INCLUDES
 
+// Define HASH_INDEX_ENABLE_PARALLEL before including this file to get hash_index<>::build_parallel()
+// and rehash_parallel(). Off by default, so that single-threaded users don't pull in <thread>.
+#ifdef HASH_INDEX_ENABLE_PARALLEL
+    #ifndef HASH_INDEX_NO_STD_INCLUDES
+        #include <thread>
+    #endif // HASH_INDEX_NO_STD_INCLUDES
+#endif // HASH_INDEX_ENABLE_PARALLEL
+
+// std::string_view overload of hash_index_hasher, if the library has it (C++17).
+#if (__cplusplus >= 201703L) || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+    #if defined(__has_include)
+        #if __has_include(<string_view>)
+            #ifndef HASH_INDEX_NO_STD_INCLUDES
+                #include <string_view>
+            #endif // HASH_INDEX_NO_STD_INCLUDES
+            #define HASH_INDEX_STRING_VIEW 1
+        #endif // __has_include(<string_view>)
+    #endif // __has_include
+#endif // C++17
+
+// std::pmr support for pmr_hash_index<>, if the library has it (C++17).
+#if !defined(HASH_INDEX_NO_PMR) && ((__cplusplus >= 201703L) || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+    #if defined(__has_include)
+        #if __has_include(<memory_resource>)
+            #ifndef HASH_INDEX_NO_STD_INCLUDES
+                #include <memory_resource>
+            #endif // HASH_INDEX_NO_STD_INCLUDES
+            #define HASH_INDEX_PMR 1
+        #endif // __has_include(<memory_resource>)
+    #endif // __has_include
+#endif // HASH_INDEX_NO_PMR
+
+// Coroutine lookups with hash_index<>::find_async(), if the compiler and library have them (C++20).
+#if !defined(HASH_INDEX_NO_COROUTINES) && defined(__cpp_impl_coroutine)
+    #if defined(__has_include)
+        #if __has_include(<coroutine>)
+            #ifndef HASH_INDEX_NO_STD_INCLUDES
+                #include <coroutine>
+                #include <exception>
+            #endif // HASH_INDEX_NO_STD_INCLUDES
+            #define HASH_INDEX_COROUTINES 1
+        #endif // __has_include(<coroutine>)
+    #endif // __has_include
+#endif // HASH_INDEX_NO_COROUTINES
+
 // Hook to allow providing a custom assert() before including this file.
 #ifndef HASH_INDEX_ASSERT
     #ifndef HASH_INDEX_NO_STD_INCLUDES
@@ -39,82 +91,6391 @@
     #define HASH_INDEX_ASSERT assert
 #endif // HASH_INDEX_ASSERT
 
+// Hook to allow providing a custom memory prefetch hint before including this file.
+// Used by the batched lookups. Must not fault on any address, like the builtins below.
+#ifndef HASH_INDEX_PREFETCH
+    #if defined(__GNUC__) || defined(__clang__)
+        #define HASH_INDEX_PREFETCH(addr) __builtin_prefetch(static_cast<const void *>(addr))
+    #elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        #include <xmmintrin.h>
+        #define HASH_INDEX_PREFETCH(addr) _mm_prefetch(reinterpret_cast<const char *>(addr), _MM_HINT_T0)
+    #else
+        #define HASH_INDEX_PREFETCH(addr) ((void)(addr))
+    #endif
+#endif // HASH_INDEX_PREFETCH
+
+// Define HASH_INDEX_ENABLE_COUNTERS before including this file to collect the
+// hash_index<>::lookup_counters. Must be the same for every translation unit,
+// since it changes the class layout. When undefined, counting compiles to nothing.
+#ifdef HASH_INDEX_ENABLE_COUNTERS
+    #define HASH_INDEX_COUNT(stmt) stmt
+#else // !HASH_INDEX_ENABLE_COUNTERS
+    #define HASH_INDEX_COUNT(stmt)
+#endif // HASH_INDEX_ENABLE_COUNTERS
+
+// Methods that can only be constexpr with the relaxed rules of C++17 (mutating std::array, loops).
+#if (__cplusplus >= 201703L) || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+    #define HASH_INDEX_CONSTEXPR17 constexpr
+#else // Pre C++17
+    #define HASH_INDEX_CONSTEXPR17
+#endif // C++17
+
+// SIMD support for group_hash_index<>. Define HASH_INDEX_NO_SIMD to force the portable code path.
+#ifndef HASH_INDEX_NO_SIMD
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #include <emmintrin.h>
+        #define HASH_INDEX_SSE2 1
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        #include <arm_neon.h>
+        #define HASH_INDEX_NEON 1
+    #endif
+#endif // HASH_INDEX_NO_SIMD
+
+//
+// -----------------------------
+//  hash_index_file_header
+// -----------------------------
+//
+// Brief:
+//  Stable binary format written by hash_index<>::serialize() and read
+//  back by hash_index<>::deserialize() or used in place by hash_index_view<>.
+//  A serialized table is this header followed by the hash buckets, the index
+//  chain and, if present, the retained keys and the fingerprints, each of
+//  those sections starting at an offset multiple of section_alignment.
+//
+//  Tables written by frozen_hash_index<>::serialize() use layout_perfect
+//  instead, reusing the same fields with these meanings:
+//   - hash_buckets_size : Number of pilots, 32-bit each, at hash_buckets_offset.
+//   - index_chain_size  : Number of slots, one per distinct key.
+//   - hash_mask         : Seed of the perfect hash function.
+//   - num_items         : Number of indexes, at index_chain_offset in slot order.
+//   - hash_keys_offset  : Start of each slot's indexes, index_chain_size + 1 of them.
+//                         Only present with flag_multi_index, otherwise slot i has index i.
+//   - fingerprints      : One per slot, always present.
+//  granularity, growth_factor and max_load_factor are zero.
+//
+//  Every field and array is stored in the native byte order of the writer.
+//  The arrays are meant to be used straight from a memory-mapped file, so
+//  they are never byte-swapped. Instead a reader on a machine of different
+//  endianness sees a swapped byte_order mark and rejects the file, same as
+//  it does when the index or key widths don't match its own types.
+//
+struct hash_index_file_header
+{
+    enum : std::uint32_t
+    {
+        current_version   = 1,
+        byte_order_mark   = 0x0102,
+        section_alignment = 64,
+        layout_chained    = 0,
+        layout_perfect    = 1,
+        flag_hash_keys    = 1 << 0,
+        flag_fingerprints = 1 << 1,
+        flag_prev_chain   = 1 << 2, // Back links are rebuilt on load, so no section for these.
+        flag_multi_index  = 1 << 3  // layout_perfect only: Some keys have several indexes.
+    };
+
+    char          magic[8];          // "HASHIDX", null terminated.
+    std::uint32_t version;           // current_version.
+    std::uint16_t byte_order;        // byte_order_mark, as written by the producer.
+    std::uint8_t  index_width;       // sizeof(index_type)
+    std::uint8_t  key_width;         // sizeof(key_type)
+    std::uint8_t  layout;            // layout_chained or layout_perfect.
+    std::uint8_t  flags;             // flag_hash_keys | flag_fingerprints | flag_prev_chain
+    std::uint16_t reserved0;
+    std::uint32_t growth_factor;
+    float         max_load_factor;
+    std::uint32_t reserved1;
+    std::uint64_t hash_buckets_size;
+    std::uint64_t index_chain_size;
+    std::uint64_t hash_mask;
+    std::uint64_t num_items;
+    std::uint64_t granularity;
+    std::uint64_t hash_buckets_offset; // All offsets are from the start of the header.
+    std::uint64_t index_chain_offset;
+    std::uint64_t hash_keys_offset;    // Zero if the section is absent.
+    std::uint64_t fingerprints_offset; // Zero if the section is absent.
+    std::uint64_t total_size;
+
+    static std::uint64_t align_section(const std::uint64_t offset) noexcept
+    {
+        return (offset + section_alignment - 1) & ~static_cast<std::uint64_t>(section_alignment - 1);
+    }
+
+    // Fills in the section offsets and the total size from the other
+    // fields. Readers recompute these to reject inconsistent headers.
+    void compute_layout() noexcept
+    {
+        std::uint64_t offset = align_section(sizeof(hash_index_file_header));
+
+        if (layout == layout_perfect)
+        {
+            hash_buckets_offset = offset;
+            offset = align_section(offset + hash_buckets_size * sizeof(std::uint32_t));
+
+            index_chain_offset = offset;
+            offset += num_items * index_width;
+
+            hash_keys_offset = 0;
+            if (flags & flag_multi_index)
+            {
+                offset = hash_keys_offset = align_section(offset);
+                offset += (index_chain_size + 1) * index_width;
+            }
+
+            offset = fingerprints_offset = align_section(offset);
+            total_size = offset + index_chain_size;
+            return;
+        }
+
+        hash_buckets_offset = offset;
+        offset = align_section(offset + hash_buckets_size * index_width);
+
+        index_chain_offset = offset;
+        offset += index_chain_size * index_width;
+
+        hash_keys_offset = 0;
+        if (flags & flag_hash_keys)
+        {
+            offset = hash_keys_offset = align_section(offset);
+            offset += index_chain_size * key_width;
+        }
+
+        fingerprints_offset = 0;
+        if (flags & flag_fingerprints)
+        {
+            offset = fingerprints_offset = align_section(offset);
+            offset += index_chain_size;
+        }
+
+        total_size = offset;
+    }
+
+    // Copies the header from the start of data[0..data_size-1] into 'out' and checks that it
+    // describes a well-formed table of the expected layout for the given index and key widths,
+    // with every section in bounds. The array contents are not looked at; see verify_chains().
+    static bool read(const void * data, const std::uint64_t data_size, const std::uint8_t index_width,
+                     const std::uint8_t key_width, hash_index_file_header & out,
+                     const std::uint8_t expected_layout = layout_chained) noexcept
+    {
+        if (data == nullptr || data_size < sizeof(hash_index_file_header))
+        {
+            return false;
+        }
+        std::memcpy(&out, data, sizeof(hash_index_file_header));
+
+        if (std::memcmp(out.magic, "HASHIDX", sizeof(out.magic)) != 0 ||
+            out.version     != current_version ||
+            out.byte_order  != byte_order_mark ||
+            out.index_width != index_width     ||
+            out.key_width   != key_width       ||
+            out.layout      != expected_layout)
+        {
+            return false;
+        }
+
+        // Sizes are capped well below overflowing the layout arithmetic.
+        const std::uint64_t max_count = static_cast<std::uint64_t>(1) << 48;
+        const std::uint64_t b = out.hash_buckets_size;
+        if (out.layout == layout_perfect)
+        {
+            // Pilots, slots and indexes: Either all zero or 0 < pilots <= slots <= indexes.
+            const bool multi = (out.flags & flag_multi_index) != 0;
+            if ((out.flags & ~static_cast<std::uint32_t>(flag_multi_index)) != flag_fingerprints ||
+                out.num_items > max_count || out.index_chain_size > out.num_items || b > out.index_chain_size ||
+                (b == 0) != (out.index_chain_size == 0) || multi != (out.index_chain_size != out.num_items) ||
+                out.granularity != 0 || out.growth_factor != 0 || out.max_load_factor != 0.0f)
+            {
+                return false;
+            }
+        }
+        else if ((out.flags & ~(flag_hash_keys | flag_fingerprints | flag_prev_chain)) != 0 ||
+                 b == 0 || b > max_count || (b & (b - 1)) != 0 || out.hash_mask != b - 1 ||
+                 out.index_chain_size > max_count || out.num_items > out.index_chain_size ||
+                 out.granularity == 0 || out.growth_factor < 2 || !(out.max_load_factor >= 0.0f) ||
+                 (out.max_load_factor > 0.0f && !(out.flags & flag_hash_keys)))
+        {
+            return false;
+        }
+
+        hash_index_file_header expected = out;
+        expected.compute_layout();
+        return expected.hash_buckets_offset == out.hash_buckets_offset &&
+               expected.index_chain_offset  == out.index_chain_offset  &&
+               expected.hash_keys_offset    == out.hash_keys_offset    &&
+               expected.fingerprints_offset == out.fingerprints_offset &&
+               expected.total_size          == out.total_size          &&
+               out.total_size <= data_size;
+    }
+
+    // Walks every chain checking that all indexes fit the index chain, that there
+    // are no cycles, and that the number of linked indexes matches num_items.
+    // O(hash_buckets_size + num_items). Needed before trusting a file from elsewhere.
+    template<typename IndexType>
+    static bool verify_chains(const IndexType * hash_buckets, const IndexType * index_chain,
+                              const hash_index_file_header & header) noexcept
+    {
+        const IndexType null_index = ~static_cast<IndexType>(0);
+        std::uint64_t linked = 0;
+
+        for (std::uint64_t b = 0; b < header.hash_buckets_size; ++b)
+        {
+            for (IndexType i = hash_buckets[b]; i != null_index; i = index_chain[i])
+            {
+                // A negative signed index converts to a huge value and also fails here.
+                if (static_cast<std::uint64_t>(i) >= header.index_chain_size || ++linked > header.num_items)
+                {
+                    return false;
+                }
+            }
+        }
+        return linked == header.num_items;
+    }
+};
+
+//
+// -----------------------------
+//  hash_index_hasher
+// -----------------------------
+//
+// Brief:
+//  Fast hash function for the keys of a hash_index<>, used by the find_hashed(),
+//  insert_hashed() and erase_hashed() helpers, or directly in place of std::hash.
+//  hash_index<> buckets are selected by the low bits of the key, so a hash that
+//  leaves those poorly mixed piles the items in a few long chains. std::hash is
+//  the identity for integers on most libraries, which does exactly that for keys
+//  that are multiples of a power of two, and its string hash is fairly slow.
+//
+//  Strings are hashed with a wyhash-style function, reading 8 or 16 bytes per
+//  step and folding each 128-bit product, so every output bit depends on every
+//  input byte. Integers go through the cheap mix() finalizer instead. Results
+//  are the same within a process but not across platforms of different
+//  endianness, so don't persist them where that matters.
+//
+//  Usage:
+//
+//  hash_index_hasher hasher;
+//  hash_idx.insert(hasher(thing.name), values.size() - 1);
+//
+struct hash_index_hasher
+{
+    // Allows heterogeneous lookups, the string overloads all hash the same for equal characters.
+    using is_transparent = void;
+
+    std::uint64_t operator()(const char * str, const std::size_t length) const noexcept
+    {
+        return hash_bytes(str, length);
+    }
+
+    std::uint64_t operator()(const char * str) const noexcept
+    {
+        HASH_INDEX_ASSERT(str != nullptr);
+        return hash_bytes(str, std::strlen(str));
+    }
+
+    template<typename Traits, typename Alloc>
+    std::uint64_t operator()(const std::basic_string<char, Traits, Alloc> & str) const noexcept
+    {
+        return hash_bytes(str.data(), str.size());
+    }
+
+    #if defined(HASH_INDEX_STRING_VIEW)
+    std::uint64_t operator()(const std::string_view str) const noexcept
+    {
+        return hash_bytes(str.data(), str.size());
+    }
+    #endif // HASH_INDEX_STRING_VIEW
+
+    template<typename IntegerType, typename = typename std::enable_if<std::is_integral<IntegerType>::value>::type>
+    constexpr std::uint64_t operator()(const IntegerType value) const noexcept
+    {
+        return mix(static_cast<std::uint64_t>(value));
+    }
+
+    // Bijective bit mixer (MurmurHash3 fmix64). Spreads the entropy of any bit
+    // of x over all output bits, so that sequential keys use every bucket.
+    static constexpr std::uint64_t mix(const std::uint64_t x) noexcept
+    {
+        return xorshift(xorshift(xorshift(x, 33) * 0xFF51AFD7ED558CCDull, 33) * 0xC4CEB9FE1A85EC53ull, 33);
+    }
+
+    static std::uint64_t hash_bytes(const void * data, const std::size_t length, std::uint64_t seed = 0) noexcept
+    {
+        const unsigned char * p = static_cast<const unsigned char *>(data);
+        std::uint64_t a = 0;
+        std::uint64_t b = 0;
+
+        seed ^= fold_multiply(seed ^ secret0, secret1);
+        if (length <= 16)
+        {
+            if (length >= 4)
+            {
+                const std::size_t mid = (length >> 3) << 2;
+                a = (read32(p) << 32) | read32(p + mid);
+                b = (read32(p + length - 4) << 32) | read32(p + length - 4 - mid);
+            }
+            else if (length > 0)
+            {
+                a = (static_cast<std::uint64_t>(p[0]) << 16) | (static_cast<std::uint64_t>(p[length >> 1]) << 8) | p[length - 1];
+            }
+        }
+        else
+        {
+            std::size_t remaining = length;
+            if (remaining > 48)
+            {
+                // Three independent lanes to overlap the multiplies.
+                std::uint64_t lane1 = seed;
+                std::uint64_t lane2 = seed;
+                do
+                {
+                    seed  = fold_multiply(read64(p)      ^ secret1, read64(p + 8)  ^ seed);
+                    lane1 = fold_multiply(read64(p + 16) ^ secret2, read64(p + 24) ^ lane1);
+                    lane2 = fold_multiply(read64(p + 32) ^ secret3, read64(p + 40) ^ lane2);
+                    p += 48;
+                    remaining -= 48;
+                }
+                while (remaining > 48);
+                seed ^= lane1 ^ lane2;
+            }
+            while (remaining > 16)
+            {
+                seed = fold_multiply(read64(p) ^ secret1, read64(p + 8) ^ seed);
+                p += 16;
+                remaining -= 16;
+            }
+            // Last 16 bytes, overlapping with the previous step if not a multiple of 16.
+            a = read64(p + remaining - 16);
+            b = read64(p + remaining - 8);
+        }
+
+        a ^= secret1;
+        b ^= seed;
+        multiply(a, b);
+        return fold_multiply(a ^ secret0 ^ length, b ^ secret1);
+    }
+
+private:
+
+    static constexpr std::uint64_t secret0 = 0xA0761D6478BD642Full;
+    static constexpr std::uint64_t secret1 = 0xE7037ED1A0B428DBull;
+    static constexpr std::uint64_t secret2 = 0x8EBC6AF09C88C6E3ull;
+    static constexpr std::uint64_t secret3 = 0x589965CC75374CC3ull;
+
+    static constexpr std::uint64_t xorshift(const std::uint64_t x, const int shift) noexcept
+    {
+        return x ^ (x >> shift);
+    }
+
+    // Full 128-bit product of a and b, low half in a, high half in b.
+    static void multiply(std::uint64_t & a, std::uint64_t & b) noexcept
+    {
+        #if defined(__SIZEOF_INT128__)
+        __extension__ typedef unsigned __int128 uint128;
+        const uint128 r = static_cast<uint128>(a) * b;
+        a = static_cast<std::uint64_t>(r);
+        b = static_cast<std::uint64_t>(r >> 64);
+        #else // Portable 32x32 partial products.
+        const std::uint64_t a_hi = a >> 32, a_lo = a & 0xFFFFFFFFull;
+        const std::uint64_t b_hi = b >> 32, b_lo = b & 0xFFFFFFFFull;
+        const std::uint64_t hh = a_hi * b_hi, hl = a_hi * b_lo;
+        const std::uint64_t lh = a_lo * b_hi, ll = a_lo * b_lo;
+        const std::uint64_t mid = (ll >> 32) + (hl & 0xFFFFFFFFull) + (lh & 0xFFFFFFFFull);
+        a = (mid << 32) | (ll & 0xFFFFFFFFull);
+        b = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+        #endif // __SIZEOF_INT128__
+    }
+
+    static std::uint64_t fold_multiply(std::uint64_t a, std::uint64_t b) noexcept
+    {
+        multiply(a, b);
+        return a ^ b;
+    }
+
+    // Unaligned reads. memcpy compiles to a single load on any decent compiler.
+    static std::uint64_t read64(const unsigned char * p) noexcept
+    {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static std::uint64_t read32(const unsigned char * p) noexcept
+    {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+};
+
+#if defined(HASH_INDEX_COROUTINES)
+
+//
+// -----------------------------
+//  hash_index_scheduler
+// -----------------------------
+//
+// Brief:
+//  Minimal round-robin scheduler for the coroutine lookups of
+//  hash_index<>::find_async(). Each lookup suspends right after
+//  prefetching the memory its next step will touch and is queued
+//  here, so resuming the other queued lookups in the meantime hides
+//  that cache miss. Keep a few dozen lookups in flight for the best
+//  overlap. Not thread-safe; Use one scheduler per thread.
+//
+//  Exceptions thrown by a lookup's predicate are kept in the lookup
+//  and rethrown from its result, so they never unwind through here.
+//  If anything else resumed from run_once() throws, the coroutines
+//  not yet resumed in that round stay queued for the next one.
+//
+class hash_index_scheduler final
+{
+public:
+
+    void schedule(const std::coroutine_handle<> handle)
+    {
+        m_ready.push_back(handle);
+    }
+
+    // Resumes every coroutine queued at the time of the call once, in FIFO
+    // order. Those suspending again are queued for the next round. Returns
+    // true if any are still pending.
+    bool run_once()
+    {
+        // Puts the rest of the round back in front of the queue if a resume throws.
+        struct round_guard
+        {
+            hash_index_scheduler & owner;
+            ~round_guard()
+            {
+                if (owner.m_position < owner.m_running.size())
+                {
+                    owner.m_ready.insert(owner.m_ready.begin(), owner.m_running.begin() + owner.m_position + 1, owner.m_running.end());
+                }
+                owner.m_running.clear();
+                owner.m_position = 0;
+            }
+        };
+
+        HASH_INDEX_ASSERT(m_running.empty() && "run_once() called from a coroutine it resumed!");
+        m_running.swap(m_ready);
+        const round_guard guard{ *this };
+        for (m_position = 0; m_position < m_running.size(); ++m_position)
+        {
+            const std::coroutine_handle<> handle = m_running[m_position];
+            if (handle) // Null if cancelled during the round.
+            {
+                handle.resume();
+            }
+        }
+        return !m_ready.empty();
+    }
+
+    // Removes a coroutine from the queue, e.g. one about to be destroyed while still
+    // suspended. Called by ~hash_index_lookup(), so pending lookups can be dropped.
+    void cancel(const std::coroutine_handle<> handle) noexcept
+    {
+        const auto queued = std::find(m_ready.begin(), m_ready.end(), handle);
+        if (queued != m_ready.end())
+        {
+            m_ready.erase(queued);
+        }
+        for (std::size_t i = m_position + 1; i < m_running.size(); ++i)
+        {
+            if (m_running[i] == handle)
+            {
+                m_running[i] = nullptr;
+            }
+        }
+    }
+
+    // Runs until no coroutines are left queued.
+    void run()
+    {
+        while (run_once())
+        {
+        }
+    }
+
+    std::size_t pending() const noexcept
+    {
+        return m_ready.size();
+    }
+
+    bool empty() const noexcept
+    {
+        return m_ready.empty();
+    }
+
+private:
+
+    std::vector<std::coroutine_handle<>> m_ready{};
+    std::vector<std::coroutine_handle<>> m_running{};
+    std::size_t                          m_position = 0; // Into m_running, during run_once().
+};
+
+//
+// -----------------------------
+//  hash_index_lookup<> template
+// -----------------------------
+//
+// Brief:
+//  Pending result of a hash_index<>::find_async(). Queued on the scheduler
+//  as soon as it is created, and done once the scheduler has run it to the
+//  end. Either check done() and read result() after running the scheduler,
+//  or co_await the lookup from another coroutine, which is then resumed by
+//  the scheduler with the resulting index. Destroying a lookup that is
+//  still pending removes it from the scheduler, so its result is lost,
+//  but the scheduler must still be alive at that point. An exception
+//  thrown by the predicate finishes the lookup and is rethrown from
+//  result() or co_await.
+//
+template<typename IndexType>
+class hash_index_lookup final
+{
+public:
+
+    using index_type = IndexType;
+
+    struct promise_type;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+
+    // Suspends the lookup, queuing it back on its scheduler.
+    struct yield_awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(const handle_type handle) const { handle.promise().scheduler->schedule(handle); }
+        void await_resume() const noexcept { }
+    };
+
+    // Hands control to the coroutine awaiting the lookup, if any.
+    struct final_awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(const handle_type handle) const noexcept
+        {
+            const std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() const noexcept { }
+    };
+
+    struct promise_type
+    {
+        hash_index_scheduler *  scheduler    = nullptr;
+        std::coroutine_handle<> continuation = nullptr;
+        index_type              result       = null_index;
+        std::exception_ptr      exception    = nullptr;
+
+        // The scheduler is taken from the arguments of the lookup coroutine:
+        // the hash index the method is called on, followed by the scheduler.
+        template<typename OwnerType, typename... Args>
+        promise_type(const OwnerType &, hash_index_scheduler & s, const Args & ...) noexcept
+            : scheduler{ &s }
+        {
+        }
+
+        // Lives in the coroutine frame; Never copied.
+        promise_type(const promise_type &) = delete;
+        promise_type & operator = (const promise_type &) = delete;
+
+        hash_index_lookup get_return_object() noexcept { return hash_index_lookup{ handle_type::from_promise(*this) }; }
+        yield_awaiter     initial_suspend()   noexcept { return {}; }
+        final_awaiter     final_suspend()     noexcept { return {}; }
+
+        void return_value(const index_type index) noexcept { result = index; }
+        void unhandled_exception() noexcept { exception = std::current_exception(); } // Thrown by the predicate.
+
+        index_type get() const
+        {
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+            return result;
+        }
+    };
+
+    hash_index_lookup(hash_index_lookup && other) noexcept
+        : m_handle{ other.m_handle }
+    {
+        other.m_handle = nullptr;
+    }
+
+    hash_index_lookup & operator = (hash_index_lookup && other) noexcept
+    {
+        if (this != &other)
+        {
+            destroy();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+
+    hash_index_lookup(const hash_index_lookup &) = delete;
+    hash_index_lookup & operator = (const hash_index_lookup &) = delete;
+
+    ~hash_index_lookup()
+    {
+        destroy();
+    }
+
+    bool done() const noexcept
+    {
+        return m_handle.done();
+    }
+
+    // Rethrows the exception of the predicate, if it threw.
+    index_type result() const
+    {
+        HASH_INDEX_ASSERT(done() && "Lookup still pending; Run the scheduler first!");
+        return m_handle.promise().get();
+    }
+
+    // The awaiting coroutine is only resumed once the lookup is done,
+    // so the scheduler must be run by someone else, e.g. its caller.
+    struct awaiter
+    {
+        handle_type handle;
+
+        bool await_ready() const noexcept { return handle.done(); }
+        void await_suspend(const std::coroutine_handle<> continuation) const noexcept { handle.promise().continuation = continuation; }
+        index_type await_resume() const { return handle.promise().get(); }
+    };
+
+    awaiter operator co_await() const noexcept
+    {
+        return awaiter{ m_handle };
+    }
+
+private:
+
+    explicit hash_index_lookup(const handle_type handle) noexcept
+        : m_handle{ handle }
+    {
+    }
+
+    void destroy() noexcept
+    {
+        if (m_handle)
+        {
+            if (!m_handle.done())
+            {
+                m_handle.promise().scheduler->cancel(m_handle);
+            }
+            m_handle.destroy();
+        }
+    }
+
+    handle_type m_handle;
+};
+
+template<typename IT>
+constexpr typename hash_index_lookup<IT>::index_type hash_index_lookup<IT>::null_index;
+
+#endif // HASH_INDEX_COROUTINES
+
+// Read-only perfect hash table made by hash_index<>::freeze(), defined further down.
+template<typename IndexType, typename KeyType, typename SizeType, typename Allocator>
+class frozen_hash_index;
+
+//
+// -----------------------
+//  hash_index<> template
+// -----------------------
+//
+// Brief:
+//  Provides an efficient way of indexing into arrays by a key
+//  other than the integer element index. hash_index<> allows
+//  associating a hash key (returned by a function like std::hash)
+//  with an integer index of an external array where the mapped
+//  value is stored.
+//
+// Template arguments:
+//  IndexType is the type used to store the value array indexes.
+//  It must be an integer type. By default set to unsigned int
+//  to save memory on platforms where that type is 32-bits wide,
+//  since most of the time the full 64-bits indexing range is
+//  not required.
+//
+//  KeyType is the type of a hash key/hash-code used to
+//  lookup into hash_index. This type is only used in the
+//  public interface. By default set to std::size_t to match
+//  the return value of std::hash.
+//
+//  SizeType is used internally to store array sizes and is also
+//  visible in the public interface on functions that deal in sizes.
+//  Set to std::size_t by default to match the Standard library but
+//  could also be replaced by a 32-bits type to save memory if the
+//  full 64-bits range is not required.
+//
+//  Allocator is the Standard-compatible allocator used to alloc
+//  and dealloc the underlaying arrays used by hash_index<>.
+//  We inherit privately from it to take advantage of the Empty
+//  Base Class Optimization (EBO) if it is an empty class, so
+//  if providing a custom one, make sure it is inheritable
+//  (i.e., not final). By default std::allocator is used. The
+//  only methods we require are allocate() and deallocate().
+//
+//  All the template parameters are optional and you can simply
+//  declare an instance of this class as 'hash_index<>' if the
+//  defaults described above fit your needs.
+//
+// ----------------
+//  Usage examples
+// ----------------
+//
+//  struct Thing
+//  {
+//      std::string name;
+//      ...
+//  };
+//
+//  hash_index<>       hash_idx;
+//  std::vector<Thing> values;
+//
+// Insertion:
+//
+//  Thing t = make_thing();
+//  values.push_back(t);
+//  hash_idx.insert(std::hash<std::string>{}(t.name), values.size() - 1);
+//
+// Lookup:
+//
+//  std::string key = ...;
+//  const auto index = hash_idx.find(std::hash<std::string>{}(key), key, values,
+//                                   [](const std::string & key, const Thing & item)
+//                                   {
+//                                       return key == item.name;
+//                                   });
+//  index == hash_index<>::null_index if not found, index into 'values[]' otherwise.
+//
+//  From a C++20 coroutine, overlapping the cache misses with other lookups queued on the same scheduler:
+//  const auto index = co_await hash_idx.find_async(scheduler, std::hash<std::string>{}(key), key, values, pred);
+//
+//  Every item matching a key shared by many of them, without allocating:
+//  hash_idx.find_all(cell_key, cell, entities, pred, [&](const unsigned int index) { ... });
+//  const auto n = hash_idx.count(cell_key, cell, entities, pred);
+//
+// Removal:
+//
+//  std::string  key   = ...;
+//  unsigned int index = ...;
+//  hash_idx.erase(std::hash<std::string>{}(key), index);
+//
+// Hashing with hash_index_hasher:
+//
+//  hash_idx.insert_hashed(t.name, values.size() - 1);
+//  const auto index = hash_idx.find_hashed(key, values, [](const std::string & key, const Thing & item)
+//                                          {
+//                                              return key == item.name;
+//                                          });
+//  hash_idx.erase_hashed(key, index);
+//
+// Iteration:
+//
+//  for (const auto index : hash_idx.chain(std::hash<std::string>{}(key))) { ... } // Same as first()/next().
+//  for (const auto index : hash_idx.entries()) { ... }                            // Every linked index.
+//
+// Rehashing:
+//
+//  hash_index<> hash_idx;
+//  hash_idx.set_max_load_factor(1.0f); // Grow the buckets automatically (must be set while empty).
+//  hash_idx.reserve(100000);           // Or size everything upfront for a known item count.
+//
+// Serialization:
+//
+//  std::vector<unsigned char> bytes(hash_idx.serialized_size());
+//  hash_idx.serialize(bytes.data(), bytes.size());
+//  ...
+//  hash_index_view<> view{ bytes.data(), bytes.size() }; // Zero-copy lookups, or:
+//  hash_idx.deserialize(bytes.data(), bytes.size());     // Back to a mutable copy.
+//
+// Freezing:
+//
+//  const frozen_hash_index<> frozen = hash_idx.freeze(); // Read-only, one probe per lookup.
+//  const auto index = frozen.find(std::hash<std::string>{}(key), key, values, pred);
+//
+template
+<
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t,
+    typename Allocator = std::allocator<IndexType>
+>
+class hash_index final
+    : private Allocator // Take advantage of EBO for the default empty std::allocator
+{
+public:
+
+    static_assert(std::is_integral<IndexType>::value, "Integer type required for IndexType!");
+    static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
+    static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
+
+    //
+    // index_type / null_index:
+    //
+    // You can use any signed or unsigned integral type for the underlaying
+    // index type of hash_index. By default index_type is an unsigned int, so
+    // on most platforms each index will only take 32-bits. If you need the
+    // full 64-bits indexing range, then instantiate the class with int64_t
+    // or equivalent. The bit pattern ~0 (0xFFFFF...) is reserved as an
+    // internal sentinel value to indicate an unused hash bucket, so this
+    // value cannot be used as an index.
+    //
+    using index_type = IndexType;
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+
+    //
+    // key_type:
+    //
+    // Integral type of the hashed key value. By default it is set to std::size_t
+    // to match the type returned by std::hash, but you can change it to any other
+    // integral type, signed or unsigned, that better fits your hash function.
+    //
+    using key_type = KeyType;
+
+    //
+    // fingerprint_type:
+    //
+    // Type of the optional per-index fingerprints. See set_fingerprints().
+    //
+    using fingerprint_type = unsigned char;
+
+    //
+    // size_type:
+    //
+    // Type used to represent the internal array counts and sizes.
+    // Set to std::size_t by default to be consistent with the C++
+    // Standard Library, but it is rare the case where you actually
+    // have a hash_index big enough to overflow a smaller integer type,
+    // so this can probably be replaced by a 32-bits unsigned integer
+    // if you care about saving space on each individual class instance.
+    //
+    using size_type = SizeType;
+
+    //
+    // default_initial_size / default_granularity:
+    //
+    // Default values used by the non-parameterized constructor
+    // to set the initial number of hash buckets and size of the
+    // index chain. Larger sizes reduce collisions and reallocations
+    // but will of course consume more memory.
+    //
+    static constexpr size_type default_initial_size = 1024;
+    static constexpr size_type default_granularity  = 1024;
+
+    //
+    // find_many_group_size:
+    //
+    // Number of lookups find_many() keeps in flight at once. Should be enough
+    // to cover the latency of a cache miss with independent work, but not so
+    // large that the prefetched lines get evicted before they are used.
+    //
+    static constexpr size_type find_many_group_size = 16;
+
+    //
+    // parallel_grain:
+    //
+    // Minimum number of items per thread of build_parallel() and rehash_parallel()
+    // (see HASH_INDEX_ENABLE_PARALLEL). Below that, starting a thread costs more than the work it takes over, so
+    // fewer threads are used, down to just the calling thread for small tables.
+    //
+    static constexpr size_type parallel_grain = 8192;
+
+    //
+    // chain_histogram_size / chain_stats:
+    //
+    // Snapshot of the chain lengths returned by compute_chain_stats().
+    // histogram[n] is the number of buckets holding exactly n indexes,
+    // except for the last entry, which counts every chain of length
+    // chain_histogram_size - 1 or longer. p99_chain_length is weighted by
+    // the linked indexes, not by bucket: 99% of the indexes sit in chains
+    // no longer than it, so it bounds the hops of 99% of successful lookups.
+    //
+    static constexpr size_type chain_histogram_size = 32;
+
+    struct chain_stats
+    {
+        size_type hash_buckets;        // Same as hash_buckets_size().
+        size_type empty_buckets;
+        size_type linked_indexes;
+        size_type max_chain_length;
+        size_type p99_chain_length;
+        float     empty_bucket_ratio;  // empty_buckets / hash_buckets.
+        float     mean_chain_length;   // Over the non-empty buckets only.
+        float     mean_probes_per_hit; // Chain entries visited by the average successful lookup.
+        size_type histogram[chain_histogram_size];
+    };
+
+    //
+    // lookup_counters:
+    //
+    // Running totals of the work done by find(), find_many() and erase(). Only
+    // collected if HASH_INDEX_ENABLE_COUNTERS is defined, otherwise counters()
+    // always returns zeros. Probes are the chain entries visited. The counters are
+    // updated by the const lookups without any synchronization, so don't enable
+    // them in builds where a table is read from several threads at once.
+    //
+    struct lookup_counters
+    {
+        std::uint64_t lookups;
+        std::uint64_t lookup_probes;
+        std::uint64_t predicate_calls;
+        std::uint64_t erases;
+        std::uint64_t erase_probes;
+    };
+
+    //
+    // chain_iterator / entry_iterator / iteration_range:
+    //
+    // Input iterators yielding indexes, returned in pairs by chain() and entries().
+    // chain_iterator follows a single chain, like first()/next(). entry_iterator
+    // visits every linked index once, chain after chain in bucket order, and can
+    // also tell the bucket it is in. Both are invalidated by any modification.
+    //
+    class chain_iterator final
+    {
+    public:
+
+        using iterator_category = std::input_iterator_tag;
+        using value_type        = index_type;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const index_type *;
+        using reference         = index_type;
+
+        chain_iterator() = default;
+
+        chain_iterator(const index_type * index_chain, const index_type index) noexcept
+            : m_index_chain{ index_chain }
+            , m_index{ index }
+        {
+        }
+
+        index_type operator * () const noexcept { return m_index; }
+
+        chain_iterator & operator ++ () noexcept
+        {
+            m_index = m_index_chain[m_index];
+            return *this;
+        }
+
+        chain_iterator operator ++ (int) noexcept
+        {
+            const chain_iterator old{ *this };
+            ++(*this);
+            return old;
+        }
+
+        bool operator == (const chain_iterator & other) const noexcept { return m_index == other.m_index; }
+        bool operator != (const chain_iterator & other) const noexcept { return m_index != other.m_index; }
+
+    private:
+
+        const index_type * m_index_chain = nullptr;
+        index_type         m_index       = null_index;
+    };
+
+    class entry_iterator final
+    {
+    public:
+
+        using iterator_category = std::input_iterator_tag;
+        using value_type        = index_type;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const index_type *;
+        using reference         = index_type;
+
+        entry_iterator() = default;
+
+        // Starts at the first linked index at or after chain position 'position'.
+        entry_iterator(const hash_index * owner, const size_type position) noexcept
+            : m_owner{ owner }
+            , m_position{ position }
+        {
+            find_chain();
+        }
+
+        index_type operator * () const noexcept { return m_index; }
+
+        // Bucket of the current index, in the old bucket array while
+        // an incremental rehash is still migrating it.
+        size_type bucket() const noexcept
+        {
+            return (m_position < m_owner->m_hash_buckets_size) ? m_position : (m_position - m_owner->m_hash_buckets_size);
+        }
+
+        entry_iterator & operator ++ () noexcept
+        {
+            m_index = m_owner->m_index_chain[m_index];
+            if (m_index == null_index)
+            {
+                ++m_position;
+                find_chain();
+            }
+            return *this;
+        }
+
+        entry_iterator operator ++ (int) noexcept
+        {
+            const entry_iterator old{ *this };
+            ++(*this);
+            return old;
+        }
+
+        bool operator == (const entry_iterator & other) const noexcept { return m_position == other.m_position && m_index == other.m_index; }
+        bool operator != (const entry_iterator & other) const noexcept { return !(*this == other); }
+
+    private:
+
+        void find_chain() noexcept
+        {
+            const size_type end = m_owner->chain_positions();
+            for (; m_position < end; ++m_position)
+            {
+                m_index = m_owner->chain_head_at(m_position);
+                if (m_index != null_index)
+                {
+                    return;
+                }
+            }
+            m_position = end;
+            m_index    = null_index;
+        }
+
+        const hash_index * m_owner    = nullptr;
+        size_type          m_position = 0;
+        index_type         m_index    = null_index;
+    };
+
+    template<typename Iterator>
+    class iteration_range final
+    {
+    public:
+
+        iteration_range(const Iterator first, const Iterator last) noexcept
+            : m_first{ first }
+            , m_last{ last }
+        {
+        }
+
+        Iterator begin() const noexcept { return m_first; }
+        Iterator end()   const noexcept { return m_last;  }
+        bool     empty() const noexcept { return m_first == m_last; }
+
+    private:
+
+        Iterator m_first;
+        Iterator m_last;
+    };
+
+    //
+    // Constructors-destructor / copy-assignment:
+    //
+
+    hash_index()
+    {
+        internal_init(default_initial_size, default_initial_size);
+    }
+
+    hash_index(const size_type initial_hash_buckets_size,
+               const size_type initial_index_chain_size)
+    {
+        internal_init(initial_hash_buckets_size, initial_index_chain_size);
+    }
+
+    // All arrays are allocated from a copy of 'alloc' (rebound to each array type).
+    // Needed with stateful allocators, e.g. a pmr_hash_index<> over an arena.
+    explicit hash_index(const Allocator & alloc)
+        : Allocator(alloc)
+    {
+        internal_init(default_initial_size, default_initial_size);
+    }
+
+    hash_index(const size_type initial_hash_buckets_size,
+               const size_type initial_index_chain_size,
+               const Allocator & alloc)
+        : Allocator(alloc)
+    {
+        internal_init(initial_hash_buckets_size, initial_index_chain_size);
+    }
+
+    ~hash_index()
+    {
+        clear_and_free();
+    }
+
+    // Copies get the allocator given by select_on_container_copy_construction(),
+    // like the Standard containers (for a polymorphic_allocator that is the default
+    // memory resource, not the one of 'other'). Use the constructor below to pick one.
+    hash_index(const hash_index & other)
+        : hash_index(other, std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator()))
+    {
+    }
+
+    hash_index(const hash_index & other, const Allocator & alloc)
+        : Allocator(alloc)
+    {
+        // 'other' is empty/never allocated:
+        if (other.m_lookup_mask == 0)
+        {
+            m_hash_buckets = m_invalid_index_dummy;
+            m_index_chain  = m_invalid_index_dummy;
+        }
+        else // Copy data from 'other':
+        {
+            HASH_INDEX_ASSERT(other.is_allocated());
+            HASH_INDEX_ASSERT(is_power_of_two(other.m_hash_buckets_size));
+
+            m_hash_buckets = Allocator::allocate(other.m_hash_buckets_size);
+            m_index_chain  = Allocator::allocate(other.m_index_chain_size);
+
+            std::copy(other.m_index_chain,  other.m_index_chain  + other.m_index_chain_size,  m_index_chain);
+            for (size_type i = 0; i < other.m_hash_buckets_size; ++i)
+            {
+                if (other.is_live_bucket(i))
+                {
+                    m_hash_buckets[i] = other.m_hash_buckets[i];
+                }
+            }
+
+            if (other.m_hash_keys != nullptr)
+            {
+                m_hash_keys = allocate_array<key_type>(other.m_index_chain_size);
+                std::copy(other.m_hash_keys, other.m_hash_keys + other.m_index_chain_size, m_hash_keys);
+            }
+            if (other.m_fingerprints != nullptr)
+            {
+                m_fingerprints = allocate_array<fingerprint_type>(other.m_index_chain_size);
+                std::copy(other.m_fingerprints, other.m_fingerprints + other.m_index_chain_size, m_fingerprints);
+            }
+            if (other.m_prev_chain != nullptr)
+            {
+                m_prev_chain = allocate_array<index_type>(other.m_index_chain_size);
+                std::copy(other.m_prev_chain, other.m_prev_chain + other.m_index_chain_size, m_prev_chain);
+            }
+            if (other.m_old_hash_buckets != nullptr)
+            {
+                m_old_hash_buckets = Allocator::allocate(other.m_old_hash_buckets_size);
+                std::copy(other.m_old_hash_buckets, other.m_old_hash_buckets + other.m_old_hash_buckets_size, m_old_hash_buckets);
+            }
+        }
+
+        m_hash_buckets_size = other.m_hash_buckets_size;
+        m_index_chain_size  = other.m_index_chain_size;
+        m_hash_mask         = other.m_hash_mask;
+        m_lookup_mask       = other.m_lookup_mask;
+        m_granularity       = other.m_granularity;
+        m_chain_growth_factor = other.m_chain_growth_factor;
+        m_num_items         = other.m_num_items;
+        m_rehash_threshold  = other.m_rehash_threshold;
+        m_shrink_threshold  = other.m_shrink_threshold;
+        m_max_load_factor   = other.m_max_load_factor;
+        m_min_load_factor   = other.m_min_load_factor;
+        m_growth_factor     = other.m_growth_factor;
+        m_retain_keys       = other.m_retain_keys;
+        m_use_fingerprints  = other.m_use_fingerprints;
+        m_use_prev_chain    = other.m_use_prev_chain;
+        m_old_hash_buckets_size = other.m_old_hash_buckets_size;
+        m_old_hash_mask         = other.m_old_hash_mask;
+        m_rehash_position       = other.m_rehash_position;
+        m_rehash_step           = other.m_rehash_step;
+        HASH_INDEX_COUNT(m_counters = other.m_counters);
+    }
+
+    // Assignment keeps the allocator of this hash_index (none of the allocator
+    // propagate_* traits are honored except for swap), so the data is copied over
+    // to it unless both allocators compare equal, in which case a move just swaps.
+    hash_index & operator = (const hash_index & other)
+    {
+        if (this != &other)
+        {
+            hash_index temp{ other, get_allocator() };
+            swap(*this, temp);
+        }
+        return *this;
+    }
+
+    hash_index & operator = (hash_index && other)
+    {
+        if (allocators_equal(get_allocator(), other.get_allocator()))
+        {
+            swap(*this, other);
+        }
+        else
+        {
+            *this = static_cast<const hash_index &>(other);
+        }
+        return *this;
+    }
+
+    hash_index(hash_index && other)
+        : hash_index(other.get_allocator()) // Init via the allocator constructor (C++11 constructor delegation)
+    {
+        swap(*this, other);
+    }
+
+    // Non-throwing swap() overload for hash_index so we
+    // can enable copy-and-swap in the above constructors.
+    // Unless the allocator has propagate_on_container_swap,
+    // both allocators must compare equal, same as the std containers.
+    friend void swap(hash_index & lhs, hash_index & rhs) noexcept
+    {
+        using std::swap;
+        swap_allocators(lhs, rhs, typename std::allocator_traits<Allocator>::propagate_on_container_swap{});
+        swap(lhs.m_hash_buckets,      rhs.m_hash_buckets);
+        swap(lhs.m_index_chain,       rhs.m_index_chain);
+        swap(lhs.m_hash_buckets_size, rhs.m_hash_buckets_size);
+        swap(lhs.m_index_chain_size,  rhs.m_index_chain_size);
+        swap(lhs.m_hash_mask,         rhs.m_hash_mask);
+        swap(lhs.m_lookup_mask,       rhs.m_lookup_mask);
+        swap(lhs.m_granularity,       rhs.m_granularity);
+        swap(lhs.m_chain_growth_factor, rhs.m_chain_growth_factor);
+        swap(lhs.m_hash_keys,         rhs.m_hash_keys);
+        swap(lhs.m_num_items,         rhs.m_num_items);
+        swap(lhs.m_rehash_threshold,  rhs.m_rehash_threshold);
+        swap(lhs.m_shrink_threshold,  rhs.m_shrink_threshold);
+        swap(lhs.m_max_load_factor,   rhs.m_max_load_factor);
+        swap(lhs.m_min_load_factor,   rhs.m_min_load_factor);
+        swap(lhs.m_growth_factor,     rhs.m_growth_factor);
+        swap(lhs.m_retain_keys,       rhs.m_retain_keys);
+        swap(lhs.m_fingerprints,      rhs.m_fingerprints);
+        swap(lhs.m_use_fingerprints,  rhs.m_use_fingerprints);
+        swap(lhs.m_prev_chain,        rhs.m_prev_chain);
+        swap(lhs.m_use_prev_chain,    rhs.m_use_prev_chain);
+        swap(lhs.m_old_hash_buckets,      rhs.m_old_hash_buckets);
+        swap(lhs.m_old_hash_buckets_size, rhs.m_old_hash_buckets_size);
+        swap(lhs.m_old_hash_mask,         rhs.m_old_hash_mask);
+        swap(lhs.m_rehash_position,       rhs.m_rehash_position);
+        swap(lhs.m_rehash_step,           rhs.m_rehash_step);
+        HASH_INDEX_COUNT(swap(lhs.m_counters, rhs.m_counters));
+    }
+
+    //
+    // Lookup:
+    //
+
+    index_type first(const key_type key) const
+    {
+        //
+        // By ensuring the size of the hash buckets array is always a PoT
+        // we can use as fast AND (key & m_hash_mask) instead of the slow
+        // integer modulo to index the table with the incoming hash key.
+        //
+        // The lookup mask is either zero for an empty table, which is
+        // the m_invalid_index_dummy[] in that case, so we always get
+        // zero from the last AND and return the null_index that
+        // m_invalid_index_dummy[] holds. Otherwise, when the hash_index table
+        // is not empty lookup mask has all bits set to 1, so the last AND
+        // simply yields (key & m_hash_mask), which is the right hash index.
+        // During an incremental rehash, bucket_of() picks the old array for
+        // the keys whose bucket there hasn't been migrated yet.
+        //
+        return *bucket_of(key);
+    }
+
+    index_type next(const index_type index) const
+    {
+        // The index chain is resized when new items are inserted
+        // to match the largest index, so this check is mostly
+        // for internal consistency.
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
+        return m_index_chain[index & m_lookup_mask];
+    }
+
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        HASH_INDEX_COUNT(++m_counters.lookups);
+        for (index_type i = first(key); i != null_index; i = next(i))
+        {
+            HASH_INDEX_COUNT(++m_counters.lookup_probes);
+            if (!may_match(i, key))
+            {
+                continue;
+            }
+
+            HASH_INDEX_COUNT(++m_counters.predicate_calls);
+            const auto & item = collection[i];
+            if (pred(needle, item))
+            {
+                return i;
+            }
+        }
+        return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(key, needle, collection, std::equal_to<ValueType>{});
+    }
+
+    //
+    // Calls out(index) for every index in the chain of 'key' whose item matches the needle,
+    // in chain order, with a single walk and the same fingerprint filter of find(). For keys
+    // shared by many items, like a secondary index. Returns the number of matches.
+    //
+    template<typename ValueType, typename CollectionType, typename Predicate, typename Callback>
+    size_type find_all(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred, Callback out) const
+    {
+        size_type matches = 0;
+        HASH_INDEX_COUNT(++m_counters.lookups);
+        for (index_type i = first(key); i != null_index; i = next(i))
+        {
+            HASH_INDEX_COUNT(++m_counters.lookup_probes);
+            if (!may_match(i, key))
+            {
+                continue;
+            }
+
+            HASH_INDEX_COUNT(++m_counters.predicate_calls);
+            const auto & item = collection[i];
+            if (pred(needle, item))
+            {
+                out(i);
+                ++matches;
+            }
+        }
+        return matches;
+    }
+
+    template<typename ValueType, typename CollectionType, typename Callback>
+    size_type find_all(const key_type key, const ValueType & needle, const CollectionType & collection, Callback out) const
+    {
+        return find_all(key, needle, collection, std::equal_to<ValueType>{}, out);
+    }
+
+    // Number of matches find_all() would report.
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    size_type count(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        return find_all(key, needle, collection, pred, [](const index_type) { });
+    }
+
+    template<typename ValueType, typename CollectionType>
+    size_type count(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find_all(key, needle, collection, std::equal_to<ValueType>{}, [](const index_type) { });
+    }
+
+    // Same as find() with the key computed from the needle by hashed_key(). Only finds
+    // items inserted with that same key, e.g. with insert_hashed(). Integer needles are
+    // bit-mixed, so sequential integers spread over all buckets instead of clustering.
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    index_type find_hashed(const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        return find(hashed_key(needle), needle, collection, pred);
+    }
+
+    template<typename ValueType, typename CollectionType>
+    index_type find_hashed(const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(hashed_key(needle), needle, collection, std::equal_to<ValueType>{});
+    }
+
+    // Key of 'value' with hash_index_hasher, for any type it accepts: strings
+    // (std::string, std::string_view, C strings) or integers. Hash once and pass
+    // the key around if the same value is looked up or inserted repeatedly.
+    template<typename ValueType>
+    static key_type hashed_key(const ValueType & value) noexcept
+    {
+        return static_cast<key_type>(hash_index_hasher{}(value));
+    }
+
+    //
+    // Batched lookup of keys[0..count-1] / needles[0..count-1], writing the result of
+    // each individual find() to out_indexes[0..count-1]. Lookups are processed in groups
+    // of find_many_group_size: all bucket heads of a group are prefetched first, then
+    // every chain walk in the group is advanced one hop at a time, prefetching the next
+    // index chain entry and collection item of each walk before moving to the next one.
+    // This overlaps the cache misses of independent lookups instead of paying them one
+    // after the other. Results are identical to calling find() for each key.
+    //
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    void find_many(const key_type * keys, const ValueType * needles, const size_type count,
+                   const CollectionType & collection, Predicate pred, index_type * out_indexes) const
+    {
+        HASH_INDEX_ASSERT((keys != nullptr && needles != nullptr && out_indexes != nullptr) || count == 0);
+
+        index_type cursors[find_many_group_size];
+        size_type  active[find_many_group_size];
+        HASH_INDEX_COUNT(m_counters.lookups += static_cast<std::uint64_t>(count));
+
+        for (size_type base = 0; base < count; base += find_many_group_size)
+        {
+            const size_type group_size = std::min(find_many_group_size, count - base);
+
+            // Stage 1: Bucket heads.
+            for (size_type j = 0; j < group_size; ++j)
+            {
+                HASH_INDEX_PREFETCH(bucket_of(keys[base + j]));
+            }
+
+            // Stage 2: First chain entry and value of each lookup.
+            size_type num_active = 0;
+            for (size_type j = 0; j < group_size; ++j)
+            {
+                const index_type i = first(keys[base + j]);
+                out_indexes[base + j] = null_index;
+                if (i != null_index)
+                {
+                    HASH_INDEX_PREFETCH(&m_index_chain[i]);
+                    HASH_INDEX_PREFETCH(&collection[i]);
+                    cursors[j] = i;
+                    active[num_active++] = j;
+                }
+            }
+
+            // Stage 3: Advance all unresolved chain walks one hop per round.
+            while (num_active != 0)
+            {
+                size_type still_active = 0;
+                for (size_type a = 0; a < num_active; ++a)
+                {
+                    const size_type  j = active[a];
+                    const index_type i = cursors[j];
+
+                    HASH_INDEX_COUNT(++m_counters.lookup_probes);
+                    if (may_match(i, keys[base + j]))
+                    {
+                        HASH_INDEX_COUNT(++m_counters.predicate_calls);
+                        if (pred(needles[base + j], collection[i]))
+                        {
+                            out_indexes[base + j] = i;
+                            continue;
+                        }
+                    }
+
+                    const index_type n = next(i);
+                    if (n != null_index)
+                    {
+                        HASH_INDEX_PREFETCH(&m_index_chain[n]);
+                        HASH_INDEX_PREFETCH(&collection[n]);
+                        cursors[j] = n;
+                        active[still_active++] = j;
+                    }
+                }
+                num_active = still_active;
+            }
+        }
+    }
+
+    template<typename ValueType, typename CollectionType>
+    void find_many(const key_type * keys, const ValueType * needles, const size_type count,
+                   const CollectionType & collection, index_type * out_indexes) const
+    {
+        find_many(keys, needles, count, collection, std::equal_to<ValueType>{}, out_indexes);
+    }
+
+    #if defined(HASH_INDEX_COROUTINES)
+    //
+    // Coroutine lookup, with the same result of find(). It suspends after prefetching
+    // the bucket, then after prefetching each index chain entry and collection item
+    // it is about to read, queuing itself back on the scheduler every time. Running
+    // many of them on one scheduler overlaps their cache misses, like find_many(),
+    // but from code that can't gather the keys in an array first. The hash index,
+    // needle and collection must stay alive and unmodified until the lookup is done.
+    //
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    hash_index_lookup<index_type> find_async(hash_index_scheduler & scheduler, const key_type key, const ValueType & needle,
+                                             const CollectionType & collection, Predicate pred) const
+    {
+        using yield = typename hash_index_lookup<index_type>::yield_awaiter;
+        (void)scheduler; // Taken by the promise.
+
+        HASH_INDEX_COUNT(++m_counters.lookups);
+        HASH_INDEX_PREFETCH(bucket_of(key));
+        co_await yield{};
+
+        for (index_type i = first(key); i != null_index; i = next(i))
+        {
+            HASH_INDEX_PREFETCH(&m_index_chain[i]);
+            HASH_INDEX_PREFETCH(&collection[i]);
+            co_await yield{};
+
+            HASH_INDEX_COUNT(++m_counters.lookup_probes);
+            if (!may_match(i, key))
+            {
+                continue;
+            }
+
+            HASH_INDEX_COUNT(++m_counters.predicate_calls);
+            if (pred(needle, collection[i]))
+            {
+                co_return i;
+            }
+        }
+        co_return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    hash_index_lookup<index_type> find_async(hash_index_scheduler & scheduler, const key_type key, const ValueType & needle,
+                                             const CollectionType & collection) const
+    {
+        return find_async(scheduler, key, needle, collection, std::equal_to<ValueType>{});
+    }
+    #endif // HASH_INDEX_COROUTINES
+
+    //
+    // Iteration:
+    //
+    // chain(key) yields the same indexes as a first()/next() walk, so it can replace
+    // the manual loop; Remember that includes the indexes of other keys in the bucket:
+    //
+    //  for (const auto i : hash_idx.chain(key))
+    //  {
+    //      if (values[i].name == name) { ... }
+    //  }
+    //
+    // entries() yields every index in the table once, in bucket order, for snapshots
+    // or garbage collection passes over the value collection. Sort the indexes for
+    // index order, since erased indexes are not marked and can't be told apart
+    // from the chain tails by scanning the index chain.
+    //
+
+    iteration_range<chain_iterator> chain(const key_type key) const noexcept
+    {
+        return { chain_iterator{ m_index_chain, first(key) }, chain_iterator{ m_index_chain, null_index } };
+    }
+
+    iteration_range<entry_iterator> entries() const noexcept
+    {
+        return { entry_iterator{ this, 0 }, entry_iterator{ this, chain_positions() } };
+    }
+
+    //
+    // Insertion / removal:
+    //
+
+    void insert(const key_type key, const index_type index)
+    {
+        if (!is_allocated())
+        {
+            const size_type index_chain_size = ((static_cast<size_type>(index) >= m_index_chain_size) ?
+                                                index + 1 : m_index_chain_size);
+            internal_allocate(m_hash_buckets_size, index_chain_size);
+        }
+        else if (index >= m_index_chain_size)
+        {
+            grow_index_chain(index + 1);
+        }
+
+        if (m_old_hash_buckets != nullptr)
+        {
+            migrate_buckets(insert_rehash_step());
+        }
+
+        index_type * const head = bucket_of(key);
+        m_index_chain[index] = *head;
+        *head = index;
+
+        if (m_prev_chain != nullptr)
+        {
+            link_prev(index);
+        }
+        if (m_hash_keys != nullptr)
+        {
+            m_hash_keys[index] = key;
+        }
+        if (m_fingerprints != nullptr)
+        {
+            m_fingerprints[index] = fingerprint_of(key);
+        }
+
+        // Rehash threshold is the max size_type if the auto-rehash policy is disabled.
+        if (++m_num_items > m_rehash_threshold)
+        {
+            if (m_rehash_step != 0)
+            {
+                start_incremental_rehash(next_power_of_two(m_hash_buckets_size * m_growth_factor));
+            }
+            else
+            {
+                rehash(m_hash_buckets_size * m_growth_factor);
+            }
+        }
+    }
+
+    void erase(const key_type key, const index_type index)
+    {
+        erase_entry(key, index);
+        shrink_if_sparse();
+    }
+
+
+    // insert() / erase() with the key of 'value' computed by hashed_key(). See find_hashed().
+    template<typename ValueType>
+    void insert_hashed(const ValueType & value, const index_type index)
+    {
+        insert(hashed_key(value), index);
+    }
+
+    template<typename ValueType>
+    void erase_hashed(const ValueType & value, const index_type index)
+    {
+        erase(hashed_key(value), index);
+    }
+
+    // Insert an entry into the index chain and add it to the hash, increasing all indexes >= index.
+    void insert_at_index(const key_type key, const index_type index)
+    {
+        insert_at_indexes(&key, &index, 1);
+    }
+
+    // Remove an entry from the index chain and remove it from the hash, decreasing all indexes >= index.
+    void erase_and_remove_index(const key_type key, const index_type index)
+    {
+        erase_and_remove_indexes(&key, &index, 1);
+    }
+
+    //
+    // Batched form of insert_at_index(), applying all insertions in a single sweep over
+    // the hash buckets and index chain. 'indexes' must be strictly increasing and refer
+    // to the positions of the new entries after all of them are inserted, which is
+    // the same as calling insert_at_index() for each (key, index) pair in order.
+    //
+    void insert_at_indexes(const key_type * keys, const index_type * indexes, const size_type count)
+    {
+        HASH_INDEX_ASSERT((keys != nullptr && indexes != nullptr) || count == 0);
+        HASH_INDEX_ASSERT(std::adjacent_find(indexes, indexes + count, std::greater_equal<index_type>{}) == indexes + count &&
+                          "Indexes must be strictly increasing!");
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        if (is_allocated())
+        {
+            // Every bucket is shifted below, so the old array can't be left pending.
+            finish_rehash();
+
+            // The number of new entries that land before an existing index 'v'
+            // is the count of positions p[j] with (p[j] - j) <= v, i.e. with fewer
+            // existing entries before them than 'v' has.
+            auto shift_of = [indexes, count](const index_type v) -> index_type
+            {
+                size_type lo = 0;
+                size_type hi = count;
+                while (lo < hi)
+                {
+                    const size_type mid = lo + (hi - lo) / 2;
+                    if (static_cast<size_type>(indexes[mid]) - mid <= static_cast<size_type>(v))
+                    {
+                        lo = mid + 1;
+                    }
+                    else
+                    {
+                        hi = mid;
+                    }
+                }
+                return static_cast<index_type>(lo);
+            };
+
+            index_type max_old;
+            if (count == 1)
+            {
+                max_old = std::max(shift_up(m_hash_buckets, m_hash_buckets_size, indexes[0]),
+                                   shift_up(m_index_chain,  m_index_chain_size,  indexes[0]));
+                if (m_prev_chain != nullptr)
+                {
+                    shift_up(m_prev_chain, m_index_chain_size, indexes[0]);
+                }
+            }
+            else
+            {
+                max_old = std::max(shift_by(m_hash_buckets, m_hash_buckets_size, shift_of),
+                                   shift_by(m_index_chain,  m_index_chain_size,  shift_of));
+                if (m_prev_chain != nullptr)
+                {
+                    shift_by(m_prev_chain, m_index_chain_size, shift_of);
+                }
+            }
+
+            // Move the chain entries of the shifted indexes to their new positions,
+            // top-down since they only move up. Entries below indexes[0] stay put.
+            const size_type first_moved = static_cast<size_type>(indexes[0]);
+            if (max_old != null_index && static_cast<size_type>(max_old) >= first_moved)
+            {
+                const size_type top = static_cast<size_type>(max_old) + count;
+                if (top >= m_index_chain_size)
+                {
+                    grow_index_chain(top + 1);
+                }
+
+                size_type j = count;
+                for (size_type v = static_cast<size_type>(max_old) + 1; v-- > first_moved;)
+                {
+                    while (j > 0 && static_cast<size_type>(indexes[j - 1]) - (j - 1) > v)
+                    {
+                        --j;
+                    }
+                    move_chain_entry(v, v + j);
+                }
+            }
+
+            for (size_type j = 0; j < count; ++j)
+            {
+                if (static_cast<size_type>(indexes[j]) < m_index_chain_size)
+                {
+                    m_index_chain[indexes[j]] = null_index;
+                    if (m_prev_chain != nullptr)
+                    {
+                        m_prev_chain[indexes[j]] = null_index;
+                    }
+                }
+            }
+        }
+
+        for (size_type j = 0; j < count; ++j)
+        {
+            insert(keys[j], indexes[j]);
+        }
+    }
+
+    //
+    // Batched form of erase_and_remove_index(). 'indexes' must be strictly increasing
+    // and refer to the positions of the entries before any of them are removed, like
+    // the positions of the elements removed from the value array in an erase pass.
+    //
+    void erase_and_remove_indexes(const key_type * keys, const index_type * indexes, const size_type count)
+    {
+        HASH_INDEX_ASSERT((keys != nullptr && indexes != nullptr) || count == 0);
+        HASH_INDEX_ASSERT(std::adjacent_find(indexes, indexes + count, std::greater_equal<index_type>{}) == indexes + count &&
+                          "Indexes must be strictly increasing!");
+
+        if (!is_allocated() || count == 0)
+        {
+            return;
+        }
+
+        finish_rehash();
+        for (size_type j = 0; j < count; ++j)
+        {
+            HASH_INDEX_ASSERT(static_cast<size_type>(indexes[j]) < m_index_chain_size);
+            erase_entry(keys[j], indexes[j]);
+        }
+
+        // No entry references the removed indexes anymore, so every remaining
+        // index 'v' just moves down by the number of removed positions below it.
+        auto shift_of = [indexes, count](const index_type v) -> index_type
+        {
+            const index_type * const it = std::lower_bound(indexes, indexes + count, v);
+            return static_cast<index_type>(0) - static_cast<index_type>(it - indexes);
+        };
+
+        index_type max_old;
+        if (count == 1)
+        {
+            max_old = std::max(shift_down(m_hash_buckets, m_hash_buckets_size, indexes[0]),
+                               shift_down(m_index_chain,  m_index_chain_size,  indexes[0]));
+            if (m_prev_chain != nullptr)
+            {
+                shift_down(m_prev_chain, m_index_chain_size, indexes[0]);
+            }
+        }
+        else
+        {
+            max_old = std::max(shift_by(m_hash_buckets, m_hash_buckets_size, shift_of),
+                               shift_by(m_index_chain,  m_index_chain_size,  shift_of));
+            if (m_prev_chain != nullptr)
+            {
+                shift_by(m_prev_chain, m_index_chain_size, shift_of);
+            }
+        }
+
+        // Close the gaps in the chain, bottom-up since entries only move down.
+        size_type top = static_cast<size_type>(indexes[count - 1]);
+        if (max_old != null_index && static_cast<size_type>(max_old) > top)
+        {
+            top = static_cast<size_type>(max_old);
+        }
+
+        size_type j = 0;
+        for (size_type v = static_cast<size_type>(indexes[0]); v <= top; ++v)
+        {
+            if (j < count && static_cast<size_type>(indexes[j]) == v)
+            {
+                ++j;
+                continue;
+            }
+            move_chain_entry(v, v - j);
+        }
+        for (size_type v = top + 1 - count; v <= top; ++v)
+        {
+            m_index_chain[v] = null_index;
+            if (m_prev_chain != nullptr)
+            {
+                m_prev_chain[v] = null_index;
+            }
+        }
+
+        // Only once the arrays are consistent again, they may be shrunk.
+        shrink_if_sparse();
+    }
+
+    //
+    // Rewrite every index in one pass after the value array was compacted or otherwise
+    // reordered. remap[old_index] is the new position of the value that was at old_index,
+    // or null_index if it was removed, in which case it is also unlinked from the hash.
+    // remap_size must cover every index currently linked, and the new positions must be
+    // unique and fit the current index chain. Order of duplicate keys is preserved.
+    //
+    void compact(const index_type * remap, const size_type remap_size)
+    {
+        HASH_INDEX_ASSERT(remap != nullptr || remap_size == 0);
+
+        if (!is_allocated())
+        {
+            return;
+        }
+
+        finish_rehash();
+        const index_type fill_val = null_index;
+        index_type * new_index_chain = Allocator::allocate(m_index_chain_size);
+        std::fill_n(new_index_chain, m_index_chain_size, fill_val);
+
+        key_type         * new_hash_keys    = (m_hash_keys    != nullptr) ? allocate_array<key_type>(m_index_chain_size)         : nullptr;
+        fingerprint_type * new_fingerprints = (m_fingerprints != nullptr) ? allocate_array<fingerprint_type>(m_index_chain_size) : nullptr;
+
+        // The old back links are never read, so these are rebuilt in place.
+        if (m_prev_chain != nullptr)
+        {
+            std::fill_n(m_prev_chain, m_index_chain_size, fill_val);
+        }
+
+        size_type num_items = 0;
+        for (size_type b = 0; b < m_hash_buckets_size; ++b)
+        {
+            // Rebuild each chain in order, dropping the removed entries.
+            index_type * link = &m_hash_buckets[b];
+            index_type   prev = null_index;
+            for (index_type i = m_hash_buckets[b]; i != null_index; i = m_index_chain[i])
+            {
+                HASH_INDEX_ASSERT(static_cast<size_type>(i) < remap_size && "Remap table doesn't cover all indexes!");
+
+                const index_type r = remap[i];
+                if (r == null_index)
+                {
+                    continue;
+                }
+
+                HASH_INDEX_ASSERT(static_cast<size_type>(r) < m_index_chain_size);
+                *link = r;
+                link  = &new_index_chain[r];
+
+                if (new_hash_keys    != nullptr) { new_hash_keys[r]    = m_hash_keys[i];    }
+                if (new_fingerprints != nullptr) { new_fingerprints[r] = m_fingerprints[i]; }
+                if (m_prev_chain     != nullptr) { m_prev_chain[r]     = prev;              }
+                prev = r;
+                ++num_items;
+            }
+            *link = null_index;
+        }
+
+        Allocator::deallocate(m_index_chain, m_index_chain_size);
+        m_index_chain = new_index_chain;
+
+        if (m_hash_keys != nullptr)
+        {
+            deallocate_array(m_hash_keys, m_index_chain_size);
+            m_hash_keys = new_hash_keys;
+        }
+        if (m_fingerprints != nullptr)
+        {
+            deallocate_array(m_fingerprints, m_index_chain_size);
+            m_fingerprints = new_fingerprints;
+        }
+
+        m_num_items = num_items;
+        shrink_if_sparse();
+    }
+
+    //
+    // Bulk construction:
+    //
+
+    // Replaces the contents of the hash_index with keys[0..count-1], where each
+    // key maps to its position in the array, i.e. keys[i] is linked to index i.
+    // Both arrays are allocated exactly once and filled in a single tight loop.
+    // If new_hash_buckets_size is zero, the bucket count is derived from 'count'
+    // (respecting the max load factor, if set), otherwise it is used as is and
+    // must be a power-of-two. The end result is the same as calling insert()
+    // for each key in order, minus the per-item overhead.
+    void build(const key_type * keys, const size_type count, const size_type new_hash_buckets_size = 0)
+    {
+        HASH_INDEX_ASSERT(keys != nullptr || count == 0);
+        build_from(keys, count, new_hash_buckets_size);
+    }
+
+    // Same as above for any ForwardIterator range of keys convertible to key_type.
+    template<typename ForwardIterator>
+    void build(ForwardIterator first, ForwardIterator last, const size_type new_hash_buckets_size = 0)
+    {
+        build_from(first, static_cast<size_type>(std::distance(first, last)), new_hash_buckets_size);
+    }
+
+    #if defined(HASH_INDEX_ENABLE_PARALLEL)
+    //
+    // Parallel construction / rehash (needs HASH_INDEX_ENABLE_PARALLEL):
+    //
+    // build_parallel() yields exactly the same table as build(keys, count), using up to
+    // num_threads threads (0 for std::thread::hardware_concurrency()). Bucket ranges are
+    // split into partitions, the indexes of each partition are gathered in increasing
+    // order, then every thread links the keys of its own partitions, so each bucket and
+    // index chain entry has a single writer and no locking is needed. Costs a temporary
+    // array of 'count' indexes. Threads are started per call, see parallel_grain.
+    //
+    void build_parallel(const key_type * keys, const size_type count, const unsigned num_threads = 0,
+                        const size_type new_hash_buckets_size = 0)
+    {
+        HASH_INDEX_ASSERT(keys != nullptr || count == 0);
+
+        const size_type threads = parallel_thread_count(num_threads, count);
+        if (threads <= 1)
+        {
+            build_from(keys, count, new_hash_buckets_size);
+            return;
+        }
+
+        const size_type buckets_size = allocate_for_build(count, new_hash_buckets_size);
+        const key_type  hash_mask    = static_cast<key_type>(m_hash_mask);
+
+        // Contiguous bucket ranges; A power-of-two of them so the partition is a shift away.
+        size_type partitions = 1;
+        while (partitions < threads && partitions < buckets_size)
+        {
+            partitions <<= 1;
+        }
+        int partition_shift = 0;
+        while ((partitions << partition_shift) < buckets_size)
+        {
+            ++partition_shift;
+        }
+        auto partition_of = [keys, hash_mask, partition_shift](const size_type i)
+        {
+            return static_cast<size_type>(keys[i] & hash_mask) >> partition_shift;
+        };
+
+        // offsets[t * partitions + p] counts, then positions, the indexes of
+        // chunk t in partition p. order[] has the indexes sorted by partition.
+        const size_type chunk_size = (count + threads - 1) / threads;
+        size_type  * const offsets = allocate_array<size_type>(threads * partitions);
+        size_type  * const begins  = allocate_array<size_type>(partitions + 1);
+        index_type * const order   = allocate_array<index_type>(count);
+        std::fill_n(offsets, threads * partitions, size_type(0));
+
+        run_parallel(threads, [&](const size_type t)
+        {
+            const size_type last = std::min(count, (t + 1) * chunk_size);
+            for (size_type i = t * chunk_size; i < last; ++i)
+            {
+                ++offsets[t * partitions + partition_of(i)];
+            }
+        });
+
+        size_type position = 0;
+        for (size_type p = 0; p < partitions; ++p)
+        {
+            begins[p] = position;
+            for (size_type t = 0; t < threads; ++t)
+            {
+                const size_type n = offsets[t * partitions + p];
+                offsets[t * partitions + p] = position;
+                position += n;
+            }
+        }
+        begins[partitions] = position;
+
+        run_parallel(threads, [&](const size_type t)
+        {
+            const size_type last = std::min(count, (t + 1) * chunk_size);
+            for (size_type i = t * chunk_size; i < last; ++i)
+            {
+                order[offsets[t * partitions + partition_of(i)]++] = static_cast<index_type>(i);
+            }
+        });
+
+        run_parallel(threads, [&](const size_type t)
+        {
+            const index_type fill_val = null_index;
+            for (size_type p = t; p < partitions; p += threads)
+            {
+                std::fill_n(m_hash_buckets + (p << partition_shift), size_type(1) << partition_shift, fill_val);
+                for (size_type j = begins[p]; j < begins[p + 1]; ++j)
+                {
+                    link_built_index(order[j], keys[order[j]]);
+                }
+            }
+        });
+
+        deallocate_array(offsets, threads * partitions);
+        deallocate_array(begins,  partitions + 1);
+        deallocate_array(order,   count);
+
+        m_num_items = count;
+        if (m_num_items > m_rehash_threshold)
+        {
+            rehash_parallel(next_power_of_two(m_hash_buckets_size * m_growth_factor), num_threads);
+        }
+    }
+
+    // Same as rehash(), relinking the chains from up to num_threads threads. When growing,
+    // every old bucket feeds its own set of new buckets (old_bucket + n * old_size), and
+    // when shrinking every new bucket is fed by its own set of old buckets, so the work
+    // splits in disjoint bucket ranges. The result is identical to that of rehash().
+    void rehash_parallel(const size_type new_hash_buckets_size, const unsigned num_threads = 0)
+    {
+        HASH_INDEX_ASSERT((m_hash_keys != nullptr || m_num_items == 0) && "rehash_parallel() without a key function requires key retention!");
+        rehash_parallel(new_hash_buckets_size, num_threads, [this](const index_type index) { return m_hash_keys[index]; });
+    }
+
+    // With the key of each linked index provided by the caller, like in rehash().
+    // key_of_index is called concurrently from all the threads.
+    template<typename KeyFunc>
+    void rehash_parallel(const size_type new_hash_buckets_size, const unsigned num_threads, KeyFunc key_of_index)
+    {
+        HASH_INDEX_ASSERT(new_hash_buckets_size > 0);
+        const size_type new_size = next_power_of_two(new_hash_buckets_size);
+        finish_rehash();
+
+        const size_type threads = parallel_thread_count(num_threads, m_num_items);
+        if (threads <= 1 || !is_allocated() || new_size == m_hash_buckets_size)
+        {
+            rehash(new_size, key_of_index);
+            return;
+        }
+
+        const size_type old_size = m_hash_buckets_size;
+        const size_type new_hash_mask = new_size - 1;
+        index_type * const new_hash_buckets = Allocator::allocate(new_size);
+
+        // Chunks of the smaller bucket array, whose buckets each map to a disjoint set of the larger one.
+        const size_type range      = std::min(old_size, new_size);
+        const size_type chunk_size = (range + threads - 1) / threads;
+
+        run_parallel(threads, [&](const size_type t)
+        {
+            const size_type last = std::min(range, (t + 1) * chunk_size);
+            for (size_type b = t * chunk_size; b < last; ++b)
+            {
+                if (new_size > old_size)
+                {
+                    for (size_type n = b; n < new_size; n += old_size)
+                    {
+                        new_hash_buckets[n] = null_index;
+                    }
+                    relink_chain(m_hash_buckets[b], new_hash_buckets, new_hash_mask, key_of_index);
+                }
+                else
+                {
+                    // Old buckets in increasing order, same as the rehash() loop.
+                    new_hash_buckets[b] = null_index;
+                    for (size_type ob = b; ob < old_size; ob += new_size)
+                    {
+                        relink_chain(m_hash_buckets[ob], new_hash_buckets, new_hash_mask, key_of_index);
+                    }
+                }
+            }
+        });
+
+        Allocator::deallocate(m_hash_buckets, m_hash_buckets_size);
+        m_hash_buckets      = new_hash_buckets;
+        m_hash_buckets_size = new_size;
+        m_hash_mask         = new_hash_mask;
+        update_rehash_threshold();
+    }
+    #endif // HASH_INDEX_ENABLE_PARALLEL
+
+    //
+    // Memory management:
+    //
+
+    void clear() noexcept
+    {
+        free_old_buckets();
+        if (m_hash_buckets != m_invalid_index_dummy)
+        {
+            const index_type fill_val = null_index;
+            std::fill_n(m_hash_buckets, m_hash_buckets_size, fill_val);
+        }
+        if (m_prev_chain != nullptr)
+        {
+            // Unlike the index chain, stale back links would be followed by erase().
+            const index_type fill_val = null_index;
+            std::fill_n(m_prev_chain, m_index_chain_size, fill_val);
+        }
+        m_num_items = 0;
+        // Clearing the index chain is not strictly necessary since
+        // inserting new elements in the hash_index will overwrite
+        // corresponding index chain entries.
+    }
+
+    void clear_and_resize(const size_type new_hash_buckets_size, const size_type new_index_chain_size)
+    {
+        HASH_INDEX_ASSERT(is_power_of_two(new_hash_buckets_size) && "Size of hash_index buckets array must be a power-of-2!");
+
+        clear_and_free();
+        m_hash_buckets_size = new_hash_buckets_size;
+        m_index_chain_size  = new_index_chain_size;
+        m_hash_mask         = m_hash_buckets_size - 1;
+        update_rehash_threshold();
+    }
+
+    void clear_and_free()
+    {
+        free_old_buckets();
+        if (m_hash_buckets != m_invalid_index_dummy)
+        {
+            Allocator::deallocate(m_hash_buckets, m_hash_buckets_size);
+            m_hash_buckets = m_invalid_index_dummy;
+        }
+        if (m_index_chain != m_invalid_index_dummy)
+        {
+            Allocator::deallocate(m_index_chain, m_index_chain_size);
+            m_index_chain = m_invalid_index_dummy;
+        }
+        if (m_hash_keys != nullptr)
+        {
+            deallocate_array<key_type>(m_hash_keys, m_index_chain_size);
+            m_hash_keys = nullptr;
+        }
+        if (m_fingerprints != nullptr)
+        {
+            deallocate_array(m_fingerprints, m_index_chain_size);
+            m_fingerprints = nullptr;
+        }
+        if (m_prev_chain != nullptr)
+        {
+            deallocate_array(m_prev_chain, m_index_chain_size);
+            m_prev_chain = nullptr;
+        }
+        m_lookup_mask = 0;
+        m_num_items   = 0;
+    }
+
+    // Forgets all the memory held by the hash_index, leaving it cleared and
+    // unallocated, without returning anything to the allocator. Only meant for
+    // allocators that reclaim in bulk, like an arena about to be reset or already
+    // reset, where deallocating each array would be wasted work or even invalid.
+    void abandon_memory() noexcept
+    {
+        m_hash_buckets = m_invalid_index_dummy;
+        m_index_chain  = m_invalid_index_dummy;
+        m_hash_keys    = nullptr;
+        m_fingerprints = nullptr;
+        m_prev_chain   = nullptr;
+        m_lookup_mask  = 0;
+        m_num_items    = 0;
+        m_old_hash_buckets      = nullptr;
+        m_old_hash_buckets_size = 0;
+        m_old_hash_mask         = 0;
+        m_rehash_position       = 0;
+    }
+
+    Allocator get_allocator() const
+    {
+        return static_cast<const Allocator &>(*this);
+    }
+
+    void set_granularity(const size_type new_granularity)
+    {
+        HASH_INDEX_ASSERT(new_granularity > 0);
+        m_granularity = new_granularity;
+    }
+
+    // Growth policy of the index chain when insert() is given an index past its end.
+    // By default (growth_factor of 1) the chain grows to the smallest multiple of the
+    // granularity holding the new index, so appending N indexes one by one reallocates
+    // and copies the whole chain every granularity() inserts, which is quadratic in N.
+    // With a growth_factor above 1 (e.g. 1.5 or 2) it grows to at least that many times
+    // the current size instead, still rounded up to the granularity, for amortized
+    // constant time appends. Applies to insert() and insert_at_index(); An explicit
+    // resize_index_chain() or reserve_index_chain() is always sized as requested.
+    void set_index_chain_growth(const float growth_factor)
+    {
+        HASH_INDEX_ASSERT(growth_factor >= 1.0f && "Index chain growth factor can't shrink the chain!");
+        m_chain_growth_factor = growth_factor;
+    }
+
+    // Sizes the index chain to hold indexes [0, count) upfront, rounded up to the
+    // granularity, so that inserting them never reallocates the chain. Unlike
+    // reserve(), the hash buckets are left as they are.
+    void reserve_index_chain(const size_type count)
+    {
+        resize_index_chain(count);
+    }
+
+    void resize_index_chain(const size_type new_index_chain_size)
+    {
+        if (new_index_chain_size <= m_index_chain_size)
+        {
+            return;
+        }
+
+        size_type new_size;
+        const auto mod = new_index_chain_size % m_granularity;
+
+        if (mod == 0)
+        {
+            new_size = new_index_chain_size;
+        }
+        else
+        {
+            new_size = new_index_chain_size + m_granularity - mod;
+        }
+
+        if (m_index_chain == m_invalid_index_dummy) // Not allocated yet; Defer.
+        {
+            m_index_chain_size = new_size;
+            return;
+        }
+
+        const auto old_index_chain_size = m_index_chain_size;
+
+        // Grows in place if the allocator can, see try_expand().
+        resize_array(m_index_chain, old_index_chain_size, new_size);
+
+        // Newly allocated space must be filled with null_index
+        const index_type fill_val = null_index;
+        std::fill_n(m_index_chain + old_index_chain_size, new_size - old_index_chain_size, fill_val);
+
+        // Keys/fingerprints past the largest inserted index are never read, so no need to fill those.
+        if (m_hash_keys != nullptr)
+        {
+            resize_array(m_hash_keys, old_index_chain_size, new_size);
+        }
+        if (m_fingerprints != nullptr)
+        {
+            resize_array(m_fingerprints, old_index_chain_size, new_size);
+        }
+        if (m_prev_chain != nullptr)
+        {
+            resize_array(m_prev_chain, old_index_chain_size, new_size);
+            std::fill_n(m_prev_chain + old_index_chain_size, new_size - old_index_chain_size, fill_val);
+        }
+
+        m_index_chain_size = new_size;
+    }
+
+    //
+    // Returns the memory not needed by the indexes still linked, e.g. after erasing
+    // most of them. The index chain and its parallel arrays are reallocated to the
+    // highest linked index + 1, rounded up to the granularity, so indexes past that
+    // can't be given to erase() anymore. With key retention, the hash buckets are
+    // also shrunk by rehashing down to the size reserve() would pick for size()
+    // items. An empty table frees all of its arrays, same as clear_and_free(), and
+    // with key retention the bucket count also drops to that of a single item.
+    // Finishes any incremental rehash. See also set_min_load_factor().
+    //
+    void shrink_to_fit()
+    {
+        if (m_hash_keys != nullptr)
+        {
+            shrink_to_fit([this](const index_type index) { return m_hash_keys[index]; });
+        }
+        else
+        {
+            shrink_index_chain();
+        }
+    }
+
+    // Same as above, always shrinking the hash buckets, with the key of each linked
+    // index provided by the caller. See rehash(new_hash_buckets_size, key_of_index).
+    template<typename KeyFunc>
+    void shrink_to_fit(KeyFunc key_of_index)
+    {
+        shrink_index_chain();
+        if (!is_allocated())
+        {
+            return;
+        }
+
+        const size_type wanted_buckets = fitted_hash_buckets_size();
+        if (wanted_buckets < m_hash_buckets_size)
+        {
+            rehash(wanted_buckets, key_of_index);
+        }
+    }
+
+    //
+    // Rehashing:
+    //
+
+    // Keep a copy of every inserted hash key in a parallel array, so that the
+    // hash buckets can later be rebuilt without help from the caller. Costs an
+    // extra sizeof(key_type) per index chain entry. Can only be toggled while
+    // the hash_index is empty.
+    void set_key_retention(const bool retain)
+    {
+        HASH_INDEX_ASSERT(m_num_items == 0 && "Key retention can only change on an empty hash_index!");
+
+        if (retain == m_retain_keys)
+        {
+            return;
+        }
+
+        m_retain_keys = retain;
+        if (!is_allocated())
+        {
+            return; // Deferred to internal_allocate().
+        }
+
+        if (retain)
+        {
+            m_hash_keys = allocate_array<key_type>(m_index_chain_size);
+        }
+        else
+        {
+            deallocate_array<key_type>(m_hash_keys, m_index_chain_size);
+            m_hash_keys = nullptr;
+        }
+    }
+
+    // Keep a small fingerprint (the top bits) of every inserted hash key in a
+    // parallel array. find() then compares fingerprints before invoking the
+    // predicate, skipping most of the chain entries that only share a bucket
+    // with the key without touching the external collection. Costs an extra
+    // sizeof(fingerprint_type) per index chain entry. Only useful with hash
+    // functions that produce well-mixed high bits. Has no effect if full keys
+    // are already retained (see set_key_retention()), since those are used
+    // for the same purpose. Can only be toggled while the hash_index is empty.
+    void set_fingerprints(const bool use_fingerprints)
+    {
+        HASH_INDEX_ASSERT(m_num_items == 0 && "Fingerprints can only change on an empty hash_index!");
+
+        if (use_fingerprints == m_use_fingerprints)
+        {
+            return;
+        }
+
+        m_use_fingerprints = use_fingerprints;
+        if (!is_allocated())
+        {
+            return; // Deferred to internal_allocate().
+        }
+
+        if (use_fingerprints)
+        {
+            m_fingerprints = allocate_array<fingerprint_type>(m_index_chain_size);
+        }
+        else
+        {
+            deallocate_array(m_fingerprints, m_index_chain_size);
+            m_fingerprints = nullptr;
+        }
+    }
+
+    // Keep a back link to the previous entry of every index in its chain, in
+    // a parallel array, so that erase() unlinks in constant time instead of
+    // walking the chain from the bucket head looking for the predecessor. The
+    // batched erase_and_remove_indexes() benefits the same. Costs an extra
+    // sizeof(index_type) per index chain entry and makes clear() O(n). Since
+    // the links can be derived from the chains, this can be toggled any time.
+    // With it enabled, erase() must be given the same key used to insert the
+    // index, since the bucket is no longer searched to confirm the index is there.
+    void set_prev_chain(const bool use_prev_chain)
+    {
+        if (use_prev_chain == m_use_prev_chain)
+        {
+            return;
+        }
+
+        m_use_prev_chain = use_prev_chain;
+        if (!is_allocated())
+        {
+            return; // Deferred to internal_allocate().
+        }
+
+        if (use_prev_chain)
+        {
+            m_prev_chain = allocate_array<index_type>(m_index_chain_size);
+            rebuild_prev_chain();
+        }
+        else
+        {
+            deallocate_array(m_prev_chain, m_index_chain_size);
+            m_prev_chain = nullptr;
+        }
+    }
+
+    // Opt-in automatic growth of the hash buckets array. When the number of linked
+    // indexes exceeds max_load_factor * hash_buckets_size(), the next insert() will
+    // grow the buckets by growth_factor (rounded up to a power-of-two) and relink
+    // the index chain in place. Enabling it turns on key retention, so it must be
+    // set before inserting anything. A max_load_factor of zero disables it again.
+    void set_max_load_factor(const float max_load_factor, const size_type growth_factor = 2)
+    {
+        HASH_INDEX_ASSERT(max_load_factor >= 0.0f);
+        HASH_INDEX_ASSERT(growth_factor >= 2 && "Growth factor must actually grow the table!");
+
+        if (max_load_factor > 0.0f)
+        {
+            set_key_retention(true);
+        }
+
+        m_max_load_factor = max_load_factor;
+        m_growth_factor   = growth_factor;
+        update_rehash_threshold();
+    }
+
+    // Opt-in automatic shrinking, the low watermark counterpart of set_max_load_factor().
+    // When erase() leaves fewer than min_load_factor * hash_buckets_size() linked indexes,
+    // it calls shrink_to_fit(), which relinks the whole table at once even if incremental
+    // rehash is enabled. Requires the max load factor to be set, with min_load_factor *
+    // growth_factor below it, so that a table just grown or shrunk is not immediately
+    // resized back the other way. A min_load_factor of zero (the default) disables it.
+    void set_min_load_factor(const float min_load_factor)
+    {
+        HASH_INDEX_ASSERT(min_load_factor >= 0.0f);
+        HASH_INDEX_ASSERT((min_load_factor == 0.0f || min_load_factor * static_cast<float>(m_growth_factor) < m_max_load_factor) &&
+                          "Min load factor times the growth factor must be below the max load factor!");
+
+        m_min_load_factor = min_load_factor;
+        update_rehash_threshold();
+    }
+
+    // Spread the automatic growth of set_max_load_factor() over the following operations,
+    // instead of relinking the whole table inside the insert() that crosses the threshold.
+    // That insert() only allocates the larger bucket array and keeps the old one, then
+    // every insert() and erase() migrates the next buckets_per_operation old buckets to
+    // the new array, until none is left and the old array is freed. Lookups in between
+    // go to the old array if the old bucket of the key is still pending, or to the new
+    // one otherwise, so the worst case cost of an operation is bounded by the step size
+    // (plus the chain lengths) rather than by the table size. With a low max load factor
+    // the new array can reach its own threshold before a small step is done with the old
+    // one, so insert() migrates more than the step when needed to finish in time, up to
+    // 1 / ((growth_factor - 1) * max_load_factor) buckets per call. The final layout is the
+    // same as with the stop-the-world rehash. Zero (the default) disables it, finishing
+    // any pending migration. Operations over the whole table (rehash(), compact() and
+    // the index shifting ones) also finish the migration before doing their work.
+    void set_incremental_rehash(const size_type buckets_per_operation)
+    {
+        if (buckets_per_operation == 0)
+        {
+            finish_rehash();
+        }
+        m_rehash_step = buckets_per_operation;
+    }
+
+    // Migrates all buckets still pending from an incremental rehash, if any.
+    void finish_rehash() noexcept
+    {
+        if (m_old_hash_buckets != nullptr)
+        {
+            migrate_buckets(m_old_hash_buckets_size);
+        }
+    }
+
+    // Rebuild the hash buckets with a new power-of-two size (rounded up if not),
+    // relinking the existing index chain in place, using the retained keys.
+    void rehash(const size_type new_hash_buckets_size)
+    {
+        HASH_INDEX_ASSERT((m_hash_keys != nullptr || m_num_items == 0) && "rehash() without a key function requires key retention!");
+        rehash(new_hash_buckets_size, [this](const index_type index) { return m_hash_keys[index]; });
+    }
+
+    // Same as above, but the key of each linked index is provided by the caller,
+    // so it works even without key retention. KeyFunc is any callable with the
+    // signature key_type(index_type), typically hashing the value at that index.
+    template<typename KeyFunc>
+    void rehash(const size_type new_hash_buckets_size, KeyFunc key_of_index)
+    {
+        HASH_INDEX_ASSERT(new_hash_buckets_size > 0);
+        const size_type new_size = next_power_of_two(new_hash_buckets_size);
+        finish_rehash();
+
+        if (!is_allocated())
+        {
+            // Empty; Defer the allocation to the first insert().
+            m_hash_buckets_size = new_size;
+            m_hash_mask         = new_size - 1;
+            update_rehash_threshold();
+            return;
+        }
+
+        if (new_size == m_hash_buckets_size)
+        {
+            return;
+        }
+
+        const index_type fill_val = null_index;
+        index_type * new_hash_buckets = Allocator::allocate(new_size);
+        std::fill_n(new_hash_buckets, new_size, fill_val);
+
+        const size_type new_hash_mask = new_size - 1;
+        for (size_type b = 0; b < m_hash_buckets_size; ++b)
+        {
+            relink_chain(m_hash_buckets[b], new_hash_buckets, new_hash_mask, key_of_index);
+        }
+
+        Allocator::deallocate(m_hash_buckets, m_hash_buckets_size);
+        m_hash_buckets      = new_hash_buckets;
+        m_hash_buckets_size = new_size;
+        m_hash_mask         = new_hash_mask;
+        update_rehash_threshold();
+    }
+
+    // Size the hash buckets and index chain to hold at least expected_items
+    // indexes (from 0 to expected_items-1) without growing or rehashing again.
+    // Buckets are sized to respect the max load factor, or one item per bucket
+    // if the auto-rehash policy is disabled.
+    void reserve(const size_type expected_items)
+    {
+        const float load_factor = (m_max_load_factor > 0.0f) ? m_max_load_factor : 1.0f;
+        const size_type wanted_buckets = static_cast<size_type>(static_cast<float>(expected_items) / load_factor) + 1;
+
+        if (wanted_buckets > m_hash_buckets_size)
+        {
+            if (m_num_items == 0 && is_allocated())
+            {
+                clear_and_resize(next_power_of_two(wanted_buckets), m_index_chain_size);
+            }
+            else
+            {
+                rehash(wanted_buckets);
+            }
+        }
+
+        resize_index_chain(expected_items);
+    }
+
+    //
+    // Queries:
+    //
+
+    size_type compute_distribution_percentage() const noexcept
+    {
+        // Computes a number in the range [0,100] representing the spread over the hash table.
+        // See compute_chain_stats() for a more detailed view of the chain lengths.
+
+        if (!is_allocated())
+        {
+            return 100;
+        }
+
+        long total_items = 0;
+        for_each_chain([this, &total_items](const index_type head)
+        {
+            total_items += static_cast<long>(chain_length(head));
+        });
+
+        // If no items in the hash buckets...
+        if (total_items <= 1)
+        {
+            return 100;
+        }
+
+        long error = 0;
+        const long average = total_items / static_cast<long>(live_buckets());
+
+        for_each_chain([this, &error, average](const index_type head)
+        {
+            long e = static_cast<long>(chain_length(head)) - average;
+            if (e < 0) { e = -e; } // absolute value of 'e'
+
+            if (e > 1)
+            {
+                error += (e - 1);
+            }
+        });
+
+        return static_cast<size_type>(100 - (error * 100 / total_items));
+    }
+
+    // Walks every chain once (twice more, in the unlikely case that the p99 chain
+    // length falls past the histogram), never allocating. O(hash_buckets_size + size()).
+    // During an incremental rehash, the buckets are the old ones not yet migrated plus the
+    // new ones already filled from the migrated old buckets, see start_incremental_rehash().
+    chain_stats compute_chain_stats() const noexcept
+    {
+        chain_stats stats{};
+        stats.hash_buckets = live_buckets();
+
+        if (!is_allocated())
+        {
+            stats.empty_buckets      = m_hash_buckets_size;
+            stats.empty_bucket_ratio = 1.0f;
+            stats.histogram[0]       = m_hash_buckets_size;
+            return stats;
+        }
+
+        double probes_per_hit_sum = 0.0;
+        for_each_chain([this, &stats, &probes_per_hit_sum](const index_type head)
+        {
+            const size_type length = chain_length(head);
+            stats.histogram[std::min(length, chain_histogram_size - 1)]++;
+            stats.linked_indexes  += length;
+            stats.max_chain_length = std::max(stats.max_chain_length, length);
+            probes_per_hit_sum    += 0.5 * static_cast<double>(length) * static_cast<double>(length + 1);
+        });
+
+        const size_type used_buckets = stats.hash_buckets - stats.histogram[0];
+        stats.empty_buckets      = stats.histogram[0];
+        stats.empty_bucket_ratio = static_cast<float>(stats.empty_buckets) / static_cast<float>(stats.hash_buckets);
+        if (stats.linked_indexes == 0)
+        {
+            return stats;
+        }
+
+        stats.mean_chain_length   = static_cast<float>(stats.linked_indexes) / static_cast<float>(used_buckets);
+        stats.mean_probes_per_hit = static_cast<float>(probes_per_hit_sum / static_cast<double>(stats.linked_indexes));
+
+        // Smallest length L with at least 99% of the indexes in chains of length <= L.
+        const double target = 0.99 * static_cast<double>(stats.linked_indexes);
+        size_type covered = 0;
+        for (size_type length = 1; length < chain_histogram_size - 1; ++length)
+        {
+            covered += length * stats.histogram[length];
+            if (static_cast<double>(covered) >= target)
+            {
+                stats.p99_chain_length = length;
+                return stats;
+            }
+        }
+
+        // Past the histogram; Binary search the length over the long chains.
+        size_type lo = chain_histogram_size - 1;
+        size_type hi = stats.max_chain_length;
+        while (lo < hi)
+        {
+            const size_type mid = lo + (hi - lo) / 2;
+            size_type covered_mid = covered;
+            for_each_chain([this, &covered_mid, mid](const index_type head)
+            {
+                const size_type length = chain_length(head);
+                if (length >= chain_histogram_size - 1 && length <= mid)
+                {
+                    covered_mid += length;
+                }
+            });
+            if (static_cast<double>(covered_mid) >= target)
+            {
+                hi = mid;
+            }
+            else
+            {
+                lo = mid + 1;
+            }
+        }
+        stats.p99_chain_length = lo;
+        return stats;
+    }
+
+    lookup_counters counters() const noexcept
+    {
+        #ifdef HASH_INDEX_ENABLE_COUNTERS
+        return m_counters;
+        #else // !HASH_INDEX_ENABLE_COUNTERS
+        return lookup_counters{};
+        #endif // HASH_INDEX_ENABLE_COUNTERS
+    }
+
+    void reset_counters() noexcept
+    {
+        HASH_INDEX_COUNT(m_counters = lookup_counters{});
+    }
+
+    size_type allocated_bytes() const noexcept
+    {
+        if (!is_allocated())
+        {
+            return 0;
+        }
+        return (m_hash_buckets_size * sizeof(index_type)) +
+               ((m_old_hash_buckets != nullptr) ? m_old_hash_buckets_size * sizeof(index_type) : 0) +
+               (m_index_chain_size  * sizeof(index_type)) +
+               ((m_hash_keys    != nullptr) ? m_index_chain_size * sizeof(key_type)         : 0) +
+               ((m_fingerprints != nullptr) ? m_index_chain_size * sizeof(fingerprint_type) : 0) +
+               ((m_prev_chain   != nullptr) ? m_index_chain_size * sizeof(index_type)       : 0);
+    }
+
+    size_type hash_buckets_size() const noexcept
+    {
+        return m_hash_buckets_size;
+    }
+
+    size_type index_chain_size() const noexcept
+    {
+        return m_index_chain_size;
+    }
+
+    size_type granularity() const noexcept
+    {
+        return m_granularity;
+    }
+
+    float index_chain_growth() const noexcept
+    {
+        return m_chain_growth_factor;
+    }
+
+    // Number of indexes currently linked into the hash buckets.
+    size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    float load_factor() const noexcept
+    {
+        return static_cast<float>(m_num_items) / static_cast<float>(m_hash_buckets_size);
+    }
+
+    float max_load_factor() const noexcept
+    {
+        return m_max_load_factor;
+    }
+
+    float min_load_factor() const noexcept
+    {
+        return m_min_load_factor;
+    }
+
+    size_type growth_factor() const noexcept
+    {
+        return m_growth_factor;
+    }
+
+    bool retains_keys() const noexcept
+    {
+        return m_retain_keys;
+    }
+
+    bool uses_fingerprints() const noexcept
+    {
+        return m_use_fingerprints;
+    }
+
+    bool uses_prev_chain() const noexcept
+    {
+        return m_use_prev_chain;
+    }
+
+    // Old buckets migrated per insert()/erase(), zero if incremental rehash is disabled.
+    size_type incremental_rehash_step() const noexcept
+    {
+        return m_rehash_step;
+    }
+
+    // True while the old bucket array of an incremental rehash is still around.
+    bool is_rehashing() const noexcept
+    {
+        return m_old_hash_buckets != nullptr;
+    }
+
+    bool is_allocated() const noexcept
+    {
+        return (m_hash_buckets != nullptr) &&
+               (m_hash_buckets != m_invalid_index_dummy);
+    }
+
+    //
+    // Serialization:
+    //
+    // The format is described by hash_index_file_header. serialize() writes the
+    // whole table to a caller provided buffer, which can then be saved to a file
+    // (see hash_index_file.hpp). deserialize() copies it back into a hash_index,
+    // while hash_index_view<> does lookups straight from the serialized memory.
+    // Only retained keys and fingerprints of linked indexes are written, the
+    // rest of those arrays is zeroed so the output is deterministic.
+    //
+
+    size_type serialized_size() const noexcept
+    {
+        return static_cast<size_type>(make_file_header().total_size);
+    }
+
+    // Writes the table to buffer[0..buffer_size-1], which needs no particular alignment.
+    // Returns the number of bytes written or zero if the buffer is too small.
+    size_type serialize(void * buffer, const size_type buffer_size) const noexcept
+    {
+        const hash_index_file_header header = make_file_header();
+        if (buffer == nullptr || static_cast<std::uint64_t>(buffer_size) < header.total_size)
+        {
+            return 0;
+        }
+
+        unsigned char * const bytes = static_cast<unsigned char *>(buffer);
+        std::memset(bytes, 0, static_cast<std::size_t>(header.total_size));
+        std::memcpy(bytes, &header, sizeof(header));
+
+        if (is_allocated())
+        {
+            std::memcpy(bytes + header.hash_buckets_offset, m_hash_buckets, m_hash_buckets_size * sizeof(index_type));
+            std::memcpy(bytes + header.index_chain_offset,  m_index_chain,  m_index_chain_size  * sizeof(index_type));
+        }
+        else // Deferred allocation; Write the equivalent empty arrays.
+        {
+            const index_type fill_val = null_index;
+            for (size_type i = 0; i < m_hash_buckets_size; ++i)
+            {
+                std::memcpy(bytes + header.hash_buckets_offset + i * sizeof(index_type), &fill_val, sizeof(index_type));
+            }
+            for (size_type i = 0; i < m_index_chain_size; ++i)
+            {
+                std::memcpy(bytes + header.index_chain_offset + i * sizeof(index_type), &fill_val, sizeof(index_type));
+            }
+        }
+
+        if (m_old_hash_buckets != nullptr)
+        {
+            // Finish the pending part of an incremental rehash on the copy, the same
+            // way migrate_buckets() does it, so the output matches a fully migrated table.
+            unsigned char * const buckets = bytes + header.hash_buckets_offset;
+            unsigned char * const chain   = bytes + header.index_chain_offset;
+            const auto load = [](const unsigned char * array, const size_type i) -> index_type
+            {
+                index_type v;
+                std::memcpy(&v, array + i * sizeof(index_type), sizeof(index_type));
+                return v;
+            };
+            const auto store = [](unsigned char * array, const size_type i, const index_type v)
+            {
+                std::memcpy(array + i * sizeof(index_type), &v, sizeof(index_type));
+            };
+
+            for (size_type b = m_rehash_position; b < m_old_hash_buckets_size; ++b)
+            {
+                for (size_type t = b; t < m_hash_buckets_size; t += m_old_hash_buckets_size)
+                {
+                    store(buckets, t, null_index);
+                }
+
+                index_type reversed = null_index;
+                for (index_type i = m_old_hash_buckets[b]; i != null_index; i = m_index_chain[i])
+                {
+                    store(chain, static_cast<size_type>(i), reversed);
+                    reversed = i;
+                }
+                for (index_type i = reversed; i != null_index;)
+                {
+                    const index_type n = load(chain, static_cast<size_type>(i));
+                    const size_type  k = static_cast<size_type>(m_hash_keys[i] & static_cast<key_type>(m_hash_mask));
+                    store(chain, static_cast<size_type>(i), load(buckets, k));
+                    store(buckets, k, i);
+                    i = n;
+                }
+            }
+        }
+
+        if (m_hash_keys != nullptr || m_fingerprints != nullptr)
+        {
+            for_each_chain([this, bytes, &header](const index_type head)
+            {
+                for (index_type i = head; i != null_index; i = m_index_chain[i])
+                {
+                    const size_type offset = static_cast<size_type>(i);
+                    if (m_hash_keys != nullptr)
+                    {
+                        std::memcpy(bytes + header.hash_keys_offset + offset * sizeof(key_type), &m_hash_keys[i], sizeof(key_type));
+                    }
+                    if (m_fingerprints != nullptr)
+                    {
+                        bytes[header.fingerprints_offset + offset] = m_fingerprints[i];
+                    }
+                }
+            });
+        }
+        return static_cast<size_type>(header.total_size);
+    }
+
+    // Replaces the contents of the hash_index with a copy of a table written by serialize(),
+    // including its key retention, fingerprint and rehash settings. The data needs no particular
+    // alignment. Returns false and leaves the hash_index cleared if the data is not a well-formed
+    // table for this index_type/key_type, or if its chains are broken (see verify_chains()).
+    bool deserialize(const void * data, const size_type data_size)
+    {
+        hash_index_file_header header;
+        if (!hash_index_file_header::read(data, static_cast<std::uint64_t>(data_size),
+                                          sizeof(index_type), sizeof(key_type), header) ||
+            std::max(header.hash_buckets_size, header.index_chain_size) > static_cast<std::uint64_t>(std::numeric_limits<size_type>::max()))
+        {
+            clear_and_free();
+            return false;
+        }
+
+        clear_and_free();
+        m_retain_keys      = (header.flags & hash_index_file_header::flag_hash_keys)    != 0;
+        m_use_fingerprints = (header.flags & hash_index_file_header::flag_fingerprints) != 0;
+        m_use_prev_chain   = (header.flags & hash_index_file_header::flag_prev_chain)   != 0;
+        m_max_load_factor  = header.max_load_factor;
+        m_growth_factor    = static_cast<size_type>(header.growth_factor);
+        m_granularity      = static_cast<size_type>(header.granularity);
+        clear_and_resize(static_cast<size_type>(header.hash_buckets_size), static_cast<size_type>(header.index_chain_size));
+
+        if (header.num_items == 0)
+        {
+            return true; // Allocation deferred to the first insert().
+        }
+
+        const unsigned char * const bytes = static_cast<const unsigned char *>(data);
+        internal_allocate(m_hash_buckets_size, m_index_chain_size);
+
+        std::memcpy(m_hash_buckets, bytes + header.hash_buckets_offset, m_hash_buckets_size * sizeof(index_type));
+        std::memcpy(m_index_chain,  bytes + header.index_chain_offset,  m_index_chain_size  * sizeof(index_type));
+        if (m_hash_keys != nullptr)
+        {
+            std::memcpy(m_hash_keys, bytes + header.hash_keys_offset, m_index_chain_size * sizeof(key_type));
+        }
+        if (m_fingerprints != nullptr)
+        {
+            std::memcpy(m_fingerprints, bytes + header.fingerprints_offset, m_index_chain_size * sizeof(fingerprint_type));
+        }
+
+        if (!hash_index_file_header::verify_chains(m_hash_buckets, m_index_chain, header))
+        {
+            clear_and_free();
+            return false;
+        }
+        if (m_prev_chain != nullptr)
+        {
+            rebuild_prev_chain();
+        }
+
+        m_num_items = static_cast<size_type>(header.num_items);
+        return true;
+    }
+
+    //
+    // Freezing:
+    //
+
+    // Builds a read-only frozen_hash_index<> with the same contents, for tables that won't
+    // change anymore. find() on it gives the same results as on this hash_index, but with a
+    // single entry compared per lookup. Needs the hash keys, so key retention must be enabled.
+    frozen_hash_index<IndexType, KeyType, SizeType, Allocator> freeze() const
+    {
+        HASH_INDEX_ASSERT((m_hash_keys != nullptr || m_num_items == 0) && "freeze() without a key function needs key retention!");
+        return freeze([this](const index_type i) { return m_hash_keys[i]; });
+    }
+
+    // Same as above, but with the hash keys given by a callable with the signature key_type(index_type).
+    template<typename KeyFunc>
+    frozen_hash_index<IndexType, KeyType, SizeType, Allocator> freeze(KeyFunc key_of_index) const
+    {
+        std::vector<key_type>   keys;
+        std::vector<index_type> indexes;
+        keys.reserve(static_cast<std::size_t>(m_num_items));
+        indexes.reserve(static_cast<std::size_t>(m_num_items));
+
+        // Chain order, so that duplicate keys keep the precedence find() gives them here.
+        if (is_allocated())
+        {
+            for_each_chain([this, &keys, &indexes, &key_of_index](const index_type head)
+            {
+                for (index_type i = head; i != null_index; i = m_index_chain[i])
+                {
+                    keys.push_back(static_cast<key_type>(key_of_index(i)));
+                    indexes.push_back(i);
+                }
+            });
+        }
+
+        return frozen_hash_index<IndexType, KeyType, SizeType, Allocator>{
+            keys.data(), indexes.data(), static_cast<size_type>(keys.size()), static_cast<const Allocator &>(*this) };
+    }
+
+    //
+    // Deep comparison operators:
+    //
+
+    bool operator == (const hash_index & other) const noexcept
+    {
+        // Self comparison of comparison to pointer/ref to self?
+        if (this == &other)
+        {
+            return true;
+        }
+
+        // Same sizes?
+        if (m_hash_buckets_size != other.m_hash_buckets_size) { return false; }
+        if (m_index_chain_size  != other.m_index_chain_size ) { return false; }
+        if (m_hash_mask         != other.m_hash_mask        ) { return false; }
+        if (m_lookup_mask       != other.m_lookup_mask      ) { return false; }
+        if (m_granularity       != other.m_granularity      ) { return false; }
+        if (m_num_items         != other.m_num_items        ) { return false; }
+        if (m_retain_keys       != other.m_retain_keys      ) { return false; }
+        if (m_max_load_factor   != other.m_max_load_factor  ) { return false; }
+        if (m_min_load_factor   != other.m_min_load_factor  ) { return false; }
+        if (m_use_fingerprints  != other.m_use_fingerprints ) { return false; }
+        if (m_use_prev_chain    != other.m_use_prev_chain   ) { return false; }
+        if (m_rehash_step       != other.m_rehash_step      ) { return false; }
+        if (m_rehash_position   != other.m_rehash_position  ) { return false; }
+        if (m_old_hash_buckets_size != other.m_old_hash_buckets_size) { return false; }
+
+        // This or other could be pointing to the m_invalid_index_dummy.
+        if ( is_allocated() && !other.is_allocated()) { return false; }
+        if (!is_allocated() &&  other.is_allocated()) { return false; }
+        if (!is_allocated()) { return true; } // Both empty; The sizes don't apply to the dummy.
+
+        // Same sizes, but do both have the same data?
+        for (size_type i = 0; i < m_hash_buckets_size; ++i)
+        {
+            if (is_live_bucket(i) && m_hash_buckets[i] != other.m_hash_buckets[i])
+            {
+                return false;
+            }
+        }
+        for (size_type i = 0; i < m_index_chain_size; ++i)
+        {
+            if (m_index_chain[i] != other.m_index_chain[i])
+            {
+                return false;
+            }
+        }
+        if (m_old_hash_buckets != nullptr)
+        {
+            for (size_type i = m_rehash_position; i < m_old_hash_buckets_size; ++i)
+            {
+                if (m_old_hash_buckets[i] != other.m_old_hash_buckets[i])
+                {
+                    return false;
+                }
+            }
+        }
+        if (m_hash_keys != nullptr && other.m_hash_keys != nullptr)
+        {
+            // Only the keys of linked indexes are meaningful.
+            bool keys_equal = true;
+            for_each_chain([this, &other, &keys_equal](const index_type head)
+            {
+                for (index_type index = head; index != null_index && keys_equal; index = m_index_chain[index])
+                {
+                    keys_equal = (m_hash_keys[index] == other.m_hash_keys[index]);
+                }
+            });
+            if (!keys_equal)
+            {
+                return false;
+            }
+        }
+
+        // The same sizes and contents.
+        return true;
+    }
+
+    bool operator != (const hash_index & other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+private:
+
+    template<typename IntType>
+    static bool is_power_of_two(const IntType num) noexcept
+    {
+        static_assert(std::is_integral<IntType>::value, "Integer type required!");
+        return (num > 0) && ((num & (num - 1)) == 0);
+    }
+
+    static size_type next_power_of_two(const size_type num) noexcept
+    {
+        size_type pot = 1;
+        while (pot < num)
+        {
+            pot <<= 1;
+        }
+        return pot;
+    }
+
+    #if defined(HASH_INDEX_ENABLE_PARALLEL)
+    static size_type parallel_thread_count(const unsigned num_threads, const size_type num_items) noexcept
+    {
+        const unsigned  wanted  = (num_threads != 0) ? num_threads : std::thread::hardware_concurrency();
+        const size_type threads = std::min(static_cast<size_type>(wanted), num_items / parallel_grain);
+        return (threads > 1) ? threads : 1;
+    }
+
+    // Runs func(t) for t in [0, num_threads), each on its own thread, the first on the
+    // calling one, and waits for all. Parts whose thread couldn't start run right here.
+    template<typename Func>
+    static void run_parallel(const size_type num_threads, Func func)
+    {
+        std::vector<std::thread> workers;
+        workers.reserve(static_cast<std::size_t>(num_threads));
+
+        size_type started = 1;
+        try
+        {
+            for (; started < num_threads; ++started)
+            {
+                workers.emplace_back(func, started);
+            }
+        }
+        catch (...)
+        {
+            // Out of threads; The remaining parts run on this one below.
+        }
+
+        func(size_type(0));
+        for (size_type t = started; t < num_threads; ++t)
+        {
+            func(t);
+        }
+        for (auto & worker : workers)
+        {
+            worker.join();
+        }
+    }
+    #endif // HASH_INDEX_ENABLE_PARALLEL
+
+    // The optional parallel arrays (keys, fingerprints) are allocated
+    // with the user Allocator rebound to their element type.
+    template<typename T>
+    T * allocate_array(const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        return alloc.allocate(count);
+    }
+
+    template<typename T>
+    void deallocate_array(T * array, const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        alloc.deallocate(array, count);
+    }
+
+    //
+    // Optional in-place growth hook. If the Allocator (rebound to T) provides a
+    //   bool try_expand(T * p, size_type old_count, size_type new_count)
+    // method, resize_array() first asks it to grow the block at 'p' in place,
+    // which is what an arena can cheaply do for its most recent allocation.
+    // It returns true if the block now holds new_count elements, false if the
+    // caller must allocate a new block instead. No other method is required.
+    //
+    template<typename Alloc, typename T>
+    static auto try_expand_with(Alloc & alloc, T * array, const size_type old_count, const size_type new_count, int)
+        -> decltype(static_cast<bool>(alloc.try_expand(array, old_count, new_count)))
+    {
+        return static_cast<bool>(alloc.try_expand(array, old_count, new_count));
+    }
+
+    template<typename Alloc, typename T>
+    static bool try_expand_with(Alloc &, T *, const size_type, const size_type, long) noexcept
+    {
+        return false; // No hook.
+    }
+
+    template<typename T>
+    bool try_expand(T * array, const size_type old_count, const size_type new_count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        return try_expand_with(alloc, array, old_count, new_count, 0);
+    }
+
+    // Allocators without operator== are assumed interchangeable if stateless.
+    template<typename Alloc>
+    static auto allocators_equal_with(const Alloc & a, const Alloc & b, int) -> decltype(static_cast<bool>(a == b))
+    {
+        return static_cast<bool>(a == b);
+    }
+
+    template<typename Alloc>
+    static bool allocators_equal_with(const Alloc &, const Alloc &, long) noexcept
+    {
+        return std::is_empty<Alloc>::value;
+    }
+
+    static bool allocators_equal(const Allocator & a, const Allocator & b)
+    {
+        return allocators_equal_with(a, b, 0);
+    }
+
+    static void swap_allocators(hash_index & lhs, hash_index & rhs, std::true_type) noexcept
+    {
+        using std::swap;
+        swap(static_cast<Allocator &>(lhs), static_cast<Allocator &>(rhs));
+    }
+
+    static void swap_allocators(hash_index &, hash_index &, std::false_type) noexcept
+    {
+    }
+
+    template<typename T>
+    void resize_array(T *& array, const size_type old_count, const size_type new_count)
+    {
+        if (try_expand(array, old_count, new_count))
+        {
+            return;
+        }
+
+        T * new_array = allocate_array<T>(new_count);
+        std::copy(array, array + std::min(old_count, new_count), new_array);
+        deallocate_array(array, old_count);
+        array = new_array;
+    }
+
+    // Unlike resize_array(), always moves to a new block, so the excess goes back to the allocator.
+    template<typename T>
+    void shrink_array(T *& array, const size_type old_count, const size_type new_count)
+    {
+        T * new_array = allocate_array<T>(new_count);
+        std::copy(array, array + new_count, new_array);
+        deallocate_array(array, old_count);
+        array = new_array;
+    }
+
+    size_type chain_length(const index_type head) const noexcept
+    {
+        size_type length = 0;
+        for (index_type index = head; index != null_index; index = m_index_chain[index])
+        {
+            ++length;
+        }
+        return length;
+    }
+
+    static fingerprint_type fingerprint_of(const key_type key) noexcept
+    {
+        // Top bits of the key, which the bucket mask never looks at.
+        using unsigned_key_type = typename std::make_unsigned<key_type>::type;
+        constexpr int shift = static_cast<int>(sizeof(key_type) - sizeof(fingerprint_type)) * 8;
+        return static_cast<fingerprint_type>(static_cast<unsigned_key_type>(key) >> shift);
+    }
+
+    // Cheap rejection of chain entries whose key can't possibly
+    // match, without touching the external value collection.
+    bool may_match(const index_type index, const key_type key) const noexcept
+    {
+        if (m_hash_keys != nullptr)
+        {
+            return m_hash_keys[index] == key;
+        }
+        if (m_fingerprints != nullptr)
+        {
+            return m_fingerprints[index] == fingerprint_of(key);
+        }
+        return true;
+    }
+
+    //
+    // Index shifting sweeps used by insert_at_indexes() / erase_and_remove_indexes().
+    // All return the largest valid index in the array before the shift, or null_index
+    // if the array holds none. The single position variants are kept branch-free so
+    // that the compiler can vectorize them, since they are bound by memory bandwidth.
+    //
+
+    static index_type shift_up(index_type * array, const size_type count, const index_type index) noexcept
+    {
+        index_type max_old = 0;
+        index_type any_old = 0;
+        for (size_type i = 0; i < count; ++i)
+        {
+            const index_type v     = array[i];
+            const index_type valid = static_cast<index_type>(v != null_index);
+            array[i] = v + (static_cast<index_type>(v >= index) & valid);
+            max_old  = std::max(max_old, static_cast<index_type>(v * valid));
+            any_old |= valid;
+        }
+        return any_old ? max_old : null_index;
+    }
+
+    static index_type shift_down(index_type * array, const size_type count, const index_type index) noexcept
+    {
+        index_type max_old = 0;
+        index_type any_old = 0;
+        for (size_type i = 0; i < count; ++i)
+        {
+            const index_type v     = array[i];
+            const index_type valid = static_cast<index_type>(v != null_index);
+            array[i] = v - (static_cast<index_type>(v > index) & valid);
+            max_old  = std::max(max_old, static_cast<index_type>(v * valid));
+            any_old |= valid;
+        }
+        return any_old ? max_old : null_index;
+    }
+
+    template<typename ShiftFunc>
+    static index_type shift_by(index_type * array, const size_type count, ShiftFunc shift_of)
+    {
+        index_type max_old = null_index;
+        for (size_type i = 0; i < count; ++i)
+        {
+            const index_type v = array[i];
+            if (v != null_index)
+            {
+                array[i] = v + shift_of(v);
+                max_old  = (max_old == null_index) ? v : std::max(max_old, v);
+            }
+        }
+        return max_old;
+    }
+
+    // Moves the index chain entry (and parallel arrays) of index 'from' to index 'to'.
+    void move_chain_entry(const size_type from, const size_type to) noexcept
+    {
+        m_index_chain[to] = m_index_chain[from];
+        if (m_hash_keys != nullptr)
+        {
+            m_hash_keys[to] = m_hash_keys[from];
+        }
+        if (m_fingerprints != nullptr)
+        {
+            m_fingerprints[to] = m_fingerprints[from];
+        }
+        if (m_prev_chain != nullptr)
+        {
+            m_prev_chain[to] = m_prev_chain[from];
+        }
+    }
+
+    // Sets the back links of an index just pushed to the front of a chain.
+    void link_prev(const index_type index) noexcept
+    {
+        const index_type next_index = m_index_chain[index];
+        m_prev_chain[index] = null_index;
+        if (next_index != null_index)
+        {
+            m_prev_chain[next_index] = index;
+        }
+    }
+
+    // Constant time erase() using the back links. A chain head has no back link,
+    // so it's told apart from an unlinked index by checking the bucket itself.
+    void erase_linked(index_type * const head, const index_type index) noexcept
+    {
+        const index_type prev_index = m_prev_chain[index];
+        const index_type next_index = m_index_chain[index];
+
+        if (prev_index != null_index)
+        {
+            m_index_chain[prev_index] = next_index;
+        }
+        else if (*head == index)
+        {
+            *head = next_index;
+        }
+        else // Not linked.
+        {
+            m_index_chain[index] = null_index;
+            return;
+        }
+
+        if (next_index != null_index)
+        {
+            m_prev_chain[next_index] = prev_index;
+        }
+
+        m_index_chain[index] = null_index;
+        m_prev_chain[index]  = null_index;
+        --m_num_items;
+    }
+
+    void rebuild_prev_chain() noexcept
+    {
+        const index_type fill_val = null_index;
+        std::fill_n(m_prev_chain, m_index_chain_size, fill_val);
+
+        for_each_chain([this](const index_type head)
+        {
+            index_type prev_index = null_index;
+            for (index_type i = head; i != null_index; i = m_index_chain[i])
+            {
+                m_prev_chain[i] = prev_index;
+                prev_index = i;
+            }
+        });
+    }
+
+    //
+    // Incremental rehash support:
+    //
+
+    // Bucket currently holding the chain of 'key'. See set_incremental_rehash().
+    index_type * bucket_of(const key_type key) const noexcept
+    {
+        if (m_old_hash_buckets != nullptr)
+        {
+            const size_type old_bucket = static_cast<size_type>(key & static_cast<key_type>(m_old_hash_mask));
+            if (old_bucket >= m_rehash_position)
+            {
+                return &m_old_hash_buckets[old_bucket];
+            }
+        }
+        return &m_hash_buckets[key & m_hash_mask & m_lookup_mask];
+    }
+
+    // Number of chains visited by for_each_chain().
+    size_type live_buckets() const noexcept
+    {
+        if (m_old_hash_buckets == nullptr)
+        {
+            return m_hash_buckets_size;
+        }
+        const size_type pending = m_old_hash_buckets_size - m_rehash_position;
+        return m_rehash_position * (m_hash_buckets_size / m_old_hash_buckets_size) + pending;
+    }
+
+    // New buckets not yet filled by migrate_buckets() hold garbage and must be skipped.
+    bool is_live_bucket(const size_type bucket) const noexcept
+    {
+        return m_old_hash_buckets == nullptr || (bucket & m_old_hash_mask) < m_rehash_position;
+    }
+
+    // Positions of the chains walked by entry_iterator: the new buckets first, then the old
+    // ones during an incremental rehash. Non-live or migrated ones have no chain.
+    size_type chain_positions() const noexcept
+    {
+        if (!is_allocated())
+        {
+            return 0;
+        }
+        return m_hash_buckets_size + ((m_old_hash_buckets != nullptr) ? m_old_hash_buckets_size : 0);
+    }
+
+    index_type chain_head_at(const size_type position) const noexcept
+    {
+        if (position < m_hash_buckets_size)
+        {
+            return is_live_bucket(position) ? m_hash_buckets[position] : null_index;
+        }
+        const size_type old_bucket = position - m_hash_buckets_size;
+        return (old_bucket >= m_rehash_position) ? m_old_hash_buckets[old_bucket] : null_index;
+    }
+
+    // Calls func(head) for the head of every chain; Mid incremental rehash these are the
+    // filled new buckets plus the old ones that weren't migrated yet.
+    template<typename Func>
+    void for_each_chain(Func func) const
+    {
+        for (size_type b = 0; b < m_hash_buckets_size; ++b)
+        {
+            if (is_live_bucket(b))
+            {
+                func(m_hash_buckets[b]);
+            }
+        }
+        for (size_type b = m_rehash_position; m_old_hash_buckets != nullptr && b < m_old_hash_buckets_size; ++b)
+        {
+            func(m_old_hash_buckets[b]);
+        }
+    }
+
+    // Moves every entry of the chain starting at 'head' to the front of its bucket in
+    // new_hash_buckets, leaving 'head' empty. The chain is reversed first, so that the
+    // original order of duplicate keys is preserved in the new buckets.
+    template<typename KeyFunc>
+    void relink_chain(index_type & head, index_type * new_hash_buckets, const size_type new_hash_mask, KeyFunc key_of_index)
+    {
+        index_type reversed = null_index;
+        for (index_type i = head; i != null_index;)
+        {
+            const index_type n = m_index_chain[i];
+            m_index_chain[i] = reversed;
+            reversed = i;
+            i = n;
+        }
+        head = null_index;
+
+        for (index_type i = reversed; i != null_index;)
+        {
+            const index_type n = m_index_chain[i];
+            const key_type   k = static_cast<key_type>(key_of_index(i)) & static_cast<key_type>(new_hash_mask);
+            m_index_chain[i]    = new_hash_buckets[k];
+            new_hash_buckets[k] = i;
+            if (m_prev_chain != nullptr)
+            {
+                link_prev(i);
+            }
+            i = n;
+        }
+    }
+
+    // Swaps in a new bucket array of new_size, keeping the current one as the old
+    // array to be drained by migrate_buckets(). The new buckets are left unfilled,
+    // since filling a large array is itself a pause proportional to its size. Each
+    // old bucket maps to the new buckets (old_bucket + n * old_size), which only ever
+    // receive entries once that old bucket was migrated, so migrate_buckets() fills
+    // them right before relinking, and everything else skips the unfilled ones.
+    void start_incremental_rehash(const size_type new_size)
+    {
+        HASH_INDEX_ASSERT(m_hash_keys != nullptr && "Incremental rehash requires key retention!");
+        HASH_INDEX_ASSERT(new_size > m_hash_buckets_size);
+        finish_rehash();
+
+        index_type * new_hash_buckets = Allocator::allocate(new_size);
+
+        m_old_hash_buckets      = m_hash_buckets;
+        m_old_hash_buckets_size = m_hash_buckets_size;
+        m_old_hash_mask         = m_hash_mask;
+        m_rehash_position       = 0;
+        m_hash_buckets          = new_hash_buckets;
+        m_hash_buckets_size     = new_size;
+        m_hash_mask             = new_size - 1;
+        update_rehash_threshold();
+    }
+
+    // Old buckets to migrate on an insert(): the step of set_incremental_rehash(), or
+    // more if needed to be done before the insert() that crosses the next threshold,
+    // which would otherwise migrate everything left in one go to start the next rehash.
+    size_type insert_rehash_step() const noexcept
+    {
+        const size_type pending   = m_old_hash_buckets_size - m_rehash_position;
+        const size_type remaining = (m_rehash_threshold > m_num_items) ? m_rehash_threshold - m_num_items : 1;
+        return std::max(m_rehash_step, pending / remaining + ((pending % remaining != 0) ? 1 : 0));
+    }
+
+    // Migrates up to 'count' old buckets, freeing the old array after the last one.
+    void migrate_buckets(const size_type count) noexcept
+    {
+        const size_type end = m_rehash_position + std::min(count, m_old_hash_buckets_size - m_rehash_position);
+        for (; m_rehash_position < end; ++m_rehash_position)
+        {
+            for (size_type b = m_rehash_position; b < m_hash_buckets_size; b += m_old_hash_buckets_size)
+            {
+                m_hash_buckets[b] = null_index;
+            }
+            relink_chain(m_old_hash_buckets[m_rehash_position], m_hash_buckets, m_hash_mask,
+                         [this](const index_type index) { return m_hash_keys[index]; });
+        }
+        if (m_rehash_position == m_old_hash_buckets_size)
+        {
+            free_old_buckets();
+        }
+    }
+
+    void free_old_buckets() noexcept
+    {
+        if (m_old_hash_buckets != nullptr)
+        {
+            Allocator::deallocate(m_old_hash_buckets, m_old_hash_buckets_size);
+            m_old_hash_buckets      = nullptr;
+            m_old_hash_buckets_size = 0;
+            m_old_hash_mask         = 0;
+            m_rehash_position       = 0;
+        }
+    }
+
+    template<typename ForwardIterator>
+    void build_from(ForwardIterator keys, const size_type count, const size_type new_hash_buckets_size)
+    {
+        const size_type buckets_size = allocate_for_build(count, new_hash_buckets_size);
+        if (buckets_size == 0)
+        {
+            return; // Nothing to link; Allocation deferred to the first insert().
+        }
+
+        const index_type fill_val = null_index;
+        std::fill_n(m_hash_buckets, buckets_size, fill_val);
+
+        for (size_type i = 0; i < count; ++i, ++keys)
+        {
+            link_built_index(static_cast<index_type>(i), static_cast<key_type>(*keys));
+        }
+
+        m_num_items = count;
+        if (m_num_items > m_rehash_threshold)
+        {
+            rehash(next_power_of_two(m_hash_buckets_size * m_growth_factor));
+        }
+    }
+
+    // Clears and sizes the table for build() of 'count' keys, returning the bucket count,
+    // or zero if count is zero and nothing was allocated. Same as internal_allocate(), but
+    // every index chain entry is about to be overwritten, so skip its null_index fill.
+    size_type allocate_for_build(const size_type count, const size_type new_hash_buckets_size)
+    {
+        size_type buckets_size = new_hash_buckets_size;
+        if (buckets_size == 0)
+        {
+            const float load_factor = (m_max_load_factor > 0.0f) ? m_max_load_factor : 1.0f;
+            buckets_size = next_power_of_two(static_cast<size_type>(static_cast<float>(count) / load_factor) + 1);
+        }
+        HASH_INDEX_ASSERT(is_power_of_two(buckets_size) && "Size of hash_index buckets array must be a power-of-2!");
+
+        clear_and_resize(buckets_size, count);
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        m_hash_buckets = Allocator::allocate(buckets_size);
+        m_index_chain  = Allocator::allocate(count);
+        m_lookup_mask  = ~static_cast<size_type>(0);
+        if (m_retain_keys)
+        {
+            m_hash_keys = allocate_array<key_type>(count);
+        }
+        if (m_use_fingerprints)
+        {
+            m_fingerprints = allocate_array<fingerprint_type>(count);
+        }
+        if (m_use_prev_chain)
+        {
+            m_prev_chain = allocate_array<index_type>(count);
+        }
+        return buckets_size;
+    }
+
+    // Links index i, the highest so far in its bucket, to the front of its chain.
+    // The bucket itself must have been filled with null_index beforehand.
+    void link_built_index(const index_type i, const key_type key) noexcept
+    {
+        const key_type k  = key & static_cast<key_type>(m_hash_mask);
+        m_index_chain[i]  = m_hash_buckets[k];
+        m_hash_buckets[k] = i;
+        if (m_hash_keys != nullptr)
+        {
+            m_hash_keys[i] = key;
+        }
+        if (m_fingerprints != nullptr)
+        {
+            m_fingerprints[i] = fingerprint_of(key);
+        }
+        if (m_prev_chain != nullptr)
+        {
+            link_prev(i);
+        }
+    }
+
+    hash_index_file_header make_file_header() const noexcept
+    {
+        hash_index_file_header header{};
+        std::memcpy(header.magic, "HASHIDX", sizeof(header.magic));
+        header.version           = hash_index_file_header::current_version;
+        header.byte_order        = hash_index_file_header::byte_order_mark;
+        header.index_width       = sizeof(index_type);
+        header.key_width         = sizeof(key_type);
+        header.layout            = hash_index_file_header::layout_chained;
+        header.flags             = static_cast<std::uint8_t>(
+                                   (m_retain_keys      ? std::uint32_t{ hash_index_file_header::flag_hash_keys    } : 0u) |
+                                   (m_use_fingerprints ? std::uint32_t{ hash_index_file_header::flag_fingerprints } : 0u) |
+                                   (m_use_prev_chain   ? std::uint32_t{ hash_index_file_header::flag_prev_chain   } : 0u));
+        header.growth_factor     = static_cast<std::uint32_t>(m_growth_factor);
+        header.max_load_factor   = m_max_load_factor;
+        header.hash_buckets_size = static_cast<std::uint64_t>(m_hash_buckets_size);
+        header.index_chain_size  = static_cast<std::uint64_t>(m_index_chain_size);
+        header.hash_mask         = static_cast<std::uint64_t>(m_hash_mask);
+        header.num_items         = static_cast<std::uint64_t>(m_num_items);
+        header.granularity       = static_cast<std::uint64_t>(m_granularity);
+        header.compute_layout();
+        return header;
+    }
+
+    void update_rehash_threshold() noexcept
+    {
+        if (m_max_load_factor > 0.0f)
+        {
+            m_rehash_threshold = static_cast<size_type>(m_max_load_factor * static_cast<float>(m_hash_buckets_size));
+        }
+        else
+        {
+            m_rehash_threshold = std::numeric_limits<size_type>::max();
+        }
+        m_shrink_threshold = static_cast<size_type>(m_min_load_factor * static_cast<float>(m_hash_buckets_size));
+    }
+
+    // Growth of the index chain to fit indexes up to min_size - 1, see set_index_chain_growth().
+    void grow_index_chain(const size_type min_size)
+    {
+        size_type new_size = min_size;
+        if (m_chain_growth_factor > 1.0f)
+        {
+            const float grown = static_cast<float>(m_index_chain_size) * m_chain_growth_factor;
+            if (grown < static_cast<float>(std::numeric_limits<size_type>::max() / 2))
+            {
+                new_size = std::max(new_size, static_cast<size_type>(grown));
+            }
+        }
+        resize_index_chain(new_size);
+    }
+
+    // erase() without the low watermark check, for the batched removals that
+    // shift the arrays afterwards and must not have them shrunk in between.
+    void erase_entry(const key_type key, const index_type index)
+    {
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
+
+        if (!is_allocated())
+        {
+            return;
+        }
+
+        if (m_old_hash_buckets != nullptr)
+        {
+            migrate_buckets(m_rehash_step);
+        }
+
+        index_type * const head = bucket_of(key);
+        HASH_INDEX_COUNT(++m_counters.erases);
+
+        if (m_prev_chain != nullptr)
+        {
+            erase_linked(head, index);
+            return;
+        }
+
+        if (*head == index)
+        {
+            *head = m_index_chain[index];
+            --m_num_items;
+        }
+        else
+        {
+            for (index_type i = *head; i != null_index; i = m_index_chain[i])
+            {
+                HASH_INDEX_COUNT(++m_counters.erase_probes);
+                if (m_index_chain[i] == index)
+                {
+                    m_index_chain[i] = m_index_chain[index];
+                    --m_num_items;
+                    break;
+                }
+            }
+        }
+
+        m_index_chain[index] = null_index;
+    }
+
+    // Bucket count shrink_to_fit() rehashes to, sized like reserve() for size() items.
+    size_type fitted_hash_buckets_size() const noexcept
+    {
+        const float load_factor = (m_max_load_factor > 0.0f) ? m_max_load_factor : 1.0f;
+        return next_power_of_two(static_cast<size_type>(static_cast<float>(m_num_items) / load_factor) + 1);
+    }
+
+    // Low watermark check of erase(), see set_min_load_factor().
+    void shrink_if_sparse()
+    {
+        if (m_num_items < m_shrink_threshold)
+        {
+            shrink_to_fit();
+        }
+    }
+
+    // Trims the index chain and its parallel arrays for shrink_to_fit().
+    void shrink_index_chain()
+    {
+        if (!is_allocated())
+        {
+            return;
+        }
+
+        finish_rehash();
+        if (m_num_items == 0)
+        {
+            clear_and_free();
+            m_index_chain_size = m_granularity; // Allocated by the next insert().
+
+            // With keys to grow them back, the buckets get the size shrink_to_fit() would
+            // rehash them to, so an insert() after the watermark emptied the table doesn't
+            // allocate and fill the peak bucket array again.
+            if (m_retain_keys)
+            {
+                m_hash_buckets_size = fitted_hash_buckets_size();
+                m_hash_mask         = m_hash_buckets_size - 1;
+                update_rehash_threshold();
+            }
+            return;
+        }
+
+        size_type highest = 0;
+        for_each_chain([this, &highest](const index_type head)
+        {
+            for (index_type i = head; i != null_index; i = m_index_chain[i])
+            {
+                highest = std::max(highest, static_cast<size_type>(i));
+            }
+        });
+
+        const auto mod = (highest + 1) % m_granularity;
+        const size_type new_size = (mod == 0) ? (highest + 1) : (highest + 1 + m_granularity - mod);
+        if (new_size >= m_index_chain_size)
+        {
+            return;
+        }
+
+        shrink_array(m_index_chain, m_index_chain_size, new_size);
+        if (m_hash_keys != nullptr)
+        {
+            shrink_array(m_hash_keys, m_index_chain_size, new_size);
+        }
+        if (m_fingerprints != nullptr)
+        {
+            shrink_array(m_fingerprints, m_index_chain_size, new_size);
+        }
+        if (m_prev_chain != nullptr)
+        {
+            shrink_array(m_prev_chain, m_index_chain_size, new_size);
+        }
+        m_index_chain_size = new_size;
+    }
+
+    void internal_init(const size_type initial_hash_buckets_size,
+                       const size_type initial_index_chain_size)
+    {
+        HASH_INDEX_ASSERT(is_power_of_two(initial_hash_buckets_size) && "Size of hash_index buckets array must be a power-of-2!");
+        HASH_INDEX_ASSERT(!is_allocated() && "Already initialized!");
+
+        m_hash_buckets      = m_invalid_index_dummy;
+        m_index_chain       = m_invalid_index_dummy;
+        m_hash_buckets_size = initial_hash_buckets_size;
+        m_index_chain_size  = initial_index_chain_size;
+        m_hash_mask         = m_hash_buckets_size - 1;
+        m_lookup_mask       = 0;
+        m_granularity       = default_granularity;
+        m_num_items         = 0;
+        update_rehash_threshold();
+    }
+
+    void internal_allocate(const size_type new_hash_buckets_size,
+                           const size_type new_index_chain_size)
+    {
+        HASH_INDEX_ASSERT(is_power_of_two(new_hash_buckets_size) && "Size of hash_index buckets array must be a power-of-2!");
+
+        if (is_allocated())
+        {
+            clear_and_free();
+        }
+
+        m_hash_buckets      = Allocator::allocate(new_hash_buckets_size);
+        m_index_chain       = Allocator::allocate(new_index_chain_size);
+        m_hash_buckets_size = new_hash_buckets_size;
+        m_index_chain_size  = new_index_chain_size;
+        m_hash_mask         = m_hash_buckets_size - 1;
+        m_lookup_mask       = ~static_cast<size_type>(0);
+
+        const index_type fill_val = null_index;
+        std::fill_n(m_hash_buckets, new_hash_buckets_size, fill_val);
+        std::fill_n(m_index_chain,  new_index_chain_size,  fill_val);
+
+        if (m_retain_keys)
+        {
+            m_hash_keys = allocate_array<key_type>(new_index_chain_size);
+        }
+        if (m_use_fingerprints)
+        {
+            m_fingerprints = allocate_array<fingerprint_type>(new_index_chain_size);
+        }
+        if (m_use_prev_chain)
+        {
+            m_prev_chain = allocate_array<index_type>(new_index_chain_size);
+            std::fill_n(m_prev_chain, new_index_chain_size, fill_val);
+        }
+        update_rehash_threshold();
+    }
+
+    //
+    // m_hash_buckets[] is indexed directly from an incoming key ANDed with
+    // m_hash_mask (which is just the cached result of m_hash_buckets_size - 1).
+    // The resulting index will be either the index of the requested data or
+    // an index into m_index_chain[]. Index chain will then either have the
+    // index of the requested data or a successive chain of indexes to itself
+    // until the data index is found or a null_index is encountered.
+    // See first() and next() for more details on the lookup algorithm.
+    //
+    // m_hash_buckets[] can be of any power-of-two size (PoT is enforced).
+    // m_index_chain[] must match the size of the external data array and
+    // will be resized accordingly to accommodate the largest index inserted.
+    //
+    // Note: When the hash_index is empty, both m_hash_buckets and m_index_chain
+    // will point to the m_invalid_index_dummy below. This allows simplifying some
+    // things and avoiding additional IF checks for the empty hash_index case.
+    //
+    index_type * m_hash_buckets = nullptr;
+    index_type * m_index_chain  = nullptr;
+    size_type    m_hash_buckets_size = 0;
+    size_type    m_index_chain_size  = 0;
+
+    //
+    // As mentioned above, m_hash_mask is the cached result of m_hash_buckets_size - 1.
+    // Since we require a power-of-two size for the hash buckets array, we can use a
+    // much cheaper AND to modulate the incoming hash key, but we need to AND it with
+    // the num of buckets - 1, hence this cached value.
+    //
+    size_type m_hash_mask = 0;
+
+    //
+    // m_lookup_mask is a bit of magic... We use it to make the methods first() and
+    // next() branch-less. When the hash_index is empty, the buckets and index chain
+    // will point to the m_invalid_index_dummy[] array. In this case, we always want
+    // the incoming hash key to map to index zero, so m_lookup_mask is set to zero
+    // when hash_index is empty. It will get ANDed with the incoming hash key in
+    // first() and next() yielding the 0th index of m_invalid_index_dummy[] (null_index),
+    // so we've successfully managed to avoid an extra IF there for the empty case.
+    // But when the table is not empty, buckets and the index chain will point to
+    // heap-allocated arrays, so ANDing m_lookup_mask with a hash key should not
+    // alter the resulting array index. Therefore, when the table is not empty,
+    // m_lookup_mask is set to the bit pattern ~0 (0xFFFFF... or all 1s) so that
+    // ANDing anything with it will just yield back the original input.
+    //
+    size_type m_lookup_mask = 0;
+
+    //
+    // Factor used to resize the index chain on demand.
+    // Works best if using a power-of-two, but not required.
+    // Geometric growth on top of it if m_chain_growth_factor > 1.
+    //
+    size_type m_granularity = 0;
+    float     m_chain_growth_factor = 1.0f;
+
+    //
+    // Optional copy of the hash key of each index, parallel to m_index_chain[]
+    // (same size). Only allocated when key retention is enabled, null otherwise.
+    // This is what allows rebuilding the buckets without the caller's help.
+    //
+    key_type * m_hash_keys = nullptr;
+
+    //
+    // Number of indexes linked into the buckets, and the value of m_num_items
+    // past which insert() triggers a rehash (max size_type when auto-rehash is off).
+    //
+    size_type m_num_items        = 0;
+    size_type m_rehash_threshold = 0;
+    size_type m_shrink_threshold = 0; // Below which erase() shrinks, see set_min_load_factor().
+
+    //
+    // Auto-rehash policy. Disabled by default (m_max_load_factor == 0).
+    // See set_max_load_factor().
+    //
+    float     m_max_load_factor = 0.0f;
+    float     m_min_load_factor = 0.0f;
+    size_type m_growth_factor   = 2;
+    bool      m_retain_keys     = false;
+
+    //
+    // Optional fingerprint (top bits of the hash key) of each index, also parallel
+    // to m_index_chain[]. Only allocated if enabled via set_fingerprints().
+    //
+    fingerprint_type * m_fingerprints     = nullptr;
+    bool               m_use_fingerprints = false;
+
+    //
+    // Optional back links, also parallel to m_index_chain[]. m_prev_chain[i] is the
+    // index preceding i in its chain, or null_index if i is the head of the chain or
+    // is not linked at all. Only allocated if enabled via set_prev_chain().
+    //
+    index_type * m_prev_chain     = nullptr;
+    bool         m_use_prev_chain = false;
+
+    //
+    // Incremental rehash state. While m_old_hash_buckets is not null, the previous
+    // bucket array is being drained into m_hash_buckets[], and its buckets below
+    // m_rehash_position were already migrated. m_rehash_step is the number of old
+    // buckets migrated per insert()/erase(). See set_incremental_rehash().
+    //
+    index_type * m_old_hash_buckets      = nullptr;
+    size_type    m_old_hash_buckets_size = 0;
+    size_type    m_old_hash_mask         = 0;
+    size_type    m_rehash_position       = 0;
+    size_type    m_rehash_step           = 0;
+
+    #ifdef HASH_INDEX_ENABLE_COUNTERS
+    // Updated by the const lookups too. See lookup_counters.
+    mutable lookup_counters m_counters{};
+    #endif // HASH_INDEX_ENABLE_COUNTERS
+
+    //
+    // The initial empty hash_index allocates no heap memory, but to simplify
+    // handling of the empty case we still want the hash buckets and
+    // index chain to point to some array with at least one null_index
+    // in it. That's where this placeholder comes in. The data in it
+    // will not be modified by the hash_index, but since the m_hash_buckets
+    // and m_index_chain pointers are not const, this has to be kept mutable.
+    //
+    static index_type m_invalid_index_dummy[1];
+};
+
+// This abomination here is the m_invalid_index_dummy[] static initializer:
+template<typename IT, typename KT, typename ST, typename AT>
+typename hash_index<IT, KT, ST, AT>::index_type hash_index<IT, KT, ST, AT>::m_invalid_index_dummy[1] = {
+    hash_index<IT, KT, ST, AT>::null_index
+};
+
+// Out-of-class definitions so the constants can be bound to references (odr-used) before C++17.
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename hash_index<IT, KT, ST, AT>::index_type hash_index<IT, KT, ST, AT>::null_index;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename hash_index<IT, KT, ST, AT>::size_type hash_index<IT, KT, ST, AT>::default_initial_size;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename hash_index<IT, KT, ST, AT>::size_type hash_index<IT, KT, ST, AT>::default_granularity;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename hash_index<IT, KT, ST, AT>::size_type hash_index<IT, KT, ST, AT>::find_many_group_size;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename hash_index<IT, KT, ST, AT>::size_type hash_index<IT, KT, ST, AT>::parallel_grain;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename hash_index<IT, KT, ST, AT>::size_type hash_index<IT, KT, ST, AT>::chain_histogram_size;
+
+#if defined(HASH_INDEX_PMR)
+//
+// hash_index<> allocating from a std::pmr::memory_resource, given to the
+// constructor as a polymorphic_allocator (or the default resource if not).
+// E.g., to back a temporary table with a monotonic_buffer_resource arena:
+//
+//  std::pmr::monotonic_buffer_resource arena{ buffer, sizeof(buffer) };
+//  pmr_hash_index<> hash_idx{ 256, 256, &arena };
+//
+template
+<
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t
+>
+using pmr_hash_index = hash_index<IndexType, KeyType, SizeType, std::pmr::polymorphic_allocator<IndexType>>;
+#endif // HASH_INDEX_PMR
+
+//
+// ----------------------------
+//  hash_index_view<> template
+// ----------------------------
+//
+// Brief:
+//  Read-only hash_index<> over a table written by hash_index<>::serialize(),
+//  typically a memory-mapped file (see hash_index_file.hpp). Lookups use the
+//  serialized arrays in place, so attaching a view is O(1) and copies nothing,
+//  no matter the size of the table. The memory must outlive the view and must
+//  be aligned for index_type and key_type, which a memory-mapped file or any
+//  heap buffer always is.
+//
+//  IndexType and KeyType must have the same widths used when serializing,
+//  SizeType is free to differ. first/next/find behave exactly like in the
+//  hash_index<> that was serialized. Attaching only validates the header;
+//  call verify() once before trusting chain contents that came from a file
+//  you haven't produced yourself.
+//
+template
+<
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t
+>
+class hash_index_view final
+{
+public:
+
+    static_assert(std::is_integral<IndexType>::value, "Integer type required for IndexType!");
+    static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
+    static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
+
+    using index_type       = IndexType;
+    using key_type         = KeyType;
+    using size_type        = SizeType;
+    using fingerprint_type = unsigned char;
+
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+
+    //
+    // Constructors / attaching:
+    //
+
+    hash_index_view() noexcept
+    {
+        detach();
+    }
+
+    hash_index_view(const void * data, const size_type data_size) noexcept
+    {
+        attach(data, data_size);
+    }
+
+    // Points the view at a serialized table. Returns false and leaves
+    // the view detached (behaving like an empty table) on malformed data.
+    bool attach(const void * data, const size_type data_size) noexcept
+    {
+        detach();
+
+        hash_index_file_header header;
+        if (!hash_index_file_header::read(data, static_cast<std::uint64_t>(data_size),
+                                          sizeof(index_type), sizeof(key_type), header) ||
+            std::max(header.hash_buckets_size, header.index_chain_size) > static_cast<std::uint64_t>(std::numeric_limits<size_type>::max()))
+        {
+            return false;
+        }
+
+        // Sections are aligned relative to the start of the data, so this covers all of them.
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(data);
+        if ((address % alignof(index_type)) != 0 || (address % alignof(key_type)) != 0)
+        {
+            return false;
+        }
+
+        const unsigned char * const bytes = static_cast<const unsigned char *>(data);
+        m_header            = header;
+        m_hash_buckets      = reinterpret_cast<const index_type *>(bytes + header.hash_buckets_offset);
+        m_index_chain       = reinterpret_cast<const index_type *>(bytes + header.index_chain_offset);
+        m_hash_keys         = (header.hash_keys_offset != 0) ? reinterpret_cast<const key_type *>(bytes + header.hash_keys_offset) : nullptr;
+        m_fingerprints      = (header.fingerprints_offset != 0) ? (bytes + header.fingerprints_offset) : nullptr;
+        m_hash_buckets_size = static_cast<size_type>(header.hash_buckets_size);
+        m_index_chain_size  = static_cast<size_type>(header.index_chain_size);
+        m_hash_mask         = static_cast<size_type>(header.hash_mask);
+        m_num_items         = static_cast<size_type>(header.num_items);
+        m_lookup_mask       = ~static_cast<size_type>(0);
+        return true;
+    }
+
+    void detach() noexcept
+    {
+        m_header            = hash_index_file_header{};
+        m_hash_buckets      = m_invalid_index_dummy;
+        m_index_chain       = m_invalid_index_dummy;
+        m_hash_keys         = nullptr;
+        m_fingerprints      = nullptr;
+        m_hash_buckets_size = 0;
+        m_index_chain_size  = 0;
+        m_hash_mask         = 0;
+        m_num_items         = 0;
+        m_lookup_mask       = 0; // Same trick of hash_index<> for the empty case.
+    }
+
+    // Full O(n) check of the chains; See hash_index_file_header::verify_chains().
+    bool verify() const noexcept
+    {
+        return !is_attached() || hash_index_file_header::verify_chains(m_hash_buckets, m_index_chain, m_header);
+    }
+
+    //
+    // Lookup:
+    //
+
+    index_type first(const key_type key) const
+    {
+        return m_hash_buckets[key & m_hash_mask & m_lookup_mask];
+    }
+
+    index_type next(const index_type index) const
+    {
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
+        return m_index_chain[index & m_lookup_mask];
+    }
+
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        for (index_type i = first(key); i != null_index; i = next(i))
+        {
+            if (!may_match(i, key))
+            {
+                continue;
+            }
+
+            const auto & item = collection[i];
+            if (pred(needle, item))
+            {
+                return i;
+            }
+        }
+        return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(key, needle, collection, std::equal_to<ValueType>{});
+    }
+
+    //
+    // Queries:
+    //
+
+    size_type hash_buckets_size() const noexcept
+    {
+        return m_hash_buckets_size;
+    }
+
+    size_type index_chain_size() const noexcept
+    {
+        return m_index_chain_size;
+    }
+
+    size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    bool retains_keys() const noexcept
+    {
+        return m_hash_keys != nullptr;
+    }
+
+    bool uses_fingerprints() const noexcept
+    {
+        return m_fingerprints != nullptr;
+    }
+
+    bool is_attached() const noexcept
+    {
+        return m_lookup_mask != 0;
+    }
+
+    // Header of the attached table, all zeros if detached.
+    const hash_index_file_header & file_header() const noexcept
+    {
+        return m_header;
+    }
+
+private:
+
+    static fingerprint_type fingerprint_of(const key_type key) noexcept
+    {
+        // Must match hash_index<>::fingerprint_of().
+        using unsigned_key_type = typename std::make_unsigned<key_type>::type;
+        constexpr int shift = static_cast<int>(sizeof(key_type) - sizeof(fingerprint_type)) * 8;
+        return static_cast<fingerprint_type>(static_cast<unsigned_key_type>(key) >> shift);
+    }
+
+    bool may_match(const index_type index, const key_type key) const noexcept
+    {
+        if (m_hash_keys != nullptr)
+        {
+            return m_hash_keys[index] == key;
+        }
+        if (m_fingerprints != nullptr)
+        {
+            return m_fingerprints[index] == fingerprint_of(key);
+        }
+        return true;
+    }
+
+    // All pointers into the attached memory, or m_invalid_index_dummy when detached.
+    const index_type       * m_hash_buckets = nullptr;
+    const index_type       * m_index_chain  = nullptr;
+    const key_type         * m_hash_keys    = nullptr;
+    const fingerprint_type * m_fingerprints = nullptr;
+
+    size_type m_hash_buckets_size = 0;
+    size_type m_index_chain_size  = 0;
+    size_type m_hash_mask         = 0;
+    size_type m_lookup_mask       = 0;
+    size_type m_num_items         = 0;
+
+    hash_index_file_header m_header{};
+
+    static const index_type m_invalid_index_dummy[1];
+};
+
+template<typename IT, typename KT, typename ST>
+const typename hash_index_view<IT, KT, ST>::index_type hash_index_view<IT, KT, ST>::m_invalid_index_dummy[1] = {
+    hash_index_view<IT, KT, ST>::null_index
+};
+
+template<typename IT, typename KT, typename ST>
+constexpr typename hash_index_view<IT, KT, ST>::index_type hash_index_view<IT, KT, ST>::null_index;
+
+//
+// 64-bits FNV-1a hash of str[0..length-1], usable at compile time to produce the keys
+// of a constexpr static_hash_index<> (or anywhere else a simple string hash will do).
+// The array overload is for string literals, hashing all but the null terminator.
+//
+constexpr std::uint64_t hash_index_fnv1a(const char * str, const std::size_t length,
+                                         const std::uint64_t hash = 14695981039346656037ull) noexcept
+{
+#if defined(__cpp_constexpr) && (__cpp_constexpr >= 201304L)
+    std::uint64_t h = hash;
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        h = (h ^ static_cast<unsigned char>(str[i])) * 1099511628211ull;
+    }
+    return h;
+#else // C++11 constexpr functions are limited to a single return statement.
+    return (length == 0) ? hash : hash_index_fnv1a(str + 1, length - 1, (hash ^ static_cast<unsigned char>(*str)) * 1099511628211ull);
+#endif // __cpp_constexpr
+}
+
+template<std::size_t N>
+constexpr std::uint64_t hash_index_fnv1a(const char (&str)[N]) noexcept
+{
+    return hash_index_fnv1a(str, N - 1);
+}
+
+//
+// ------------------------------
+//  frozen_hash_index<> template
+// ------------------------------
+//
+// Brief:
+//  Read-only table built once from a set of (key, index) pairs, for tables never
+//  modified after they are populated, typically with hash_index<>::freeze(). Keys
+//  map through a minimal perfect hash (PTHash-style hash and displace) to exactly
+//  one slot each, so there are no chains: a lookup reads the key's pilot, then the
+//  slot's fingerprint and index, and compares a single item. Misses are rejected
+//  by the slot fingerprint without touching the collection, save for one in 256.
+//
+//  Keys with several indexes (duplicates or full key collisions) get all of them
+//  in their slot, in the order they were given, which for freeze() is the chain
+//  order of the hash_index<>. find() then returns the first match like hash_index<>
+//  does, with an extra start offset load per lookup. Key bits are mixed before use,
+//  so no particular key distribution is required.
+//
+//  The table lives in a single block laid out exactly as its serialized form (see
+//  hash_index_file_header, layout_perfect), so serialize() is a plain copy, and
+//  attach() uses a serialized table in place, e.g. a memory-mapped file, like
+//  hash_index_view<> does. Building takes O(n) memory and expected O(n log n)
+//  time, dominated by placing the last few keys in the remaining free slots.
+//
+// Usage example:
+//
+//  frozen_hash_index<> frozen = hash_idx.freeze(); // Needs key retention or a key function.
+//  const auto index = frozen.find(std::hash<std::string>{}(key), key, values, pred);
+//  hash_index_save_file("table.bin", frozen);
+//  ...
+//  hash_index_mapped_file file{ "table.bin" };
+//  frozen_hash_index<> loaded{ file.data(), file.size() }; // Zero-copy.
+//
+template
+<
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t,
+    typename Allocator = std::allocator<IndexType>
+>
+class frozen_hash_index final
+    : private Allocator // Take advantage of EBO for the default empty std::allocator
+{
+public:
+
+    static_assert(std::is_integral<IndexType>::value, "Integer type required for IndexType!");
+    static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
+    static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
+
+    using index_type       = IndexType;
+    using key_type         = KeyType;
+    using size_type        = SizeType;
+    using fingerprint_type = unsigned char;
+
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+
+    // Average keys sharing a pilot. Fewer is faster to build, but takes more memory.
+    static constexpr size_type keys_per_pilot = 4;
+
+    //
+    // Constructors-destructor / copy-assignment:
+    //
+
+    frozen_hash_index() = default;
+
+    // Same as build().
+    frozen_hash_index(const key_type * keys, const index_type * indexes, const size_type count,
+                      const Allocator & allocator = Allocator{})
+        : Allocator{ allocator }
+    {
+        build(keys, indexes, count);
+    }
+
+    // Same as attach().
+    frozen_hash_index(const void * data, const size_type data_size)
+    {
+        attach(data, data_size);
+    }
+
+    ~frozen_hash_index()
+    {
+        clear_and_free();
+    }
+
+    // Owned tables are deep copied, attached ones share the same external memory.
+    frozen_hash_index(const frozen_hash_index & other)
+        : Allocator{ static_cast<const Allocator &>(other) }
+    {
+        if (other.m_storage != nullptr)
+        {
+            deserialize(other.m_data, other.m_data_size);
+        }
+        else if (other.m_data != nullptr)
+        {
+            attach(other.m_data, other.m_data_size);
+        }
+    }
+
+    frozen_hash_index & operator = (frozen_hash_index other)
+    {
+        swap(*this, other);
+        return *this;
+    }
+
+    frozen_hash_index(frozen_hash_index && other)
+        : frozen_hash_index{}
+    {
+        swap(*this, other);
+    }
+
+    friend void swap(frozen_hash_index & lhs, frozen_hash_index & rhs) noexcept
+    {
+        using std::swap;
+        swap(lhs.m_header,         rhs.m_header);
+        swap(lhs.m_storage,        rhs.m_storage);
+        swap(lhs.m_storage_words,  rhs.m_storage_words);
+        swap(lhs.m_data,           rhs.m_data);
+        swap(lhs.m_data_size,      rhs.m_data_size);
+        swap(lhs.m_pilots,         rhs.m_pilots);
+        swap(lhs.m_indexes,        rhs.m_indexes);
+        swap(lhs.m_slot_starts,    rhs.m_slot_starts);
+        swap(lhs.m_fingerprints,   rhs.m_fingerprints);
+        swap(lhs.m_num_pilots,     rhs.m_num_pilots);
+        swap(lhs.m_num_slots,      rhs.m_num_slots);
+        swap(lhs.m_num_items,      rhs.m_num_items);
+        swap(lhs.m_seed,           rhs.m_seed);
+    }
+
+    //
+    // Building / attaching:
+    //
+
+    // Replaces the table with one mapping keys[i] to indexes[i], for i in [0, count).
+    // Indexes of a key that appears more than once are tried by find() in that order.
+    void build(const key_type * keys, const index_type * indexes, const size_type count)
+    {
+        HASH_INDEX_ASSERT((keys != nullptr && indexes != nullptr) || count == 0);
+        clear_and_free();
+        if (count == 0)
+        {
+            return;
+        }
+
+        // Group the indexes of each distinct key, keeping their given order.
+        std::vector<size_type> order(static_cast<std::size_t>(count));
+        for (size_type i = 0; i < count; ++i)
+        {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [keys](const size_type a, const size_type b) { return keys[a] < keys[b]; });
+
+        std::vector<size_type> group_starts; // Into 'order', one per distinct key, plus the end.
+        for (size_type i = 0; i < count; ++i)
+        {
+            if (i == 0 || keys[order[i]] != keys[order[i - 1]])
+            {
+                group_starts.push_back(i);
+            }
+        }
+        group_starts.push_back(count);
+
+        const size_type num_keys   = static_cast<size_type>(group_starts.size() - 1);
+        const size_type num_pilots = (num_keys + keys_per_pilot - 1) / keys_per_pilot;
+
+        std::vector<std::uint64_t> key_hashes(static_cast<std::size_t>(num_keys));
+        std::vector<std::uint32_t> pilots(static_cast<std::size_t>(num_pilots));
+        std::vector<size_type>     key_slots(static_cast<std::size_t>(num_keys));
+
+        // A seed only fails if some pilot runs out of values, which is
+        // practically impossible, but just try the next one if it does.
+        std::uint64_t seed = 0;
+        for (std::uint64_t attempt = 1;; ++attempt)
+        {
+            seed = hash_index_hasher::mix(attempt);
+            for (size_type k = 0; k < num_keys; ++k)
+            {
+                key_hashes[k] = key_hash(keys[order[group_starts[k]]], seed);
+            }
+            if (place_keys(key_hashes, num_pilots, pilots, key_slots))
+            {
+                break;
+            }
+        }
+
+        hash_index_file_header header{};
+        std::memcpy(header.magic, "HASHIDX", sizeof(header.magic));
+        header.version           = hash_index_file_header::current_version;
+        header.byte_order        = hash_index_file_header::byte_order_mark;
+        header.index_width       = sizeof(index_type);
+        header.key_width         = sizeof(key_type);
+        header.layout            = hash_index_file_header::layout_perfect;
+        header.flags             = hash_index_file_header::flag_fingerprints |
+                                   ((num_keys != count) ? static_cast<std::uint32_t>(hash_index_file_header::flag_multi_index) : 0u);
+        header.hash_buckets_size = static_cast<std::uint64_t>(num_pilots);
+        header.index_chain_size  = static_cast<std::uint64_t>(num_keys);
+        header.hash_mask         = seed;
+        header.num_items         = static_cast<std::uint64_t>(count);
+        header.compute_layout();
+
+        unsigned char * const bytes = allocate_storage(header.total_size);
+        std::memset(bytes, 0, static_cast<std::size_t>(header.total_size));
+        std::memcpy(bytes, &header, sizeof(header));
+        std::memcpy(bytes + header.hash_buckets_offset, pilots.data(), pilots.size() * sizeof(std::uint32_t));
+
+        // Slots in order, each with the indexes of its key.
+        std::vector<size_type> slot_keys(static_cast<std::size_t>(num_keys));
+        for (size_type k = 0; k < num_keys; ++k)
+        {
+            slot_keys[key_slots[k]] = k;
+        }
+
+        index_type * const indexes_out = reinterpret_cast<index_type *>(bytes + header.index_chain_offset);
+        index_type * const starts_out  = (header.hash_keys_offset != 0) ? reinterpret_cast<index_type *>(bytes + header.hash_keys_offset) : nullptr;
+        size_type written = 0;
+        for (size_type s = 0; s < num_keys; ++s)
+        {
+            const size_type k = slot_keys[s];
+            if (starts_out != nullptr)
+            {
+                starts_out[s] = static_cast<index_type>(written);
+            }
+            for (size_type i = group_starts[k]; i < group_starts[k + 1]; ++i)
+            {
+                HASH_INDEX_ASSERT(indexes[order[i]] != null_index);
+                indexes_out[written++] = indexes[order[i]];
+            }
+            bytes[header.fingerprints_offset + s] = fingerprint_of(key_hashes[k]);
+        }
+        if (starts_out != nullptr)
+        {
+            starts_out[num_keys] = static_cast<index_type>(written);
+        }
+
+        use_image(bytes, header);
+    }
+
+    // Points the table at one written by serialize(), without copying it. Returns false
+    // and leaves the table empty on malformed data. The memory must outlive the table
+    // and be aligned for index_type. Only validates the header, see verify().
+    bool attach(const void * data, const size_type data_size) noexcept
+    {
+        clear_and_free();
+
+        hash_index_file_header header;
+        if (!read_header(data, data_size, header))
+        {
+            return false;
+        }
+
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(data);
+        if ((address % alignof(index_type)) != 0 || (address % alignof(std::uint32_t)) != 0)
+        {
+            return false;
+        }
+
+        use_image(static_cast<const unsigned char *>(data), header);
+        return true;
+    }
+
+    void clear_and_free() noexcept
+    {
+        if (m_storage != nullptr)
+        {
+            typename std::allocator_traits<Allocator>::template rebind_alloc<std::uint64_t> alloc{ static_cast<const Allocator &>(*this) };
+            alloc.deallocate(m_storage, m_storage_words);
+        }
+
+        m_header        = hash_index_file_header{};
+        m_storage       = nullptr;
+        m_storage_words = 0;
+        m_data          = nullptr;
+        m_data_size     = 0;
+        m_pilots        = nullptr;
+        m_indexes       = nullptr;
+        m_slot_starts   = nullptr;
+        m_fingerprints  = nullptr;
+        m_num_pilots    = 0;
+        m_num_slots     = 0;
+        m_num_items     = 0;
+        m_seed          = 0;
+    }
+
+    // Full O(n) check of the slot starts, needed before trusting a table from elsewhere.
+    // Indexes themselves are only checked to not be null; Bounds are up to the collection.
+    bool verify() const noexcept
+    {
+        for (size_type i = 0; i < m_num_items; ++i)
+        {
+            if (m_indexes[i] == null_index)
+            {
+                return false;
+            }
+        }
+        if (m_slot_starts == nullptr)
+        {
+            return true;
+        }
+        if (m_slot_starts[0] != 0 || static_cast<std::uint64_t>(m_slot_starts[m_num_slots]) != static_cast<std::uint64_t>(m_num_items))
+        {
+            return false;
+        }
+        for (size_type s = 0; s < m_num_slots; ++s)
+        {
+            // Every slot holds at least one index; A negative signed start also fails here.
+            if (!(m_slot_starts[s] < m_slot_starts[s + 1]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //
+    // Lookup:
+    //
+
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        if (m_num_slots == 0)
+        {
+            return null_index;
+        }
+
+        const std::uint64_t hash = key_hash(key, m_seed);
+        const size_type     slot = slot_of(hash, m_pilots[reduce(hash, m_num_pilots)], m_num_slots);
+        if (m_fingerprints[slot] != fingerprint_of(hash))
+        {
+            return null_index;
+        }
+
+        if (m_slot_starts == nullptr)
+        {
+            const index_type i = m_indexes[slot];
+            return pred(needle, collection[i]) ? i : null_index;
+        }
+
+        const size_type end = static_cast<size_type>(m_slot_starts[slot + 1]);
+        for (size_type s = static_cast<size_type>(m_slot_starts[slot]); s < end; ++s)
+        {
+            const index_type i = m_indexes[s];
+            const auto & item = collection[i];
+            if (pred(needle, item))
+            {
+                return i;
+            }
+        }
+        return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(key, needle, collection, std::equal_to<ValueType>{});
+    }
+
+    //
+    // Serialization:
+    //
+
+    size_type serialized_size() const noexcept
+    {
+        return (m_data != nullptr) ? m_data_size : static_cast<size_type>(empty_header().total_size);
+    }
+
+    // Writes the table to buffer[0..buffer_size-1], which needs no particular alignment.
+    // Returns the number of bytes written or zero if the buffer is too small.
+    size_type serialize(void * buffer, const size_type buffer_size) const noexcept
+    {
+        const size_type size = serialized_size();
+        if (buffer == nullptr || buffer_size < size)
+        {
+            return 0;
+        }
+
+        if (m_data != nullptr)
+        {
+            std::memcpy(buffer, m_data, static_cast<std::size_t>(size));
+        }
+        else
+        {
+            const hash_index_file_header header = empty_header();
+            std::memset(buffer, 0, static_cast<std::size_t>(size));
+            std::memcpy(buffer, &header, sizeof(header));
+        }
+        return size;
+    }
+
+    // Replaces the table with a copy of one written by serialize(). The data needs no particular
+    // alignment. Returns false and leaves the table empty if malformed or if verify() fails.
+    bool deserialize(const void * data, const size_type data_size)
+    {
+        clear_and_free();
+
+        hash_index_file_header header;
+        if (!read_header(data, data_size, header))
+        {
+            return false;
+        }
+
+        unsigned char * const bytes = allocate_storage(header.total_size);
+        std::memcpy(bytes, data, static_cast<std::size_t>(header.total_size));
+        use_image(bytes, header);
+
+        if (!verify())
+        {
+            clear_and_free();
+            return false;
+        }
+        return true;
+    }
+
+    //
+    // Queries:
+    //
+
+    // Number of indexes in the table.
+    size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    // Number of distinct keys, which is also the number of slots.
+    size_type key_count() const noexcept
+    {
+        return m_num_slots;
+    }
+
+    size_type pilot_count() const noexcept
+    {
+        return m_num_pilots;
+    }
+
+    // Bytes of the table itself, owned or attached.
+    size_type table_bytes() const noexcept
+    {
+        return m_data_size;
+    }
+
+    // True if the table points to external memory given to attach().
+    bool is_attached() const noexcept
+    {
+        return m_data != nullptr && m_storage == nullptr;
+    }
+
+    // Header of the table, all zeros if empty.
+    const hash_index_file_header & file_header() const noexcept
+    {
+        return m_header;
+    }
+
+private:
+
+    static std::uint64_t key_hash(const key_type key, const std::uint64_t seed) noexcept
+    {
+        using unsigned_key_type = typename std::make_unsigned<key_type>::type;
+        return hash_index_hasher::mix(static_cast<std::uint64_t>(static_cast<unsigned_key_type>(key)) ^ seed);
+    }
+
+    // Maps x into [0, n) by the high bits of x, without a division for the usual sizes.
+    static size_type reduce(const std::uint64_t x, const size_type n) noexcept
+    {
+        const std::uint64_t range = static_cast<std::uint64_t>(n);
+        if (range <= (static_cast<std::uint64_t>(1) << 32))
+        {
+            return static_cast<size_type>(((x >> 32) * range) >> 32);
+        }
+        return static_cast<size_type>(x % range);
+    }
+
+    static size_type slot_of(const std::uint64_t hash, const std::uint32_t pilot, const size_type num_slots) noexcept
+    {
+        return reduce(hash_index_hasher::mix(hash + pilot * 0x9E3779B97F4A7C15ull), num_slots);
+    }
+
+    // Low bits of the key hash, independent from the high bits selecting the pilot.
+    static fingerprint_type fingerprint_of(const std::uint64_t hash) noexcept
+    {
+        return static_cast<fingerprint_type>(hash);
+    }
+
+    //
+    // Pilot search: Keys are grouped by pilot, and the groups placed largest first,
+    // each trying pilot values from zero until all its keys land in distinct free
+    // slots. Returns false if some group runs out of pilot values.
+    //
+    static bool place_keys(const std::vector<std::uint64_t> & key_hashes, const size_type num_pilots,
+                           std::vector<std::uint32_t> & pilots, std::vector<size_type> & key_slots)
+    {
+        const size_type num_keys = static_cast<size_type>(key_hashes.size());
+
+        std::vector<size_type> group_starts(static_cast<std::size_t>(num_pilots) + 1, 0);
+        std::vector<size_type> grouped(static_cast<std::size_t>(num_keys));
+        for (size_type k = 0; k < num_keys; ++k)
+        {
+            ++group_starts[reduce(key_hashes[k], num_pilots) + 1];
+        }
+        for (size_type p = 0; p < num_pilots; ++p)
+        {
+            group_starts[p + 1] += group_starts[p];
+        }
+        {
+            std::vector<size_type> fill(group_starts.begin(), group_starts.end() - 1);
+            for (size_type k = 0; k < num_keys; ++k)
+            {
+                grouped[fill[reduce(key_hashes[k], num_pilots)]++] = k;
+            }
+        }
+
+        std::vector<size_type> pilot_order(static_cast<std::size_t>(num_pilots));
+        for (size_type p = 0; p < num_pilots; ++p)
+        {
+            pilot_order[p] = p;
+        }
+        std::stable_sort(pilot_order.begin(), pilot_order.end(), [&group_starts](const size_type a, const size_type b)
+        {
+            return (group_starts[a + 1] - group_starts[a]) > (group_starts[b + 1] - group_starts[b]);
+        });
+
+        std::vector<unsigned char> taken(static_cast<std::size_t>(num_keys), 0);
+        std::vector<size_type> candidate;
+
+        for (const size_type p : pilot_order)
+        {
+            const size_type first = group_starts[p];
+            const size_type last  = group_starts[p + 1];
+            pilots[p] = 0;
+            if (first == last)
+            {
+                continue;
+            }
+
+            for (std::uint64_t pilot = 0;; ++pilot)
+            {
+                if (pilot > std::numeric_limits<std::uint32_t>::max())
+                {
+                    return false;
+                }
+
+                candidate.clear();
+                bool fits = true;
+                for (size_type g = first; g < last && fits; ++g)
+                {
+                    const size_type slot = slot_of(key_hashes[grouped[g]], static_cast<std::uint32_t>(pilot), num_keys);
+                    fits = !taken[slot] && (std::find(candidate.begin(), candidate.end(), slot) == candidate.end());
+                    candidate.push_back(slot);
+                }
+                if (!fits)
+                {
+                    continue;
+                }
+
+                for (size_type g = first; g < last; ++g)
+                {
+                    const size_type slot = candidate[g - first];
+                    taken[slot] = 1;
+                    key_slots[grouped[g]] = slot;
+                }
+                pilots[p] = static_cast<std::uint32_t>(pilot);
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool read_header(const void * data, const size_type data_size, hash_index_file_header & header) const noexcept
+    {
+        return hash_index_file_header::read(data, static_cast<std::uint64_t>(data_size), sizeof(index_type), sizeof(key_type),
+                                            header, hash_index_file_header::layout_perfect) &&
+               header.total_size <= static_cast<std::uint64_t>(std::numeric_limits<size_type>::max());
+    }
+
+    static hash_index_file_header empty_header() noexcept
+    {
+        hash_index_file_header header{};
+        std::memcpy(header.magic, "HASHIDX", sizeof(header.magic));
+        header.version     = hash_index_file_header::current_version;
+        header.byte_order  = hash_index_file_header::byte_order_mark;
+        header.index_width = sizeof(index_type);
+        header.key_width   = sizeof(key_type);
+        header.layout      = hash_index_file_header::layout_perfect;
+        header.flags       = hash_index_file_header::flag_fingerprints;
+        header.compute_layout();
+        return header;
+    }
+
+    // Owned block for the table, in 64-bit words so every section is suitably aligned.
+    unsigned char * allocate_storage(const std::uint64_t bytes)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<std::uint64_t> alloc{ static_cast<const Allocator &>(*this) };
+        m_storage_words = static_cast<size_type>((bytes + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+        m_storage       = alloc.allocate(m_storage_words);
+        return reinterpret_cast<unsigned char *>(m_storage);
+    }
+
+    void use_image(const unsigned char * bytes, const hash_index_file_header & header) noexcept
+    {
+        m_header       = header;
+        m_data         = bytes;
+        m_data_size    = static_cast<size_type>(header.total_size);
+        m_pilots       = reinterpret_cast<const std::uint32_t *>(bytes + header.hash_buckets_offset);
+        m_indexes      = reinterpret_cast<const index_type *>(bytes + header.index_chain_offset);
+        m_slot_starts  = (header.hash_keys_offset != 0) ? reinterpret_cast<const index_type *>(bytes + header.hash_keys_offset) : nullptr;
+        m_fingerprints = bytes + header.fingerprints_offset;
+        m_num_pilots   = static_cast<size_type>(header.hash_buckets_size);
+        m_num_slots    = static_cast<size_type>(header.index_chain_size);
+        m_num_items    = static_cast<size_type>(header.num_items);
+        m_seed         = header.hash_mask;
+    }
+
+    hash_index_file_header m_header{};
+
+    // Owned block, null if empty or attached to external memory.
+    std::uint64_t * m_storage       = nullptr;
+    size_type       m_storage_words = 0;
+
+    // Serialized table in use, owned or attached, and pointers to its sections.
+    const unsigned char    * m_data         = nullptr;
+    size_type                m_data_size    = 0;
+    const std::uint32_t    * m_pilots       = nullptr;
+    const index_type       * m_indexes      = nullptr;
+    const index_type       * m_slot_starts  = nullptr; // Null if every key has a single index.
+    const fingerprint_type * m_fingerprints = nullptr;
+
+    size_type     m_num_pilots = 0;
+    size_type     m_num_slots  = 0;
+    size_type     m_num_items  = 0;
+    std::uint64_t m_seed       = 0;
+};
+
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename frozen_hash_index<IT, KT, ST, AT>::index_type frozen_hash_index<IT, KT, ST, AT>::null_index;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename frozen_hash_index<IT, KT, ST, AT>::size_type frozen_hash_index<IT, KT, ST, AT>::keys_per_pilot;
+
+//
+// ------------------------------
+//  static_hash_index<> template
+// ------------------------------
+//
+// Brief:
+//  Fixed capacity hash_index<> with the buckets and index chain stored
+//  inline as std::array members, sized at compile time. It never allocates,
+//  so it is a good fit for the many small per-object tables with a known
+//  upper bound, and it can live on the stack or inside the owning object.
+//  The bucket mask is a compile-time constant, so first() is just an AND
+//  and a load, without the lookup mask indirection of hash_index<>.
+//
+//  Buckets must be a power-of-two. Capacity is the size of the index chain,
+//  i.e. indexes must be in the range [0, Capacity). The other template
+//  arguments have the same meaning of hash_index<>. Copying is a plain
+//  copy of the arrays, so keep Buckets and Capacity small.
+//
+//  With C++17 or newer, a fully populated table can be built in a constant
+//  expression from a list of keys, placing the arrays in read-only data and
+//  leaving nothing to do at startup. Lookups with constant keys can then be
+//  folded by the compiler as well:
+//
+//  constexpr const char * opcodes[] = { "add", "sub", "mul" };
+//  constexpr std::uint64_t opcode_keys[] = { hash_index_fnv1a("add"), hash_index_fnv1a("sub"), hash_index_fnv1a("mul") };
+//  static constexpr static_hash_index<std::uint8_t, 4, 3, std::uint64_t> opcode_table{ opcode_keys };
+//  static_assert(opcode_table.first(hash_index_fnv1a("mul")) == 2, "");
+//
+template
+<
+    typename    IndexType,
+    std::size_t Buckets,
+    std::size_t Capacity,
+    typename    KeyType  = std::size_t,
+    typename    SizeType = std::size_t
+>
+class static_hash_index final
+{
+public:
+
+    static_assert(std::is_integral<IndexType>::value, "Integer type required for IndexType!");
+    static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
+    static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
+    static_assert(Buckets > 0 && (Buckets & (Buckets - 1)) == 0, "Size of static_hash_index buckets array must be a power-of-2!");
+    static_assert(Capacity > 0 && Capacity <= static_cast<std::uintmax_t>(std::numeric_limits<IndexType>::max()),
+                  "Capacity must fit in IndexType, minus the null_index!");
+
+    using index_type = IndexType;
+    using key_type   = KeyType;
+    using size_type  = SizeType;
+
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+    static constexpr size_type  hash_mask  = static_cast<size_type>(Buckets - 1);
+
+    //
+    // Constructors:
+    //
+
+    HASH_INDEX_CONSTEXPR17 static_hash_index() noexcept
+    {
+        clear();
+    }
+
+    // Links keys[i] to index i, same as inserting them in order.
+    template<std::size_t Count>
+    HASH_INDEX_CONSTEXPR17 explicit static_hash_index(const key_type (&keys)[Count]) noexcept
+    {
+        static_assert(Count <= Capacity, "More keys than the static_hash_index capacity!");
+        clear();
+        for (std::size_t i = 0; i < Count; ++i)
+        {
+            insert(keys[i], static_cast<index_type>(i));
+        }
+    }
+
+    //
+    // Lookup:
+    //
+
+    HASH_INDEX_CONSTEXPR17 index_type first(const key_type key) const noexcept
+    {
+        return m_hash_buckets[static_cast<size_type>(key) & hash_mask];
+    }
+
+    HASH_INDEX_CONSTEXPR17 index_type next(const index_type index) const noexcept
+    {
+        HASH_INDEX_ASSERT(static_cast<std::size_t>(index) < Capacity);
+        return m_index_chain[static_cast<std::size_t>(index)];
+    }
+
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    HASH_INDEX_CONSTEXPR17 index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        for (index_type i = first(key); i != null_index; i = next(i))
+        {
+            const auto & item = collection[i];
+            if (pred(needle, item))
+            {
+                return i;
+            }
+        }
+        return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    HASH_INDEX_CONSTEXPR17 index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(key, needle, collection, std::equal_to<ValueType>{});
+    }
+
+    //
+    // Insertion / removal:
+    //
+
+    HASH_INDEX_CONSTEXPR17 void insert(const key_type key, const index_type index) noexcept
+    {
+        HASH_INDEX_ASSERT(static_cast<std::size_t>(index) < Capacity && "Index out of static_hash_index capacity!");
+
+        const size_type k = static_cast<size_type>(key) & hash_mask;
+        m_index_chain[static_cast<std::size_t>(index)] = m_hash_buckets[k];
+        m_hash_buckets[k] = index;
+        ++m_num_items;
+    }
+
+    HASH_INDEX_CONSTEXPR17 void erase(const key_type key, const index_type index) noexcept
+    {
+        HASH_INDEX_ASSERT(static_cast<std::size_t>(index) < Capacity);
+
+        const size_type k = static_cast<size_type>(key) & hash_mask;
+        if (m_hash_buckets[k] == index)
+        {
+            m_hash_buckets[k] = m_index_chain[static_cast<std::size_t>(index)];
+            --m_num_items;
+        }
+        else
+        {
+            for (index_type i = m_hash_buckets[k]; i != null_index; i = m_index_chain[static_cast<std::size_t>(i)])
+            {
+                if (m_index_chain[static_cast<std::size_t>(i)] == index)
+                {
+                    m_index_chain[static_cast<std::size_t>(i)] = m_index_chain[static_cast<std::size_t>(index)];
+                    --m_num_items;
+                    break;
+                }
+            }
+        }
+
+        m_index_chain[static_cast<std::size_t>(index)] = null_index;
+    }
+
+    HASH_INDEX_CONSTEXPR17 void clear() noexcept
+    {
+        // Not std::array::fill(), which is only constexpr since C++20.
+        for (std::size_t i = 0; i < Buckets;  ++i) { m_hash_buckets[i] = null_index; }
+        for (std::size_t i = 0; i < Capacity; ++i) { m_index_chain[i]  = null_index; }
+        m_num_items = 0;
+    }
+
+    //
+    // Queries:
+    //
+
+    static constexpr size_type hash_buckets_size() noexcept
+    {
+        return static_cast<size_type>(Buckets);
+    }
+
+    static constexpr size_type index_chain_size() noexcept
+    {
+        return static_cast<size_type>(Capacity);
+    }
+
+    static constexpr size_type allocated_bytes() noexcept
+    {
+        return 0; // Never allocates; sizeof(static_hash_index) is all there is.
+    }
+
+    constexpr size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    constexpr bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    constexpr float load_factor() const noexcept
+    {
+        return static_cast<float>(m_num_items) / static_cast<float>(Buckets);
+    }
+
+    //
+    // Deep comparison operators:
+    //
+
+    bool operator == (const static_hash_index & other) const noexcept
+    {
+        return m_num_items    == other.m_num_items    &&
+               m_hash_buckets == other.m_hash_buckets &&
+               m_index_chain  == other.m_index_chain;
+    }
+
+    bool operator != (const static_hash_index & other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+private:
+
+    // Same roles as in hash_index<>, except both always exist. Value initialized
+    // only because constexpr constructors can't leave members uninitialized.
+    std::array<index_type, Buckets>  m_hash_buckets{};
+    std::array<index_type, Capacity> m_index_chain{};
+    size_type                        m_num_items = 0;
+};
+
+template<typename IT, std::size_t B, std::size_t C, typename KT, typename ST>
+constexpr typename static_hash_index<IT, B, C, KT, ST>::index_type static_hash_index<IT, B, C, KT, ST>::null_index;
+template<typename IT, std::size_t B, std::size_t C, typename KT, typename ST>
+constexpr typename static_hash_index<IT, B, C, KT, ST>::size_type static_hash_index<IT, B, C, KT, ST>::hash_mask;
+
+//
+// -----------------------------
+//  group_hash_index<> template
+// -----------------------------
+//
+// Brief:
+//  Open addressing alternative to hash_index<>, with the same
+//  first/next/find/insert/erase interface, but better locality
+//  under high load. Instead of hash buckets pointing into the
+//  index chain, (key, index) pairs are stored directly in a flat
+//  slot array, next to a control byte per slot. Slots are grouped
+//  in 16s, and the control bytes of a whole group are matched
+//  against 7 bits of the key at once (with SSE2 or NEON, if
+//  available), so most lookups touch a single group of slots.
+//  The design is the same used by Abseil's Swiss tables.
+//
+//  Stored keys are compared in full, so first()/next() only yield
+//  indexes inserted with that exact key, and not every index that
+//  happens to share a bucket with it like hash_index<> does.
+//  Duplicate keys are visited in probe order, which isn't necessarily
+//  the newest first. insert_at_index() and erase_and_remove_index()
+//  are not supported by this layout.
+//
+//  Template arguments have the same meaning of hash_index<>.
+//  To pick the layout per table via a template parameter while
+//  keeping the call sites unchanged, see basic_hash_index<>.
+//
+template
+<
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t,
+    typename Allocator = std::allocator<IndexType>
+>
+class group_hash_index final
+    : private Allocator // Take advantage of EBO for the default empty std::allocator
+{
+public:
+
+    static_assert(std::is_integral<IndexType>::value, "Integer type required for IndexType!");
+    static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
+    static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
+
+    using index_type = IndexType;
+    using key_type   = KeyType;
+    using size_type  = SizeType;
+
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+
+    //
+    // group_width / default_initial_size / default_granularity:
+    //
+    // Number of slots probed at a time and default initial sizes. The slot
+    // count is always a power-of-two multiple of group_width. The slot array
+    // is grown before it gets more than 7/8ths full.
+    //
+    static constexpr size_type group_width          = 16;
+    static constexpr size_type default_initial_size = 1024;
+    static constexpr size_type default_granularity  = 1024;
+
+    //
+    // Constructors-destructor / copy-assignment:
+    //
+
+    group_hash_index()
+    {
+        internal_init(default_initial_size, default_initial_size);
+    }
+
+    group_hash_index(const size_type initial_slots_size,
+                     const size_type initial_index_chain_size)
+    {
+        internal_init(initial_slots_size, initial_index_chain_size);
+    }
+
+    ~group_hash_index()
+    {
+        clear_and_free();
+    }
+
+    group_hash_index(const group_hash_index & other)
+        : Allocator{ static_cast<const Allocator &>(other) }
+    {
+        internal_init(other.m_slots_size, other.m_slot_of_index_size);
+        if (other.is_allocated())
+        {
+            internal_allocate(other.m_slots_size, other.m_slot_of_index_size);
+            std::copy(other.m_ctrl,          other.m_ctrl          + m_slots_size,         m_ctrl);
+            std::copy(other.m_slot_keys,     other.m_slot_keys     + m_slots_size,         m_slot_keys);
+            std::copy(other.m_slot_indexes,  other.m_slot_indexes  + m_slots_size,         m_slot_indexes);
+            std::copy(other.m_slot_of_index, other.m_slot_of_index + m_slot_of_index_size, m_slot_of_index);
+        }
+        m_num_items   = other.m_num_items;
+        m_growth_left = other.m_growth_left;
+    }
+
+    group_hash_index & operator = (group_hash_index other)
+    {
+        swap(*this, other);
+        return *this;
+    }
+
+    group_hash_index(group_hash_index && other)
+        : group_hash_index{}
+    {
+        swap(*this, other);
+    }
+
+    friend void swap(group_hash_index & lhs, group_hash_index & rhs) noexcept
+    {
+        using std::swap;
+        swap(lhs.m_ctrl,               rhs.m_ctrl);
+        swap(lhs.m_slot_keys,          rhs.m_slot_keys);
+        swap(lhs.m_slot_indexes,       rhs.m_slot_indexes);
+        swap(lhs.m_slot_of_index,      rhs.m_slot_of_index);
+        swap(lhs.m_slots_size,         rhs.m_slots_size);
+        swap(lhs.m_slot_of_index_size, rhs.m_slot_of_index_size);
+        swap(lhs.m_group_mask,         rhs.m_group_mask);
+        swap(lhs.m_num_items,          rhs.m_num_items);
+        swap(lhs.m_growth_left,        rhs.m_growth_left);
+    }
+
+    //
+    // Lookup:
+    //
+
+    index_type first(const key_type key) const
+    {
+        // On an empty table m_ctrl points to a single group of empty control
+        // bytes and m_group_mask is zero, so this stops at the first group.
+        return scan(key, group_of(key), 0);
+    }
+
+    index_type next(const index_type index) const
+    {
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_slot_of_index_size);
+        HASH_INDEX_ASSERT(m_slot_of_index[index] != null_index && "Index is not in the table!");
+
+        const size_type slot = static_cast<size_type>(m_slot_of_index[index]);
+        return scan(m_slot_keys[slot], slot / group_width, (slot % group_width) + 1);
+    }
+
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        for (index_type i = first(key); i != null_index; i = next(i))
+        {
+            const auto & item = collection[i];
+            if (pred(needle, item))
+            {
+                return i;
+            }
+        }
+        return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(key, needle, collection, std::equal_to<ValueType>{});
+    }
+
+    //
+    // Insertion / removal:
+    //
+
+    void insert(const key_type key, const index_type index)
+    {
+        HASH_INDEX_ASSERT(index != null_index);
+
+        if (!is_allocated())
+        {
+            const size_type index_chain_size = ((static_cast<size_type>(index) >= m_slot_of_index_size) ?
+                                                index + 1 : m_slot_of_index_size);
+            internal_allocate(m_slots_size, index_chain_size);
+        }
+        else if (static_cast<size_type>(index) >= m_slot_of_index_size)
+        {
+            resize_index_chain(index + 1);
+        }
+
+        if (m_growth_left == 0)
+        {
+            // Grow if actually full, otherwise just flush the deleted slots.
+            const bool grow = (m_num_items + 1) > (max_items_for(m_slots_size) / 2);
+            rehash(grow ? m_slots_size * 2 : m_slots_size);
+        }
+
+        const size_type slot = find_free_slot(key);
+        if (m_ctrl[slot] == ctrl_empty)
+        {
+            --m_growth_left;
+        }
+
+        m_ctrl[slot]          = h2_of(key);
+        m_slot_keys[slot]     = key;
+        m_slot_indexes[slot]  = index;
+        m_slot_of_index[index] = static_cast<index_type>(slot);
+        ++m_num_items;
+    }
+
+    void erase(const key_type key, const index_type index)
+    {
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_slot_of_index_size);
+
+        if (!is_allocated() || m_slot_of_index[index] == null_index)
+        {
+            return;
+        }
+
+        const size_type slot = static_cast<size_type>(m_slot_of_index[index]);
+        if (m_slot_keys[slot] != key)
+        {
+            return;
+        }
+
+        // If the group still has an empty slot, no probe sequence could have
+        // continued past it, so the erased slot can go back to empty. Otherwise
+        // it must become a tombstone to keep later entries in the group reachable.
+        const ctrl_type * group = m_ctrl + (slot / group_width) * group_width;
+        if (match_byte(group, ctrl_empty) != 0)
+        {
+            m_ctrl[slot] = ctrl_empty;
+            ++m_growth_left;
+        }
+        else
+        {
+            m_ctrl[slot] = ctrl_deleted;
+        }
+
+        m_slot_of_index[index] = null_index;
+        --m_num_items;
+    }
+
+    //
+    // Memory management:
+    //
+
+    void clear() noexcept
+    {
+        if (is_allocated())
+        {
+            std::fill_n(m_ctrl, m_slots_size, ctrl_empty);
+            std::fill_n(m_slot_of_index, m_slot_of_index_size, null_index);
+        }
+        m_num_items   = 0;
+        m_growth_left = max_items_for(m_slots_size);
+    }
+
+    void clear_and_free()
+    {
+        if (is_allocated())
+        {
+            deallocate_array(m_ctrl,          m_slots_size);
+            deallocate_array(m_slot_keys,     m_slots_size);
+            deallocate_array(m_slot_indexes,  m_slots_size);
+            deallocate_array(m_slot_of_index, m_slot_of_index_size);
+        }
+        m_ctrl          = m_empty_group;
+        m_slot_keys     = nullptr;
+        m_slot_indexes  = nullptr;
+        m_slot_of_index = nullptr;
+        m_group_mask    = 0;
+        m_num_items     = 0;
+        m_growth_left   = 0;
+    }
+
+    void resize_index_chain(const size_type new_index_chain_size)
+    {
+        if (new_index_chain_size <= m_slot_of_index_size)
+        {
+            return;
+        }
+
+        const auto mod = new_index_chain_size % default_granularity;
+        const size_type new_size = (mod == 0) ? new_index_chain_size : new_index_chain_size + default_granularity - mod;
+
+        if (!is_allocated()) // Not allocated yet; Defer.
+        {
+            m_slot_of_index_size = new_size;
+            return;
+        }
+
+        index_type * new_slot_of_index = allocate_array<index_type>(new_size);
+        std::copy(m_slot_of_index, m_slot_of_index + m_slot_of_index_size, new_slot_of_index);
+        std::fill(new_slot_of_index + m_slot_of_index_size, new_slot_of_index + new_size, null_index);
+
+        deallocate_array(m_slot_of_index, m_slot_of_index_size);
+        m_slot_of_index      = new_slot_of_index;
+        m_slot_of_index_size = new_size;
+    }
+
+    // Rebuild the slot array with a new size (rounded up to a power-of-two
+    // number of groups), reinserting every entry and dropping tombstones.
+    void rehash(const size_type new_slots_size)
+    {
+        const size_type slots_size = round_slots_size(new_slots_size);
+        HASH_INDEX_ASSERT(max_items_for(slots_size) >= m_num_items && "New size too small for the current items!");
+
+        if (!is_allocated())
+        {
+            m_slots_size  = slots_size; // Defer.
+            m_group_mask  = 0;
+            return;
+        }
+
+        ctrl_type  * const old_ctrl         = m_ctrl;
+        key_type   * const old_slot_keys    = m_slot_keys;
+        index_type * const old_slot_indexes = m_slot_indexes;
+        const size_type    old_slots_size   = m_slots_size;
+
+        m_ctrl         = allocate_array<ctrl_type>(slots_size);
+        m_slot_keys    = allocate_array<key_type>(slots_size);
+        m_slot_indexes = allocate_array<index_type>(slots_size);
+        m_slots_size   = slots_size;
+        m_group_mask   = (slots_size / group_width) - 1;
+        m_growth_left  = max_items_for(slots_size) - m_num_items;
+        std::fill_n(m_ctrl, slots_size, ctrl_empty);
+
+        for (size_type s = 0; s < old_slots_size; ++s)
+        {
+            if (is_full(old_ctrl[s]))
+            {
+                const size_type slot  = find_free_slot(old_slot_keys[s]);
+                m_ctrl[slot]          = old_ctrl[s];
+                m_slot_keys[slot]     = old_slot_keys[s];
+                m_slot_indexes[slot]  = old_slot_indexes[s];
+                m_slot_of_index[old_slot_indexes[s]] = static_cast<index_type>(slot);
+            }
+        }
+
+        deallocate_array(old_ctrl,         old_slots_size);
+        deallocate_array(old_slot_keys,    old_slots_size);
+        deallocate_array(old_slot_indexes, old_slots_size);
+    }
+
+    void reserve(const size_type expected_items)
+    {
+        size_type slots_size = m_slots_size;
+        while (max_items_for(slots_size) < expected_items)
+        {
+            slots_size *= 2;
+        }
+        if (slots_size != m_slots_size)
+        {
+            rehash(slots_size);
+        }
+        resize_index_chain(expected_items);
+    }
+
+    //
+    // Queries:
+    //
+
+    size_type allocated_bytes() const noexcept
+    {
+        if (!is_allocated())
+        {
+            return 0;
+        }
+        return (m_slots_size * (sizeof(ctrl_type) + sizeof(key_type) + sizeof(index_type))) +
+               (m_slot_of_index_size * sizeof(index_type));
+    }
+
+    // Total number of slots. Named after the hash_index<> counterpart for interface parity.
+    size_type hash_buckets_size() const noexcept
+    {
+        return m_slots_size;
+    }
+
+    size_type index_chain_size() const noexcept
+    {
+        return m_slot_of_index_size;
+    }
+
+    size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    float load_factor() const noexcept
+    {
+        return static_cast<float>(m_num_items) / static_cast<float>(m_slots_size);
+    }
+
+    bool is_allocated() const noexcept
+    {
+        return m_ctrl != m_empty_group;
+    }
+
+private:
+
+    //
+    // Control bytes: The high bit set means the slot is not in use, either
+    // empty (0x80) or deleted (0xFE). Otherwise the low 7 bits are the H2
+    // hash of the key stored in the slot, the top 7 bits of the key.
+    //
+    using ctrl_type    = unsigned char;
+    using bitmask_type = std::uint64_t;
+
+    static constexpr ctrl_type ctrl_empty   = 0x80;
+    static constexpr ctrl_type ctrl_deleted = 0xFE;
+
+    static bool is_full(const ctrl_type ctrl) noexcept
+    {
+        return (ctrl & 0x80) == 0;
+    }
+
+    static ctrl_type h2_of(const key_type key) noexcept
+    {
+        using unsigned_key_type = typename std::make_unsigned<key_type>::type;
+        constexpr int shift = static_cast<int>(sizeof(key_type) * 8) - 7;
+        return static_cast<ctrl_type>(static_cast<unsigned_key_type>(key) >> shift) & 0x7F;
+    }
+
+    size_type group_of(const key_type key) const noexcept
+    {
+        using unsigned_key_type = typename std::make_unsigned<key_type>::type;
+        return static_cast<size_type>(static_cast<unsigned_key_type>(key) & static_cast<unsigned_key_type>(m_group_mask));
+    }
+
+    static size_type max_items_for(const size_type slots_size) noexcept
+    {
+        return slots_size - (slots_size / 8);
+    }
+
+    static size_type round_slots_size(const size_type slots_size) noexcept
+    {
+        size_type pot = group_width;
+        while (pot < slots_size)
+        {
+            pot <<= 1;
+        }
+        return pot;
+    }
+
+    //
+    // Group matching. Each returns a bitmask with one set bit
+    // (every mask_stride bits) per control byte in the group that
+    // satisfies the condition, lowest bit for the first slot.
+    //
+    #if defined(HASH_INDEX_SSE2)
+    static constexpr int mask_stride = 1;
+
+    static bitmask_type match_byte(const ctrl_type * group, const ctrl_type value) noexcept
+    {
+        const __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        const __m128i cmp  = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(static_cast<char>(value)));
+        return static_cast<bitmask_type>(static_cast<unsigned int>(_mm_movemask_epi8(cmp)));
+    }
+
+    static bitmask_type match_empty_or_deleted(const ctrl_type * group) noexcept
+    {
+        const __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return static_cast<bitmask_type>(static_cast<unsigned int>(_mm_movemask_epi8(ctrl)));
+    }
+    #elif defined(HASH_INDEX_NEON)
+    static constexpr int mask_stride = 4;
+
+    static bitmask_type narrow_mask(const uint8x16_t cmp) noexcept
+    {
+        // No movemask on NEON; Shift-narrow each byte to a nibble and keep one bit per nibble.
+        const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+        return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ull;
+    }
+
+    static bitmask_type match_byte(const ctrl_type * group, const ctrl_type value) noexcept
+    {
+        return narrow_mask(vceqq_u8(vld1q_u8(group), vdupq_n_u8(value)));
+    }
+
+    static bitmask_type match_empty_or_deleted(const ctrl_type * group) noexcept
+    {
+        return narrow_mask(vtstq_u8(vld1q_u8(group), vdupq_n_u8(0x80)));
+    }
+    #else // Portable fallback
+    static constexpr int mask_stride = 1;
+
+    static bitmask_type match_byte(const ctrl_type * group, const ctrl_type value) noexcept
+    {
+        bitmask_type mask = 0;
+        for (size_type i = 0; i < group_width; ++i)
+        {
+            mask |= static_cast<bitmask_type>(group[i] == value) << i;
+        }
+        return mask;
+    }
+
+    static bitmask_type match_empty_or_deleted(const ctrl_type * group) noexcept
+    {
+        bitmask_type mask = 0;
+        for (size_type i = 0; i < group_width; ++i)
+        {
+            mask |= static_cast<bitmask_type>((group[i] & 0x80) != 0) << i;
+        }
+        return mask;
+    }
+    #endif // HASH_INDEX_SSE2 / HASH_INDEX_NEON
+
+    static size_type lowest_slot(const bitmask_type mask) noexcept
+    {
+        HASH_INDEX_ASSERT(mask != 0);
+        #if defined(__GNUC__) || defined(__clang__)
+        return static_cast<size_type>(__builtin_ctzll(mask)) / mask_stride;
+        #else
+        size_type bit = 0;
+        while (((mask >> bit) & 1) == 0)
+        {
+            ++bit;
+        }
+        return bit / mask_stride;
+        #endif
+    }
+
+    // Probes for the next slot holding 'key', starting at slot
+    // 'start' of 'group', returning its index or null_index.
+    index_type scan(const key_type key, size_type group, size_type start) const
+    {
+        const ctrl_type h2 = h2_of(key);
+        for (size_type probes = 0; probes <= m_group_mask; ++probes)
+        {
+            const ctrl_type * const ctrl = m_ctrl + group * group_width;
+            if (start < group_width)
+            {
+                bitmask_type matches = match_byte(ctrl, h2) & ~((bitmask_type(1) << (start * mask_stride)) - 1);
+                while (matches != 0)
+                {
+                    const size_type slot = group * group_width + lowest_slot(matches);
+                    if (m_slot_keys[slot] == key)
+                    {
+                        return m_slot_indexes[slot];
+                    }
+                    matches &= matches - 1;
+                }
+            }
+            if (match_byte(ctrl, ctrl_empty) != 0)
+            {
+                break; // Key would have been inserted in this group.
+            }
+            group = (group + 1) & m_group_mask;
+            start = 0;
+        }
+        return null_index;
+    }
+
+    size_type find_free_slot(const key_type key) const
+    {
+        HASH_INDEX_ASSERT(is_allocated());
+        size_type group = group_of(key);
+        for (;;)
+        {
+            const bitmask_type free_slots = match_empty_or_deleted(m_ctrl + group * group_width);
+            if (free_slots != 0)
+            {
+                return group * group_width + lowest_slot(free_slots);
+            }
+            // The 7/8ths max load guarantees we find a free slot eventually.
+            group = (group + 1) & m_group_mask;
+        }
+    }
+
+    template<typename T>
+    T * allocate_array(const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        return alloc.allocate(count);
+    }
+
+    template<typename T>
+    void deallocate_array(T * array, const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        alloc.deallocate(array, count);
+    }
+
+    void internal_init(const size_type initial_slots_size,
+                       const size_type initial_index_chain_size)
+    {
+        m_ctrl               = m_empty_group;
+        m_slots_size         = round_slots_size(initial_slots_size);
+        m_slot_of_index_size = initial_index_chain_size;
+        m_group_mask         = 0;
+        m_num_items          = 0;
+        m_growth_left        = 0;
+    }
+
+    void internal_allocate(const size_type new_slots_size,
+                           const size_type new_index_chain_size)
+    {
+        HASH_INDEX_ASSERT(!is_allocated());
+
+        m_slots_size         = round_slots_size(new_slots_size);
+        m_slot_of_index_size = new_index_chain_size;
+        m_ctrl               = allocate_array<ctrl_type>(m_slots_size);
+        m_slot_keys          = allocate_array<key_type>(m_slots_size);
+        m_slot_indexes       = allocate_array<index_type>(m_slots_size);
+        m_slot_of_index      = allocate_array<index_type>(m_slot_of_index_size);
+        m_group_mask         = (m_slots_size / group_width) - 1;
+        m_growth_left        = max_items_for(m_slots_size);
+        HASH_INDEX_ASSERT(m_slots_size - 1 <= static_cast<size_type>(std::numeric_limits<index_type>::max()) && "Slots must be addressable by index_type!");
+
+        std::fill_n(m_ctrl, m_slots_size, ctrl_empty);
+        std::fill_n(m_slot_of_index, m_slot_of_index_size, null_index);
+    }
+
+    //
+    // m_ctrl[] has one control byte per slot, m_slot_keys[] and m_slot_indexes[]
+    // the key and value index stored in each slot. All m_slots_size long.
+    // m_slot_of_index[] maps a value index back to the slot holding it, which is
+    // what allows next() to resume a probe from an index, and erase() to find its
+    // slot without probing. It is sized like the hash_index<> index chain.
+    //
+    ctrl_type  * m_ctrl          = nullptr;
+    key_type   * m_slot_keys     = nullptr;
+    index_type * m_slot_indexes  = nullptr;
+    index_type * m_slot_of_index = nullptr;
+    size_type    m_slots_size         = 0;
+    size_type    m_slot_of_index_size = 0;
+
+    // Number of groups - 1. Zero for the empty table, so every key maps to m_empty_group.
+    size_type m_group_mask = 0;
+
+    // Items in use, and remaining inserts into empty slots before the next rehash.
+    size_type m_num_items   = 0;
+    size_type m_growth_left = 0;
+
+    // Same idea of hash_index<>::m_invalid_index_dummy[]: A group of empty
+    // control bytes that an empty table points to, so lookups need no extra IF.
+    static ctrl_type m_empty_group[group_width];
+};
+
+template<typename IT, typename KT, typename ST, typename AT>
+typename group_hash_index<IT, KT, ST, AT>::ctrl_type group_hash_index<IT, KT, ST, AT>::m_empty_group[group_hash_index<IT, KT, ST, AT>::group_width] = {
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80
+};
+
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename group_hash_index<IT, KT, ST, AT>::index_type group_hash_index<IT, KT, ST, AT>::null_index;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename group_hash_index<IT, KT, ST, AT>::size_type group_hash_index<IT, KT, ST, AT>::group_width;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename group_hash_index<IT, KT, ST, AT>::size_type group_hash_index<IT, KT, ST, AT>::default_initial_size;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename group_hash_index<IT, KT, ST, AT>::size_type group_hash_index<IT, KT, ST, AT>::default_granularity;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename group_hash_index<IT, KT, ST, AT>::ctrl_type group_hash_index<IT, KT, ST, AT>::ctrl_empty;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename group_hash_index<IT, KT, ST, AT>::ctrl_type group_hash_index<IT, KT, ST, AT>::ctrl_deleted;
+
+//
+// -------------------------------
+//  compact_hash_index<> template
+// -------------------------------
+//
+// Brief:
+//  hash_index<> with the hash buckets and index chain packed into the narrowest
+//  entries able to hold the current index range, instead of a full index_type
+//  each. Entries start at 16 bits and are widened to 24, then 32 (and 64, if
+//  index_type is that wide) bits whenever the index chain grows past what the
+//  current width can address, e.g. when insert() is given a larger index.
+//  Widening re-encodes both arrays once, so it costs about the same as a
+//  resize_index_chain(). A table of fewer than 65535 items takes half the
+//  memory of a hash_index<> with 32-bit indexes, so twice as much of it
+//  stays in cache. In exchange, each entry access decodes a packed value.
+//
+//  Both arrays store the same kind of value (an index into the external array,
+//  or the null sentinel), so they always share the same width. The all-ones
+//  pattern of that width is the sentinel, so only it is lost from the range.
+//
+//  Chains, lookups and erasures behave exactly like in hash_index<>. Key
+//  retention, fingerprints, the rehash policies and the other optional
+//  features of hash_index<> are not available. Template arguments have
+//  the same meaning of hash_index<>, with index_type only being the type
+//  of the indexes in the public interface.
+//
+template
+<
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t,
+    typename Allocator = std::allocator<IndexType>
+>
+class compact_hash_index final
+    : private Allocator // Take advantage of EBO for the default empty std::allocator
+{
+public:
+
+    static_assert(std::is_integral<IndexType>::value, "Integer type required for IndexType!");
+    static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
+    static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
+    static_assert(sizeof(IndexType) >= 2, "IndexType must be at least 16-bits wide!");
+
+    using index_type = IndexType;
+    using key_type   = KeyType;
+    using size_type  = SizeType;
+
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
+
+    // Same defaults of hash_index<>.
+    static constexpr size_type default_initial_size = 1024;
+    static constexpr size_type default_granularity  = 1024;
+
+    //
+    // Constructors-destructor / copy-assignment:
+    //
+
+    compact_hash_index()
+    {
+        internal_init(default_initial_size, default_initial_size);
+    }
+
+    compact_hash_index(const size_type initial_hash_buckets_size,
+                       const size_type initial_index_chain_size)
+    {
+        internal_init(initial_hash_buckets_size, initial_index_chain_size);
+    }
+
+    ~compact_hash_index()
+    {
+        clear_and_free();
+    }
+
+    compact_hash_index(const compact_hash_index & other)
+        : Allocator{ static_cast<const Allocator &>(other) }
+    {
+        internal_init(other.m_hash_buckets_size, other.m_index_chain_size);
+        if (other.is_allocated())
+        {
+            internal_allocate(other.m_hash_buckets_size, other.m_index_chain_size);
+            std::memcpy(m_hash_buckets, other.m_hash_buckets, static_cast<std::size_t>(m_hash_buckets_size * m_index_width));
+            std::memcpy(m_index_chain,  other.m_index_chain,  static_cast<std::size_t>(m_index_chain_size  * m_index_width));
+        }
+        m_granularity = other.m_granularity;
+        m_chain_growth_factor = other.m_chain_growth_factor;
+        m_num_items   = other.m_num_items;
+    }
+
+    compact_hash_index & operator = (compact_hash_index other)
+    {
+        swap(*this, other);
+        return *this;
+    }
+
+    compact_hash_index(compact_hash_index && other)
+        : compact_hash_index{}
+    {
+        swap(*this, other);
+    }
+
+    friend void swap(compact_hash_index & lhs, compact_hash_index & rhs) noexcept
+    {
+        using std::swap;
+        swap(lhs.m_hash_buckets,      rhs.m_hash_buckets);
+        swap(lhs.m_index_chain,       rhs.m_index_chain);
+        swap(lhs.m_hash_buckets_size, rhs.m_hash_buckets_size);
+        swap(lhs.m_index_chain_size,  rhs.m_index_chain_size);
+        swap(lhs.m_hash_mask,         rhs.m_hash_mask);
+        swap(lhs.m_lookup_mask,       rhs.m_lookup_mask);
+        swap(lhs.m_granularity,       rhs.m_granularity);
+        swap(lhs.m_chain_growth_factor, rhs.m_chain_growth_factor);
+        swap(lhs.m_num_items,         rhs.m_num_items);
+        swap(lhs.m_index_width,       rhs.m_index_width);
+    }
+
+    //
+    // Lookup:
+    //
+
+    index_type first(const key_type key) const
+    {
+        // Same lookup mask trick of hash_index<>: The empty table points to
+        // m_invalid_entry_dummy[], which decodes to null_index at any width.
+        return load_entry(m_hash_buckets, static_cast<size_type>(key & m_hash_mask & m_lookup_mask), m_index_width);
+    }
+
+    index_type next(const index_type index) const
+    {
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
+        return load_entry(m_index_chain, static_cast<size_type>(index) & m_lookup_mask, m_index_width);
+    }
+
+    template<typename ValueType, typename CollectionType, typename Predicate>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
+    {
+        for (index_type i = first(key); i != null_index; i = next(i))
+        {
+            const auto & item = collection[i];
+            if (pred(needle, item))
+            {
+                return i;
+            }
+        }
+        return null_index;
+    }
+
+    template<typename ValueType, typename CollectionType>
+    index_type find(const key_type key, const ValueType & needle, const CollectionType & collection) const
+    {
+        return find(key, needle, collection, std::equal_to<ValueType>{});
+    }
+
+    //
+    // Insertion / removal:
+    //
+
+    void insert(const key_type key, const index_type index)
+    {
+        HASH_INDEX_ASSERT(index != null_index);
+
+        if (!is_allocated())
+        {
+            const size_type index_chain_size = ((static_cast<size_type>(index) >= m_index_chain_size) ?
+                                                index + 1 : m_index_chain_size);
+            internal_allocate(m_hash_buckets_size, index_chain_size);
+        }
+        else if (static_cast<size_type>(index) >= m_index_chain_size)
+        {
+            grow_index_chain(index + 1); // Widens the entries if needed.
+        }
+
+        const size_type k = static_cast<size_type>(key & m_hash_mask);
+        store_entry(m_index_chain, static_cast<size_type>(index), m_index_width, load_entry(m_hash_buckets, k, m_index_width));
+        store_entry(m_hash_buckets, k, m_index_width, index);
+        ++m_num_items;
+    }
+
+    void erase(const key_type key, const index_type index)
+    {
+        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
+
+        if (!is_allocated())
+        {
+            return;
+        }
+
+        const size_type k    = static_cast<size_type>(key & m_hash_mask);
+        const index_type nxt = load_entry(m_index_chain, static_cast<size_type>(index), m_index_width);
+
+        if (load_entry(m_hash_buckets, k, m_index_width) == index)
+        {
+            store_entry(m_hash_buckets, k, m_index_width, nxt);
+            --m_num_items;
+        }
+        else
+        {
+            for (index_type i = load_entry(m_hash_buckets, k, m_index_width); i != null_index; i = next(i))
+            {
+                if (next(i) == index)
+                {
+                    store_entry(m_index_chain, static_cast<size_type>(i), m_index_width, nxt);
+                    --m_num_items;
+                    break;
+                }
+            }
+        }
+
+        store_entry(m_index_chain, static_cast<size_type>(index), m_index_width, null_index);
+    }
+
+    //
+    // Memory management:
+    //
+
+    void clear() noexcept
+    {
+        if (is_allocated())
+        {
+            // All ones is the null sentinel at every width.
+            std::memset(m_hash_buckets, 0xFF, static_cast<std::size_t>(m_hash_buckets_size * m_index_width));
+        }
+        m_num_items = 0;
+    }
+
+    void clear_and_free()
+    {
+        if (is_allocated())
+        {
+            deallocate_array(m_hash_buckets, m_hash_buckets_size * m_index_width);
+            deallocate_array(m_index_chain,  m_index_chain_size  * m_index_width);
+        }
+        m_hash_buckets = m_invalid_entry_dummy;
+        m_index_chain  = m_invalid_entry_dummy;
+        m_lookup_mask  = 0;
+        m_num_items    = 0;
+    }
+
+    void set_granularity(const size_type new_granularity)
+    {
+        HASH_INDEX_ASSERT(new_granularity > 0);
+        m_granularity = new_granularity;
+    }
+
+    // Same growth policy of hash_index<>::set_index_chain_growth(). By default the chain
+    // grows by granularity() when insert() is given an index past its end.
+    void set_index_chain_growth(const float growth_factor)
+    {
+        HASH_INDEX_ASSERT(growth_factor >= 1.0f && "Index chain growth factor can't shrink the chain!");
+        m_chain_growth_factor = growth_factor;
+    }
+
+    // Sizes the index chain to hold indexes [0, count) upfront, like hash_index<>::reserve_index_chain().
+    void reserve_index_chain(const size_type count)
+    {
+        resize_index_chain(count);
+    }
+
+    // Grows the index chain, re-encoding both arrays with wider entries if the
+    // new size can't be addressed by the current width. Never shrinks either.
+    void resize_index_chain(const size_type new_index_chain_size)
+    {
+        if (new_index_chain_size <= m_index_chain_size)
+        {
+            return;
+        }
+
+        const auto mod = new_index_chain_size % m_granularity;
+        const size_type new_size  = (mod == 0) ? new_index_chain_size : new_index_chain_size + m_granularity - mod;
+        const size_type new_width = width_for(new_size);
+
+        if (!is_allocated()) // Not allocated yet; Defer.
+        {
+            m_index_chain_size = new_size;
+            m_index_width      = new_width;
+            return;
+        }
+
+        if (new_width != m_index_width)
+        {
+            m_hash_buckets = reencode(m_hash_buckets, m_hash_buckets_size, m_hash_buckets_size, new_width);
+        }
+        m_index_chain = reencode(m_index_chain, m_index_chain_size, new_size, new_width);
+
+        m_index_chain_size = new_size;
+        m_index_width      = new_width;
+    }
+
+    //
+    // Queries:
+    //
+
+    size_type allocated_bytes() const noexcept
+    {
+        if (!is_allocated())
+        {
+            return 0;
+        }
+        return (m_hash_buckets_size + m_index_chain_size) * m_index_width;
+    }
+
+    // Current width in bytes of the hash bucket and index chain entries: 2, 3, 4 or 8.
+    size_type index_width() const noexcept
+    {
+        return m_index_width;
+    }
+
+    size_type hash_buckets_size() const noexcept
+    {
+        return m_hash_buckets_size;
+    }
+
+    size_type index_chain_size() const noexcept
+    {
+        return m_index_chain_size;
+    }
+
+    size_type granularity() const noexcept
+    {
+        return m_granularity;
+    }
+
+    float index_chain_growth() const noexcept
+    {
+        return m_chain_growth_factor;
+    }
+
+    size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    float load_factor() const noexcept
+    {
+        return static_cast<float>(m_num_items) / static_cast<float>(m_hash_buckets_size);
+    }
+
+    bool is_allocated() const noexcept
+    {
+        return m_hash_buckets != m_invalid_entry_dummy;
+    }
+
+    //
+    // Deep comparison operators:
+    //
+
+    bool operator == (const compact_hash_index & other) const noexcept
+    {
+        if (this == &other)
+        {
+            return true;
+        }
+
+        if (m_hash_buckets_size != other.m_hash_buckets_size) { return false; }
+        if (m_index_chain_size  != other.m_index_chain_size ) { return false; }
+        if (m_granularity       != other.m_granularity      ) { return false; }
+        if (m_num_items         != other.m_num_items        ) { return false; }
+        if (is_allocated()      != other.is_allocated()     ) { return false; }
+        if (!is_allocated()) { return true; }
+
+        // Same sizes imply the same width.
+        return std::memcmp(m_hash_buckets, other.m_hash_buckets, static_cast<std::size_t>(m_hash_buckets_size * m_index_width)) == 0 &&
+               std::memcmp(m_index_chain,  other.m_index_chain,  static_cast<std::size_t>(m_index_chain_size  * m_index_width)) == 0;
+    }
+
+    bool operator != (const compact_hash_index & other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+private:
+
+    static constexpr size_type max_index_width = sizeof(index_type);
+
+    static std::uint64_t sentinel_of(const size_type width) noexcept
+    {
+        return (width >= 8) ? ~std::uint64_t{ 0 } : (std::uint64_t{ 1 } << (width * 8)) - 1;
+    }
+
+    // Narrowest width whose range (minus the sentinel) covers every index below count.
+    static size_type width_for(const size_type count) noexcept
+    {
+        const size_type widths[] = { 2, 3, 4, 8 };
+        for (const size_type width : widths)
+        {
+            if (width >= max_index_width || static_cast<std::uint64_t>(count) <= sentinel_of(width))
+            {
+                return std::min(width, max_index_width);
+            }
+        }
+        return max_index_width;
+    }
+
+    // 24-bit entries are always stored little-endian, the others in native byte order.
+    static index_type load_entry(const unsigned char * array, const size_type i, const size_type width) noexcept
+    {
+        const unsigned char * const p = array + i * width;
+        std::uint64_t v;
+        switch (width)
+        {
+        case 2  : { std::uint16_t v16; std::memcpy(&v16, p, 2); v = v16; break; }
+        case 3  : { v = std::uint64_t{ p[0] } | (std::uint64_t{ p[1] } << 8) | (std::uint64_t{ p[2] } << 16); break; }
+        case 4  : { std::uint32_t v32; std::memcpy(&v32, p, 4); v = v32; break; }
+        default : { std::memcpy(&v, p, 8); break; }
+        } // switch (width)
+        return (v == sentinel_of(width)) ? null_index : static_cast<index_type>(v);
+    }
+
+    static void store_entry(unsigned char * array, const size_type i, const size_type width, const index_type index) noexcept
+    {
+        unsigned char * const p = array + i * width;
+        const std::uint64_t v = (index == null_index) ? sentinel_of(width) : static_cast<std::uint64_t>(index);
+        switch (width)
+        {
+        case 2  : { const std::uint16_t v16 = static_cast<std::uint16_t>(v); std::memcpy(p, &v16, 2); break; }
+        case 3  : { p[0] = static_cast<unsigned char>(v); p[1] = static_cast<unsigned char>(v >> 8); p[2] = static_cast<unsigned char>(v >> 16); break; }
+        case 4  : { const std::uint32_t v32 = static_cast<std::uint32_t>(v); std::memcpy(p, &v32, 4); break; }
+        default : { std::memcpy(p, &v, 8); break; }
+        } // switch (width)
+    }
+
+    // Copies the first old_count entries of 'array' into a new array of new_count
+    // entries of new_width, null filling the rest, and frees the old one.
+    unsigned char * reencode(unsigned char * array, const size_type old_count, const size_type new_count, const size_type new_width)
+    {
+        unsigned char * const new_array = allocate_array<unsigned char>(new_count * new_width);
+        if (new_width == m_index_width)
+        {
+            std::memcpy(new_array, array, static_cast<std::size_t>(old_count * new_width));
+        }
+        else
+        {
+            for (size_type i = 0; i < old_count; ++i)
+            {
+                store_entry(new_array, i, new_width, load_entry(array, i, m_index_width));
+            }
+        }
+        std::memset(new_array + old_count * new_width, 0xFF, static_cast<std::size_t>((new_count - old_count) * new_width));
+        deallocate_array(array, old_count * m_index_width);
+        return new_array;
+    }
+
+    template<typename T>
+    T * allocate_array(const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        return alloc.allocate(count);
+    }
+
+    template<typename T>
+    void deallocate_array(T * array, const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        alloc.deallocate(array, count);
+    }
+
+    // Growth of the index chain to fit indexes up to min_size - 1, see set_index_chain_growth().
+    void grow_index_chain(const size_type min_size)
+    {
+        size_type new_size = min_size;
+        if (m_chain_growth_factor > 1.0f)
+        {
+            const float grown = static_cast<float>(m_index_chain_size) * m_chain_growth_factor;
+            if (grown < static_cast<float>(std::numeric_limits<size_type>::max() / 2))
+            {
+                new_size = std::max(new_size, static_cast<size_type>(grown));
+            }
+        }
+        resize_index_chain(new_size);
+    }
+
+    void internal_init(const size_type initial_hash_buckets_size,
+                       const size_type initial_index_chain_size)
+    {
+        HASH_INDEX_ASSERT(initial_hash_buckets_size > 0 && (initial_hash_buckets_size & (initial_hash_buckets_size - 1)) == 0 &&
+                          "Size of hash_index buckets array must be a power-of-2!");
+
+        m_hash_buckets      = m_invalid_entry_dummy;
+        m_index_chain       = m_invalid_entry_dummy;
+        m_hash_buckets_size = initial_hash_buckets_size;
+        m_index_chain_size  = initial_index_chain_size;
+        m_hash_mask         = m_hash_buckets_size - 1;
+        m_lookup_mask       = 0;
+        m_granularity       = default_granularity;
+        m_num_items         = 0;
+        m_index_width       = width_for(initial_index_chain_size);
+    }
+
+    void internal_allocate(const size_type new_hash_buckets_size,
+                           const size_type new_index_chain_size)
+    {
+        HASH_INDEX_ASSERT(!is_allocated());
+
+        m_index_width       = width_for(new_index_chain_size);
+        m_hash_buckets      = allocate_array<unsigned char>(new_hash_buckets_size * m_index_width);
+        m_index_chain       = allocate_array<unsigned char>(new_index_chain_size  * m_index_width);
+        m_hash_buckets_size = new_hash_buckets_size;
+        m_index_chain_size  = new_index_chain_size;
+        m_hash_mask         = m_hash_buckets_size - 1;
+        m_lookup_mask       = ~static_cast<size_type>(0);
+
+        std::memset(m_hash_buckets, 0xFF, static_cast<std::size_t>(m_hash_buckets_size * m_index_width));
+        std::memset(m_index_chain,  0xFF, static_cast<std::size_t>(m_index_chain_size  * m_index_width));
+    }
+
+    //
+    // Packed arrays of m_hash_buckets_size and m_index_chain_size entries
+    // of m_index_width bytes each, otherwise the same of hash_index<>.
+    //
+    unsigned char * m_hash_buckets      = nullptr;
+    unsigned char * m_index_chain       = nullptr;
+    size_type       m_hash_buckets_size = 0;
+    size_type       m_index_chain_size  = 0;
+    size_type       m_hash_mask         = 0;
+    size_type       m_lookup_mask       = 0;
+    size_type       m_granularity       = 0;
+    float           m_chain_growth_factor = 1.0f;
+    size_type       m_num_items         = 0;
+    size_type       m_index_width       = 2;
+
+    // Decodes to null_index at any width. See hash_index<>::m_invalid_index_dummy[].
+    static unsigned char m_invalid_entry_dummy[8];
+};
+
+template<typename IT, typename KT, typename ST, typename AT>
+unsigned char compact_hash_index<IT, KT, ST, AT>::m_invalid_entry_dummy[8] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename compact_hash_index<IT, KT, ST, AT>::index_type compact_hash_index<IT, KT, ST, AT>::null_index;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename compact_hash_index<IT, KT, ST, AT>::size_type compact_hash_index<IT, KT, ST, AT>::default_initial_size;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename compact_hash_index<IT, KT, ST, AT>::size_type compact_hash_index<IT, KT, ST, AT>::default_granularity;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename compact_hash_index<IT, KT, ST, AT>::size_type compact_hash_index<IT, KT, ST, AT>::max_index_width;
+
 //
-// -----------------------
-//  hash_index<> template
-// -----------------------
+// -------------------------------------
+//  inline_bucket_hash_index<> template
+// -------------------------------------
 //
 // Brief:
-//  Provides an efficient way of indexing into arrays by a key
-//  other than the integer element index. hash_index<> allows
-//  associating a hash key (returned by a function like std::hash)
-//  with an integer index of an external array where the mapped
-//  value is stored.
-//
-// Template arguments:
-//  IndexType is the type used to store the value array indexes.
-//  It must be an integer type. By default set to unsigned int
-//  to save memory on platforms where that type is 32-bits wide,
-//  since most of the time the full 64-bits indexing range is
-//  not required.
-//
-//  KeyType is the type of a hash key/hash-code used to
-//  lookup into hash_index. This type is only used in the
-//  public interface. By default set to std::size_t to match
-//  the return value of std::hash.
-//
-//  SizeType is used internally to store array sizes and is also
-//  visible in the public interface on functions that deal in sizes.
-//  Set to std::size_t by default to match the Standard library but
-//  could also be replaced by a 32-bits type to save memory if the
-//  full 64-bits range is not required.
-//
-//  Allocator is the Standard-compatible allocator used to alloc
-//  and dealloc the underlaying arrays used by hash_index<>.
-//  We inherit privately from it to take advantage of the Empty
-//  Base Class Optimization (EBO) if it is an empty class, so
-//  if providing a custom one, make sure it is inheritable
-//  (i.e., not final). By default std::allocator is used. The
-//  only methods we require are allocate() and deallocate().
-//
-//  All the template parameters are optional and you can simply
-//  declare an instance of this class as 'hash_index<>' if the
-//  defaults described above fit your needs.
+//  hash_index<> variant where each bucket is a 64-byte cache line holding
+//  the first entries of its chain inline, as (index, fingerprint) pairs,
+//  besides linking them through the index chain as usual. A lookup matches
+//  the key fingerprint against the inline entries of the bucket, so in the
+//  common case it touches that single line and the collection items it
+//  actually compares, without loading any index chain entry. Only chains
+//  longer than inline_capacity continue into the index chain past the last
+//  inline entry, with a fingerprint per index kept for those as well.
 //
-// ----------------
-//  Usage examples
-// ----------------
-//
-//  struct Thing
-//  {
-//      std::string name;
-//      ...
-//  };
-//
-//  hash_index<>       hash_idx;
-//  std::vector<Thing> values;
-//
-// Insertion:
-//
-//  Thing t = make_thing();
-//  values.push_back(t);
-//  hash_idx.insert(std::hash<std::string>{}(t.name), values.size() - 1);
-//
-// Lookup:
-//
-//  std::string key = ...;
-//  const auto index = hash_idx.find(std::hash<std::string>{}(key), key, values,
-//                                   [](const std::string & key, const Thing & item)
-//                                   {
-//                                       return key == item.name;
-//                                   });
-//  index == hash_index<>::null_index if not found, index into 'values[]' otherwise.
+//  first()/next() walk the same chains, newest first, that hash_index<>
+//  would produce for the same inserts and erases, and find() has the same
+//  results. Buckets are 16 times the size of a hash_index<> bucket, so size
+//  the bucket count to about the expected items / inline_capacity instead of
+//  the items count. The bucket array is aligned to the cache line if the
+//  allocator honors over-aligned types, like std::allocator does with C++17.
 //
-// Removal:
-//
-//  std::string  key   = ...;
-//  unsigned int index = ...;
-//  hash_idx.erase(std::hash<std::string>{}(key), index);
+//  Template arguments have the same meaning of hash_index<>. Like
+//  group_hash_index<>, insert_at_index() and erase_and_remove_index()
+//  are not supported. See basic_hash_index<> to select this layout.
 //
 template
 <
@@ -123,7 +6484,7 @@ template
     typename SizeType  = std::size_t,
     typename Allocator = std::allocator<IndexType>
 >
-class hash_index final
+class inline_bucket_hash_index final
     : private Allocator // Take advantage of EBO for the default empty std::allocator
 {
 public:
@@ -132,123 +6493,87 @@ public:
     static_assert(std::is_integral<KeyType>::value,   "Integer type required for KeyType!");
     static_assert(std::is_integral<SizeType>::value,  "Integer type required for SizeType!");
 
-    //
-    // index_type / null_index:
-    //
-    // You can use any signed or unsigned integral type for the underlaying
-    // index type of hash_index. By default index_type is an unsigned int, so
-    // on most platforms each index will only take 32-bits. If you need the
-    // full 64-bits indexing range, then instantiate the class with int64_t
-    // or equivalent. The bit pattern ~0 (0xFFFFF...) is reserved as an
-    // internal sentinel value to indicate an unused hash bucket, so this
-    // value cannot be used as an index.
-    //
-    using index_type = IndexType;
-    static constexpr index_type null_index = ~static_cast<index_type>(0);
+    using index_type       = IndexType;
+    using key_type         = KeyType;
+    using size_type        = SizeType;
+    using fingerprint_type = unsigned char;
 
-    //
-    // key_type:
-    //
-    // Integral type of the hashed key value. By default it is set to std::size_t
-    // to match the type returned by std::hash, but you can change it to any other
-    // integral type, signed or unsigned, that better fits your hash function.
-    //
-    using key_type = KeyType;
+    static constexpr index_type null_index = ~static_cast<index_type>(0);
 
     //
-    // size_type:
+    // cache_line_size / inline_capacity:
     //
-    // Type used to represent the internal array counts and sizes.
-    // Set to std::size_t by default to be consistent with the C++
-    // Standard Library, but it is rare the case where you actually
-    // have a hash_index big enough to overflow a smaller integer type,
-    // so this can probably be replaced by a 32-bits unsigned integer
-    // if you care about saving space on each individual class instance.
+    // As many (index, fingerprint) pairs as fit in a line with the entry count:
+    // 12 for 32-bit indexes, 7 for 64-bit ones.
     //
-    using size_type = SizeType;
+    static constexpr size_type cache_line_size = 64;
+    static constexpr size_type inline_capacity = (cache_line_size - 1) / (sizeof(index_type) + sizeof(fingerprint_type));
 
-    //
-    // default_initial_size / default_granularity:
-    //
-    // Default values used by the non-parameterized constructor
-    // to set the initial number of hash buckets and size of the
-    // index chain. Larger sizes reduce collisions and reallocations
-    // but will of course consume more memory.
-    //
-    static constexpr size_type default_initial_size = 1024;
+    // Buckets default to 128 lines, about the same inline capacity of 1024 hash_index<> buckets.
+    static constexpr size_type default_initial_size = 128;
     static constexpr size_type default_granularity  = 1024;
 
     //
     // Constructors-destructor / copy-assignment:
     //
 
-    hash_index()
+    inline_bucket_hash_index()
     {
-        internal_init(default_initial_size, default_initial_size);
+        internal_init(default_initial_size, default_granularity);
     }
 
-    hash_index(const size_type initial_hash_buckets_size,
-               const size_type initial_index_chain_size)
+    inline_bucket_hash_index(const size_type initial_hash_buckets_size,
+                             const size_type initial_index_chain_size)
     {
         internal_init(initial_hash_buckets_size, initial_index_chain_size);
     }
 
-    ~hash_index()
+    ~inline_bucket_hash_index()
     {
         clear_and_free();
     }
 
-    hash_index(const hash_index & other)
+    inline_bucket_hash_index(const inline_bucket_hash_index & other)
+        : Allocator{ static_cast<const Allocator &>(other) }
     {
-        // 'other' is empty/never allocated:
-        if (other.m_lookup_mask == 0)
-        {
-            m_hash_buckets = m_invalid_index_dummy;
-            m_index_chain  = m_invalid_index_dummy;
-        }
-        else // Copy data from 'other':
+        internal_init(other.m_hash_buckets_size, other.m_index_chain_size);
+        if (other.is_allocated())
         {
-            HASH_INDEX_ASSERT(other.is_allocated());
-            HASH_INDEX_ASSERT(is_power_of_two(other.m_hash_buckets_size));
-
-            m_hash_buckets = Allocator::allocate(other.m_hash_buckets_size);
-            m_index_chain  = Allocator::allocate(other.m_index_chain_size);
-
-            std::copy(other.m_hash_buckets, other.m_hash_buckets + other.m_hash_buckets_size, m_hash_buckets);
-            std::copy(other.m_index_chain,  other.m_index_chain  + other.m_index_chain_size,  m_index_chain);
+            internal_allocate(other.m_hash_buckets_size, other.m_index_chain_size);
+            std::copy(other.m_buckets,      other.m_buckets      + m_hash_buckets_size, m_buckets);
+            std::copy(other.m_index_chain,  other.m_index_chain  + m_index_chain_size,  m_index_chain);
+            std::copy(other.m_fingerprints, other.m_fingerprints + m_index_chain_size,  m_fingerprints);
         }
-
-        m_hash_buckets_size = other.m_hash_buckets_size;
-        m_index_chain_size  = other.m_index_chain_size;
-        m_hash_mask         = other.m_hash_mask;
-        m_lookup_mask       = other.m_lookup_mask;
-        m_granularity       = other.m_granularity;
+        m_granularity = other.m_granularity;
+        m_chain_growth_factor = other.m_chain_growth_factor;
+        m_num_items   = other.m_num_items;
     }
 
-    hash_index & operator = (hash_index other)
+    inline_bucket_hash_index & operator = (inline_bucket_hash_index other)
     {
         swap(*this, other);
         return *this;
     }
 
-    hash_index(hash_index && other)
-        : hash_index{} // Init via default constructor (C++11 constructor delegation)
+    inline_bucket_hash_index(inline_bucket_hash_index && other)
+        : inline_bucket_hash_index{}
     {
         swap(*this, other);
     }
 
-    // Non-throwing swap() overload for hash_index so we
-    // can enable copy-and-swap in the above constructors.
-    friend void swap(hash_index & lhs, hash_index & rhs) noexcept
+    friend void swap(inline_bucket_hash_index & lhs, inline_bucket_hash_index & rhs) noexcept
     {
         using std::swap;
-        swap(lhs.m_hash_buckets,      rhs.m_hash_buckets);
+        swap(lhs.m_buckets,           rhs.m_buckets);
         swap(lhs.m_index_chain,       rhs.m_index_chain);
+        swap(lhs.m_fingerprints,      rhs.m_fingerprints);
         swap(lhs.m_hash_buckets_size, rhs.m_hash_buckets_size);
         swap(lhs.m_index_chain_size,  rhs.m_index_chain_size);
         swap(lhs.m_hash_mask,         rhs.m_hash_mask);
         swap(lhs.m_lookup_mask,       rhs.m_lookup_mask);
         swap(lhs.m_granularity,       rhs.m_granularity);
+        swap(lhs.m_chain_growth_factor, rhs.m_chain_growth_factor);
+        swap(lhs.m_num_items,         rhs.m_num_items);
     }
 
     //
@@ -257,39 +6582,45 @@ public:
 
     index_type first(const key_type key) const
     {
-        //
-        // By ensuring the size of the hash buckets array is always a PoT
-        // we can use as fast AND (key & m_hash_mask) instead of the slow
-        // integer modulo to index the table with the incoming hash key.
-        //
-        // The lookup mask is either zero for an empty table, which is
-        // the m_invalid_index_dummy[] in that case, so we always get
-        // zero from the last AND and return the null_index that
-        // m_invalid_index_dummy[] holds. Otherwise, when the hash_index table
-        // is not empty lookup mask has all bits set to 1, so the last AND
-        // simply yields (key & m_hash_mask), which is the right hash index.
-        //
-        return m_hash_buckets[key & m_hash_mask & m_lookup_mask];
+        // The empty table points to m_empty_bucket, which has no entries.
+        const bucket & b = bucket_of(key);
+        return (b.count != 0) ? b.indexes[0] : null_index;
     }
 
     index_type next(const index_type index) const
     {
-        // The index chain is resized when new items are inserted
-        // to match the largest index, so this check is mostly
-        // for internal consistency.
+        // No chain before the first insert(), same as hash_index<> with its dummy entry.
+        if (m_index_chain == nullptr)
+        {
+            return null_index;
+        }
         HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
-        return m_index_chain[index & m_lookup_mask];
+        return m_index_chain[index];
     }
 
     template<typename ValueType, typename CollectionType, typename Predicate>
     index_type find(const key_type key, const ValueType & needle, const CollectionType & collection, Predicate pred) const
     {
-        for (index_type i = first(key); i != null_index; i = next(i))
+        const bucket & b = bucket_of(key);
+        const fingerprint_type fingerprint = fingerprint_of(key);
+
+        for (size_type s = 0; s < b.count; ++s)
         {
-            const auto & item = collection[i];
-            if (pred(needle, item))
+            if (b.fingerprints[s] == fingerprint && pred(needle, collection[b.indexes[s]]))
             {
-                return i;
+                return b.indexes[s];
+            }
+        }
+
+        // Overflow past the line, only for full buckets.
+        if (b.count == inline_capacity)
+        {
+            for (index_type i = m_index_chain[b.indexes[inline_capacity - 1]]; i != null_index; i = m_index_chain[i])
+            {
+                if (m_fingerprints[i] == fingerprint && pred(needle, collection[i]))
+                {
+                    return i;
+                }
             }
         }
         return null_index;
@@ -307,20 +6638,21 @@ public:
 
     void insert(const key_type key, const index_type index)
     {
+        HASH_INDEX_ASSERT(index != null_index);
+
         if (!is_allocated())
         {
             const size_type index_chain_size = ((static_cast<size_type>(index) >= m_index_chain_size) ?
                                                 index + 1 : m_index_chain_size);
             internal_allocate(m_hash_buckets_size, index_chain_size);
         }
-        else if (index >= m_index_chain_size)
+        else if (static_cast<size_type>(index) >= m_index_chain_size)
         {
-            resize_index_chain(index + 1);
+            grow_index_chain(index + 1);
         }
 
-        const key_type k     = key & m_hash_mask;
-        m_index_chain[index] = m_hash_buckets[k];
-        m_hash_buckets[k]    = index;
+        link_front(bucket_of(key), index, fingerprint_of(key));
+        ++m_num_items;
     }
 
     void erase(const key_type key, const index_type index)
@@ -332,119 +6664,58 @@ public:
             return;
         }
 
-        const key_type k = key & m_hash_mask;
-
-        if (m_hash_buckets[k] == index)
+        bucket & b = bucket_of(key);
+        size_type s = 0;
+        while (s < b.count && b.indexes[s] != index)
         {
-            m_hash_buckets[k] = m_index_chain[index];
+            ++s;
         }
-        else
+
+        if (s < b.count)
         {
-            for (index_type i = m_hash_buckets[k]; i != null_index; i = m_index_chain[i])
+            // Inline; The predecessor is the previous slot. Unlink, close the gap
+            // and pull the first overflow entry (if any) into the last slot.
+            const index_type next_index = m_index_chain[index];
+            if (s > 0)
             {
-                if (m_index_chain[i] == index)
-                {
-                    m_index_chain[i] = m_index_chain[index];
-                    break;
-                }
+                m_index_chain[b.indexes[s - 1]] = next_index;
             }
-        }
-
-        m_index_chain[index] = null_index;
-    }
-
-    // Insert an entry into the index chain and add it to the hash, increasing all indexes >= index.
-    void insert_at_index(const key_type key, const index_type index)
-    {
-        if (!is_allocated())
-        {
-            return;
-        }
-
-        size_type i;
-        index_type max = index;
 
-        for (i = 0; i < m_hash_buckets_size; ++i)
-        {
-            if (m_hash_buckets[i] >= index)
+            const bool was_full = (b.count == inline_capacity);
+            for (; s + 1 < b.count; ++s)
             {
-                m_hash_buckets[i]++;
-                if (m_hash_buckets[i] > max)
-                {
-                    max = m_hash_buckets[i];
-                }
+                b.indexes[s]      = b.indexes[s + 1];
+                b.fingerprints[s] = b.fingerprints[s + 1];
             }
-        }
 
-        for (i = 0; i < m_index_chain_size; ++i)
-        {
-            if (m_index_chain[i] >= index)
+            const index_type overflow = (was_full && b.count > 1) ? m_index_chain[b.indexes[b.count - 2]] :
+                                        (was_full ? next_index : null_index);
+            if (overflow != null_index)
             {
-                m_index_chain[i]++;
-                if (m_index_chain[i] > max)
-                {
-                    max = m_index_chain[i];
-                }
+                b.indexes[b.count - 1]      = overflow;
+                b.fingerprints[b.count - 1] = m_fingerprints[overflow];
             }
-        }
-
-        if (max >= m_index_chain_size)
-        {
-            resize_index_chain(max + 1);
-        }
-        for (i = max; i > index; --i)
-        {
-            m_index_chain[i] = m_index_chain[i - 1];
-        }
-        m_index_chain[index] = null_index;
-
-        insert(key, index);
-    }
-
-    // Remove an entry from the index chain and remove it from the hash, decreasing all indexes >= index.
-    void erase_and_remove_index(const key_type key, const index_type index)
-    {
-        HASH_INDEX_ASSERT(static_cast<size_type>(index) < m_index_chain_size);
-
-        if (!is_allocated())
-        {
-            return;
-        }
-
-        erase(key, index);
-
-        size_type i;
-        index_type max = index;
-
-        for (i = 0; i < m_hash_buckets_size; ++i)
-        {
-            if (m_hash_buckets[i] >= index)
+            else
             {
-                if (m_hash_buckets[i] > max)
-                {
-                    max = m_hash_buckets[i];
-                }
-                m_hash_buckets[i]--;
+                --b.count;
             }
+            --m_num_items;
         }
-
-        for (i = 0; i < m_index_chain_size; ++i)
+        else if (b.count == inline_capacity)
         {
-            if (m_index_chain[i] >= index)
+            // Overflow; Walk the chain past the line looking for the predecessor.
+            for (index_type i = b.indexes[inline_capacity - 1]; m_index_chain[i] != null_index; i = m_index_chain[i])
             {
-                if (m_index_chain[i] > max)
+                if (m_index_chain[i] == index)
                 {
-                    max = m_index_chain[i];
+                    m_index_chain[i] = m_index_chain[index];
+                    --m_num_items;
+                    break;
                 }
-                m_index_chain[i]--;
             }
         }
 
-        for (i = index; i < max; ++i)
-        {
-            m_index_chain[i] = m_index_chain[i + 1];
-        }
-        m_index_chain[max] = null_index;
+        m_index_chain[index] = null_index;
     }
 
     //
@@ -453,38 +6724,26 @@ public:
 
     void clear() noexcept
     {
-        if (m_hash_buckets != m_invalid_index_dummy)
+        if (is_allocated())
         {
-            const index_type fill_val = null_index;
-            std::fill_n(m_hash_buckets, m_hash_buckets_size, fill_val);
+            std::fill_n(m_buckets, m_hash_buckets_size, bucket{});
         }
-        // Clearing the index chain is not strictly necessary since
-        // inserting new elements in the hash_index will overwrite
-        // corresponding index chain entries.
-    }
-
-    void clear_and_resize(const size_type new_hash_buckets_size, const size_type new_index_chain_size)
-    {
-        HASH_INDEX_ASSERT(is_power_of_two(new_hash_buckets_size) && "Size of hash_index buckets array must be a power-of-2!");
-
-        clear_and_free();
-        m_hash_buckets_size = new_hash_buckets_size;
-        m_index_chain_size  = new_index_chain_size;
+        m_num_items = 0;
     }
 
     void clear_and_free()
     {
-        if (m_hash_buckets != m_invalid_index_dummy)
-        {
-            Allocator::deallocate(m_hash_buckets, m_hash_buckets_size);
-            m_hash_buckets = m_invalid_index_dummy;
-        }
-        if (m_index_chain != m_invalid_index_dummy)
+        if (is_allocated())
         {
-            Allocator::deallocate(m_index_chain, m_index_chain_size);
-            m_index_chain = m_invalid_index_dummy;
+            deallocate_array(m_buckets,      m_hash_buckets_size);
+            deallocate_array(m_index_chain,  m_index_chain_size);
+            deallocate_array(m_fingerprints, m_index_chain_size);
         }
-        m_lookup_mask = 0;
+        m_buckets      = &m_empty_bucket;
+        m_index_chain  = nullptr;
+        m_fingerprints = nullptr;
+        m_lookup_mask  = 0;
+        m_num_items    = 0;
     }
 
     void set_granularity(const size_type new_granularity)
@@ -493,6 +6752,20 @@ public:
         m_granularity = new_granularity;
     }
 
+    // Same growth policy of hash_index<>::set_index_chain_growth(). By default the chain
+    // grows by granularity() when insert() is given an index past its end.
+    void set_index_chain_growth(const float growth_factor)
+    {
+        HASH_INDEX_ASSERT(growth_factor >= 1.0f && "Index chain growth factor can't shrink the chain!");
+        m_chain_growth_factor = growth_factor;
+    }
+
+    // Sizes the index chain to hold indexes [0, count) upfront, like hash_index<>::reserve_index_chain().
+    void reserve_index_chain(const size_type count)
+    {
+        resize_index_chain(count);
+    }
+
     void resize_index_chain(const size_type new_index_chain_size)
     {
         if (new_index_chain_size <= m_index_chain_size)
@@ -500,97 +6773,92 @@ public:
             return;
         }
 
-        size_type new_size;
         const auto mod = new_index_chain_size % m_granularity;
+        const size_type new_size = (mod == 0) ? new_index_chain_size : new_index_chain_size + m_granularity - mod;
 
-        if (mod == 0)
-        {
-            new_size = new_index_chain_size;
-        }
-        else
-        {
-            new_size = new_index_chain_size + m_granularity - mod;
-        }
-
-        if (m_index_chain == m_invalid_index_dummy) // Not allocated yet; Defer.
+        if (!is_allocated()) // Not allocated yet; Defer.
         {
             m_index_chain_size = new_size;
             return;
         }
 
-        const auto old_index_chain_size = m_index_chain_size;
-        const auto old_index_chain      = m_index_chain;
-
-        auto new_index_chain = Allocator::allocate(new_size);
-        std::copy(old_index_chain, old_index_chain + old_index_chain_size, new_index_chain);
+        index_type * new_index_chain = allocate_array<index_type>(new_size);
+        std::copy(m_index_chain, m_index_chain + m_index_chain_size, new_index_chain);
+        std::fill(new_index_chain + m_index_chain_size, new_index_chain + new_size, null_index);
+        deallocate_array(m_index_chain, m_index_chain_size);
+        m_index_chain = new_index_chain;
 
-        // Newly allocated space must be filled with null_index
-        const index_type fill_val = null_index;
-        std::fill_n(new_index_chain + old_index_chain_size, new_size - old_index_chain_size, fill_val);
+        fingerprint_type * new_fingerprints = allocate_array<fingerprint_type>(new_size);
+        std::copy(m_fingerprints, m_fingerprints + m_index_chain_size, new_fingerprints);
+        deallocate_array(m_fingerprints, m_index_chain_size);
+        m_fingerprints = new_fingerprints;
 
-        Allocator::deallocate(old_index_chain, old_index_chain_size);
-        m_index_chain = new_index_chain;
         m_index_chain_size = new_size;
     }
 
-    //
-    // Queries:
-    //
-
-    size_type compute_distribution_percentage() const
+    // Rebuild the buckets with a new power-of-two size, keeping the order of every chain.
+    // KeyFunc is any callable with the signature key_type(index_type), like in hash_index<>.
+    template<typename KeyFunc>
+    void rehash(const size_type new_hash_buckets_size, KeyFunc key_of_index)
     {
-        // Computes a number in the range [0,100] representing the spread over the hash table.
-        // This method will allocate some temporary memory via std::vector.
+        HASH_INDEX_ASSERT(new_hash_buckets_size > 0 && (new_hash_buckets_size & (new_hash_buckets_size - 1)) == 0 &&
+                          "Size of hash_index buckets array must be a power-of-2!");
 
         if (!is_allocated())
         {
-            return 100;
+            m_hash_buckets_size = new_hash_buckets_size; // Defer.
+            m_hash_mask         = new_hash_buckets_size - 1;
+            return;
         }
 
-        long total_items = 0;
-        std::vector<long> hash_items_count(m_hash_buckets_size);
+        bucket * const  old_buckets      = m_buckets;
+        const size_type old_buckets_size = m_hash_buckets_size;
 
-        for (size_type i = 0; i < m_hash_buckets_size; ++i)
+        m_buckets           = allocate_array<bucket>(new_hash_buckets_size);
+        m_hash_buckets_size = new_hash_buckets_size;
+        m_hash_mask         = new_hash_buckets_size - 1;
+        std::fill_n(m_buckets, m_hash_buckets_size, bucket{});
+
+        for (size_type ob = 0; ob < old_buckets_size; ++ob)
         {
-            hash_items_count[i] = 0;
-            for (index_type index = m_hash_buckets[i]; index != null_index; index = m_index_chain[index])
+            if (old_buckets[ob].count == 0)
             {
-                hash_items_count[i]++;
+                continue;
             }
-            total_items += hash_items_count[i];
-        }
-
-        // If no items in the hash buckets...
-        if (total_items <= 1)
-        {
-            return 100;
-        }
-
-        long error = 0;
-        const long average = total_items / m_hash_buckets_size;
-
-        for (size_type i = 0; i < m_hash_buckets_size; ++i)
-        {
-            long e = hash_items_count[i] - average;
-            if (e < 0) { e = -e; } // absolute value of 'e'
 
-            if (e > 1)
+            // Reverse the old chain first, so that pushing its entries
+            // to the front of the new buckets preserves their order.
+            index_type reversed = null_index;
+            for (index_type i = old_buckets[ob].indexes[0]; i != null_index;)
             {
-                error += (e - 1);
+                const index_type n = m_index_chain[i];
+                m_index_chain[i] = reversed;
+                reversed = i;
+                i = n;
+            }
+            for (index_type i = reversed; i != null_index;)
+            {
+                const index_type n = m_index_chain[i];
+                link_front(bucket_of(static_cast<key_type>(key_of_index(i))), i, m_fingerprints[i]);
+                i = n;
             }
         }
 
-        return 100 - (error * 100 / total_items);
+        deallocate_array(old_buckets, old_buckets_size);
     }
 
+    //
+    // Queries:
+    //
+
     size_type allocated_bytes() const noexcept
     {
         if (!is_allocated())
         {
             return 0;
         }
-        return (m_hash_buckets_size * sizeof(index_type)) +
-               (m_index_chain_size  * sizeof(index_type));
+        return (m_hash_buckets_size * sizeof(bucket)) +
+               (m_index_chain_size  * (sizeof(index_type) + sizeof(fingerprint_type)));
     }
 
     size_type hash_buckets_size() const noexcept
@@ -608,39 +6876,54 @@ public:
         return m_granularity;
     }
 
+    float index_chain_growth() const noexcept
+    {
+        return m_chain_growth_factor;
+    }
+
+    size_type size() const noexcept
+    {
+        return m_num_items;
+    }
+
+    bool empty() const noexcept
+    {
+        return m_num_items == 0;
+    }
+
+    // Items per inline slot, i.e. reaches 1.0 when all buckets would be exactly full.
+    float load_factor() const noexcept
+    {
+        return static_cast<float>(m_num_items) / static_cast<float>(m_hash_buckets_size * inline_capacity);
+    }
+
     bool is_allocated() const noexcept
     {
-        return (m_hash_buckets != nullptr) &&
-               (m_hash_buckets != m_invalid_index_dummy);
+        return m_buckets != &m_empty_bucket;
     }
 
     //
     // Deep comparison operators:
     //
 
-    bool operator == (const hash_index & other) const noexcept
+    bool operator == (const inline_bucket_hash_index & other) const noexcept
     {
-        // Self comparison of comparison to pointer/ref to self?
         if (this == &other)
         {
             return true;
         }
 
-        // Same sizes?
         if (m_hash_buckets_size != other.m_hash_buckets_size) { return false; }
         if (m_index_chain_size  != other.m_index_chain_size ) { return false; }
-        if (m_hash_mask         != other.m_hash_mask        ) { return false; }
-        if (m_lookup_mask       != other.m_lookup_mask      ) { return false; }
         if (m_granularity       != other.m_granularity      ) { return false; }
+        if (m_num_items         != other.m_num_items        ) { return false; }
+        if (is_allocated()      != other.is_allocated()     ) { return false; }
+        if (!is_allocated()) { return true; }
 
-        // This or other could be pointing to the m_invalid_index_dummy.
-        if ( is_allocated() && !other.is_allocated()) { return false; }
-        if (!is_allocated() &&  other.is_allocated()) { return false; }
-
-        // Same sizes, but do both have the same data?
-        for (size_type i = 0; i < m_hash_buckets_size; ++i)
+        // The inline entries mirror the chain heads, so comparing the chains is enough.
+        for (size_type b = 0; b < m_hash_buckets_size; ++b)
         {
-            if (m_hash_buckets[i] != other.m_hash_buckets[i])
+            if (first_of(m_buckets[b]) != other.first_of(other.m_buckets[b]))
             {
                 return false;
             }
@@ -652,129 +6935,220 @@ public:
                 return false;
             }
         }
-
-        // The same sizes and contents.
         return true;
     }
 
-    bool operator != (const hash_index & other) const noexcept
+    bool operator != (const inline_bucket_hash_index & other) const noexcept
     {
         return !(*this == other);
     }
 
 private:
 
-    template<typename IntType>
-    static bool is_power_of_two(const IntType num) noexcept
+    //
+    // indexes[0..count-1] are the first entries of the chain, in chain order, so
+    // indexes[0] is the head and m_index_chain[indexes[s]] == indexes[s + 1].
+    // A full bucket continues in the index chain after indexes[inline_capacity - 1].
+    //
+    struct alignas(cache_line_size) bucket
     {
-        static_assert(std::is_integral<IntType>::value, "Integer type required!");
-        return (num > 0) && ((num & (num - 1)) == 0);
+        index_type       indexes[inline_capacity];
+        fingerprint_type fingerprints[inline_capacity];
+        unsigned char    count;
+    };
+
+    static_assert(sizeof(bucket) == cache_line_size, "Bucket doesn't fit a cache line!");
+
+    static fingerprint_type fingerprint_of(const key_type key) noexcept
+    {
+        // Top bits of the key, which the bucket mask never looks at.
+        using unsigned_key_type = typename std::make_unsigned<key_type>::type;
+        constexpr int shift = static_cast<int>(sizeof(key_type) - sizeof(fingerprint_type)) * 8;
+        return static_cast<fingerprint_type>(static_cast<unsigned_key_type>(key) >> shift);
+    }
+
+    static index_type first_of(const bucket & b) noexcept
+    {
+        return (b.count != 0) ? b.indexes[0] : null_index;
+    }
+
+    bucket & bucket_of(const key_type key) const noexcept
+    {
+        return m_buckets[static_cast<size_type>(key & m_hash_mask & m_lookup_mask)];
+    }
+
+    // Pushes 'index' to the front of the chain of 'b'. The last inline entry of a
+    // full bucket is shifted out of the line, but stays linked in the index chain.
+    void link_front(bucket & b, const index_type index, const fingerprint_type fingerprint) noexcept
+    {
+        m_index_chain[index]  = first_of(b);
+        m_fingerprints[index] = fingerprint;
+
+        const size_type count = std::min(static_cast<size_type>(b.count) + 1, inline_capacity);
+        for (size_type s = count - 1; s > 0; --s)
+        {
+            b.indexes[s]      = b.indexes[s - 1];
+            b.fingerprints[s] = b.fingerprints[s - 1];
+        }
+        b.indexes[0]      = index;
+        b.fingerprints[0] = fingerprint;
+        b.count           = static_cast<unsigned char>(count);
+    }
+
+    template<typename T>
+    T * allocate_array(const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        return alloc.allocate(count);
+    }
+
+    template<typename T>
+    void deallocate_array(T * array, const size_type count)
+    {
+        typename std::allocator_traits<Allocator>::template rebind_alloc<T> alloc{ static_cast<const Allocator &>(*this) };
+        alloc.deallocate(array, count);
+    }
+
+    // Growth of the index chain to fit indexes up to min_size - 1, see set_index_chain_growth().
+    void grow_index_chain(const size_type min_size)
+    {
+        size_type new_size = min_size;
+        if (m_chain_growth_factor > 1.0f)
+        {
+            const float grown = static_cast<float>(m_index_chain_size) * m_chain_growth_factor;
+            if (grown < static_cast<float>(std::numeric_limits<size_type>::max() / 2))
+            {
+                new_size = std::max(new_size, static_cast<size_type>(grown));
+            }
+        }
+        resize_index_chain(new_size);
     }
 
     void internal_init(const size_type initial_hash_buckets_size,
                        const size_type initial_index_chain_size)
     {
-        HASH_INDEX_ASSERT(is_power_of_two(initial_hash_buckets_size) && "Size of hash_index buckets array must be a power-of-2!");
-        HASH_INDEX_ASSERT(!is_allocated() && "Already initialized!");
+        HASH_INDEX_ASSERT(initial_hash_buckets_size > 0 && (initial_hash_buckets_size & (initial_hash_buckets_size - 1)) == 0 &&
+                          "Size of hash_index buckets array must be a power-of-2!");
 
-        m_hash_buckets      = m_invalid_index_dummy;
-        m_index_chain       = m_invalid_index_dummy;
+        m_buckets           = &m_empty_bucket;
+        m_index_chain       = nullptr;
+        m_fingerprints      = nullptr;
         m_hash_buckets_size = initial_hash_buckets_size;
         m_index_chain_size  = initial_index_chain_size;
         m_hash_mask         = m_hash_buckets_size - 1;
         m_lookup_mask       = 0;
         m_granularity       = default_granularity;
+        m_num_items         = 0;
     }
 
     void internal_allocate(const size_type new_hash_buckets_size,
                            const size_type new_index_chain_size)
     {
-        HASH_INDEX_ASSERT(is_power_of_two(new_hash_buckets_size) && "Size of hash_index buckets array must be a power-of-2!");
-
-        if (is_allocated())
-        {
-            clear_and_free();
-        }
+        HASH_INDEX_ASSERT(!is_allocated());
 
-        m_hash_buckets      = Allocator::allocate(new_hash_buckets_size);
-        m_index_chain       = Allocator::allocate(new_index_chain_size);
+        m_buckets           = allocate_array<bucket>(new_hash_buckets_size);
+        m_index_chain       = allocate_array<index_type>(new_index_chain_size);
+        m_fingerprints      = allocate_array<fingerprint_type>(new_index_chain_size);
         m_hash_buckets_size = new_hash_buckets_size;
         m_index_chain_size  = new_index_chain_size;
         m_hash_mask         = m_hash_buckets_size - 1;
         m_lookup_mask       = ~static_cast<size_type>(0);
 
-        const index_type fill_val = null_index;
-        std::fill_n(m_hash_buckets, new_hash_buckets_size, fill_val);
-        std::fill_n(m_index_chain,  new_index_chain_size,  fill_val);
+        std::fill_n(m_buckets, m_hash_buckets_size, bucket{});
+        std::fill_n(m_index_chain, m_index_chain_size, null_index);
     }
 
     //
-    // m_hash_buckets[] is indexed directly from an incoming key ANDed with
-    // m_hash_mask (which is just the cached result of m_hash_buckets_size - 1).
-    // The resulting index will be either the index of the requested data or
-    // an index into m_index_chain[]. Index chain will then either have the
-    // index of the requested data or a successive chain of indexes to itself
-    // until the data index is found or a null_index is encountered.
-    // See first() and next() for more details on the lookup algorithm.
-    //
-    // m_hash_buckets[] can be of any power-of-two size (PoT is enforced).
-    // m_index_chain[] must match the size of the external data array and
-    // will be resized accordingly to accommodate the largest index inserted.
-    //
-    // Note: When the hash_index is empty, both m_hash_buckets and m_index_chain
-    // will point to the m_invalid_index_dummy below. This allows simplifying some
-    // things and avoiding additional IF checks for the empty hash_index case.
+    // m_buckets[] has one line per bucket. m_index_chain[] links every entry to the
+    // next of its chain, like in hash_index<>, and m_fingerprints[] has the fingerprint
+    // of every linked index, read for the overflow entries and when refilling a bucket.
     //
-    index_type * m_hash_buckets = nullptr;
-    index_type * m_index_chain  = nullptr;
-    size_type    m_hash_buckets_size = 0;
-    size_type    m_index_chain_size  = 0;
+    bucket           * m_buckets      = nullptr;
+    index_type       * m_index_chain  = nullptr;
+    fingerprint_type * m_fingerprints = nullptr;
+    size_type          m_hash_buckets_size = 0;
+    size_type          m_index_chain_size  = 0;
+    size_type          m_hash_mask         = 0;
+    size_type          m_lookup_mask       = 0;
+    size_type          m_granularity       = 0;
+    float              m_chain_growth_factor = 1.0f;
+    size_type          m_num_items         = 0;
 
-    //
-    // As mentioned above, m_hash_mask is the cached result of m_hash_buckets_size - 1.
-    // Since we require a power-of-two size for the hash buckets array, we can use a
-    // much cheaper AND to modulate the incoming hash key, but we need to AND it with
-    // the num of buckets - 1, hence this cached value.
-    //
-    size_type m_hash_mask = 0;
+    // Shared empty bucket of the unallocated table. See hash_index<>::m_invalid_index_dummy[].
+    static bucket m_empty_bucket;
+};
 
-    //
-    // m_lookup_mask is a bit of magic... We use it to make the methods first() and
-    // next() branch-less. When the hash_index is empty, the buckets and index chain
-    // will point to the m_invalid_index_dummy[] array. In this case, we always want
-    // the incoming hash key to map to index zero, so m_lookup_mask is set to zero
-    // when hash_index is empty. It will get ANDed with the incoming hash key in
-    // first() and next() yielding the 0th index of m_invalid_index_dummy[] (null_index),
-    // so we've successfully managed to avoid an extra IF there for the empty case.
-    // But when the table is not empty, buckets and the index chain will point to
-    // heap-allocated arrays, so ANDing m_lookup_mask with a hash key should not
-    // alter the resulting array index. Therefore, when the table is not empty,
-    // m_lookup_mask is set to the bit pattern ~0 (0xFFFFF... or all 1s) so that
-    // ANDing anything with it will just yield back the original input.
-    //
-    size_type m_lookup_mask = 0;
+template<typename IT, typename KT, typename ST, typename AT>
+typename inline_bucket_hash_index<IT, KT, ST, AT>::bucket inline_bucket_hash_index<IT, KT, ST, AT>::m_empty_bucket{};
 
-    //
-    // Factor used to resize the index chain on demand.
-    // Works best if using a power-of-two, but not required.
-    //
-    size_type m_granularity = 0;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename inline_bucket_hash_index<IT, KT, ST, AT>::index_type inline_bucket_hash_index<IT, KT, ST, AT>::null_index;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename inline_bucket_hash_index<IT, KT, ST, AT>::size_type inline_bucket_hash_index<IT, KT, ST, AT>::cache_line_size;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename inline_bucket_hash_index<IT, KT, ST, AT>::size_type inline_bucket_hash_index<IT, KT, ST, AT>::inline_capacity;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename inline_bucket_hash_index<IT, KT, ST, AT>::size_type inline_bucket_hash_index<IT, KT, ST, AT>::default_initial_size;
+template<typename IT, typename KT, typename ST, typename AT>
+constexpr typename inline_bucket_hash_index<IT, KT, ST, AT>::size_type inline_bucket_hash_index<IT, KT, ST, AT>::default_granularity;
 
-    //
-    // The initial empty hash_index allocates no heap memory, but to simplify
-    // handling of the empty case we still want the hash buckets and
-    // index chain to point to some array with at least one null_index
-    // in it. That's where this placeholder comes in. The data in it
-    // will not be modified by the hash_index, but since the m_hash_buckets
-    // and m_index_chain pointers are not const, this has to be kept mutable.
-    //
-    static index_type m_invalid_index_dummy[1];
+//
+// ----------------------------
+//  basic_hash_index<> / layouts
+// ----------------------------
+//
+// Selects the hash_index memory layout from a policy template parameter.
+// All layouts share the same lookup, insertion and removal interface, so
+// code written against a basic_hash_index<Layout> works with any of them:
+//
+//  chained_layout        - hash_index<>, separate chaining through the index chain.
+//                          Cheapest inserts and erases, smallest memory footprint.
+//  group_probing_layout  - group_hash_index<>, open addressing probed 16 slots at a
+//                          time. Better lookup locality when the table is heavily loaded.
+//  compact_layout        - compact_hash_index<>, chaining like hash_index<> with 16, 24
+//                          or 32-bit packed entries. Smallest footprint for small tables.
+//  inline_bucket_layout  - inline_bucket_hash_index<>, chaining with the first entries of
+//                          each chain inline in a cache line. Fewest lookup cache misses.
+//
+//  template<typename Layout>
+//  struct Registry
+//  {
+//      basic_hash_index<Layout> hash_idx;
+//      ...
+//  };
+//
+struct chained_layout
+{
+    template<typename IndexType, typename KeyType, typename SizeType, typename Allocator>
+    using type = hash_index<IndexType, KeyType, SizeType, Allocator>;
 };
 
-// This abomination here is the m_invalid_index_dummy[] static initializer:
-template<typename IT, typename KT, typename ST, typename AT>
-typename hash_index<IT, KT, ST, AT>::index_type hash_index<IT, KT, ST, AT>::m_invalid_index_dummy[1] = {
-    hash_index<IT, KT, ST, AT>::null_index
+struct group_probing_layout
+{
+    template<typename IndexType, typename KeyType, typename SizeType, typename Allocator>
+    using type = group_hash_index<IndexType, KeyType, SizeType, Allocator>;
+};
+
+struct compact_layout
+{
+    template<typename IndexType, typename KeyType, typename SizeType, typename Allocator>
+    using type = compact_hash_index<IndexType, KeyType, SizeType, Allocator>;
+};
+
+struct inline_bucket_layout
+{
+    template<typename IndexType, typename KeyType, typename SizeType, typename Allocator>
+    using type = inline_bucket_hash_index<IndexType, KeyType, SizeType, Allocator>;
 };
 
+template
+<
+    typename Layout    = chained_layout,
+    typename IndexType = unsigned int,
+    typename KeyType   = std::size_t,
+    typename SizeType  = std::size_t,
+    typename Allocator = std::allocator<IndexType>
+>
+using basic_hash_index = typename Layout::template type<IndexType, KeyType, SizeType, Allocator>;
+
 #endif // HASH_INDEX_HPP
@@ -0,0 +1,273 @@
+// ================================================================================================
+// -*- C++ -*-
+// File: hash_index_file.hpp
+// Author: Guilherme R. Lampert
+// Created on: 10/14/26
+//
+// About:
+//  File helpers for the hash_index serialization: saving a serialized
+//  table to disk and memory-mapping it back for use with hash_index_view.
+//  Kept apart from hash_index.hpp since they pull platform headers.
+//
+// License:
+//  hash_index is work derived from a similar class found on the source code release of
+//  DOOM 3 BFG by id Software, available at <https://github.com/id-Software/DOOM-3-BFG>,
+//  and therefore is released under the GNU General Public License version 3 to comply
+//  with the original work. See the accompanying LICENSE file for full disclosure.
+//
+// ================================================================================================
+
+#ifndef HASH_INDEX_FILE_HPP
+#define HASH_INDEX_FILE_HPP
+
+#include "hash_index.hpp"
+
+// Same as in hash_index.hpp. User is responsible for providing
+// the Standard headers if HASH_INDEX_NO_STD_INCLUDES is defined.
+// The platform headers below are always included.
+#ifndef HASH_INDEX_NO_STD_INCLUDES
+    #include <cstdio>
+    #include <new>
+#endif // HASH_INDEX_NO_STD_INCLUDES
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif // WIN32_LEAN_AND_MEAN
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif // NOMINMAX
+    #include <windows.h>
+    #define HASH_INDEX_MMAP_WIN32 1
+#elif defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define HASH_INDEX_MMAP_POSIX 1
+#endif // Platform
+
+//
+// ----------------------------
+//  hash_index_mapped_file
+// ----------------------------
+//
+// Brief:
+//  Read-only memory mapping of a whole file, so that a hash_index_view
+//  can be attached to it without reading the file upfront. Pages are
+//  loaded by the OS on first access and shared between all processes
+//  mapping the same file. The mapping is page aligned, which satisfies
+//  the alignment required by hash_index_view. On platforms without
+//  memory mapping support the file is read into a heap buffer instead.
+//
+//  Usage:
+//
+//  hash_index_mapped_file file;
+//  if (file.open("table.bin"))
+//  {
+//      hash_index_view<> view{ file.data(), file.size() };
+//      ...
+//  }
+//
+class hash_index_mapped_file final
+{
+public:
+
+    hash_index_mapped_file() = default;
+
+    explicit hash_index_mapped_file(const char * path)
+    {
+        open(path);
+    }
+
+    ~hash_index_mapped_file()
+    {
+        close();
+    }
+
+    hash_index_mapped_file(const hash_index_mapped_file &) = delete;
+    hash_index_mapped_file & operator = (const hash_index_mapped_file &) = delete;
+
+    hash_index_mapped_file(hash_index_mapped_file && other) noexcept
+        : m_data{ other.m_data }
+        , m_size{ other.m_size }
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    hash_index_mapped_file & operator = (hash_index_mapped_file && other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            m_data = other.m_data;
+            m_size = other.m_size;
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+
+    // Maps the file at 'path', closing any previously open one. Returns
+    // false if the file can't be opened or is empty, leaving this closed.
+    bool open(const char * path)
+    {
+        HASH_INDEX_ASSERT(path != nullptr);
+        close();
+
+        #if defined(HASH_INDEX_MMAP_WIN32)
+        const HANDLE file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER file_size;
+        if (!::GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0)
+        {
+            ::CloseHandle(file);
+            return false;
+        }
+
+        // The view keeps the mapping alive, so both handles can be closed right away.
+        const HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        ::CloseHandle(file);
+        if (mapping == nullptr)
+        {
+            return false;
+        }
+
+        void * const data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        ::CloseHandle(mapping);
+        if (data == nullptr)
+        {
+            return false;
+        }
+
+        m_data = data;
+        m_size = static_cast<std::size_t>(file_size.QuadPart);
+        #elif defined(HASH_INDEX_MMAP_POSIX)
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat file_info;
+        if (::fstat(fd, &file_info) != 0 || file_info.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        // The mapping remains valid after closing the descriptor.
+        const std::size_t size = static_cast<std::size_t>(file_info.st_size);
+        void * const data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        m_data = data;
+        m_size = size;
+        #else // Portable fallback
+        std::FILE * const file = std::fopen(path, "rb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        long file_size = -1;
+        if (std::fseek(file, 0, SEEK_END) == 0)
+        {
+            file_size = std::ftell(file);
+        }
+        if (file_size <= 0 || std::fseek(file, 0, SEEK_SET) != 0)
+        {
+            std::fclose(file);
+            return false;
+        }
+
+        // Plain operator new is suitably aligned for any fundamental type.
+        const std::size_t size = static_cast<std::size_t>(file_size);
+        void * const data = ::operator new(size, std::nothrow);
+        if (data == nullptr || std::fread(data, 1, size, file) != size)
+        {
+            ::operator delete(data);
+            std::fclose(file);
+            return false;
+        }
+
+        std::fclose(file);
+        m_data = data;
+        m_size = size;
+        #endif // Platform
+        return true;
+    }
+
+    void close() noexcept
+    {
+        if (m_data == nullptr)
+        {
+            return;
+        }
+
+        #if defined(HASH_INDEX_MMAP_WIN32)
+        ::UnmapViewOfFile(m_data);
+        #elif defined(HASH_INDEX_MMAP_POSIX)
+        ::munmap(m_data, m_size);
+        #else // Portable fallback
+        ::operator delete(m_data);
+        #endif // Platform
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    const void * data() const noexcept
+    {
+        return m_data;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    bool is_open() const noexcept
+    {
+        return m_data != nullptr;
+    }
+
+private:
+
+    void *      m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+//
+// Serializes 'hash_idx' (a hash_index<> instance) and writes it to the file at 'path',
+// replacing any existing file. Returns false if the file couldn't be fully written.
+//
+template<typename HashIndexType>
+bool hash_index_save_file(const char * path, const HashIndexType & hash_idx)
+{
+    HASH_INDEX_ASSERT(path != nullptr);
+
+    std::vector<unsigned char> bytes(static_cast<std::size_t>(hash_idx.serialized_size()));
+    hash_idx.serialize(bytes.data(), static_cast<typename HashIndexType::size_type>(bytes.size()));
+
+    std::FILE * const file = std::fopen(path, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    const bool written = (std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size());
+    return (std::fclose(file) == 0) && written;
+}
+
+#endif // HASH_INDEX_FILE_HPP
@@ -0,0 +1,307 @@
+// ================================================================================================
+// -*- C++ -*-
+// File: hash_index_huge_pages.hpp
+// Author: Guilherme R. Lampert
+// Created on: 10/14/26
+//
+// About:
+//  hash_index_huge_page_allocator, a Standard-compatible allocator backing
+//  large hash_index arrays with huge pages, optionally placed or interleaved
+//  across NUMA nodes. Kept apart from hash_index.hpp since it pulls platform
+//  headers. Only Linux is supported; elsewhere it falls back to operator new.
+//
+// License:
+//  hash_index is work derived from a similar class found on the source code release of
+//  DOOM 3 BFG by id Software, available at <https://github.com/id-Software/DOOM-3-BFG>,
+//  and therefore is released under the GNU General Public License version 3 to comply
+//  with the original work. See the accompanying LICENSE file for full disclosure.
+//
+// ================================================================================================
+
+#ifndef HASH_INDEX_HUGE_PAGES_HPP
+#define HASH_INDEX_HUGE_PAGES_HPP
+
+#include "hash_index.hpp"
+
+// Same as in hash_index.hpp. User is responsible for providing
+// the Standard headers if HASH_INDEX_NO_STD_INCLUDES is defined.
+// The platform headers below are always included.
+#ifndef HASH_INDEX_NO_STD_INCLUDES
+    #include <cstddef>
+    #include <new>
+#endif // HASH_INDEX_NO_STD_INCLUDES
+
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #define HASH_INDEX_HUGE_PAGES_LINUX 1
+
+    // Not every libc exposes these, but the values are part of the kernel ABI.
+    #ifndef MAP_HUGE_SHIFT
+        #define MAP_HUGE_SHIFT 26
+    #endif // MAP_HUGE_SHIFT
+    #ifndef MAP_HUGE_2MB
+        #define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+    #endif // MAP_HUGE_2MB
+    #ifndef MAP_HUGE_1GB
+        #define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+    #endif // MAP_HUGE_1GB
+#endif // __linux__
+
+//
+// ----------------------------------
+//  hash_index_huge_page_options
+// ----------------------------------
+//
+// Brief:
+//  Configuration of a hash_index_huge_page_allocator.
+//
+//  pages selects how the arrays are backed:
+//   - transparent: Regular mapping aligned to 2 MB and flagged with
+//     madvise(MADV_HUGEPAGE), so the kernel uses transparent huge pages
+//     if enabled (/sys/kernel/mm/transparent_hugepage/enabled is "always"
+//     or "madvise"). Always succeeds, but huge pages are not guaranteed.
+//   - explicit_2mb / explicit_1gb: MAP_HUGETLB mappings from the reserved
+//     huge page pool (/proc/sys/vm/nr_hugepages or the 1 GB equivalent).
+//     If the pool is exhausted, falls back to the transparent mode.
+//
+//  numa selects the NUMA placement of the pages, applied with mbind() before
+//  the memory is first touched, on the nodes set in numa_nodes (bit N for node N):
+//   - local: Default kernel policy, first touch.
+//   - bind: Only on the given nodes.
+//   - preferred: On the first given node when possible.
+//   - interleave: Pages spread round-robin across the given nodes, which
+//     evens out the bandwidth of tables read from threads on every node.
+//  Placement is best effort; mbind() failures (e.g. no NUMA) are ignored.
+//
+//  Blocks smaller than min_bytes skip all of the above and come from operator
+//  new instead, since a huge page per small array would waste a lot of memory.
+//
+struct hash_index_huge_page_options
+{
+    enum class page_mode { transparent, explicit_2mb, explicit_1gb };
+    enum class numa_mode { local, bind, preferred, interleave };
+
+    page_mode     pages      = page_mode::transparent;
+    numa_mode     numa       = numa_mode::local;
+    unsigned long numa_nodes = 0;
+    std::size_t   min_bytes  = std::size_t(2) * 1024 * 1024;
+
+    bool operator == (const hash_index_huge_page_options & other) const noexcept
+    {
+        return pages == other.pages && numa == other.numa && numa_nodes == other.numa_nodes && min_bytes == other.min_bytes;
+    }
+
+    bool operator != (const hash_index_huge_page_options & other) const noexcept
+    {
+        return !(*this == other);
+    }
+};
+
+//
+// ------------------------------------------
+//  hash_index_huge_page_allocator<> template
+// ------------------------------------------
+//
+// Brief:
+//  Allocator for the hash_index arrays of very large tables, where lookups
+//  are dominated by TLB misses with regular 4 KB pages. Each large block is
+//  a separate mapping rounded up to the huge page size. Allocators compare
+//  equal if their options are the same.
+//
+//  Usage:
+//
+//  using big_hash_index = hash_index<std::uint32_t, std::size_t, std::size_t,
+//                                    hash_index_huge_page_allocator<std::uint32_t>>;
+//
+//  hash_index_huge_page_options options;
+//  options.numa       = hash_index_huge_page_options::numa_mode::interleave;
+//  options.numa_nodes = 0x3; // Nodes 0 and 1
+//  big_hash_index hash_idx{ 1 << 26, 1 << 26, hash_index_huge_page_allocator<std::uint32_t>{ options } };
+//
+template<typename T>
+class hash_index_huge_page_allocator
+{
+public:
+
+    using value_type = T;
+    using page_mode  = hash_index_huge_page_options::page_mode;
+    using numa_mode  = hash_index_huge_page_options::numa_mode;
+
+    hash_index_huge_page_allocator() = default;
+
+    explicit hash_index_huge_page_allocator(const hash_index_huge_page_options & options) noexcept
+        : m_options{ options }
+    {
+    }
+
+    template<typename U>
+    hash_index_huge_page_allocator(const hash_index_huge_page_allocator<U> & other) noexcept
+        : m_options{ other.options() }
+    {
+    }
+
+    T * allocate(const std::size_t count)
+    {
+        if (count > static_cast<std::size_t>(-1) / sizeof(T))
+        {
+            throw std::bad_alloc{};
+        }
+
+        const std::size_t bytes = count * sizeof(T);
+        if (!uses_mapping(bytes))
+        {
+            return static_cast<T *>(::operator new(bytes));
+        }
+
+        #if defined(HASH_INDEX_HUGE_PAGES_LINUX)
+        const std::size_t length = mapping_length(bytes);
+        void * block = nullptr;
+
+        if (m_options.pages != page_mode::transparent)
+        {
+            const int size_flag = (m_options.pages == page_mode::explicit_1gb) ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+            block = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+            if (block == MAP_FAILED)
+            {
+                block = nullptr; // Pool empty or not configured; Fall back to THP.
+            }
+        }
+        if (block == nullptr)
+        {
+            block = map_transparent(length);
+        }
+
+        apply_numa_policy(block, length);
+        return static_cast<T *>(block);
+        #else // !HASH_INDEX_HUGE_PAGES_LINUX
+        return static_cast<T *>(::operator new(bytes));
+        #endif // HASH_INDEX_HUGE_PAGES_LINUX
+    }
+
+    void deallocate(T * ptr, const std::size_t count) noexcept
+    {
+        const std::size_t bytes = count * sizeof(T);
+        if (!uses_mapping(bytes))
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        #if defined(HASH_INDEX_HUGE_PAGES_LINUX)
+        // Both the explicit and the transparent mappings have the same length.
+        ::munmap(ptr, mapping_length(bytes));
+        #else // !HASH_INDEX_HUGE_PAGES_LINUX
+        ::operator delete(ptr);
+        #endif // HASH_INDEX_HUGE_PAGES_LINUX
+    }
+
+    const hash_index_huge_page_options & options() const noexcept
+    {
+        return m_options;
+    }
+
+    // Size of the pages the mappings are rounded up to.
+    std::size_t page_size() const noexcept
+    {
+        return (m_options.pages == page_mode::explicit_1gb) ? (std::size_t(1) << 30) : (std::size_t(1) << 21);
+    }
+
+    // False if this platform always falls back to operator new.
+    static constexpr bool is_supported() noexcept
+    {
+        #if defined(HASH_INDEX_HUGE_PAGES_LINUX)
+        return true;
+        #else // !HASH_INDEX_HUGE_PAGES_LINUX
+        return false;
+        #endif // HASH_INDEX_HUGE_PAGES_LINUX
+    }
+
+    template<typename U>
+    bool operator == (const hash_index_huge_page_allocator<U> & other) const noexcept
+    {
+        return m_options == other.options();
+    }
+
+    template<typename U>
+    bool operator != (const hash_index_huge_page_allocator<U> & other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+private:
+
+    bool uses_mapping(const std::size_t bytes) const noexcept
+    {
+        return is_supported() && bytes >= m_options.min_bytes && bytes > 0;
+    }
+
+    std::size_t mapping_length(const std::size_t bytes) const noexcept
+    {
+        const std::size_t page = page_size();
+        return (bytes + page - 1) & ~(page - 1);
+    }
+
+    #if defined(HASH_INDEX_HUGE_PAGES_LINUX)
+    static void * map_transparent(const std::size_t length)
+    {
+        // THP needs the range aligned to the 2 MB huge page size, but mmap()
+        // only guarantees 4 KB, so over-map and trim the unaligned ends.
+        const std::size_t huge_page = std::size_t(1) << 21;
+        const std::size_t padded    = length + huge_page;
+
+        void * const raw = ::mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+        {
+            throw std::bad_alloc{};
+        }
+
+        const std::uintptr_t start   = reinterpret_cast<std::uintptr_t>(raw);
+        const std::uintptr_t aligned = (start + huge_page - 1) & ~static_cast<std::uintptr_t>(huge_page - 1);
+        const std::size_t    head    = static_cast<std::size_t>(aligned - start);
+        const std::size_t    tail    = padded - head - length;
+
+        if (head != 0)
+        {
+            ::munmap(raw, head);
+        }
+        if (tail != 0)
+        {
+            ::munmap(reinterpret_cast<void *>(aligned + length), tail);
+        }
+
+        void * const block = reinterpret_cast<void *>(aligned);
+        #if defined(MADV_HUGEPAGE)
+        ::madvise(block, length, MADV_HUGEPAGE);
+        #endif // MADV_HUGEPAGE
+        return block;
+    }
+
+    void apply_numa_policy(void * block, const std::size_t length) const noexcept
+    {
+        #if defined(SYS_mbind)
+        if (m_options.numa == numa_mode::local || m_options.numa_nodes == 0)
+        {
+            return;
+        }
+
+        // Same values of MPOL_PREFERRED/MPOL_BIND/MPOL_INTERLEAVE from <numaif.h>,
+        // which belongs to libnuma, so the syscall is issued directly instead.
+        const int mode = (m_options.numa == numa_mode::preferred) ? 1 :
+                         (m_options.numa == numa_mode::bind)      ? 2 : 3;
+
+        const unsigned long node_mask = m_options.numa_nodes;
+        ::syscall(SYS_mbind, block, length, mode, &node_mask, sizeof(node_mask) * 8 + 1, 0);
+        #else // !SYS_mbind
+        (void)block;
+        (void)length;
+        #endif // SYS_mbind
+    }
+    #endif // HASH_INDEX_HUGE_PAGES_LINUX
+
+    hash_index_huge_page_options m_options{};
+};
+
+#endif // HASH_INDEX_HUGE_PAGES_HPP
@@ -8,15 +8,31 @@
 // ================================================================================================
 
 // Compiles with:
-// c++ -std=c++11 -Wall -Wextra -Weffc++ -pedantic -O3 tests.cpp -o hash_idx_tests
+// c++ -std=c++11 -Wall -Wextra -Weffc++ -pedantic -O3 -pthread tests.cpp -o hash_idx_tests
+
+// Also test build_parallel() and rehash_parallel(), which are opt-in.
+#ifndef HASH_INDEX_ENABLE_PARALLEL
+    #define HASH_INDEX_ENABLE_PARALLEL
+#endif // HASH_INDEX_ENABLE_PARALLEL
 
 #include "hash_index.hpp"
+#include "concurrent_hash_index.hpp"
+#include "hash_index_file.hpp"
+#include "hash_index_huge_pages.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <cassert>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <numeric>
 #include <random>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 // ========================================================
@@ -200,6 +216,2290 @@ static void test_key_collisions()
     }
 }
 
+template<typename HashIndexType>
+static void test_rehash()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    // Auto-rehash policy, starting small so it has to grow a few times:
+    HashIndexType h1{ 16, 16 };
+    h1.set_max_load_factor(1.0f);
+    assert(h1.retains_keys() == true);
+
+    std::vector<std::size_t> keys;
+    fill_random_keys(&h1, &keys);
+
+    assert(static_cast<std::size_t>(h1.size()) == keys.size());
+    assert(static_cast<std::size_t>(h1.hash_buckets_size()) >= keys.size());
+    assert(h1.load_factor() <= h1.max_load_factor());
+
+    for (std::size_t k = 0; k < keys.size(); ++k)
+    {
+        bool found = false;
+        for (auto i = h1.first(static_cast<key_type>(keys[k])); i != h1.null_index; i = h1.next(i))
+        {
+            if (static_cast<std::size_t>(i) == k)
+            {
+                found = true;
+                break;
+            }
+        }
+        assert(found == true);
+    }
+
+    // Explicit rehash with a key function, on a table without key retention,
+    // must preserve the order of duplicate keys in a chain:
+    HashIndexType h2{ 16, 16 };
+    constexpr std::size_t dup_key = 42;
+    for (std::size_t i = 0; i < 8; ++i)
+    {
+        h2.insert(static_cast<key_type>(dup_key), static_cast<index_type>(i));
+    }
+    h2.rehash(256, [](const index_type) { return static_cast<key_type>(dup_key); });
+    assert(h2.hash_buckets_size() == 256);
+
+    auto expected = static_cast<index_type>(7);
+    for (auto i = h2.first(static_cast<key_type>(dup_key)); i != h2.null_index; i = h2.next(i))
+    {
+        assert(i == expected);
+        --expected;
+    }
+    assert(h2.size() == 8);
+
+    // reserve() ahead of time shouldn't need to rehash later on:
+    HashIndexType h3;
+    h3.reserve(4096);
+    assert(h3.hash_buckets_size() >= 4096);
+    assert(h3.index_chain_size()  >= 4096);
+}
+
+template<typename HashIndexType>
+static void test_build()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    constexpr std::size_t count = 1024;
+    std::vector<key_type> keys;
+
+    std::hash<std::size_t> hasher;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        keys.push_back(static_cast<key_type>(hasher(i * 7919)));
+    }
+
+    // Bulk build must yield the same table as individual inserts:
+    HashIndexType h1;
+    h1.build(keys.data(), keys.size(), 256);
+
+    HashIndexType h2{ 256, count };
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        h2.insert(keys[i], static_cast<index_type>(i));
+    }
+
+    assert(h1.size() == h2.size());
+    assert(h1 == h2);
+
+    // Iterator range, bucket count derived from the number of keys:
+    HashIndexType h3;
+    h3.build(std::begin(keys), std::end(keys));
+    assert(static_cast<std::size_t>(h3.hash_buckets_size()) >= count);
+
+    for (std::size_t k = 0; k < count; ++k)
+    {
+        bool found = false;
+        for (auto i = h3.first(keys[k]); i != h3.null_index; i = h3.next(i))
+        {
+            if (static_cast<std::size_t>(i) == k)
+            {
+                found = true;
+                break;
+            }
+        }
+        assert(found == true);
+    }
+
+    // Table is still usable with the per-item interface afterwards:
+    h3.insert(keys[0], static_cast<index_type>(count));
+    assert(static_cast<std::size_t>(h3.size()) == count + 1);
+}
+
+template<typename HashIndexType>
+static void test_find_many()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    // Few buckets so that most lookups have to walk a chain:
+    HashIndexType h1{ 64, 1024 };
+
+    constexpr std::size_t count = 1000;
+    std::vector<std::size_t> values;
+    std::vector<key_type>    keys;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        values.push_back(i * 3);
+        keys.push_back(static_cast<key_type>(i * 3));
+        h1.insert(keys.back(), static_cast<index_type>(i));
+    }
+
+    // Half hits, half misses, with a count that is not a multiple of the group size:
+    std::vector<std::size_t> needles;
+    std::vector<key_type>    needle_keys;
+    for (std::size_t i = 0; i < count + 7; ++i)
+    {
+        needles.push_back((i % 2 == 0) ? i * 3 : i * 3 + 1);
+        needle_keys.push_back(static_cast<key_type>(needles.back()));
+    }
+
+    std::vector<index_type> results(needles.size());
+    h1.find_many(needle_keys.data(), needles.data(), needles.size(), values, results.data());
+
+    for (std::size_t i = 0; i < needles.size(); ++i)
+    {
+        assert(results[i] == h1.find(needle_keys[i], needles[i], values));
+        if (i % 2 == 0 && i < count)
+        {
+            assert(static_cast<std::size_t>(results[i]) == i);
+        }
+        else
+        {
+            assert(results[i] == h1.null_index);
+        }
+    }
+
+    // Empty table never touches the collection:
+    HashIndexType h2;
+    h2.find_many(needle_keys.data(), needles.data(), needles.size(), values, results.data());
+    for (auto r : results)
+    {
+        assert(r == h2.null_index);
+    }
+}
+
+#if defined(HASH_INDEX_COROUTINES)
+// Eagerly started coroutine that nobody waits on, like a request handler.
+struct detached_task
+{
+    struct promise_type
+    {
+        detached_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+template<typename HashIndexType, typename IndexType>
+static detached_task find_async_pair(const HashIndexType & h, hash_index_scheduler & scheduler,
+                                     const std::vector<std::size_t> & values, const std::size_t a,
+                                     const std::size_t b, IndexType * out)
+{
+    using key_type = typename HashIndexType::key_type;
+    out[0] = co_await h.find_async(scheduler, static_cast<key_type>(values[a]), values[a], values);
+    out[1] = co_await h.find_async(scheduler, static_cast<key_type>(values[b]), values[b], values);
+}
+#endif // HASH_INDEX_COROUTINES
+
+template<typename HashIndexType>
+static void test_find_async()
+{
+    #if defined(HASH_INDEX_COROUTINES)
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    // Few buckets so that lookups suspend a few times each:
+    HashIndexType h1{ 64, 1024 };
+
+    constexpr std::size_t count = 1000;
+    std::vector<std::size_t> values;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        values.push_back(i * 3);
+        h1.insert(static_cast<key_type>(values.back()), static_cast<index_type>(i));
+    }
+
+    hash_index_scheduler scheduler;
+
+    // Nothing runs until the scheduler does:
+    const HashIndexType h2;
+    auto empty_lookup = h2.find_async(scheduler, 42, std::size_t(42), values);
+    assert(!empty_lookup.done());
+    assert(scheduler.pending() == 1);
+    scheduler.run();
+    assert(empty_lookup.done() && empty_lookup.result() == h2.null_index);
+
+    // Many lookups in flight, hits and misses, same results of find():
+    std::vector<std::size_t> needles;
+    std::vector<hash_index_lookup<index_type>> lookups;
+    for (std::size_t i = 0; i < 256; ++i)
+    {
+        needles.push_back((i % 2 == 0) ? i * 3 : i * 3 + 1);
+    }
+    for (std::size_t i = 0; i < needles.size(); ++i)
+    {
+        lookups.push_back(h1.find_async(scheduler, static_cast<key_type>(needles[i]), needles[i], values,
+                                        [](const std::size_t a, const std::size_t b) { return a == b; }));
+    }
+    assert(scheduler.pending() == needles.size());
+    assert(scheduler.run_once()); // Prefetching the buckets; Still pending.
+    scheduler.run();
+    assert(scheduler.empty());
+    for (std::size_t i = 0; i < needles.size(); ++i)
+    {
+        assert(lookups[i].done());
+        assert(lookups[i].result() == h1.find(static_cast<key_type>(needles[i]), needles[i], values));
+        assert(lookups[i].result() == ((i % 2 == 0) ? static_cast<index_type>(i) : h1.null_index));
+    }
+
+    // Awaited from other coroutines, which resume with the results:
+    index_type results[8][2];
+    for (std::size_t t = 0; t < 8; ++t)
+    {
+        find_async_pair(h1, scheduler, values, t * 10, count - 1 - t, results[t]);
+    }
+    scheduler.run();
+    for (std::size_t t = 0; t < 8; ++t)
+    {
+        assert(static_cast<std::size_t>(results[t][0]) == t * 10);
+        assert(static_cast<std::size_t>(results[t][1]) == count - 1 - t);
+    }
+
+    // A throwing predicate finishes its lookup only, rethrowing from the result:
+    auto throwing = h1.find_async(scheduler, static_cast<key_type>(values[5]), values[5], values,
+                                  [](const std::size_t, const std::size_t) -> bool { throw std::runtime_error{ "predicate" }; });
+    auto after = h1.find_async(scheduler, static_cast<key_type>(values[7]), values[7], values);
+    scheduler.run();
+    assert(throwing.done() && after.done());
+    assert(static_cast<std::size_t>(after.result()) == 7);
+    bool thrown = false;
+    try
+    {
+        throwing.result();
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Dropping pending lookups takes them off the scheduler:
+    {
+        auto dropped = h1.find_async(scheduler, static_cast<key_type>(values[9]), values[9], values);
+        assert(scheduler.pending() == 1);
+    }
+    assert(scheduler.empty());
+    #endif // HASH_INDEX_COROUTINES
+}
+
+template<typename HashIndexType>
+static void test_fingerprints()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using ukey_type  = typename std::make_unsigned<key_type>::type;
+
+    HashIndexType h1;
+    h1.set_fingerprints(true);
+    assert(h1.uses_fingerprints() == true);
+
+    // All keys land in the same bucket but differ in the top byte:
+    constexpr std::size_t count = 256;
+    constexpr int shift = static_cast<int>(sizeof(key_type) - 1) * 8;
+
+    std::vector<key_type> keys;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        keys.push_back(static_cast<key_type>((static_cast<ukey_type>(i) << shift) | 0xD00D));
+        h1.insert(keys.back(), static_cast<index_type>(i));
+    }
+
+    std::size_t pred_calls = 0;
+    auto pred = [&pred_calls](const key_type & needle, const key_type & item)
+    {
+        ++pred_calls;
+        return needle == item;
+    };
+
+    for (std::size_t k = 0; k < count; ++k)
+    {
+        assert(static_cast<std::size_t>(h1.find(keys[k], keys[k], keys, pred)) == k);
+    }
+    // Every lookup rejected the colliding entries without calling the predicate.
+    assert(pred_calls == count);
+
+    // Copies keep the fingerprints:
+    HashIndexType h2{ h1 };
+    assert(h2 == h1);
+    pred_calls = 0;
+    assert(h2.find(keys[1], keys[1], keys, pred) == 1);
+    assert(pred_calls == 1);
+
+    // Erase-and-shift must move the fingerprints along with the chain:
+    h2.erase_and_remove_index(keys[0], 0);
+    keys.erase(keys.begin());
+    for (std::size_t k = 0; k < keys.size(); ++k)
+    {
+        assert(static_cast<std::size_t>(h2.find(keys[k], keys[k], keys, pred)) == k);
+    }
+}
+
+template<typename HashIndexType>
+static void test_group_probing()
+{
+    // Same integer types, group probing layout instead of chaining:
+    using GroupIndexType = basic_hash_index<group_probing_layout,
+                                            typename HashIndexType::index_type,
+                                            typename HashIndexType::key_type,
+                                            typename HashIndexType::size_type>;
+    using key_type   = typename GroupIndexType::key_type;
+    using index_type = typename GroupIndexType::index_type;
+
+    GroupIndexType h1{ 16, 16 }; // Small so it has to grow.
+    assert(h1.is_allocated() == false);
+    assert(h1.first(0) == h1.null_index);
+
+    std::vector<std::size_t> keys;
+    fill_random_keys(&h1, &keys);
+    assert(static_cast<std::size_t>(h1.size()) == keys.size());
+    assert(h1.load_factor() <= 0.875f);
+
+    for (std::size_t k = 0; k < keys.size(); ++k)
+    {
+        bool found = false;
+        for (auto i = h1.first(static_cast<key_type>(keys[k])); i != h1.null_index; i = h1.next(i))
+        {
+            if (static_cast<std::size_t>(i) == k)
+            {
+                found = true;
+                break;
+            }
+        }
+        assert(found == true);
+    }
+
+    // Copies are independent:
+    GroupIndexType h2{ h1 };
+    assert(h2.size() == h1.size());
+    assert(h2.first(static_cast<key_type>(keys[0])) == h1.first(static_cast<key_type>(keys[0])));
+
+    // Erase everything, with a final check against the value collection:
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        h1.erase(static_cast<key_type>(keys[i]), static_cast<index_type>(i));
+    }
+    assert(h1.empty() == true);
+    for (std::size_t k = 0; k < keys.size(); ++k)
+    {
+        assert(h1.find(static_cast<key_type>(keys[k]), keys[k], keys) == h1.null_index);
+        assert(static_cast<std::size_t>(h2.find(static_cast<key_type>(keys[k]), keys[k], keys)) == k);
+    }
+
+    // Duplicate keys, enough to span several groups, with churn to create tombstones:
+    GroupIndexType h3;
+    constexpr std::size_t count = 1024;
+    constexpr std::size_t key   = 0xCAFED00D;
+    for (int round = 0; round < 4; ++round)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            h3.insert(static_cast<key_type>(key), static_cast<index_type>(i));
+        }
+
+        std::vector<bool> found_keys(count, false);
+        std::size_t num_found = 0;
+        for (auto i = h3.first(static_cast<key_type>(key)); i != h3.null_index; i = h3.next(i))
+        {
+            assert(found_keys[static_cast<std::size_t>(i)] == false);
+            found_keys[static_cast<std::size_t>(i)] = true;
+            ++num_found;
+        }
+        assert(num_found == count);
+
+        for (std::size_t i = 0; i < count; i += 2)
+        {
+            h3.erase(static_cast<key_type>(key), static_cast<index_type>(i));
+        }
+        for (std::size_t i = 1; i < count; i += 2)
+        {
+            h3.erase(static_cast<key_type>(key), static_cast<index_type>(i));
+        }
+        assert(h3.empty() == true);
+        assert(h3.first(static_cast<key_type>(key)) == h3.null_index);
+    }
+}
+
+// Checks that every value in 'values' is reachable at its position via
+// its own key, and that nothing else is linked. Keys are the values itself.
+template<typename HashIndexType>
+static void check_values_indexed(const HashIndexType & h, const std::vector<std::size_t> & values)
+{
+    using key_type = typename HashIndexType::key_type;
+
+    assert(static_cast<std::size_t>(h.size()) == values.size());
+    for (std::size_t k = 0; k < values.size(); ++k)
+    {
+        assert(static_cast<std::size_t>(h.find(static_cast<key_type>(values[k]), values[k], values)) == k);
+    }
+}
+
+template<typename HashIndexType>
+static void test_insert_remove_at()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    HashIndexType h1{ 64, 64 };
+    std::vector<std::size_t> values;
+
+    // Inserting at a position on an empty table still inserts:
+    h1.insert_at_index(static_cast<key_type>(1000), 0);
+    values.push_back(1000);
+    check_values_indexed(h1, values);
+
+    for (std::size_t i = 1; i < 200; ++i)
+    {
+        // Alternate between the front, the middle and the back:
+        const std::size_t pos = (i % 3 == 0) ? 0 : (i % 3 == 1) ? values.size() / 2 : values.size();
+        h1.insert_at_index(static_cast<key_type>(1000 + i), static_cast<index_type>(pos));
+        values.insert(values.begin() + pos, 1000 + i);
+    }
+    check_values_indexed(h1, values);
+
+    // Batched insert, positions refer to the final array:
+    {
+        const std::vector<index_type> positions = { 0, 1, 5, 50, 51, 100, static_cast<index_type>(values.size() + 6) };
+        std::vector<key_type> new_keys;
+        for (std::size_t j = 0; j < positions.size(); ++j)
+        {
+            new_keys.push_back(static_cast<key_type>(5000 + j));
+            values.insert(values.begin() + positions[j], 5000 + j);
+        }
+        h1.insert_at_indexes(new_keys.data(), positions.data(), positions.size());
+    }
+    check_values_indexed(h1, values);
+
+    // Single and batched removal, positions refer to the array before removal:
+    h1.erase_and_remove_index(static_cast<key_type>(values[10]), 10);
+    values.erase(values.begin() + 10);
+    check_values_indexed(h1, values);
+
+    {
+        const std::vector<index_type> positions = { 0, 3, 4, 20, 99, static_cast<index_type>(values.size() - 1) };
+        std::vector<key_type> old_keys;
+        for (auto p : positions)
+        {
+            old_keys.push_back(static_cast<key_type>(values[p]));
+        }
+        for (std::size_t j = positions.size(); j-- > 0;)
+        {
+            values.erase(values.begin() + positions[j]);
+        }
+        h1.erase_and_remove_indexes(old_keys.data(), positions.data(), positions.size());
+    }
+    check_values_indexed(h1, values);
+
+    // compact() after an erase-remove pass, dropping every third value:
+    std::vector<index_type>  remap(values.size(), h1.null_index);
+    std::vector<std::size_t> kept;
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+        if (i % 3 != 0)
+        {
+            remap[i] = static_cast<index_type>(kept.size());
+            kept.push_back(values[i]);
+        }
+    }
+    h1.compact(remap.data(), remap.size());
+    check_values_indexed(h1, kept);
+}
+
+template<typename HashIndexType>
+static void test_concurrent_readers()
+{
+    using ConcurrentIndexType = concurrent_hash_index<typename HashIndexType::index_type,
+                                                      typename HashIndexType::key_type,
+                                                      typename HashIndexType::size_type>;
+    using key_type   = typename ConcurrentIndexType::key_type;
+    using index_type = typename ConcurrentIndexType::index_type;
+
+    // Small index chain so the writer has to republish the arrays a few times.
+    constexpr std::size_t stable_count = 512;
+    constexpr std::size_t total_count  = 8192;
+    constexpr int         num_readers  = 4;
+
+    ConcurrentIndexType h1{ 256, 64, num_readers };
+
+    // Values are fully populated upfront; Only the index changes concurrently.
+    std::vector<std::size_t> values;
+    for (std::size_t i = 0; i < total_count; ++i)
+    {
+        values.push_back(i * 2654435761u);
+    }
+    for (std::size_t i = 0; i < stable_count; ++i)
+    {
+        h1.insert(static_cast<key_type>(values[i]), static_cast<index_type>(i));
+    }
+
+    std::atomic<bool> writer_done{ false };
+    std::atomic<int>  failures{ 0 };
+
+    // Readers keep checking that the entries inserted before they started are always found:
+    std::vector<std::thread> readers;
+    for (int r = 0; r < num_readers; ++r)
+    {
+        readers.emplace_back([&h1, &values, &writer_done, &failures]()
+        {
+            typename ConcurrentIndexType::reader reader{ h1 };
+            do
+            {
+                for (std::size_t k = 0; k < stable_count; ++k)
+                {
+                    if (static_cast<std::size_t>(reader.find(static_cast<key_type>(values[k]), values[k], values)) != k)
+                    {
+                        ++failures;
+                    }
+                }
+            }
+            while (!writer_done.load());
+        });
+    }
+
+    // Meanwhile the writer inserts and erases the rest:
+    for (std::size_t i = stable_count; i < total_count; ++i)
+    {
+        h1.insert(static_cast<key_type>(values[i]), static_cast<index_type>(i));
+        if (i % 3 == 0)
+        {
+            h1.erase(static_cast<key_type>(values[i]), static_cast<index_type>(i));
+        }
+    }
+    writer_done = true;
+
+    for (auto & t : readers)
+    {
+        t.join();
+    }
+    assert(failures == 0);
+
+    // With all readers gone, everything retired can be freed:
+    h1.synchronize();
+    assert(h1.retired_count() == 0);
+    assert(static_cast<std::size_t>(h1.index_chain_size()) >= total_count);
+
+    typename ConcurrentIndexType::reader reader{ h1 };
+    for (std::size_t k = 0; k < total_count; ++k)
+    {
+        const auto expected = (k >= stable_count && k % 3 == 0) ? h1.null_index : static_cast<index_type>(k);
+        assert(reader.find(static_cast<key_type>(values[k]), values[k], values) == expected);
+    }
+
+    // Manual walks go through a read section:
+    {
+        typename ConcurrentIndexType::reader::section s{ reader };
+        bool found = false;
+        for (auto i = s.first(static_cast<key_type>(values[1])); i != h1.null_index; i = s.next(i))
+        {
+            found |= (i == 1);
+        }
+        assert(found == true);
+    }
+
+    // With every slot taken, new readers wait for one to be released:
+    ConcurrentIndexType h2{ 64, 64, 1 };
+    std::atomic<bool> claimed{ false };
+    std::thread waiting_reader;
+    {
+        typename ConcurrentIndexType::reader first{ h2 };
+        waiting_reader = std::thread{ [&h2, &claimed]()
+        {
+            typename ConcurrentIndexType::reader second{ h2 };
+            claimed = true;
+        } };
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        assert(claimed == false);
+    }
+    waiting_reader.join();
+    assert(claimed == true);
+}
+
+template<typename HashIndexType>
+static void test_sharded_writers()
+{
+    using ShardedIndexType = sharded_hash_index<8,
+                                                typename HashIndexType::index_type,
+                                                typename HashIndexType::key_type,
+                                                typename HashIndexType::size_type>;
+    using key_type   = typename ShardedIndexType::key_type;
+    using index_type = typename ShardedIndexType::index_type;
+
+    constexpr std::size_t count       = 8192;
+    constexpr std::size_t num_writers = 4;
+
+    // Keys with well mixed high bits, so that all shards get some:
+    std::vector<key_type> values;
+    std::mt19937_64 rand_engine{ 1234 };
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        values.push_back(static_cast<key_type>(rand_engine()));
+    }
+
+    ShardedIndexType h1;
+
+    // Each writer inserts its own interleaved share of the global indexes:
+    std::vector<std::thread> writers;
+    for (std::size_t w = 0; w < num_writers; ++w)
+    {
+        writers.emplace_back([&h1, &values, w]()
+        {
+            for (std::size_t i = w; i < count; i += num_writers)
+            {
+                h1.insert(values[i], static_cast<index_type>(i));
+            }
+        });
+    }
+    for (auto & t : writers)
+    {
+        t.join();
+    }
+
+    assert(static_cast<std::size_t>(h1.size()) == count);
+    for (std::size_t k = 0; k < count; ++k)
+    {
+        assert(static_cast<std::size_t>(h1.find(values[k], values[k], values)) == k);
+    }
+
+    // Per-shard stats add up, and random keys should be reasonably balanced:
+    std::size_t total = 0;
+    for (std::size_t s = 0; s < ShardedIndexType::shard_count; ++s)
+    {
+        const auto stats = h1.compute_shard_stats(static_cast<typename ShardedIndexType::size_type>(s));
+        assert(stats.size > 0);
+        assert(stats.distribution_percentage <= 100);
+        // Local indexes keep each shard's chain small, instead of sized to the largest global index:
+        assert(static_cast<std::size_t>(stats.index_chain_size) < count);
+        total += static_cast<std::size_t>(stats.size);
+    }
+    assert(total == count);
+    assert(h1.compute_shard_imbalance() < 1.5f);
+
+    // Erase half, then reinsert a few to reuse the freed local indexes:
+    for (std::size_t i = 0; i < count; i += 2)
+    {
+        h1.erase(values[i], static_cast<index_type>(i));
+    }
+    for (std::size_t i = 0; i < 64; i += 2)
+    {
+        h1.insert(values[i], static_cast<index_type>(i));
+    }
+    for (std::size_t k = 0; k < count; ++k)
+    {
+        const bool present = (k % 2 != 0) || (k < 64);
+        assert(h1.find(values[k], values[k], values) == (present ? static_cast<index_type>(k) : h1.null_index));
+    }
+}
+
+template<typename HashIndexType>
+static void test_cow_snapshots()
+{
+    using CowIndexType = cow_hash_index<typename HashIndexType::index_type,
+                                        typename HashIndexType::key_type,
+                                        typename HashIndexType::size_type>;
+    using key_type   = typename CowIndexType::key_type;
+    using index_type = typename CowIndexType::index_type;
+    using size_type  = typename CowIndexType::size_type;
+
+    constexpr std::size_t count = 8192;
+
+    std::vector<std::size_t> values;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        values.push_back(i * 2654435761u);
+    }
+
+    // Half the chunk size of buckets, so they all fit in one.
+    CowIndexType h1{ CowIndexType::chunk_size / 2, 64 };
+    assert(h1.index_chain_size() == CowIndexType::chunk_size);
+    for (std::size_t i = 0; i < count / 2 - 1; ++i)
+    {
+        h1.insert(static_cast<key_type>(values[i]), static_cast<index_type>(i));
+    }
+    const size_type chunks = h1.chunk_count();
+    assert(chunks == 1 + (count / 2 + CowIndexType::chunk_size - 1) / CowIndexType::chunk_size);
+    assert(h1.shared_chunks() == 0);
+
+    // Snapshots share everything until written to:
+    const CowIndexType h2 = h1.snapshot();
+    assert(h2 == h1);
+    assert(h1.shared_chunks() == chunks);
+    assert(h2.shared_chunks() == chunks);
+
+    // A write only duplicates the bucket chunk and the chain chunk it lands in:
+    h1.insert(static_cast<key_type>(values[count / 2 - 1]), static_cast<index_type>(count / 2 - 1));
+    assert(h1.shared_chunks() == chunks - 2);
+    assert(h2.shared_chunks() == chunks - 2);
+    assert(h2 != h1);
+
+    // Growing the chain keeps sharing the old chunks:
+    for (std::size_t i = count / 2; i < count; ++i)
+    {
+        h1.insert(static_cast<key_type>(values[i]), static_cast<index_type>(i));
+    }
+    assert(static_cast<std::size_t>(h1.index_chain_size()) >= count);
+    assert(h1.shared_chunks() > 0);
+
+    // Erasing/clearing in the original doesn't affect the snapshot:
+    for (std::size_t i = 0; i < count; i += 2)
+    {
+        h1.erase(static_cast<key_type>(values[i]), static_cast<index_type>(i));
+    }
+    for (std::size_t k = 0; k < count; ++k)
+    {
+        const bool in_h1 = (k % 2 != 0);
+        const bool in_h2 = (k < count / 2 - 1);
+        assert(h1.find(static_cast<key_type>(values[k]), values[k], values) == (in_h1 ? static_cast<index_type>(k) : h1.null_index));
+        assert(h2.find(static_cast<key_type>(values[k]), values[k], values) == (in_h2 ? static_cast<index_type>(k) : h2.null_index));
+    }
+    assert(static_cast<std::size_t>(h1.size()) == count / 2);
+    assert(static_cast<std::size_t>(h2.size()) == count / 2 - 1);
+
+    CowIndexType h3{ h2 };
+    h3.clear();
+    assert(h3.empty());
+    assert(h3.find(static_cast<key_type>(values[1]), values[1], values) == h3.null_index);
+    assert(h2.find(static_cast<key_type>(values[1]), values[1], values) == 1);
+
+    // Snapshots read and dropped by other threads while the original keeps changing:
+    std::atomic<int> failures{ 0 };
+    std::vector<std::thread> readers;
+    for (std::size_t tick = 0; tick < 16; ++tick)
+    {
+        const std::size_t erased = tick * 64 + 1; // Odd, present in h1.
+        h1.erase(static_cast<key_type>(values[erased]), static_cast<index_type>(erased));
+
+        const CowIndexType snapshot = h1.snapshot();
+        readers.emplace_back([snapshot, erased, &values, &failures]()
+        {
+            for (std::size_t k = 1; k < count; k += 2)
+            {
+                const bool present = (k > erased || (k - 1) % 64 != 0);
+                const auto expected = present ? static_cast<index_type>(k) : snapshot.null_index;
+                if (snapshot.find(static_cast<key_type>(values[k]), values[k], values) != expected)
+                {
+                    ++failures;
+                }
+            }
+        });
+    }
+    for (auto & t : readers)
+    {
+        t.join();
+    }
+    assert(failures == 0);
+    assert(h1.shared_chunks() == 0);
+}
+
+template<typename HashIndexType>
+static void test_serialization()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+    using ViewType   = hash_index_view<index_type, key_type, size_type>;
+
+    HashIndexType h1;
+    h1.set_key_retention(true);
+    h1.set_fingerprints(true);
+
+    std::vector<std::size_t> keys;
+    fill_random_keys(&h1, &keys);
+    h1.erase(static_cast<key_type>(keys[3]), 3);
+
+    const size_type num_bytes = h1.serialized_size();
+    std::vector<unsigned char> bytes(static_cast<std::size_t>(num_bytes));
+    assert(h1.serialize(bytes.data(), num_bytes - 1) == 0); // Too small
+    assert(h1.serialize(bytes.data(), num_bytes) == num_bytes);
+
+    // Chains of the view must match the source exactly:
+    ViewType view{ bytes.data(), num_bytes };
+    assert(view.is_attached() == true);
+    assert(view.verify() == true);
+    assert(view.size() == h1.size());
+    assert(view.retains_keys() == true);
+    assert(view.uses_fingerprints() == true);
+    for (std::size_t k = 0; k < keys.size(); ++k)
+    {
+        const auto key = static_cast<key_type>(keys[k]);
+        auto i = h1.first(key);
+        auto j = view.first(key);
+        for (; i != h1.null_index; i = h1.next(i), j = view.next(j))
+        {
+            assert(i == j);
+        }
+        assert(j == view.null_index);
+        if (k != 3)
+        {
+            assert(static_cast<std::size_t>(view.find(key, keys[k], keys)) == k);
+        }
+    }
+
+    // Round-trip:
+    HashIndexType h2;
+    assert(h2.deserialize(bytes.data(), num_bytes) == true);
+    assert(h2 == h1);
+    assert(h2.retains_keys() == true);
+    h2.insert(static_cast<key_type>(keys[3]), 3); // Still mutable
+    assert(h2.find(static_cast<key_type>(keys[3]), keys[3], keys) == 3);
+
+    // An empty and unallocated hash_index:
+    HashIndexType h3;
+    std::vector<unsigned char> empty_bytes(static_cast<std::size_t>(h3.serialized_size()));
+    assert(h3.serialize(empty_bytes.data(), h3.serialized_size()) != 0);
+    const ViewType empty_view{ empty_bytes.data(), h3.serialized_size() };
+    assert(empty_view.is_attached() == true);
+    assert(empty_view.first(static_cast<key_type>(keys[0])) == empty_view.null_index);
+    assert(h2.deserialize(empty_bytes.data(), h3.serialized_size()) == true);
+    assert(h2 == h3);
+
+    // Mismatched widths and malformed data are rejected:
+    hash_index_view<std::uint16_t, key_type, size_type> narrow_view{ bytes.data(), num_bytes };
+    assert(narrow_view.is_attached() == false);
+    assert(narrow_view.first(static_cast<key_type>(keys[0])) == narrow_view.null_index);
+    assert(ViewType(bytes.data(), num_bytes - 1).is_attached() == false);
+
+    std::vector<unsigned char> bad_bytes{ bytes };
+    bad_bytes[0] = 'X';
+    assert(ViewType(bad_bytes.data(), num_bytes).is_attached() == false);
+    assert(h2.deserialize(bad_bytes.data(), num_bytes) == false);
+    assert(h2.is_allocated() == false);
+
+    // A cycle in the chain passes the header checks, but not verify():
+    bad_bytes = bytes;
+    const index_type head = h1.first(static_cast<key_type>(keys[0]));
+    std::memcpy(&bad_bytes[static_cast<std::size_t>(view.file_header().index_chain_offset + head * sizeof(index_type))],
+                &head, sizeof(index_type));
+    const ViewType cyclic_view{ bad_bytes.data(), num_bytes };
+    assert(cyclic_view.is_attached() == true);
+    assert(cyclic_view.verify() == false);
+    assert(h2.deserialize(bad_bytes.data(), num_bytes) == false);
+
+    // Through a file and a read-only memory mapping:
+    const char * const file_name = "hash_idx_test_serialization.bin";
+    assert(hash_index_save_file(file_name, h1) == true);
+    {
+        hash_index_mapped_file file{ file_name };
+        assert(file.is_open() == true);
+        assert(file.size() == static_cast<std::size_t>(num_bytes));
+
+        const ViewType mapped_view{ file.data(), static_cast<size_type>(file.size()) };
+        assert(mapped_view.is_attached() == true);
+        assert(mapped_view.verify() == true);
+        for (std::size_t k = 0; k < keys.size(); ++k)
+        {
+            if (k != 3)
+            {
+                assert(static_cast<std::size_t>(mapped_view.find(static_cast<key_type>(keys[k]), keys[k], keys)) == k);
+            }
+        }
+    }
+    std::remove(file_name);
+}
+
+template<typename HashIndexType>
+static void test_frozen_hash_index()
+{
+    using key_type    = typename HashIndexType::key_type;
+    using index_type  = typename HashIndexType::index_type;
+    using size_type   = typename HashIndexType::size_type;
+    using FrozenType  = frozen_hash_index<index_type, key_type, size_type>;
+
+    constexpr std::size_t count = 5000;
+
+    HashIndexType h1;
+    h1.set_key_retention(true);
+
+    std::vector<std::size_t> values;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        values.push_back(i * 7);
+        h1.insert(static_cast<key_type>(i * 7), static_cast<index_type>(i));
+    }
+    // Duplicates of the first few items and different values under the same key:
+    for (std::size_t i = 0; i < 10; ++i)
+    {
+        values.push_back(i * 7);
+        h1.insert(static_cast<key_type>(i * 7), static_cast<index_type>(values.size() - 1));
+        values.push_back(i * 7 + 1);
+        h1.insert(static_cast<key_type>(i * 7), static_cast<index_type>(values.size() - 1));
+    }
+    h1.erase(static_cast<key_type>(3 * 7), 3);
+
+    const FrozenType frozen = h1.freeze();
+    assert(frozen.size() == h1.size());
+    assert(static_cast<std::size_t>(frozen.key_count()) == count);
+    assert(frozen.pilot_count() == (frozen.key_count() + FrozenType::keys_per_pilot - 1) / FrozenType::keys_per_pilot);
+    assert(frozen.is_attached() == false);
+    assert((frozen.file_header().flags & hash_index_file_header::flag_multi_index) != 0);
+
+    // Same results as the source, duplicates included, for hits and misses:
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const auto key = static_cast<key_type>(i * 7);
+        assert(frozen.find(key, i * 7, values) == h1.find(key, i * 7, values));
+        assert(frozen.find(key, i * 7 + 1, values) == h1.find(key, i * 7 + 1, values));
+        assert(frozen.find(static_cast<key_type>(i * 7 + 3), i * 7, values) == frozen.null_index);
+    }
+    assert(static_cast<std::size_t>(frozen.find(static_cast<key_type>(3 * 7), std::size_t(3 * 7), values)) == count + 6);
+
+    // With a key function and single index per key, which drops the slot starts:
+    HashIndexType h2;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        h2.insert(static_cast<key_type>(i * 7), static_cast<index_type>(i));
+    }
+    const FrozenType frozen2 = h2.freeze([](const index_type i) { return static_cast<key_type>(i * 7); });
+    assert((frozen2.file_header().flags & hash_index_file_header::flag_multi_index) == 0);
+    assert(frozen2.table_bytes() < frozen.table_bytes());
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        assert(static_cast<std::size_t>(frozen2.find(static_cast<key_type>(i * 7), i * 7, values)) == i);
+    }
+
+    // Empty:
+    const FrozenType empty = HashIndexType{}.freeze();
+    assert(empty.empty() == true);
+    assert(empty.find(static_cast<key_type>(7), std::size_t(7), values) == empty.null_index);
+
+    // Serialized, attached in place and deserialized:
+    const size_type num_bytes = frozen.serialized_size();
+    std::vector<std::uint64_t> words(static_cast<std::size_t>(num_bytes / 8 + 1));
+    void * const bytes = words.data();
+    assert(frozen.serialize(bytes, num_bytes - 1) == 0); // Too small
+    assert(frozen.serialize(bytes, num_bytes) == num_bytes);
+
+    const FrozenType attached{ bytes, num_bytes };
+    assert(attached.is_attached() == true);
+    assert(attached.verify() == true);
+    FrozenType copied;
+    assert(copied.deserialize(bytes, num_bytes) == true);
+    assert(copied.is_attached() == false);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const auto key = static_cast<key_type>(i * 7);
+        assert(attached.find(key, i * 7, values) == frozen.find(key, i * 7, values));
+        assert(copied.find(key, i * 7 + 1, values) == frozen.find(key, i * 7 + 1, values));
+    }
+
+    std::vector<unsigned char> empty_bytes(static_cast<std::size_t>(empty.serialized_size()));
+    assert(empty.serialize(empty_bytes.data(), empty.serialized_size()) != 0);
+    assert(copied.deserialize(empty_bytes.data(), empty.serialized_size()) == true);
+    assert(copied.empty() == true);
+
+    // Chained and perfect tables don't mix:
+    using ViewType = hash_index_view<index_type, key_type, size_type>;
+    assert(ViewType(bytes, num_bytes).is_attached() == false);
+    assert(HashIndexType{}.deserialize(bytes, num_bytes) == false);
+    std::vector<unsigned char> chained_bytes(static_cast<std::size_t>(h1.serialized_size()));
+    h1.serialize(chained_bytes.data(), h1.serialized_size());
+    assert(copied.deserialize(chained_bytes.data(), h1.serialized_size()) == false);
+
+    // Broken slot starts pass the header checks, but not verify():
+    std::vector<std::uint64_t> bad_words{ words };
+    unsigned char * const bad_bytes = reinterpret_cast<unsigned char *>(bad_words.data());
+    const index_type bad_start = static_cast<index_type>(count + 1);
+    std::memcpy(bad_bytes + frozen.file_header().hash_keys_offset + sizeof(index_type), &bad_start, sizeof(index_type));
+    assert(FrozenType(bad_bytes, num_bytes).verify() == false);
+    assert(copied.deserialize(bad_bytes, num_bytes) == false);
+    assert(copied.empty() == true);
+
+    // Through a file and a read-only memory mapping:
+    const char * const file_name = "hash_idx_test_frozen.bin";
+    assert(hash_index_save_file(file_name, frozen) == true);
+    {
+        hash_index_mapped_file file{ file_name };
+        assert(file.is_open() == true);
+
+        const FrozenType mapped{ file.data(), static_cast<size_type>(file.size()) };
+        assert(mapped.is_attached() == true);
+        assert(mapped.verify() == true);
+        for (std::size_t i = 0; i < count; i += 7)
+        {
+            const auto key = static_cast<key_type>(i * 7);
+            assert(mapped.find(key, i * 7, values) == h1.find(key, i * 7, values));
+        }
+    }
+    std::remove(file_name);
+}
+
+template<typename HashIndexType>
+static void test_chain_stats()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    // Unallocated, all buckets empty:
+    HashIndexType h1{ 16, 16 };
+    auto stats = h1.compute_chain_stats();
+    assert(stats.hash_buckets == 16 && stats.empty_buckets == 16);
+    assert(stats.linked_indexes == 0 && stats.max_chain_length == 0);
+    assert(stats.empty_bucket_ratio == 1.0f);
+
+    // Bucket 0 holds 3 indexes, bucket 1 holds 1:
+    h1.insert(0,  0);
+    h1.insert(16, 1);
+    h1.insert(32, 2);
+    h1.insert(1,  3);
+
+    stats = h1.compute_chain_stats();
+    assert(stats.linked_indexes == 4);
+    assert(stats.empty_buckets == 14);
+    assert(stats.max_chain_length == 3);
+    assert(stats.p99_chain_length == 3);
+    assert(stats.histogram[0] == 14 && stats.histogram[1] == 1 && stats.histogram[2] == 0 && stats.histogram[3] == 1);
+    assert(stats.empty_bucket_ratio == 14.0f / 16.0f);
+    assert(stats.mean_chain_length == 2.0f);
+    assert(stats.mean_probes_per_hit == 1.75f); // (1 + 2 + 3 + 1) / 4
+
+    // Average chain is 4 / 16 = 0, so each chain of length L > 1 adds L - 1 of error:
+    std::size_t error = 0;
+    for (std::size_t length = 2; length < static_cast<std::size_t>(HashIndexType::chain_histogram_size); ++length)
+    {
+        error += static_cast<std::size_t>(stats.histogram[length]) * (length - 1);
+    }
+    assert(error == 2);
+    assert(static_cast<std::size_t>(h1.compute_distribution_percentage()) == 100 - error * 100 / 4); // 50
+
+    // A chain longer than the histogram lands in its last entry, p99 is still exact:
+    HashIndexType h2{ 16, 64 };
+    const std::size_t long_chain = static_cast<std::size_t>(HashIndexType::chain_histogram_size) + 8;
+    for (std::size_t i = 0; i < long_chain; ++i)
+    {
+        h2.insert(static_cast<key_type>(i * 16), static_cast<index_type>(i));
+    }
+    h2.insert(1, static_cast<index_type>(long_chain));
+
+    stats = h2.compute_chain_stats();
+    assert(static_cast<std::size_t>(stats.max_chain_length) == long_chain);
+    assert(static_cast<std::size_t>(stats.p99_chain_length) == long_chain);
+    assert(stats.histogram[HashIndexType::chain_histogram_size - 1] == 1);
+
+    // Lookup counters, only collected if enabled at compile time:
+    const std::vector<key_type> values{ 0, 16, 32, 1 };
+    h1.reset_counters();
+    assert(h1.find(0, key_type{ 0 }, values) == 0);
+    h1.erase(16, 1);
+    const auto counters = h1.counters();
+    #ifdef HASH_INDEX_ENABLE_COUNTERS
+    assert(counters.lookups == 1);
+    assert(counters.lookup_probes == 3);   // Newest first: 2, 1, 0
+    assert(counters.predicate_calls == 3);
+    assert(counters.erases == 1);
+    assert(counters.erase_probes == 1);
+    #else // !HASH_INDEX_ENABLE_COUNTERS
+    assert(counters.lookups == 0 && counters.lookup_probes == 0 && counters.predicate_calls == 0);
+    assert(counters.erases == 0 && counters.erase_probes == 0);
+    #endif // HASH_INDEX_ENABLE_COUNTERS
+}
+
+template<typename HashIndexType>
+static void check_same_chains(const HashIndexType & with_prev, const HashIndexType & without_prev)
+{
+    HashIndexType h{ with_prev };
+    h.set_prev_chain(false);
+    assert(h == without_prev);
+}
+
+template<typename HashIndexType>
+static void test_prev_chain()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    // Everything mirrored on a table without back links, which must end up with the same chains.
+    // Only 8 distinct keys, so every chain is long and the erases hit all positions of a chain.
+    HashIndexType h1{ 64, 64 };
+    HashIndexType h2{ 64, 64 };
+    h1.set_key_retention(true);
+    h2.set_key_retention(true);
+    h1.set_prev_chain(true);
+    assert(h1.uses_prev_chain() == true);
+
+    std::vector<key_type> keys;
+    for (std::size_t i = 0; i < 512; ++i)
+    {
+        keys.push_back(static_cast<key_type>(i % 8));
+        h1.insert(keys.back(), static_cast<index_type>(i));
+        h2.insert(keys.back(), static_cast<index_type>(i));
+    }
+    assert(h1.allocated_bytes() > h2.allocated_bytes());
+
+    auto erase_both = [&](const std::size_t stride, const std::size_t offset)
+    {
+        for (std::size_t i = offset; i < keys.size(); i += stride)
+        {
+            h1.erase(keys[i], static_cast<index_type>(i));
+            h2.erase(keys[i], static_cast<index_type>(i));
+        }
+        assert(h1.size() == h2.size());
+        check_same_chains(h1, h2);
+    };
+
+    erase_both(7, 0); // Heads, tails and middles.
+    erase_both(7, 0); // Already unlinked, no-op.
+
+    // Shifting keeps the back links in sync:
+    const std::vector<index_type> positions = { 1, 2, 30, 300 };
+    std::vector<key_type> moved_keys;
+    for (auto p : positions)
+    {
+        moved_keys.push_back(keys[p]);
+    }
+    h1.erase_and_remove_indexes(moved_keys.data(), positions.data(), positions.size());
+    h2.erase_and_remove_indexes(moved_keys.data(), positions.data(), positions.size());
+    for (std::size_t j = positions.size(); j-- > 0;)
+    {
+        keys.erase(keys.begin() + positions[j]);
+    }
+    check_same_chains(h1, h2);
+
+    h1.insert_at_indexes(moved_keys.data(), positions.data(), positions.size());
+    h2.insert_at_indexes(moved_keys.data(), positions.data(), positions.size());
+    for (std::size_t j = 0; j < positions.size(); ++j)
+    {
+        keys.insert(keys.begin() + positions[j], moved_keys[j]);
+    }
+    check_same_chains(h1, h2);
+    erase_both(5, 1);
+
+    // Rehash and compact rebuild them:
+    h1.rehash(256);
+    h2.rehash(256);
+    erase_both(5, 2);
+
+    std::vector<index_type> remap(keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        remap[i] = static_cast<index_type>(keys.size() - 1 - i);
+    }
+    h1.compact(remap.data(), remap.size());
+    h2.compact(remap.data(), remap.size());
+    std::reverse(keys.begin(), keys.end());
+    erase_both(3, 0);
+
+    // Enabling on a populated table, copies and deserialization:
+    HashIndexType h3{ h2 };
+    h3.set_prev_chain(true);
+    HashIndexType h4{ h3 };
+    std::vector<unsigned char> bytes(static_cast<std::size_t>(h3.serialized_size()));
+    h3.serialize(bytes.data(), h3.serialized_size());
+    HashIndexType h5;
+    assert(h5.deserialize(bytes.data(), h3.serialized_size()) == true);
+    assert(h5.uses_prev_chain() == true);
+    for (std::size_t i = 1; i < keys.size(); i += 3)
+    {
+        h2.erase(keys[i], static_cast<index_type>(i));
+        h3.erase(keys[i], static_cast<index_type>(i));
+        h4.erase(keys[i], static_cast<index_type>(i));
+        h5.erase(keys[i], static_cast<index_type>(i));
+    }
+    check_same_chains(h3, h2);
+    check_same_chains(h4, h2);
+    check_same_chains(h5, h2);
+
+    // clear() drops the stale back links, so erasing afterwards is harmless:
+    h1.clear();
+    h1.erase(keys[0], 0);
+    assert(h1.empty());
+    h1.insert(keys[0], 0);
+    assert(h1.first(keys[0]) == 0 && h1.next(0) == h1.null_index);
+
+    // Bulk build:
+    HashIndexType h6;
+    HashIndexType h7;
+    h6.set_prev_chain(true);
+    h6.build(keys.data(), keys.size());
+    h7.build(keys.data(), keys.size());
+    for (std::size_t i = 0; i < keys.size(); i += 2)
+    {
+        h6.erase(keys[i], static_cast<index_type>(i));
+        h7.erase(keys[i], static_cast<index_type>(i));
+    }
+    check_same_chains(h6, h7);
+}
+
+template<typename HashIndexType>
+static void test_static_hash_index()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using StaticIndexType = static_hash_index<index_type, 16, 128, key_type, typename HashIndexType::size_type>;
+
+    // All storage is inline:
+    static_assert(sizeof(StaticIndexType) >= (16 + 128) * sizeof(index_type), "Arrays should be inline!");
+    static_assert(StaticIndexType::hash_buckets_size() == 16 && StaticIndexType::index_chain_size() == 128, "");
+    static_assert(StaticIndexType::allocated_bytes() == 0, "");
+
+    StaticIndexType h1;
+    assert(h1.empty() == true);
+    assert(h1.first(static_cast<key_type>(3)) == h1.null_index);
+
+    // Same behavior of a hash_index<> given the same inserts and erases:
+    HashIndexType h2{ 16, 128 };
+    std::vector<key_type> values;
+    for (std::size_t i = 0; i < 128; ++i)
+    {
+        values.push_back(static_cast<key_type>(i * 7));
+        h1.insert(values.back(), static_cast<index_type>(i));
+        h2.insert(values.back(), static_cast<index_type>(i));
+    }
+    for (std::size_t i = 0; i < 128; i += 3)
+    {
+        h1.erase(values[i], static_cast<index_type>(i));
+        h2.erase(values[i], static_cast<index_type>(i));
+    }
+    assert(h1.size() == h2.size());
+
+    for (std::size_t i = 0; i < 128; ++i)
+    {
+        auto a = h1.first(values[i]);
+        auto b = h2.first(values[i]);
+        for (; a != h1.null_index; a = h1.next(a), b = h2.next(b))
+        {
+            assert(a == b);
+        }
+        assert(b == h2.null_index);
+        assert(h1.find(values[i], values[i], values) == ((i % 3 == 0) ? h1.null_index : static_cast<index_type>(i)));
+    }
+
+    // Plain value copies:
+    StaticIndexType h3{ h1 };
+    assert(h3 == h1);
+    h3.erase(values[1], 1);
+    assert(h3 != h1);
+    h3.clear();
+    assert(h3.empty() && h3.first(values[1]) == h3.null_index);
+}
+
+// Compile-time string compare for the constexpr lookups below.
+static constexpr bool const_str_equal(const char * a, const char * b)
+{
+    return (*a == *b) && (*a == '\0' || const_str_equal(a + 1, b + 1));
+}
+
+template<typename HashIndexType>
+static void test_constexpr_build()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using StaticIndexType = static_hash_index<index_type, 8, 16, key_type, typename HashIndexType::size_type>;
+
+    // Known FNV-1a 64 test vectors:
+    static_assert(hash_index_fnv1a("") == 14695981039346656037ull, "");
+    static_assert(hash_index_fnv1a("a") == 0xAF63DC4C8601EC8Cull, "");
+    static_assert(hash_index_fnv1a("foobar") == 0x85944171F73967E8ull, "");
+
+    static constexpr const char * keywords[] = { "if", "else", "while", "for", "return", "break", "continue", "switch", "case" };
+    static constexpr key_type keys[] = {
+        static_cast<key_type>(hash_index_fnv1a("if")),     static_cast<key_type>(hash_index_fnv1a("else")),
+        static_cast<key_type>(hash_index_fnv1a("while")),  static_cast<key_type>(hash_index_fnv1a("for")),
+        static_cast<key_type>(hash_index_fnv1a("return")), static_cast<key_type>(hash_index_fnv1a("break")),
+        static_cast<key_type>(hash_index_fnv1a("continue")), static_cast<key_type>(hash_index_fnv1a("switch")),
+        static_cast<key_type>(hash_index_fnv1a("case"))
+    };
+
+    #if (__cplusplus >= 201703L) || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+    // Built and queried entirely at compile time:
+    static constexpr StaticIndexType table{ keys };
+    constexpr auto pred = [](const char * a, const char * b) { return const_str_equal(a, b); };
+    static_assert(table.size() == 9, "");
+    static_assert(table.find(keys[4], "return", keywords, pred) == 4, "");
+    static_assert(table.find(keys[8], "case", keywords, pred) == 8, "");
+    static_assert(table.find(static_cast<key_type>(hash_index_fnv1a("goto")), "goto", keywords, pred) == table.null_index, "");
+    #else // Pre C++17
+    const StaticIndexType table{ keys };
+    auto pred = [](const char * a, const char * b) { return const_str_equal(a, b); };
+    #endif // C++17
+
+    // Same results at runtime, and the same as inserting one by one:
+    StaticIndexType inserted;
+    for (std::size_t i = 0; i < 9; ++i)
+    {
+        inserted.insert(keys[i], static_cast<index_type>(i));
+        assert(static_cast<std::size_t>(table.find(keys[i], keywords[i], keywords, pred)) == i);
+    }
+    assert(inserted == table);
+}
+
+// Bump allocator over a fixed buffer, growing the most recent block in place.
+struct test_arena
+{
+    alignas(16) unsigned char buffer[1 << 16];
+    std::size_t used          = 0;
+    std::size_t last_offset   = ~std::size_t(0);
+    int         allocations   = 0;
+    int         deallocations = 0;
+    int         expansions    = 0;
+};
+
+template<typename T>
+struct test_arena_allocator
+{
+    using value_type = T;
+    test_arena * arena;
+
+    explicit test_arena_allocator(test_arena * a) noexcept : arena{ a } { }
+    template<typename U> test_arena_allocator(const test_arena_allocator<U> & other) noexcept : arena{ other.arena } { }
+
+    T * allocate(const std::size_t count)
+    {
+        const std::size_t offset = (arena->used + 15) & ~std::size_t(15);
+        assert(offset + count * sizeof(T) <= sizeof(arena->buffer));
+        arena->used        = offset + count * sizeof(T);
+        arena->last_offset = offset;
+        arena->allocations++;
+        return reinterpret_cast<T *>(arena->buffer + offset);
+    }
+
+    void deallocate(T *, std::size_t) noexcept
+    {
+        arena->deallocations++;
+    }
+
+    bool try_expand(T * p, const std::size_t, const std::size_t new_count) noexcept
+    {
+        const std::size_t offset = static_cast<std::size_t>(reinterpret_cast<unsigned char *>(p) - arena->buffer);
+        if (offset != arena->last_offset || offset + new_count * sizeof(T) > sizeof(arena->buffer))
+        {
+            return false;
+        }
+        arena->used = offset + new_count * sizeof(T);
+        arena->expansions++;
+        return true;
+    }
+
+    template<typename U> bool operator == (const test_arena_allocator<U> & other) const noexcept { return arena == other.arena; }
+    template<typename U> bool operator != (const test_arena_allocator<U> & other) const noexcept { return arena != other.arena; }
+};
+
+template<typename HashIndexType>
+static void test_allocators()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+    using ArenaIndexType = hash_index<index_type, key_type, size_type, test_arena_allocator<index_type>>;
+
+    auto arena = std::unique_ptr<test_arena>{ new test_arena{} };
+    {
+        // The index chain is the last block allocated, so it keeps growing in place:
+        ArenaIndexType h1{ 64, 16, test_arena_allocator<index_type>{ arena.get() } };
+        h1.set_granularity(16);
+        for (std::size_t i = 0; i < 1000; ++i)
+        {
+            h1.insert(static_cast<key_type>(i), static_cast<index_type>(i));
+        }
+        assert(arena->allocations == 2);
+        assert(arena->expansions > 0);
+        assert(h1.index_chain_size() >= 1000);
+        std::vector<std::size_t> values;
+        for (std::size_t i = 0; i < 1000; ++i)
+        {
+            values.push_back(i);
+        }
+        for (std::size_t i = 0; i < 1000; ++i)
+        {
+            assert(static_cast<std::size_t>(h1.find(static_cast<key_type>(i), i, values)) == i);
+        }
+
+        // Copies and moves stay on the same arena:
+        ArenaIndexType h2{ h1 };
+        assert(h2 == h1 && h2.get_allocator() == h1.get_allocator());
+        ArenaIndexType h3{ std::move(h2) };
+        assert(h3 == h1 && h2.is_allocated() == false);
+        h2 = h3;
+        assert(h2 == h1);
+
+        // Freed in one shot when the arena goes, nothing returned piecemeal:
+        h1.abandon_memory();
+        h2.abandon_memory();
+        h3.abandon_memory();
+        assert(h1.is_allocated() == false && h1.empty() == true);
+    }
+    assert(arena->deallocations == 0);
+
+    #if defined(HASH_INDEX_PMR)
+    using PmrIndexType = pmr_hash_index<index_type, key_type, size_type>;
+    alignas(16) static unsigned char buffer[1 << 16];
+    std::pmr::monotonic_buffer_resource resource{ buffer, sizeof(buffer), std::pmr::null_memory_resource() };
+    {
+        PmrIndexType h4{ 64, 64, &resource };
+        for (std::size_t i = 0; i < 500; ++i)
+        {
+            h4.insert(static_cast<key_type>(i), static_cast<index_type>(i));
+        }
+        assert(h4.get_allocator().resource() == &resource);
+
+        PmrIndexType h5{ h4, &resource };
+        assert(h5 == h4 && h5.get_allocator().resource() == &resource);
+
+        // Plain copies use the default resource, assignment keeps the target's resource:
+        PmrIndexType h6{ h4 };
+        assert(h6.get_allocator().resource() == std::pmr::get_default_resource());
+        h6 = std::move(h5);
+        assert(h6 == h4 && h6.get_allocator().resource() == std::pmr::get_default_resource());
+    }
+    #endif // HASH_INDEX_PMR
+}
+
+template<typename HashIndexType>
+static void test_huge_pages()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+    using HugeAllocator = hash_index_huge_page_allocator<index_type>;
+    using HugeIndexType = hash_index<index_type, key_type, size_type, HugeAllocator>;
+
+    // Low threshold, so the buckets get mapped but the small key arrays don't.
+    hash_index_huge_page_options options;
+    options.min_bytes  = 4096;
+    options.numa       = hash_index_huge_page_options::numa_mode::interleave;
+    options.numa_nodes = 0x1;
+
+    HugeIndexType h1{ 4096, 512, HugeAllocator{ options } };
+    std::vector<std::size_t> values;
+    for (std::size_t i = 0; i < 3000; ++i)
+    {
+        h1.insert(static_cast<key_type>(i), static_cast<index_type>(i));
+        values.push_back(i);
+    }
+    for (std::size_t i = 0; i < 3000; ++i)
+    {
+        assert(static_cast<std::size_t>(h1.find(static_cast<key_type>(i), i, values)) == i);
+    }
+
+    // Rebound copies keep the options; different options don't compare equal.
+    const hash_index_huge_page_allocator<char> rebound{ h1.get_allocator() };
+    assert(rebound == h1.get_allocator() && rebound.options().min_bytes == 4096);
+    assert(HugeAllocator{} != h1.get_allocator());
+
+    // Growing the chain re-maps it, freeing the old block with the same length.
+    HugeIndexType h2{ h1 };
+    assert(h2 == h1);
+    h1.clear_and_free();
+    for (std::size_t i = 3000; i < 6000; ++i)
+    {
+        h2.insert(static_cast<key_type>(i), static_cast<index_type>(i));
+        values.push_back(i);
+    }
+    assert(static_cast<std::size_t>(h2.find(static_cast<key_type>(5000), 5000, values)) == 5000);
+}
+
+template<typename HashIndexType>
+static void test_incremental_rehash()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+
+    // Mirrored on a stop-the-world table, which must end up with the same chains.
+    // Keys repeat, so the migration must also preserve the order of duplicates.
+    HashIndexType h1{ 16, 16 };
+    HashIndexType h2{ 16, 16 };
+    h1.set_max_load_factor(1.0f);
+    h2.set_max_load_factor(1.0f);
+    h1.set_incremental_rehash(2);
+    h1.set_prev_chain(true);
+    assert(h1.incremental_rehash_step() == 2);
+
+    auto key_of = [](const std::size_t i) { return static_cast<key_type>((i * 2654435761u) % 1500); };
+    std::vector<std::size_t> values;
+    bool serialized = false;
+
+    for (std::size_t i = 0; i < 2000; ++i)
+    {
+        h1.insert(key_of(i), static_cast<index_type>(i));
+        h2.insert(key_of(i), static_cast<index_type>(i));
+        values.push_back(i);
+
+        if (!h1.is_rehashing() || i % 16 != 0)
+        {
+            continue;
+        }
+
+        // Everything is still found halfway through a migration:
+        for (std::size_t j = 0; j <= i; ++j)
+        {
+            assert(static_cast<std::size_t>(h1.find(key_of(j), j, values)) == j);
+        }
+        assert(h1.compute_chain_stats().linked_indexes == h1.size());
+
+        const HashIndexType copy{ h1 };
+        assert(copy == h1);
+
+        // Serialized as the fully migrated table:
+        if (!serialized)
+        {
+            HashIndexType finished{ h1 };
+            finished.finish_rehash();
+            assert(finished.is_rehashing() == false);
+
+            std::vector<unsigned char> bytes1(static_cast<std::size_t>(h1.serialized_size()));
+            std::vector<unsigned char> bytes2(static_cast<std::size_t>(finished.serialized_size()));
+            assert(bytes1.size() == bytes2.size());
+            h1.serialize(bytes1.data(), static_cast<size_type>(bytes1.size()));
+            finished.serialize(bytes2.data(), static_cast<size_type>(bytes2.size()));
+            assert(bytes1 == bytes2);
+            serialized = true;
+        }
+    }
+    assert(serialized == true);
+
+    // Erasures also advance the migration:
+    for (std::size_t i = 0; i < 2000; i += 2)
+    {
+        h1.erase(key_of(i), static_cast<index_type>(i));
+        h2.erase(key_of(i), static_cast<index_type>(i));
+    }
+    for (std::size_t i = 1; i < 2000; i += 2)
+    {
+        assert(static_cast<std::size_t>(h1.find(key_of(i), i, values)) == i);
+    }
+
+    h1.finish_rehash();
+    assert(h1.is_rehashing() == false);
+    assert(h1.hash_buckets_size() == h2.hash_buckets_size());
+
+    h1.set_prev_chain(false);
+    h1.set_incremental_rehash(0);
+    assert(h1 == h2);
+
+    // A low load factor with a small step still finishes each migration before the next one starts:
+    HashIndexType h3{ 16, 16 };
+    h3.set_max_load_factor(0.25f);
+    h3.set_incremental_rehash(1);
+    for (std::size_t i = 0; i < 5000; ++i)
+    {
+        const bool was_rehashing = h3.is_rehashing();
+        const size_type buckets  = h3.hash_buckets_size();
+        h3.insert(static_cast<key_type>(i * 7), static_cast<index_type>(i));
+        assert(h3.hash_buckets_size() == buckets || !was_rehashing);
+    }
+    assert(h3.hash_buckets_size() >= 5000 * 4);
+}
+
+template<typename HashIndexType>
+static void test_compact_hash_index()
+{
+    using key_type    = typename HashIndexType::key_type;
+    using index_type  = typename HashIndexType::index_type;
+    using size_type   = typename HashIndexType::size_type;
+    using CompactType = compact_hash_index<index_type, key_type, size_type>;
+
+    // Mirrored on a hash_index<>, which must yield the same chains.
+    HashIndexType h1{ 256, 1024 };
+    CompactType   h2{ 256, 1024 };
+    h1.set_granularity(1024);
+    h2.set_granularity(1024);
+    assert(h2.index_width() == 2);
+
+    std::vector<std::size_t> values;
+    auto key_of = [](const std::size_t i) { return static_cast<key_type>((i * 2654435761u) % 700); };
+    auto check_same = [&]()
+    {
+        assert(h1.size() == h2.size());
+        for (std::size_t k = 0; k < 700; ++k)
+        {
+            auto i = h1.first(static_cast<key_type>(k));
+            auto j = h2.first(static_cast<key_type>(k));
+            for (; i != h1.null_index; i = h1.next(i), j = h2.next(j))
+            {
+                assert(i == j);
+            }
+            assert(j == h2.null_index);
+        }
+    };
+
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        h1.insert(key_of(i), static_cast<index_type>(i));
+        h2.insert(key_of(i), static_cast<index_type>(i));
+        values.push_back(i);
+    }
+    check_same();
+    assert(h2.index_width() == 2);
+    assert(static_cast<std::size_t>(h2.allocated_bytes()) * sizeof(index_type) == static_cast<std::size_t>(h1.allocated_bytes()) * 2);
+
+    for (std::size_t i = 0; i < 1000; i += 3)
+    {
+        h1.erase(key_of(i), static_cast<index_type>(i));
+        h2.erase(key_of(i), static_cast<index_type>(i));
+    }
+    check_same();
+
+    const CompactType h3{ h2 };
+    assert(h3 == h2);
+
+    // An index past 16 bits widens both arrays, keeping every chain:
+    values.resize(70001);
+    std::iota(values.begin(), values.end(), std::size_t(0));
+    h1.insert(key_of(70000), 70000);
+    h2.insert(key_of(70000), 70000);
+    assert(h2.index_width() == 3);
+    assert(h2.index_chain_size() == h1.index_chain_size());
+    check_same();
+    assert(h3 != h2);
+    assert(static_cast<std::size_t>(h2.find(key_of(70000), 70000, values)) == 70000);
+    assert(static_cast<std::size_t>(h2.find(key_of(1), 1, values)) == 1);
+    assert(h2.find(key_of(3), 3, values) == h2.null_index);
+
+    basic_hash_index<compact_layout, index_type, key_type, size_type> h4;
+    h4.insert(key_of(5), 5);
+    assert(h4.first(key_of(5)) == 5);
+    h4.clear_and_free();
+    assert(h4.first(key_of(5)) == h4.null_index);
+
+    // Same chain growth policy of hash_index<>:
+    CompactType h5{ 1024, 64 };
+    h5.set_granularity(64);
+    assert(h5.index_chain_growth() == 1.0f);
+    h5.set_index_chain_growth(2.0f);
+    std::vector<std::size_t> appended;
+    std::size_t resizes = 0;
+    for (std::size_t i = 0; i < 20000; ++i)
+    {
+        const size_type old_size = h5.index_chain_size();
+        appended.push_back(i * 7);
+        h5.insert(static_cast<key_type>(i * 7), static_cast<index_type>(i));
+        resizes += (h5.index_chain_size() != old_size) ? 1 : 0;
+    }
+    assert(resizes == 9 && h5.index_chain_size() == 32768); // 64 -> 128 -> ... -> 32768
+    for (std::size_t i = 0; i < 20000; i += 13)
+    {
+        assert(static_cast<std::size_t>(h5.find(static_cast<key_type>(i * 7), i * 7, appended)) == i);
+    }
+    const CompactType h6{ h5 };
+    assert(h6.index_chain_growth() == 2.0f);
+
+    CompactType h7{ 1024, 64 };
+    h7.set_granularity(64);
+    h7.set_index_chain_growth(2.0f);
+    h7.reserve_index_chain(20000);
+    assert(h7.index_chain_size() == 20032);
+    for (std::size_t i = 0; i < 20000; ++i)
+    {
+        h7.insert(static_cast<key_type>(i * 7), static_cast<index_type>(i));
+    }
+    assert(h7.index_chain_size() == 20032);
+}
+
+template<typename HashIndexType>
+static void test_inline_bucket_hash_index()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+    using InlineType = inline_bucket_hash_index<index_type, key_type, size_type>;
+
+    static_assert(InlineType::inline_capacity == (sizeof(index_type) == 4 ? 12 : 7), "Unexpected inline capacity!");
+
+    // Never allocated, walks end right away like on hash_index<>:
+    const InlineType empty;
+    assert(empty.first(0) == empty.null_index);
+    assert(empty.next(0) == empty.null_index);
+
+    // Mirrored on a hash_index<>, which must yield the same chains. 700 keys on
+    // 64 buckets make chains long enough to overflow past the inline entries.
+    HashIndexType h1{ 64, 1024 };
+    InlineType    h2{ 64, 1024 };
+
+    std::vector<std::size_t> values(1000);
+    std::iota(values.begin(), values.end(), std::size_t(0));
+    auto key_of = [](const std::size_t i) { return static_cast<key_type>((i * 2654435761u) % 700); };
+    auto check_same = [&]()
+    {
+        assert(h1.size() == h2.size());
+        for (std::size_t k = 0; k < 700; ++k)
+        {
+            auto i = h1.first(static_cast<key_type>(k));
+            auto j = h2.first(static_cast<key_type>(k));
+            for (; i != h1.null_index; i = h1.next(i), j = h2.next(j))
+            {
+                assert(i == j);
+            }
+            assert(j == h2.null_index);
+        }
+    };
+
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        h1.insert(key_of(i), static_cast<index_type>(i));
+        h2.insert(key_of(i), static_cast<index_type>(i));
+    }
+    check_same();
+    assert(static_cast<std::size_t>(h2.find(key_of(0),   0,   values)) == 0);   // Overflowed by now
+    assert(static_cast<std::size_t>(h2.find(key_of(999), 999, values)) == 999); // Newest, first inline
+
+    // Erasing from the front, the middle and past the inline entries of the chains:
+    for (std::size_t i = 0; i < 1000; i += 3)
+    {
+        h1.erase(key_of(i), static_cast<index_type>(i));
+        h2.erase(key_of(i), static_cast<index_type>(i));
+    }
+    check_same();
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        const auto found = h2.find(key_of(i), i, values);
+        assert((i % 3 == 0) ? (found == h2.null_index) : (static_cast<std::size_t>(found) == i));
+    }
+
+    const InlineType h3{ h2 };
+    assert(h3 == h2);
+
+    h1.rehash(512, key_of);
+    h2.rehash(512, key_of);
+    assert(h2.hash_buckets_size() == 512);
+    check_same();
+    assert(h3 != h2);
+
+    h2.clear();
+    assert(h2.empty() && h2.first(key_of(1)) == h2.null_index);
+
+    basic_hash_index<inline_bucket_layout, index_type, key_type, size_type> h4;
+    h4.insert(key_of(5), 5);
+    assert(h4.first(key_of(5)) == 5);
+    h4.clear_and_free();
+    assert(h4.first(key_of(5)) == h4.null_index);
+
+    // Same chain growth policy of hash_index<>:
+    InlineType h5{ 1024, 64 };
+    h5.set_granularity(64);
+    assert(h5.index_chain_growth() == 1.0f);
+    h5.set_index_chain_growth(2.0f);
+    std::vector<std::size_t> appended;
+    std::size_t resizes = 0;
+    for (std::size_t i = 0; i < 20000; ++i)
+    {
+        const size_type old_size = h5.index_chain_size();
+        appended.push_back(i * 7);
+        h5.insert(static_cast<key_type>(i * 7), static_cast<index_type>(i));
+        resizes += (h5.index_chain_size() != old_size) ? 1 : 0;
+    }
+    assert(resizes == 9 && h5.index_chain_size() == 32768); // 64 -> 128 -> ... -> 32768
+    for (std::size_t i = 0; i < 20000; i += 13)
+    {
+        assert(static_cast<std::size_t>(h5.find(static_cast<key_type>(i * 7), i * 7, appended)) == i);
+    }
+    const InlineType h6{ h5 };
+    assert(h6.index_chain_growth() == 2.0f);
+
+    InlineType h7{ 1024, 64 };
+    h7.set_granularity(64);
+    h7.set_index_chain_growth(2.0f);
+    h7.reserve_index_chain(20000);
+    assert(h7.index_chain_size() == 20032);
+    for (std::size_t i = 0; i < 20000; ++i)
+    {
+        h7.insert(static_cast<key_type>(i * 7), static_cast<index_type>(i));
+    }
+    assert(h7.index_chain_size() == 20032);
+}
+
+template<typename HashIndexType>
+static void test_hashed_lookup()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    static_assert(hash_index_hasher::mix(0) == 0 && hash_index_hasher::mix(1) != 1, "mix() should be usable at compile time!");
+
+    // All string overloads must agree, and lengths 0 to 100 cover every branch of hash_bytes().
+    const hash_index_hasher hasher;
+    const std::string text(100, 'x');
+    std::vector<std::uint64_t> hashes;
+    for (std::size_t length = 0; length <= text.size(); ++length)
+    {
+        const std::string prefix = text.substr(0, length);
+        assert(hasher(prefix) == hasher(prefix.c_str()));
+        assert(hasher(prefix) == hasher(prefix.data(), prefix.size()));
+        #if defined(HASH_INDEX_STRING_VIEW)
+        assert(hasher(prefix) == hasher(std::string_view{ prefix }));
+        #endif // HASH_INDEX_STRING_VIEW
+        hashes.push_back(hasher(prefix));
+    }
+    std::sort(hashes.begin(), hashes.end());
+    assert(std::unique(hashes.begin(), hashes.end()) == hashes.end());
+    assert(hasher("abc") != hasher("abd") && hasher("abc") != hasher("bbc"));
+
+    // Keys with a stride of 64 would use 1/64th of the buckets unmixed.
+    std::vector<int> bucket_load(256, 0);
+    for (std::size_t i = 0; i < 4096; ++i)
+    {
+        ++bucket_load[static_cast<std::size_t>(HashIndexType::hashed_key(static_cast<key_type>(i * 64))) & 255];
+    }
+    assert(*std::max_element(bucket_load.begin(), bucket_load.end()) < 48);
+    assert(*std::min_element(bucket_load.begin(), bucket_load.end()) > 0);
+
+    std::vector<std::string> names;
+    HashIndexType h1;
+    for (std::size_t i = 0; i < 500; ++i)
+    {
+        names.push_back("name_" + std::to_string(i));
+        h1.insert_hashed(names.back(), static_cast<index_type>(i));
+    }
+    for (std::size_t i = 0; i < 500; ++i)
+    {
+        assert(static_cast<std::size_t>(h1.find_hashed(names[i], names)) == i);
+        assert(h1.find_hashed(names[i], names) == h1.find(HashIndexType::hashed_key(names[i].c_str()), names[i], names));
+    }
+    assert(h1.find_hashed(std::string{ "name_500" }, names) == h1.null_index);
+
+    h1.erase_hashed(names[7], 7);
+    assert(h1.find_hashed(names[7], names) == h1.null_index);
+    assert(static_cast<std::size_t>(h1.size()) == names.size() - 1);
+
+    // Integer needles, with a predicate comparing against the ids of the items:
+    struct item { int id; };
+    std::vector<item> items;
+    HashIndexType h2;
+    for (int i = 0; i < 100; ++i)
+    {
+        items.push_back({ i * 1024 });
+        h2.insert_hashed(items.back().id, static_cast<index_type>(i));
+    }
+    auto same_id = [](const int id, const item & it) { return id == it.id; };
+    assert(static_cast<std::size_t>(h2.find_hashed(5 * 1024, items, same_id)) == 5);
+    assert(h2.find_hashed(5, items, same_id) == h2.null_index);
+}
+
+template<typename HashIndexType>
+static void test_parallel_build()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+
+    // Enough keys for several threads, see parallel_grain.
+    const std::size_t count = static_cast<std::size_t>(HashIndexType::parallel_grain) * 6 + 123;
+    std::vector<key_type> keys;
+    std::mt19937 rng{ 1234 };
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        keys.push_back(static_cast<key_type>(rng() & 0x7FFFFFFF));
+    }
+
+    // Same table as build(), including all the optional arrays:
+    for (const unsigned threads : { 2u, 3u, 4u })
+    {
+        HashIndexType h1;
+        HashIndexType h2;
+        h1.set_key_retention(true);
+        h2.set_key_retention(true);
+        h1.set_fingerprints(true);
+        h2.set_fingerprints(true);
+        h1.set_prev_chain(true);
+        h2.set_prev_chain(true);
+
+        h1.build(keys.data(), static_cast<size_type>(count), 4096);
+        h2.build_parallel(keys.data(), static_cast<size_type>(count), threads, 4096);
+        assert(h1 == h2);
+
+        // Out of index order chains after erasing and inserting more:
+        for (std::size_t i = 0; i < count; i += 5)
+        {
+            h1.erase(keys[i], static_cast<index_type>(i));
+            h2.erase(keys[i], static_cast<index_type>(i));
+        }
+        for (std::size_t i = 0; i < count; i += 10)
+        {
+            h1.insert(keys[i], static_cast<index_type>(i));
+            h2.insert(keys[i], static_cast<index_type>(i));
+        }
+        assert(h1 == h2);
+
+        // Growing and shrinking:
+        h1.rehash(65536);
+        h2.rehash_parallel(65536, threads);
+        assert(h2.hash_buckets_size() == 65536);
+        assert(h1 == h2);
+
+        h1.rehash(1024);
+        h2.rehash_parallel(1024, threads);
+        assert(h1 == h2);
+    }
+
+    // Default bucket count and thread count, no key retention so with a key function:
+    HashIndexType h3;
+    HashIndexType h4;
+    h3.build(keys.data(), static_cast<size_type>(count));
+    h4.build_parallel(keys.data(), static_cast<size_type>(count));
+    assert(h3 == h4);
+
+    auto key_of = [&keys](const index_type i) { return keys[static_cast<std::size_t>(i)]; };
+    h3.rehash(h3.hash_buckets_size() * 4, key_of);
+    h4.rehash_parallel(h4.hash_buckets_size() * 4, 4, key_of);
+    assert(h3 == h4);
+
+    // Small inputs are built serially all the same:
+    HashIndexType h5;
+    h5.build_parallel(keys.data(), 100, 8);
+    assert(static_cast<std::size_t>(h5.size()) == 100);
+    assert(h5.first(keys[99]) == 99);
+}
+
+template<typename HashIndexType>
+static void test_iteration()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+
+    // Nothing to visit before the first insertion:
+    HashIndexType h1;
+    assert(h1.entries().empty());
+    assert(h1.chain(42).empty());
+    assert(h1.chain(42).begin() == h1.chain(42).end());
+
+    // Few buckets, so chains are shared by several keys:
+    HashIndexType h2{ 16, 16 };
+    h2.set_max_load_factor(1.0f);
+    h2.set_incremental_rehash(1);
+
+    auto key_of = [](const std::size_t i) { return static_cast<key_type>((i * 2654435761u) % 700); };
+    std::vector<bool> linked(1000, false);
+
+    auto check = [&]()
+    {
+        // Same sequence as first()/next():
+        for (std::size_t i = 0; i < 1000; ++i)
+        {
+            index_type expected = h2.first(key_of(i));
+            for (const index_type index : h2.chain(key_of(i)))
+            {
+                assert(index == expected);
+                expected = h2.next(expected);
+            }
+            assert(expected == h2.null_index);
+        }
+
+        // Every linked index exactly once:
+        std::vector<int> visits(1000, 0);
+        std::size_t count = 0;
+        for (auto it = h2.entries().begin(); it != h2.entries().end(); ++it)
+        {
+            const index_type index = *it;
+            assert(static_cast<std::size_t>(index) < visits.size());
+            ++visits[static_cast<std::size_t>(index)];
+            ++count;
+        }
+        assert(count == static_cast<std::size_t>(h2.size()));
+        for (std::size_t i = 0; i < 1000; ++i)
+        {
+            assert(visits[i] == (linked[i] ? 1 : 0));
+        }
+    };
+
+    // Also mid incremental rehash, when the chains are split between two arrays.
+    bool checked_rehashing = false;
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        h2.insert(key_of(i), static_cast<index_type>(i));
+        linked[i] = true;
+        if (i % 4 == 0 && i > 0)
+        {
+            h2.erase(key_of(i - 4), static_cast<index_type>(i - 4));
+            linked[i - 4] = false;
+        }
+        if (h2.is_rehashing() && i > 500 && !checked_rehashing)
+        {
+            check();
+            checked_rehashing = true;
+        }
+    }
+    assert(checked_rehashing == true);
+
+    h2.finish_rehash();
+    check();
+
+    // Standard algorithms work with the iterators:
+    const auto range = h2.entries();
+    assert(std::count_if(range.begin(), range.end(), [](const index_type i) { return i % 4 == 0; }) == 1);
+}
+
+template<typename HashIndexType>
+static void test_find_all()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+
+    // Items grouped by cell, with the cell as the key. Few buckets, so the
+    // chains also hold other cells, which the predicate or fingerprints skip.
+    HashIndexType h1{ 4, 64 };
+    h1.set_fingerprints(true);
+    std::vector<int> cells;
+    for (int i = 0; i < 300; ++i)
+    {
+        cells.push_back(i % 7);
+        h1.insert(static_cast<key_type>(i % 7), static_cast<index_type>(i));
+    }
+
+    for (int cell = 0; cell < 7; ++cell)
+    {
+        std::vector<index_type> found;
+        const size_type matches = h1.find_all(static_cast<key_type>(cell), cell, cells,
+                                              [&found](const index_type i) { found.push_back(i); });
+
+        // Every item of the cell once, in the same order as the chain:
+        assert(static_cast<std::size_t>(matches) == found.size());
+        assert(found.size() == static_cast<std::size_t>((300 - cell + 6) / 7));
+        for (std::size_t j = 0; j < found.size(); ++j)
+        {
+            assert(cells[static_cast<std::size_t>(found[j])] == cell);
+            assert(j == 0 || found[j] < found[j - 1]); // Most recent first.
+        }
+        assert(found.front() == h1.find(static_cast<key_type>(cell), cell, cells));
+        assert(h1.count(static_cast<key_type>(cell), cell, cells) == matches);
+    }
+
+    // Missing needles, and a key shared by different needles:
+    assert(h1.count(static_cast<key_type>(9), 9, cells) == 0);
+    assert(h1.count(static_cast<key_type>(3), 4, cells) == 0);
+
+    // With a predicate:
+    auto same_cell = [](const int needle, const int item) { return needle == item; };
+    assert(h1.count(static_cast<key_type>(2), 2, cells, same_cell) == h1.count(static_cast<key_type>(2), 2, cells));
+
+    size_type calls = 0;
+    assert(h1.find_all(static_cast<key_type>(2), 9, cells, same_cell, [&calls](const index_type) { ++calls; }) == 0);
+    assert(calls == 0);
+
+    // Empty table:
+    const HashIndexType h2;
+    assert(h2.count(static_cast<key_type>(0), 0, cells) == 0);
+}
+
+template<typename HashIndexType>
+static void test_shrink_to_fit()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+
+    auto key_of = [](const std::size_t i) { return static_cast<key_type>((i * 2654435761u) & 0x7FFFFFFF); };
+    std::vector<std::size_t> values;
+    for (std::size_t i = 0; i < 5000; ++i)
+    {
+        values.push_back(i);
+    }
+
+    // With key retention, both arrays shrink, and all the rest is still found:
+    HashIndexType h1;
+    h1.set_max_load_factor(1.0f);
+    h1.set_prev_chain(true);
+    for (std::size_t i = 0; i < 5000; ++i)
+    {
+        h1.insert(key_of(i), static_cast<index_type>(i));
+    }
+    const size_type full_bytes = h1.allocated_bytes();
+    for (std::size_t i = 100; i < 5000; ++i)
+    {
+        h1.erase(key_of(i), static_cast<index_type>(i));
+    }
+    assert(h1.allocated_bytes() == full_bytes); // Nothing shrinks on its own by default.
+
+    h1.shrink_to_fit();
+    assert(h1.allocated_bytes() < full_bytes / 4);
+    assert(h1.index_chain_size() == h1.granularity());
+    assert(h1.hash_buckets_size() == 128);
+    for (std::size_t i = 0; i < 100; ++i)
+    {
+        assert(static_cast<std::size_t>(h1.find(key_of(i), i, values)) == i);
+    }
+    assert(h1.find(key_of(200), std::size_t(200), values) == h1.null_index);
+
+    // Keeps growing as before:
+    for (std::size_t i = 100; i < 3000; ++i)
+    {
+        h1.insert(key_of(i), static_cast<index_type>(i));
+    }
+    for (std::size_t i = 0; i < 3000; ++i)
+    {
+        assert(static_cast<std::size_t>(h1.find(key_of(i), i, values)) == i);
+    }
+
+    // Without key retention, only the index chain shrinks, down to the highest linked index:
+    HashIndexType h2{ 1024, 16 };
+    h2.set_granularity(16);
+    for (std::size_t i = 0; i < 5000; ++i)
+    {
+        h2.insert(key_of(i), static_cast<index_type>(i));
+    }
+    for (std::size_t i = 0; i < 5000; ++i)
+    {
+        if (i != 7 && i != 1000)
+        {
+            h2.erase(key_of(i), static_cast<index_type>(i));
+        }
+    }
+    h2.shrink_to_fit();
+    assert(h2.hash_buckets_size() == 1024);
+    assert(h2.index_chain_size() == 1008);
+    assert(h2.find(key_of(7), std::size_t(7), values) == 7);
+    assert(h2.find(key_of(1000), std::size_t(1000), values) == 1000);
+
+    // Unless given the keys:
+    h2.shrink_to_fit([&key_of](const index_type i) { return key_of(static_cast<std::size_t>(i)); });
+    assert(h2.hash_buckets_size() == 4);
+    assert(h2.find(key_of(1000), std::size_t(1000), values) == 1000);
+
+    // Empty tables free everything:
+    h2.erase(key_of(7), 7);
+    h2.erase(key_of(1000), 1000);
+    h2.shrink_to_fit();
+    assert(h2.is_allocated() == false);
+    assert(h2.allocated_bytes() == 0);
+    h2.insert(key_of(3), 3);
+    assert(h2.find(key_of(3), std::size_t(3), values) == 3);
+
+    // Low watermark policy, shrinking as the items are erased:
+    HashIndexType h3;
+    h3.set_max_load_factor(1.0f);
+    h3.set_min_load_factor(0.25f);
+    assert(h3.min_load_factor() == 0.25f);
+    for (std::size_t i = 0; i < 5000; ++i)
+    {
+        h3.insert(key_of(i), static_cast<index_type>(i));
+    }
+    const size_type grown_buckets = h3.hash_buckets_size();
+    for (std::size_t i = 4999; i >= 10; --i)
+    {
+        h3.erase(key_of(i), static_cast<index_type>(i));
+        assert(h3.size() == 0 || h3.load_factor() >= 0.25f);
+    }
+    assert(h3.hash_buckets_size() < grown_buckets / 64);
+    assert(h3.index_chain_size() == h3.granularity());
+    for (std::size_t i = 0; i < 10; ++i)
+    {
+        assert(static_cast<std::size_t>(h3.find(key_of(i), i, values)) == i);
+    }
+
+    // Copies keep the policy:
+    const HashIndexType h4{ h3 };
+    assert(h4 == h3);
+    assert(h4.min_load_factor() == 0.25f);
+
+    // Emptied by the watermark, the buckets don't come back at their peak size:
+    HashIndexType h7{ 65536, 64 };
+    h7.set_max_load_factor(1.0f);
+    h7.set_min_load_factor(0.25f);
+    h7.insert(key_of(0), 0);
+    h7.erase(key_of(0), 0);
+    assert(h7.is_allocated() == false);
+    assert(h7.hash_buckets_size() == 1);
+    h7.insert(key_of(0), 0);
+    assert(h7.find(key_of(0), std::size_t(0), values) == 0);
+    assert(h7.hash_buckets_size() == 1);
+
+    // Batched removals only shrink once the indexes were shifted, whether the table ends up empty...
+    HashIndexType h5{ 64, 64 };
+    h5.set_max_load_factor(1.0f);
+    h5.set_min_load_factor(0.25f);
+    h5.insert(7, 0);
+    h5.erase_and_remove_index(7, 0);
+    assert(h5.empty() && h5.is_allocated() == false);
+
+    // ...or with the chain trimmed below the removed index:
+    HashIndexType h6{ 4096, 2048 };
+    h6.set_max_load_factor(1.0f);
+    h6.set_min_load_factor(0.25f);
+    for (std::size_t i = 0; i <= 1024; ++i)
+    {
+        h6.insert(static_cast<key_type>(i), static_cast<index_type>(i));
+    }
+    h6.erase(0, 0); // Right at the watermark.
+    h6.erase_and_remove_index(1024, 1024);
+    assert(h6.size() == 1023);
+    assert(h6.index_chain_size() == 1024);
+    for (std::size_t i = 1; i < 1024; ++i)
+    {
+        assert(static_cast<std::size_t>(h6.find(static_cast<key_type>(i), i, values)) == i);
+    }
+}
+
+template<typename HashIndexType>
+static void test_index_chain_growth()
+{
+    using key_type   = typename HashIndexType::key_type;
+    using index_type = typename HashIndexType::index_type;
+    using size_type  = typename HashIndexType::size_type;
+
+    // Number of times the chain is resized while appending 'count' indexes.
+    auto count_resizes = [](HashIndexType & h, const std::size_t count) -> std::size_t
+    {
+        std::size_t resizes = 0;
+        size_type size = h.index_chain_size();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            h.insert(static_cast<key_type>(i * 7), static_cast<index_type>(i));
+            if (h.index_chain_size() != size)
+            {
+                assert(static_cast<std::size_t>(h.index_chain_size()) > i);
+                assert(h.index_chain_size() % h.granularity() == 0);
+                size = h.index_chain_size();
+                ++resizes;
+            }
+        }
+        return resizes;
+    };
+
+    // Fixed steps by default:
+    HashIndexType h1{ 1024, 64 };
+    h1.set_granularity(64);
+    assert(h1.index_chain_growth() == 1.0f);
+    assert(count_resizes(h1, 20000) == 20032 / 64 - 1);
+
+    // Geometric, still rounded to the granularity:
+    HashIndexType h2{ 1024, 64 };
+    h2.set_granularity(64);
+    h2.set_index_chain_growth(2.0f);
+    assert(count_resizes(h2, 20000) == 9); // 64 -> 128 -> ... -> 32768
+    assert(h2.index_chain_size() == 32768);
+
+    HashIndexType h3{ 1024, 64 };
+    h3.set_granularity(64);
+    h3.set_index_chain_growth(1.5f);
+    assert(count_resizes(h3, 20000) < 20);
+
+    // Same lookups either way:
+    std::vector<std::size_t> values;
+    for (std::size_t i = 0; i < 20000; ++i)
+    {
+        values.push_back(i * 7);
+    }
+    for (std::size_t i = 0; i < 20000; i += 13)
+    {
+        assert(static_cast<std::size_t>(h1.find(static_cast<key_type>(i * 7), i * 7, values)) == i);
+        assert(static_cast<std::size_t>(h2.find(static_cast<key_type>(i * 7), i * 7, values)) == i);
+        assert(static_cast<std::size_t>(h3.find(static_cast<key_type>(i * 7), i * 7, values)) == i);
+    }
+
+    // Copies keep the policy:
+    const HashIndexType h4{ h2 };
+    assert(h4.index_chain_growth() == 2.0f);
+
+    // A reserved chain is never resized, nor grown geometrically past the request:
+    HashIndexType h5{ 1024, 64 };
+    h5.set_granularity(64);
+    h5.set_index_chain_growth(2.0f);
+    h5.reserve_index_chain(20000);
+    assert(h5.index_chain_size() == 20032);
+    assert(count_resizes(h5, 20000) == 0);
+}
+
 // ========================================================
 // main() - Test driver:
 // ========================================================
@@ -234,6 +2534,33 @@ int main()
     TEST(erasure);
     TEST(lookup);
     TEST(key_collisions);
+    TEST(rehash);
+    TEST(build);
+    TEST(find_many);
+    TEST(find_async);
+    TEST(fingerprints);
+    TEST(group_probing);
+    TEST(insert_remove_at);
+    TEST(concurrent_readers);
+    TEST(sharded_writers);
+    TEST(cow_snapshots);
+    TEST(serialization);
+    TEST(frozen_hash_index);
+    TEST(chain_stats);
+    TEST(prev_chain);
+    TEST(static_hash_index);
+    TEST(constexpr_build);
+    TEST(allocators);
+    TEST(huge_pages);
+    TEST(incremental_rehash);
+    TEST(compact_hash_index);
+    TEST(inline_bucket_hash_index);
+    TEST(hashed_lookup);
+    TEST(parallel_build);
+    TEST(iteration);
+    TEST(find_all);
+    TEST(shrink_to_fit);
+    TEST(index_chain_growth);
 
     std::cout << "All tests passed!\n\n";
 }